@@ -32,6 +32,7 @@
 #include <stdlib.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <zlib.h>
 
 #ifdef HAVE_CAPABILITY
 #include <sys/capability.h>
@@ -43,6 +44,7 @@
 #ifdef SYS_LINUX
 #include <linux/sched.h>
 #include <sys/mount.h>
+#include <sys/timerfd.h>
 #endif
 
 #include "msgpuck.h"
@@ -213,9 +215,30 @@ kis_capture_handler_t *cf_handler_init(const char *in_type) {
     ch->out_fd = -1;
     ch->tcp_fd = -1;
 
+    ch->shm_ring = NULL;
+
+    ch->batch_enabled = 0;
+    ch->batch_len = 0;
+    ch->batch_max_bytes = CF_BATCH_MAX_BYTES;
+    ch->batch_max_usec = CF_BATCH_MAX_USEC;
+
+    ch->compress_level = 0;
+    ch->zstream = NULL;
+    ch->zbatch_buf = NULL;
+    ch->zbatch_buf_sz = 0;
+    ch->zbatch_len = 0;
+    ch->batch_buf = (uint8_t *) malloc(sizeof(simple_cap_proto_kv_t) + ch->batch_max_bytes);
+
+    if (ch->batch_buf == NULL) {
+        free(ch);
+        return NULL;
+    }
+
     /* Disable retry by default */
     ch->remote_retry = 0;
 
+    ch->checksum_type = KIS_CAP_CSUM_ADLER32;
+
     /* Disable daemon mode by default */
     ch->daemonize = 0;
 
@@ -224,6 +247,7 @@ kis_capture_handler_t *cf_handler_init(const char *in_type) {
     ch->in_ringbuf = kis_simple_ringbuf_create(1024 * 16);
 
     if (ch->in_ringbuf == NULL) {
+        free(ch->batch_buf);
         free(ch);
         return NULL;
     }
@@ -232,8 +256,12 @@ kis_capture_handler_t *cf_handler_init(const char *in_type) {
      * packets get queued */
     ch->out_ringbuf = kis_simple_ringbuf_create(1024 * 256);
 
-    if (ch->out_ringbuf == NULL) {
+    if (ch->out_ringbuf == NULL || 
+            kis_simple_ringbuf_enable_notify(ch->out_ringbuf) < 0) {
+        if (ch->out_ringbuf != NULL)
+            kis_simple_ringbuf_free(ch->out_ringbuf);
         kis_simple_ringbuf_free(ch->in_ringbuf);
+        free(ch->batch_buf);
         free(ch);
         return NULL;
     }
@@ -242,9 +270,6 @@ kis_capture_handler_t *cf_handler_init(const char *in_type) {
     pthread_mutexattr_settype(&mutexattr, PTHREAD_MUTEX_RECURSIVE);
     pthread_mutex_init(&(ch->out_ringbuf_lock), &mutexattr);
 
-    pthread_cond_init(&(ch->out_ringbuf_flush_cond), NULL);
-    pthread_mutex_init(&(ch->out_ringbuf_flush_cond_mutex), NULL);
-
     ch->shutdown = 0;
     ch->spindown = 0;
 
@@ -260,6 +285,7 @@ kis_capture_handler_t *cf_handler_init(const char *in_type) {
     ch->chancontrol_cb = NULL;
 
     ch->spectrumconfig_cb = NULL;
+    ch->filter_cb = NULL;
 
     ch->capture_cb = NULL;
 
@@ -276,6 +302,15 @@ kis_capture_handler_t *cf_handler_init(const char *in_type) {
     ch->channel_hop_failure_list = NULL;
     ch->channel_hop_failure_list_sz = 0;
 
+    ch->hop_timer_fd = -1;
+    ch->hop_stats_count = 0;
+    ch->hop_stats_tune_usec = 0;
+    ch->hop_stats_tune_max_usec = 0;
+    ch->hop_stats_late_usec = 0;
+    ch->hop_stats_last_report = 0;
+
+    ch->capstats_pending_drops = 0;
+
     return ch;
 }
 
@@ -283,6 +318,52 @@ void cf_set_remote_capable(kis_capture_handler_t *caph, int in_capable) {
     caph->remote_capable = in_capable;
 }
 
+/* Start compressing batches; the output buffer lock must be held */
+static int cf_enable_compress(kis_capture_handler_t *caph, int level, 
+        unsigned int window_usec) {
+    z_stream *zs;
+
+    zs = (z_stream *) malloc(sizeof(z_stream));
+
+    if (zs == NULL)
+        return -1;
+
+    memset(zs, 0, sizeof(z_stream));
+
+    if (deflateInit(zs, level) != Z_OK) {
+        free(zs);
+        return -1;
+    }
+
+    caph->zstream = zs;
+    caph->zbatch_len = 0;
+    caph->compress_level = level;
+
+    /* Bigger batches compress better; wait as long as the server asked */
+    if (window_usec != 0)
+        caph->batch_max_usec = window_usec;
+
+    return 1;
+}
+
+/* Stop compressing batches, dropping the stream; the output buffer lock must
+ * be held */
+static void cf_disable_compress(kis_capture_handler_t *caph) {
+    if (caph->zstream != NULL) {
+        deflateEnd(caph->zstream);
+        free(caph->zstream);
+        caph->zstream = NULL;
+    }
+
+    if (caph->zbatch_buf != NULL)
+        free(caph->zbatch_buf);
+
+    caph->zbatch_buf = NULL;
+    caph->zbatch_buf_sz = 0;
+    caph->zbatch_len = 0;
+    caph->compress_level = 0;
+}
+
 void cf_handler_free(kis_capture_handler_t *caph) {
     size_t szi;
 
@@ -316,6 +397,14 @@ void cf_handler_free(kis_capture_handler_t *caph) {
     if (caph->out_ringbuf != NULL)
         kis_simple_ringbuf_free(caph->out_ringbuf);
 
+    if (caph->shm_ring != NULL)
+        kis_shmring_free(caph->shm_ring);
+
+    if (caph->batch_buf != NULL)
+        free(caph->batch_buf);
+
+    cf_disable_compress(caph);
+
     for (szi = 0; szi < caph->channel_hop_list_sz; szi++) {
         if (caph->channel_hop_list[szi] != NULL)
             free(caph->channel_hop_list[szi]);
@@ -343,6 +432,9 @@ void cf_handler_free(kis_capture_handler_t *caph) {
         caph->hopping_running = 0;
     }
 
+    if (caph->hop_timer_fd >= 0)
+        close(caph->hop_timer_fd);
+
     pthread_mutex_destroy(&(caph->out_ringbuf_lock));
     pthread_mutex_destroy(&(caph->handler_lock));
 }
@@ -560,6 +652,9 @@ int cf_handler_parse_opts(kis_capture_handler_t *caph, int argc, char *argv[]) {
     int retry = 1;
     int daemon = 0;
 
+    int shm_mem_fd, shm_data_efd, shm_space_efd;
+    int shm_ring = 0;
+
     static struct option longopt[] = {
         { "in-fd", required_argument, 0, 1 },
         { "out-fd", required_argument, 0, 2 },
@@ -568,6 +663,7 @@ int cf_handler_parse_opts(kis_capture_handler_t *caph, int argc, char *argv[]) {
         { "disable-retry", no_argument, 0, 5 },
         { "daemonize", no_argument, 0, 6},
         { "list", no_argument, 0, 7},
+        { "shm-ring", required_argument, 0, 8},
         { "help", no_argument, 0, 'h'},
         { 0, 0, 0, 0 }
     };
@@ -610,9 +706,27 @@ int cf_handler_parse_opts(kis_capture_handler_t *caph, int argc, char *argv[]) {
             cf_handler_list_devices(caph);
             cf_handler_free(caph);
             exit(1);
+        } else if (r == 8) {
+            if (sscanf(optarg, "%d,%d,%d", &shm_mem_fd, &shm_data_efd, 
+                        &shm_space_efd) != 3) {
+                fprintf(stderr, "FATAL: Unable to parse shared memory ring descriptors\n");
+                return -1;
+            }
+
+            shm_ring = 1;
         }
     }
 
+    /* A shared memory ring only makes sense when the server launched us; if we
+     * can't attach to it, everything just goes over the pipe */
+    if (shm_ring && caph->remote_host == NULL) {
+        caph->shm_ring = kis_shmring_attach(shm_mem_fd, shm_data_efd, shm_space_efd);
+
+        if (caph->shm_ring == NULL)
+            fprintf(stderr, "WARNING: Unable to attach to the shared memory ring, "
+                    "sending packets over the IPC pipe\n");
+    }
+
     if (caph->remote_host == NULL && caph->cli_sourcedef != NULL) {
         fprintf(stderr, 
                 "WARNING: Ignoring --source option when not connecting to a remote host\n");
@@ -705,6 +819,12 @@ void cf_handler_set_spectrumconfig_cb(kis_capture_handler_t *capf,
     pthread_mutex_unlock(&(capf->handler_lock));
 }
 
+void cf_handler_set_filter_cb(kis_capture_handler_t *capf, cf_callback_filter cb) {
+    pthread_mutex_lock(&(capf->handler_lock));
+    capf->filter_cb = cb;
+    pthread_mutex_unlock(&(capf->handler_lock));
+}
+
 void cf_handler_set_unknown_cb(kis_capture_handler_t *capf, cf_callback_unknown cb) {
     pthread_mutex_lock(&(capf->handler_lock));
     capf->unknown_cb = cb;
@@ -784,9 +904,18 @@ int cf_handler_launch_capture_thread(kis_capture_handler_t *caph) {
 }
 
 void cf_handler_wait_ringbuffer(kis_capture_handler_t *caph) {
-    pthread_cond_wait(&(caph->out_ringbuf_flush_cond),
-            &(caph->out_ringbuf_flush_cond_mutex));
-    pthread_mutex_unlock(&(caph->out_ringbuf_flush_cond_mutex));
+    /* DATA frames go over the shared memory ring, so wait for the server to
+     * read from it; bounded so a stalled server doesn't hang us forever */
+    if (caph->shm_ring != NULL) {
+        kis_shmring_wait_space(caph->shm_ring, 100);
+        return;
+    }
+
+    kis_simple_ringbuf_wait_space(caph->out_ringbuf, 100);
+}
+
+static uint64_t cf_timespec_usec(struct timespec *ts) {
+    return ((uint64_t) ts->tv_sec * 1000000L) + (ts->tv_nsec / 1000);
 }
 
 /* Internal capture thread which drives channel hopping
@@ -801,12 +930,20 @@ void *cf_int_chanhop_thread(void *arg) {
     /* Where we are in the hopping vec */
     pthread_mutex_lock(&(caph->handler_lock));
     size_t hoppos = caph->channel_hop_offset;
+    int timer_fd = caph->hop_timer_fd;
     pthread_mutex_unlock(&(caph->handler_lock));
 
     /* How long we're waiting until the next time */
     unsigned int wait_sec = 0;
     unsigned int wait_usec = 0;
 
+    /* Interval the hop timer is running at, and when it last fired */
+    uint64_t timer_interval = 0;
+    uint64_t timer_expiry = 0;
+
+    struct timespec ts;
+    uint64_t start_usec, tune_usec, late_usec;
+
     char errstr[STATUS_MAX];
     
     int r = 0;
@@ -824,18 +961,64 @@ void *cf_int_chanhop_thread(void *arg) {
         wait_usec = 1000000L / caph->channel_hop_rate;
 
         if (wait_usec < 50000) {
-            wait_sec = 0;
             wait_usec = 50000;
-        } else if (wait_usec > 1000000L) {
-            wait_sec = wait_usec / 1000000L;
-            wait_usec = wait_usec % 1000000L;
+        } 
+
+        late_usec = 0;
+
+#ifdef SYS_LINUX
+        /* (Re)arm the hop timer whenever the rate changes; the timer keeps
+         * firing on schedule on its own, so the time spent tuning and any 
+         * scheduling delay don't push every later hop back */
+        if (timer_fd >= 0 && timer_interval != wait_usec) {
+            struct itimerspec its;
+
+            its.it_interval.tv_sec = wait_usec / 1000000L;
+            its.it_interval.tv_nsec = (wait_usec % 1000000L) * 1000;
+            its.it_value = its.it_interval;
+
+            clock_gettime(CLOCK_MONOTONIC, &ts);
+
+            if (timerfd_settime(timer_fd, 0, &its, NULL) == 0) {
+                timer_interval = wait_usec;
+                timer_expiry = cf_timespec_usec(&ts);
+            } else {
+                timer_fd = -1;
+                timer_interval = 0;
+            }
         }
+#endif
 
         pthread_mutex_unlock(&(caph->handler_lock));
 
         /* Sleep until the next wakeup */
-        sleep(wait_sec);
-        usleep(wait_usec);
+        if (timer_interval != 0) {
+            uint64_t expirations;
+
+            if (read(timer_fd, &expirations, sizeof(uint64_t)) != sizeof(uint64_t)) {
+                /* Fall back to sleeping if the timer stops working */
+                if (errno != EINTR && errno != EAGAIN) {
+                    timer_fd = -1;
+                    timer_interval = 0;
+                }
+
+                continue;
+            }
+
+            /* If tuning took longer than the interval we skip the hops we 
+             * missed rather than trying to catch up */
+            timer_expiry += expirations * timer_interval;
+
+            clock_gettime(CLOCK_MONOTONIC, &ts);
+
+            if (cf_timespec_usec(&ts) > timer_expiry)
+                late_usec = cf_timespec_usec(&ts) - timer_expiry;
+        } else {
+            wait_sec = wait_usec / 1000000L;
+
+            sleep(wait_sec);
+            usleep(wait_usec % 1000000L);
+        }
 
         pthread_mutex_lock(&caph->handler_lock);
 
@@ -845,10 +1028,25 @@ void *cf_int_chanhop_thread(void *arg) {
             return NULL;
         }
 
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        start_usec = cf_timespec_usec(&ts);
+
         errstr[0] = 0;
-        if ((r = (caph->chancontrol_cb)(caph, 0, 
-                    caph->custom_channel_hop_list[hoppos % caph->channel_hop_list_sz], 
-                    errstr)) < 0) {
+        r = (caph->chancontrol_cb)(caph, 0, 
+                caph->custom_channel_hop_list[hoppos % caph->channel_hop_list_sz], 
+                errstr);
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        tune_usec = cf_timespec_usec(&ts) - start_usec;
+
+        caph->hop_stats_count++;
+        caph->hop_stats_tune_usec += tune_usec;
+        caph->hop_stats_late_usec += late_usec;
+
+        if (tune_usec > caph->hop_stats_tune_max_usec)
+            caph->hop_stats_tune_max_usec = tune_usec;
+
+        if (r < 0) {
             cf_send_error(caph, errstr);
             caph->hopping_running = 0;
             pthread_mutex_unlock(&caph->handler_lock);
@@ -981,9 +1179,24 @@ void *cf_int_chanhop_thread(void *arg) {
             caph->channel_hop_failure_list_sz = 0;
         }
 
-        pthread_mutex_unlock(&caph->handler_lock);
-
+        /* Report hop timing about once a second; if it doesn't fit in the
+         * output buffer keep counting until the next report.  This thread is
+         * cancelled asynchronously by whoever holds the handler lock, so like
+         * every other frame it sends, this has to be sent under the lock or a
+         * cancel could land partway through the send */
+        if (time(NULL) != caph->hop_stats_last_report) {
+            caph->hop_stats_last_report = time(NULL);
+
+            if (cf_send_hopstats(caph, caph->hop_stats_count, caph->hop_stats_tune_usec,
+                        caph->hop_stats_tune_max_usec, caph->hop_stats_late_usec) > 0) {
+                caph->hop_stats_count = 0;
+                caph->hop_stats_tune_usec = 0;
+                caph->hop_stats_tune_max_usec = 0;
+                caph->hop_stats_late_usec = 0;
+            }
+        }
 
+        pthread_mutex_unlock(&caph->handler_lock);
     }
 
     return NULL;
@@ -1001,6 +1214,13 @@ int cf_handler_launch_hopping_thread(kis_capture_handler_t *caph) {
         caph->hopping_running = 0;
     }
 
+#ifdef SYS_LINUX
+    /* The hop timer outlives any one hopping thread, since they can be 
+     * cancelled at any time; without one we fall back to sleeping */
+    if (caph->hop_timer_fd < 0)
+        caph->hop_timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+#endif
+
     if (pthread_create(&(caph->hopthread), &attr, cf_int_chanhop_thread, caph) < 0) {
         cf_send_error(caph, "failed to launch channel hopping thread");
         cf_handler_spindown(caph);
@@ -1051,13 +1271,13 @@ int cf_handle_rx_data(kis_capture_handler_t *caph) {
     cap_proto_frame = (simple_cap_proto_frame_t *) hdr_buf;
 
     /* Check the signature */
-    if (ntohl(cap_proto_frame->header.signature) != KIS_CAP_SIMPLE_PROTO_SIG) {
+    if (simple_cap_proto_csum_type(ntohl(cap_proto_frame->header.signature)) < 0) {
         fprintf(stderr, "FATAL: Invalid frame header received\n");
         return -1;
     }
 
     /* Check the header checksum */
-    if (!validate_simple_cap_proto_header(&(cap_proto_frame->header))) {
+    if (validate_simple_cap_proto_header(&(cap_proto_frame->header)) < 0) {
         fprintf(stderr, "DEBUG: Invalid checksum on frame header\n");
         return -1;
     }
@@ -1090,12 +1310,39 @@ int cf_handle_rx_data(kis_capture_handler_t *caph) {
     cap_proto_frame = (simple_cap_proto_frame_t *) frame_buf;
 
     /* Validate it */
-    if (!validate_simple_cap_proto(&(cap_proto_frame->header))) {
+    if (validate_simple_cap_proto(&(cap_proto_frame->header)) < 0) {
         fprintf(stderr, "FATAL:  Invalid control frame\n");
         free(frame_buf);
         return -1;
     }
 
+    /* Switch to CRC32C once the server sends a CRC32C frame or offers it */
+    if (caph->checksum_type == KIS_CAP_CSUM_ADLER32 && 
+            cf_peer_offers_crc32c(cap_proto_frame)) {
+        caph->checksum_type = KIS_CAP_CSUM_CRC32C;
+    }
+
+    /* Start batching packets once the server shows it can take them */
+    if (caph->batch_enabled == 0 && cf_peer_offers_batch(cap_proto_frame)) {
+        pthread_mutex_lock(&(caph->out_ringbuf_lock));
+        caph->batch_enabled = 1;
+        pthread_mutex_unlock(&(caph->out_ringbuf_lock));
+    }
+
+    /* Compress batches when the server asks for it; packets on the shared 
+     * memory ring never leave the host, so there's no point */
+    if (caph->batch_enabled && caph->compress_level == 0 && caph->shm_ring == NULL) {
+        int level;
+        unsigned int window_usec;
+
+        if (cf_peer_offers_compress(cap_proto_frame, &level, &window_usec)) {
+            pthread_mutex_lock(&(caph->out_ringbuf_lock));
+            if (cf_enable_compress(caph, level, window_usec) < 0)
+                fprintf(stderr, "WARNING: Unable to start batch compression\n");
+            pthread_mutex_unlock(&(caph->out_ringbuf_lock));
+        }
+    }
+
     /* Lock so we can look at callbacks */
     pthread_mutex_lock(&(caph->handler_lock));
 
@@ -1243,7 +1490,7 @@ int cf_handle_rx_data(kis_capture_handler_t *caph) {
         }
 
     } else if (strncasecmp(cap_proto_frame->header.type, "CONFIGURE", 16) == 0) {
-        char *cdef, *chanset_channel;
+        char *cdef, *chanset_channel, *filter;
         double chanhop_rate;
         char **chanhop_channels;
         void **chanhop_priv_channels;
@@ -1254,10 +1501,35 @@ int cf_handle_rx_data(kis_capture_handler_t *caph) {
 
         /* fprintf(stderr, "DEBUG - Got CONFIGURE request\n"); */
 
-        /* Look to see if we have a CHANSET command */
-        r = cf_get_CHANSET(&cdef, cap_proto_frame);
+        /* A FILTER is sent on its own, never combined with a channel change */
+        r = cf_get_FILTER(&filter, cap_proto_frame);
 
         if (r < 0) {
+            pthread_mutex_unlock(&(caph->handler_lock));
+            cf_send_configresp(caph, ntohl(cap_proto_frame->header.sequence_number),
+                    0, "Unable to parse FILTER KV");
+            cbret = -1;
+        } else if (r > 0) {
+            if (caph->filter_cb == NULL) {
+                pthread_mutex_unlock(&(caph->handler_lock));
+                cf_send_configresp(caph, ntohl(cap_proto_frame->header.sequence_number),
+                        0, "Source does not support capture filters");
+                cbret = 0;
+            } else {
+                msgstr[0] = 0;
+                cbret = (*(caph->filter_cb))(caph,
+                        ntohl(cap_proto_frame->header.sequence_number), 
+                        filter, msgstr);
+
+                cf_send_configresp(caph, ntohl(cap_proto_frame->header.sequence_number),
+                        cbret >= 0, msgstr);
+
+                pthread_mutex_unlock(&(caph->handler_lock));
+            }
+
+            free(filter);
+        } else if ((r = cf_get_CHANSET(&cdef, cap_proto_frame)) < 0) {
+            /* No FILTER, and a CHANSET we can't parse */
             cf_send_configresp(caph, ntohl(cap_proto_frame->header.sequence_number),
                     0, "Unable to parse CHANSET KV");
             cbret = -1;
@@ -1404,6 +1676,103 @@ int cf_get_DEFINITION(char **ret_definition, simple_cap_proto_frame_t *in_frame)
     return def_len;
 }
 
+int cf_peer_offers_crc32c(simple_cap_proto_frame_t *in_frame) {
+    simple_cap_proto_kv_t *csum_kv = NULL;
+    int csum_len;
+
+    if (ntohl(in_frame->header.signature) == KIS_CAP_SIMPLE_PROTO_SIG_CRC32C)
+        return 1;
+
+    csum_len = find_simple_cap_proto_kv(in_frame, "CHECKSUM", &csum_kv);
+
+    if (csum_len <= 0)
+        return 0;
+
+    if ((size_t) csum_len == strlen(KIS_CAP_CSUM_CRC32C_NAME) &&
+            memcmp(csum_kv->object, KIS_CAP_CSUM_CRC32C_NAME, csum_len) == 0)
+        return 1;
+
+    return 0;
+}
+
+int cf_peer_offers_batch(simple_cap_proto_frame_t *in_frame) {
+    simple_cap_proto_kv_t *batch_kv = NULL;
+    int batch_len;
+    uint32_t version;
+
+    batch_len = find_simple_cap_proto_kv(in_frame, "DATABATCH", &batch_kv);
+
+    if (batch_len < (int) sizeof(uint32_t))
+        return 0;
+
+    memcpy(&version, batch_kv->object, sizeof(uint32_t));
+
+    return ntohl(version) >= KIS_CAP_BATCH_VERSION;
+}
+
+int cf_peer_offers_compress(simple_cap_proto_frame_t *in_frame, int *ret_level,
+        unsigned int *ret_window_usec) {
+    simple_cap_proto_kv_t *comp_kv = NULL;
+    int comp_len;
+
+    /* msgpuck validation */
+    const char *mp_end;
+    const char *mp_buf;
+    const char *sval;
+    uint32_t sval_len;
+    uint32_t dict_size, dict_itr;
+    int zlib = 0;
+
+    *ret_level = Z_DEFAULT_COMPRESSION;
+    *ret_window_usec = 0;
+
+    comp_len = find_simple_cap_proto_kv(in_frame, "COMPRESS", &comp_kv);
+
+    if (comp_len <= 0)
+        return 0;
+
+    mp_buf = (char *) comp_kv->object;
+    mp_end = mp_buf + comp_len;
+
+    if (mp_check(&mp_buf, mp_end) != 0 || mp_buf != mp_end)
+        return 0;
+
+    mp_buf = (char *) comp_kv->object;
+
+    if (mp_typeof(*mp_buf) != MP_MAP)
+        return 0;
+
+    dict_size = mp_decode_map(&mp_buf);
+    for (dict_itr = 0; dict_itr < dict_size; dict_itr++) {
+        if (mp_typeof(*mp_buf) != MP_STR)
+            return 0;
+
+        sval = mp_decode_str(&mp_buf, &sval_len);
+
+        if (sval_len == strlen("method") && strncasecmp(sval, "method", sval_len) == 0 &&
+                mp_typeof(*mp_buf) == MP_STR) {
+            sval = mp_decode_str(&mp_buf, &sval_len);
+
+            if (sval_len == strlen(KIS_CAP_COMPRESS_ZLIB_NAME) &&
+                    strncasecmp(sval, KIS_CAP_COMPRESS_ZLIB_NAME, sval_len) == 0)
+                zlib = 1;
+        } else if (sval_len == strlen("level") && strncasecmp(sval, "level", sval_len) == 0 &&
+                mp_typeof(*mp_buf) == MP_UINT) {
+            *ret_level = (int) mp_decode_uint(&mp_buf);
+        } else if (sval_len == strlen("window") && strncasecmp(sval, "window", sval_len) == 0 &&
+                mp_typeof(*mp_buf) == MP_UINT) {
+            *ret_window_usec = (unsigned int) mp_decode_uint(&mp_buf);
+        } else {
+            mp_next(&mp_buf);
+        }
+    }
+
+    if (*ret_level < 1 || *ret_level > 9)
+        *ret_level = Z_DEFAULT_COMPRESSION;
+
+    return zlib;
+}
+
 int cf_get_CHANSET(char **ret_definition, simple_cap_proto_frame_t *in_frame) {
     simple_cap_proto_kv_t *ch_kv = NULL;
     int ch_len;
@@ -1574,6 +1943,48 @@ int cf_get_SPECSET(uint64_t *ret_start_mhz, uint64_t *ret_end_mhz,
     return 1;
 }
 
+int cf_get_FILTER(char **ret_filter, simple_cap_proto_frame_t *in_frame) {
+    simple_cap_proto_kv_t *filter_kv = NULL;
+    int filter_len;
+
+    /* msgpuck validation */
+    const char *mp_end;
+    const char *mp_buf;
+    const char *sval;
+    uint32_t sval_len;
+
+    *ret_filter = NULL;
+
+    filter_len = find_simple_cap_proto_kv(in_frame, "FILTER", &filter_kv);
+
+    if (filter_len <= 0) {
+        return filter_len;
+    }
+
+    /* The filter is a msgpack string, so that an empty filter can be told apart
+     * from a missing one */
+    mp_buf = (char *) filter_kv->object;
+    mp_end = mp_buf + ntohl(filter_kv->header.obj_sz);
+
+    if (mp_check(&mp_buf, mp_end) != 0 || mp_buf != mp_end) {
+        return -1;
+    }
+
+    mp_buf = (char *) filter_kv->object;
+
+    if (mp_typeof(*mp_buf) != MP_STR) {
+        return -1;
+    }
+
+    sval = mp_decode_str(&mp_buf, &sval_len);
+
+    if ((*ret_filter = strndup(sval, sval_len)) == NULL) {
+        return -1;
+    }
+
+    return 1;
+}
+
 int cf_handler_remote_connect(kis_capture_handler_t *caph) {
     struct hostent *connect_host;
     struct sockaddr_in client_sock, local_sock;
@@ -1605,9 +2016,19 @@ int cf_handler_remote_connect(kis_capture_handler_t *caph) {
     /* Reset spindown */
     caph->spindown = 0;
 
-    /* Clear the buffers */
+    /* Clear the buffers; the capture thread may still be writing to the output
+     * buffer, so only clear it while it's locked out */
     kis_simple_ringbuf_clear(caph->in_ringbuf);
+
+    /* The server we reconnect to may not support CRC32C or batching */
+    caph->checksum_type = KIS_CAP_CSUM_ADLER32;
+
+    pthread_mutex_lock(&(caph->out_ringbuf_lock));
     kis_simple_ringbuf_clear(caph->out_ringbuf);
+    caph->batch_enabled = 0;
+    caph->batch_len = 0;
+    cf_disable_compress(caph);
+    pthread_mutex_unlock(&(caph->out_ringbuf_lock));
 
     /* Perform a local probe on the source to see if it's valid */
     msgstr[0] = 0;
@@ -1739,6 +2160,7 @@ int cf_handler_loop(kis_capture_handler_t *caph) {
     while (1) {
         FD_ZERO(&rset);
         FD_ZERO(&wset);
+        max_fd = 0;
 
         /* Check shutdown state or if we're spinning down */
         pthread_mutex_lock(&(caph->handler_lock));
@@ -1771,23 +2193,67 @@ int cf_handler_loop(kis_capture_handler_t *caph) {
             max_fd = read_fd;
         }
 
+        tm.tv_sec = 0;
+        tm.tv_usec = 500000;
+
         /* Inspect the write buffer - do we have data? */
         pthread_mutex_lock(&(caph->out_ringbuf_lock));
 
-        if (kis_simple_ringbuf_used(caph->out_ringbuf) != 0) {
+        /* Send a batch which has aged out, or everything we have when we're 
+         * spinning down; otherwise wake up in time to send it */
+        if (caph->batch_len != 0) {
+            struct timeval now;
+            long batch_age;
+
+            gettimeofday(&now, NULL);
+
+            batch_age = (now.tv_sec - caph->batch_start.tv_sec) * 1000000L +
+                (now.tv_usec - caph->batch_start.tv_usec);
+
+            if (spindown != 0 || batch_age >= (long) caph->batch_max_usec) {
+                if (cf_flush_batch(caph) < 0) {
+                    pthread_mutex_unlock(&(caph->out_ringbuf_lock));
+                    fprintf(stderr, "FATAL:  Unable to encode packet batch\n");
+                    rv = -1;
+                    break;
+                }
+            }
+
+            /* Still queued; try again shortly */
+            if (caph->batch_len != 0) {
+                tm.tv_usec = caph->batch_max_usec - batch_age;
+
+                if (batch_age >= (long) caph->batch_max_usec)
+                    tm.tv_usec = 1000;
+            }
+        }
+
+        if (kis_simple_ringbuf_used(caph->out_ringbuf) != 0 ||
+                (spindown == 0 && 
+                 kis_simple_ringbuf_consumer_sleep(caph->out_ringbuf) != 0)) {
             FD_SET(write_fd, &wset);
             if (max_fd < write_fd)
                 max_fd = write_fd;
-        } else if (spindown != 0) {
+        } else if (spindown != 0 && caph->batch_len == 0) {
             pthread_mutex_unlock(&(caph->out_ringbuf_lock));
+
+            /* Give the server a chance to read any packets still in the shared
+             * memory ring before we exit */
+            if (caph->shm_ring != NULL)
+                kis_shmring_wait_drain(caph->shm_ring, 5000);
+
             rv = 0;
             break;
         }
 
         pthread_mutex_unlock(&(caph->out_ringbuf_lock));
 
-        tm.tv_sec = 0;
-        tm.tv_usec = 500000;
+        /* Wake up as soon as a frame is committed to an empty buffer */
+        if (!FD_ISSET(write_fd, &wset) && spindown == 0) {
+            FD_SET(caph->out_ringbuf->data_rfd, &rset);
+            if (max_fd < caph->out_ringbuf->data_rfd)
+                max_fd = caph->out_ringbuf->data_rfd;
+        }
 
         if ((ret = select(max_fd + 1, &rset, &wset, NULL, &tm)) < 0) {
             if (errno != EINTR && errno != EAGAIN) {
@@ -1800,6 +2266,9 @@ int cf_handler_loop(kis_capture_handler_t *caph) {
         if (ret == 0)
             continue;
 
+        if (FD_ISSET(caph->out_ringbuf->data_rfd, &rset))
+            kis_simple_ringbuf_consumer_wake(caph->out_ringbuf);
+
         if (FD_ISSET(read_fd, &rset)) {
             while (kis_simple_ringbuf_available(caph->in_ringbuf)) {
                 /* We use a fixed-length read buffer for simplicity, and we shouldn't
@@ -1849,61 +2318,33 @@ int cf_handler_loop(kis_capture_handler_t *caph) {
         }
 
         if (FD_ISSET(write_fd, &wset)) {
-            /* We can write data - lock the ring buffer mutex and write out
-             * whatever we can; we peek the ringbuffer and then flag off what
-             * we've successfully written out */
+            /* We can write data - we're the only reader of the ring buffer, so
+             * write out whatever we can directly from it without locking, and
+             * flag off what we've successfully written out; consuming it wakes
+             * any thread waiting for space */
             ssize_t written_sz;
             size_t peek_sz;
-            size_t peeked_sz;
             uint8_t *peek_buf;
 
-            pthread_mutex_lock(&(caph->out_ringbuf_lock));
-
-            peek_sz = kis_simple_ringbuf_used(caph->out_ringbuf);
-
-            /* Don't know how we'd get here... */
-            if (peek_sz == 0) {
-                pthread_mutex_unlock(&(caph->out_ringbuf_lock));
-                continue;
-            }
-
-            peek_buf = (uint8_t *) malloc(peek_sz);
-
-            if (peek_buf == NULL) {
-                pthread_mutex_unlock(&(caph->out_ringbuf_lock));
-                fprintf(stderr,
-                        "FATAL:  Error during write(): could not allocate write "
-                        "buffer space\n");
-                rv = -1;
-                break;
-            }
-
-            peeked_sz = kis_simple_ringbuf_peek(caph->out_ringbuf, peek_buf, peek_sz);
-
-            /* fprintf(stderr, "debug - peeked %lu\n", peeked_sz); */
+            while ((peek_sz = 
+                        kis_simple_ringbuf_peek_contig(caph->out_ringbuf, &peek_buf)) != 0) {
+                if ((written_sz = write(write_fd, peek_buf, peek_sz)) < 0) {
+                    if (errno != EINTR && errno != EAGAIN && errno != EWOULDBLOCK) {
+                        fprintf(stderr,
+                                "FATAL:  Error during write(): %s\n", strerror(errno));
+                        rv = -1;
+                        goto cap_loop_fail;
+                    }
 
-            if ((written_sz = write(write_fd, peek_buf, peeked_sz)) < 0) {
-                if (errno != EINTR && errno != EAGAIN && errno != EWOULDBLOCK) {
-                    pthread_mutex_unlock(&(caph->out_ringbuf_lock));
-                    fprintf(stderr,
-                            "FATAL:  Error during write(): %s\n", strerror(errno));
-                    free(peek_buf);
-                    rv = -1;
                     break;
                 }
-            }
-
-            free(peek_buf);
 
-            /* Flag it as consumed */
-            kis_simple_ringbuf_read(caph->out_ringbuf, NULL, (size_t) written_sz);
+                /* Flag it as consumed */
+                kis_simple_ringbuf_read(caph->out_ringbuf, NULL, (size_t) written_sz);
 
-            /* Unlock */
-            pthread_mutex_unlock(&(caph->out_ringbuf_lock));
-
-            /* Signal to any waiting IO that the buffer has some
-             * headroom */
-            pthread_cond_signal(&(caph->out_ringbuf_flush_cond));
+                if ((size_t) written_sz < peek_sz)
+                    break;
+            }
         }
     }
 
@@ -1923,19 +2364,83 @@ cap_loop_fail:
 int cf_send_raw_bytes(kis_capture_handler_t *caph, uint8_t *data, size_t len) {
     pthread_mutex_lock(&(caph->out_ringbuf_lock));
 
-    if (kis_simple_ringbuf_available(caph->out_ringbuf) < len) {
+    /* Writes are all or nothing */
+    if (kis_simple_ringbuf_write(caph->out_ringbuf, data, len) != len) {
         /* fprintf(stderr, "debug - Insufficient room in write buffer to queue data\n"); */
         pthread_mutex_unlock(&(caph->out_ringbuf_lock));
         return 0;
     }
 
-    if (kis_simple_ringbuf_write(caph->out_ringbuf, data, len) != len) {
-        fprintf(stderr, "FATAL: Failed to write data to buffer\n");
-        pthread_mutex_unlock(&(caph->out_ringbuf_lock));
-        return -1;
+    pthread_mutex_unlock(&(caph->out_ringbuf_lock));
+    return 1;
+}
+
+/* Reserve room for a frame of in_sz bytes in the shared memory ring or the
+ * output buffer, whichever it is sent over; the output buffer lock must be 
+ * held until it is committed with cf_commit_frame.
+ *
+ * Returns:
+ * -1   Frame can never fit in the shared memory ring
+ *  0   Insufficient space
+ *  1   Success, ret_buf is set
+ */
+static int cf_reserve_frame(kis_capture_handler_t *caph, const char *packtype,
+        size_t in_sz, uint8_t **ret_buf) {
+    /* Packets go over the shared memory ring when we have one, everything else
+     * stays on the pipe */
+    if (caph->shm_ring != NULL && (strncasecmp(packtype, "DATA", 16) == 0 ||
+                strncasecmp(packtype, "DATABATCH", 16) == 0))
+        return kis_shmring_reserve(caph->shm_ring, in_sz, ret_buf);
+
+    if ((*ret_buf = kis_simple_ringbuf_reserve(caph->out_ringbuf, in_sz)) == NULL)
+        return 0;
+
+    return 1;
+}
+
+static void cf_commit_frame(kis_capture_handler_t *caph, const char *packtype) {
+    if (caph->shm_ring != NULL && (strncasecmp(packtype, "DATA", 16) == 0 ||
+                strncasecmp(packtype, "DATABATCH", 16) == 0)) {
+        kis_shmring_commit(caph->shm_ring);
+        return;
     }
 
-    pthread_mutex_unlock(&(caph->out_ringbuf_lock));
+    kis_simple_ringbuf_commit(caph->out_ringbuf);
+}
+
+/* Write an encoded frame to the shared memory ring or the output buffer; the
+ * output buffer lock must be held.  Nothing is freed.
+ *
+ * Returns:
+ * -1   Frame can never fit in the shared memory ring
+ *  0   Insufficient space in buffer
+ *  1   Success
+ */
+static int cf_write_frame(kis_capture_handler_t *caph, const char *packtype,
+        simple_cap_proto_t *proto_hdr, size_t proto_sz,
+        simple_cap_proto_kv_t **in_kv_list, unsigned int in_kv_len) {
+    uint8_t *buf;
+    size_t i;
+    int r;
+
+    if ((r = cf_reserve_frame(caph, packtype, proto_sz, &buf)) <= 0)
+        return r;
+
+    /* Write the header out */
+    memcpy(buf, proto_hdr, sizeof(simple_cap_proto_t));
+    buf += sizeof(simple_cap_proto_t);
+
+    /* Write all the kv pairs out */
+    for (i = 0; i < in_kv_len; i++) {
+        simple_cap_proto_kv_t *kv = in_kv_list[i];
+        size_t kv_sz = ntohl(kv->header.obj_sz) + sizeof(simple_cap_proto_kv_t);
+
+        memcpy(buf, kv, kv_sz);
+        buf += kv_sz;
+    }
+
+    cf_commit_frame(caph, packtype);
+
     return 1;
 }
 
@@ -1947,10 +2452,11 @@ int cf_stream_packet(kis_capture_handler_t *caph, const char *packtype,
     size_t proto_sz;
 
     size_t i;
+    int r;
 
     /* Encode a header */
-    proto_hdr = encode_simple_cap_proto_hdr(&proto_sz, packtype, 0, 
-            in_kv_list, in_kv_len);
+    proto_hdr = encode_simple_cap_proto_hdr_csum(&proto_sz, caph->checksum_type,
+            packtype, 0, in_kv_list, in_kv_len);
 
     if (proto_hdr == NULL) {
         fprintf(stderr, "FATAL: Unable to allocate protocol frame header\n");
@@ -1967,27 +2473,19 @@ int cf_stream_packet(kis_capture_handler_t *caph, const char *packtype,
 
     pthread_mutex_lock(&(caph->out_ringbuf_lock));
 
-    if (kis_simple_ringbuf_available(caph->out_ringbuf) < proto_sz) {
-        pthread_mutex_unlock(&(caph->out_ringbuf_lock));
-        for (i = 0; i < in_kv_len; i++) {
-            free(in_kv_list[i]);
-        }
-        free(in_kv_list);
-        free(proto_hdr);
-        return 0;
-    }
+    /* Keep queued packets ahead of anything sent after them; if the batch
+     * can't be sent yet, neither can this */
+    r = 1;
 
-    /* Write the header out */
-    kis_simple_ringbuf_write(caph->out_ringbuf, (uint8_t *) proto_hdr, 
-            sizeof(simple_cap_proto_t));
+    if (caph->batch_len != 0 || caph->zbatch_len != 0)
+        r = cf_flush_batch(caph);
 
-    /* Write all the kv pairs out */
-    for (i = 0; i < in_kv_len; i++) {
-        simple_cap_proto_kv_t *kv = in_kv_list[i];
+    if (r > 0)
+        r = cf_write_frame(caph, packtype, proto_hdr, proto_sz, in_kv_list, in_kv_len);
 
-        kis_simple_ringbuf_write(caph->out_ringbuf, (uint8_t *) kv,
-                ntohl(kv->header.obj_sz) + sizeof(simple_cap_proto_kv_t));
+    pthread_mutex_unlock(&(caph->out_ringbuf_lock));
 
+    for (i = 0; i < in_kv_len; i++) {
         free(in_kv_list[i]);
     }
 
@@ -1996,11 +2494,152 @@ int cf_stream_packet(kis_capture_handler_t *caph, const char *packtype,
 
     free(proto_hdr);
 
-    pthread_mutex_unlock(&(caph->out_ringbuf_lock));
+    return r;
+}
+
+/* Deflate the queued batch into a ZPACKETS KV, unless one is already waiting
+ * to be sent; the output buffer lock must be held.
+ *
+ * Returns:
+ * -1   An error occurred
+ *  1   Success
+ */
+static int cf_deflate_batch(kis_capture_handler_t *caph) {
+    simple_cap_proto_kv_t *kv;
+    simple_cap_proto_zbatch_t *zhdr;
+    struct timeval start, end;
+    size_t needed;
+    uint8_t *buf;
+    long batch_usec;
+    z_stream *zs = caph->zstream;
+
+    if (caph->zbatch_len != 0)
+        return 1;
+
+    /* A sync flush adds a few bytes on top of the worst case */
+    needed = sizeof(simple_cap_proto_kv_t) + sizeof(simple_cap_proto_zbatch_t) +
+        deflateBound(zs, caph->batch_len) + 64;
+
+    if (caph->zbatch_buf_sz < needed) {
+        if ((buf = (uint8_t *) realloc(caph->zbatch_buf, needed)) == NULL)
+            return -1;
+
+        caph->zbatch_buf = buf;
+        caph->zbatch_buf_sz = needed;
+    }
+
+    kv = (simple_cap_proto_kv_t *) caph->zbatch_buf;
+    zhdr = (simple_cap_proto_zbatch_t *) kv->object;
+
+    gettimeofday(&start, NULL);
+
+    zs->next_in = caph->batch_buf + sizeof(simple_cap_proto_kv_t);
+    zs->avail_in = caph->batch_len;
+    zs->next_out = zhdr->data;
+    zs->avail_out = caph->zbatch_buf_sz - sizeof(simple_cap_proto_kv_t) - 
+        sizeof(simple_cap_proto_zbatch_t);
+
+    if (deflate(zs, Z_SYNC_FLUSH) != Z_OK || zs->avail_in != 0 || zs->avail_out == 0)
+        return -1;
+
+    gettimeofday(&end, NULL);
+
+    batch_usec = (start.tv_sec - caph->batch_start.tv_sec) * 1000000L +
+        (start.tv_usec - caph->batch_start.tv_usec);
+
+    zhdr->raw_sz = htonl(caph->batch_len);
+    zhdr->batch_usec = htonl(batch_usec < 0 ? 0 : (uint32_t) batch_usec);
+    zhdr->deflate_usec = htonl((end.tv_sec - start.tv_sec) * 1000000L +
+            (end.tv_usec - start.tv_usec));
+
+    caph->zbatch_len = sizeof(simple_cap_proto_zbatch_t) + 
+        (zs->next_out - zhdr->data);
+
+    memset(kv->header.key, 0, 16);
+    snprintf(kv->header.key, 16, "%.16s", "ZPACKETS");
+    kv->header.obj_sz = htonl(caph->zbatch_len);
 
     return 1;
 }
 
+int cf_flush_batch(kis_capture_handler_t *caph) {
+    simple_cap_proto_kv_t *kv;
+    simple_cap_proto_t *proto_hdr;
+    size_t proto_sz;
+    int r;
+
+    pthread_mutex_lock(&(caph->out_ringbuf_lock));
+
+    if (caph->batch_len == 0 && caph->zbatch_len == 0) {
+        pthread_mutex_unlock(&(caph->out_ringbuf_lock));
+        return 1;
+    }
+
+    if (caph->compress_level != 0) {
+        if (cf_deflate_batch(caph) < 0) {
+            pthread_mutex_unlock(&(caph->out_ringbuf_lock));
+            return -1;
+        }
+
+        kv = (simple_cap_proto_kv_t *) caph->zbatch_buf;
+    } else {
+        /* The records already follow room for the KV header */
+        kv = (simple_cap_proto_kv_t *) caph->batch_buf;
+
+        memset(kv->header.key, 0, 16);
+        snprintf(kv->header.key, 16, "%.16s", "PACKETS");
+        kv->header.obj_sz = htonl(caph->batch_len);
+    }
+
+    proto_hdr = encode_simple_cap_proto_hdr_csum(&proto_sz, caph->checksum_type,
+            "DATABATCH", 0, &kv, 1);
+
+    if (proto_hdr == NULL) {
+        pthread_mutex_unlock(&(caph->out_ringbuf_lock));
+        return -1;
+    }
+
+    r = cf_write_frame(caph, "DATABATCH", proto_hdr, proto_sz, &kv, 1);
+
+    if (r > 0) {
+        caph->batch_len = 0;
+        caph->zbatch_len = 0;
+    }
+
+    free(proto_hdr);
+
+    pthread_mutex_unlock(&(caph->out_ringbuf_lock));
+
+    return r;
+}
+
+int cf_handler_set_batch(kis_capture_handler_t *caph, size_t max_bytes,
+        unsigned int max_usec) {
+    uint8_t *buf = NULL;
+    int r = 1;
+
+    pthread_mutex_lock(&(caph->out_ringbuf_lock));
+
+    if (max_bytes != 0) {
+        buf = (uint8_t *) realloc(caph->batch_buf, sizeof(simple_cap_proto_kv_t) + max_bytes);
+
+        if (buf == NULL) {
+            r = -1;
+            max_bytes = 0;
+        } else {
+            caph->batch_buf = buf;
+        }
+    }
+
+    caph->batch_len = 0;
+    caph->batch_max_bytes = max_bytes;
+    caph->batch_max_usec = max_usec;
+
+    pthread_mutex_unlock(&(caph->out_ringbuf_lock));
+
+    return r;
+}
+
 int cf_send_message(kis_capture_handler_t *caph, const char *msg, unsigned int flags) {
     /* How many KV pairs are we allocating?  1 for success for sure */
     size_t num_kvs = 1;
@@ -2107,6 +2746,61 @@ int cf_send_error(kis_capture_handler_t *caph, const char *msg) {
     return cf_stream_packet(caph, "ERROR", kv_pairs, 2);
 }
 
+int cf_send_capstats(kis_capture_handler_t *caph, uint64_t drops) {
+    /* Actual KV pairs we encode into the packet */
+    simple_cap_proto_kv_t **kv_pairs;
+    int r;
+
+    /* Counters like the kernel ring statistics reset when they're read, so 
+     * anything we fail to send has to be carried over to the next report */
+    drops += __atomic_exchange_n(&(caph->capstats_pending_drops), 0, __ATOMIC_ACQ_REL);
+
+    if (drops == 0)
+        return 1;
+
+    r = 0;
+
+    if (caph->tcp_fd >= 0 || caph->out_fd >= 0) {
+        kv_pairs = 
+            (simple_cap_proto_kv_t **) malloc(sizeof(simple_cap_proto_kv_t *) * 1);
+
+        kv_pairs[0] = encode_kv_capstats(drops);
+
+        if (kv_pairs[0] == NULL) {
+            free(kv_pairs);
+            r = -1;
+        } else {
+            r = cf_stream_packet(caph, "STATS", kv_pairs, 1);
+        }
+    }
+
+    if (r <= 0)
+        __atomic_add_fetch(&(caph->capstats_pending_drops), drops, __ATOMIC_ACQ_REL);
+
+    return r;
+}
+
+int cf_send_hopstats(kis_capture_handler_t *caph, uint64_t hops, uint64_t tune_usec,
+        uint64_t tune_max_usec, uint64_t late_usec) {
+    /* Actual KV pairs we encode into the packet */
+    simple_cap_proto_kv_t **kv_pairs;
+
+    if (caph->tcp_fd < 0 && caph->out_fd < 0)
+        return 0;
+
+    kv_pairs = 
+        (simple_cap_proto_kv_t **) malloc(sizeof(simple_cap_proto_kv_t *) * 1);
+
+    kv_pairs[0] = encode_kv_capstats_hop(hops, tune_usec, tune_max_usec, late_usec);
+
+    if (kv_pairs[0] == NULL) {
+        free(kv_pairs);
+        return -1;
+    }
+
+    return cf_stream_packet(caph, "STATS", kv_pairs, 1);
+}
+
 int cf_send_listresp(kis_capture_handler_t *caph, uint32_t seq, unsigned int success,
         const char *msg, char **interfaces, char **flags, size_t len) {
     /* How many KV pairs are we allocating?  1 for success for sure */
@@ -2415,60 +3109,186 @@ int cf_send_openresp(kis_capture_handler_t *caph, uint32_t seq, unsigned int suc
     return cf_stream_packet(caph, "OPENRESP", kv_pairs, kv_pos);
 }
 
-int cf_send_data(kis_capture_handler_t *caph,
+/* Send a DATA frame, serializing the packet directly into the output buffer
+ * or shared memory ring instead of building a PACKET KV and copying it.  Frees
+ * the provided KVs.
+ */
+static int cf_send_data_frame(kis_capture_handler_t *caph,
         simple_cap_proto_kv_t *kv_message,
         simple_cap_proto_kv_t *kv_signal,
         simple_cap_proto_kv_t *kv_gps,
         struct timeval ts, uint32_t packet_sz, uint8_t *pack) {
 
-    // fprintf(stderr, "debug - cf_send_data starting\n");
-
-    /* How many KV pairs are we allocating?  1 for data for sure */
-    size_t num_kvs = 1;
-
+    /* KV pairs we copy into the frame ahead of the packet */
+    simple_cap_proto_kv_t *kv_pairs[3];
     size_t kv_pos = 0;
-    size_t i = 0;
 
-    /* Actual KV pairs we encode into the packet */
-    simple_cap_proto_kv_t **kv_pairs;
+    size_t frame_sz, kv_sz;
+    size_t i;
+    uint8_t *frame, *buf;
+    int r = 1;
 
     if (kv_message != NULL)
-        num_kvs++;
+        kv_pairs[kv_pos++] = kv_message;
+
     if (kv_signal != NULL)
-        num_kvs++;
+        kv_pairs[kv_pos++] = kv_signal;
+
     if (kv_gps != NULL)
-        num_kvs++;
+        kv_pairs[kv_pos++] = kv_gps;
 
-    kv_pairs = 
-        (simple_cap_proto_kv_t **) malloc(sizeof(simple_cap_proto_kv_t *) * num_kvs);
+    frame_sz = sizeof(simple_cap_proto_t) + encode_kv_capdata_size(ts, packet_sz);
 
-    if (kv_message != NULL) {
-        kv_pairs[kv_pos] = kv_message;
-        kv_pos++;
+    for (i = 0; i < kv_pos; i++)
+        frame_sz += sizeof(simple_cap_proto_kv_t) + ntohl(kv_pairs[i]->header.obj_sz);
+
+    pthread_mutex_lock(&(caph->out_ringbuf_lock));
+
+    /* Keep queued packets ahead of anything sent after them; if the batch
+     * can't be sent yet, neither can this */
+    if (caph->batch_len != 0 || caph->zbatch_len != 0)
+        r = cf_flush_batch(caph);
+
+    if (r > 0)
+        r = cf_reserve_frame(caph, "DATA", frame_sz, &frame);
+
+    if (r > 0) {
+        buf = frame + sizeof(simple_cap_proto_t);
+
+        for (i = 0; i < kv_pos; i++) {
+            kv_sz = sizeof(simple_cap_proto_kv_t) + ntohl(kv_pairs[i]->header.obj_sz);
+            memcpy(buf, kv_pairs[i], kv_sz);
+            buf += kv_sz;
+        }
+
+        encode_kv_capdata_inplace(buf, ts, packet_sz, pack);
+
+        encode_simple_cap_proto_hdr_inplace((simple_cap_proto_t *) frame, frame_sz,
+                caph->checksum_type, "DATA", 0, kv_pos + 1);
+
+        cf_commit_frame(caph, "DATA");
     }
 
-    if (kv_signal != NULL) {
-        kv_pairs[kv_pos] = kv_signal;
-        kv_pos++;
+    pthread_mutex_unlock(&(caph->out_ringbuf_lock));
+
+    for (i = 0; i < kv_pos; i++)
+        free(kv_pairs[i]);
+
+    return r;
+}
+
+int cf_send_data(kis_capture_handler_t *caph,
+        simple_cap_proto_kv_t *kv_message,
+        simple_cap_proto_kv_t *kv_signal,
+        simple_cap_proto_kv_t *kv_gps,
+        struct timeval ts, uint32_t packet_sz, uint8_t *pack) {
+
+    /* A bare packet can always be batched */
+    if (kv_message == NULL && kv_signal == NULL && kv_gps == NULL)
+        return cf_send_data_compact(caph, 0, NULL, NULL, ts, packet_sz, pack);
+
+    return cf_send_data_frame(caph, kv_message, kv_signal, kv_gps, ts, packet_sz, pack);
+}
+
+static uint64_t cf_batch_ntoh64(uint64_t in_val) {
+    uint8_t be[8];
+    uint64_t ret = 0;
+    unsigned int i;
+
+    memcpy(be, &in_val, 8);
+
+    for (i = 0; i < 8; i++)
+        ret = (ret << 8) | be[i];
+
+    return ret;
+}
+
+int cf_send_data_compact(kis_capture_handler_t *caph,
+        uint32_t signal_flags, simple_cap_proto_batch_signal_t *signal,
+        simple_cap_proto_batch_gps_t *gps,
+        struct timeval ts, uint32_t packet_sz, uint8_t *pack) {
+
+    simple_cap_proto_kv_t *kv_signal = NULL, *kv_gps = NULL;
+    size_t record_sz;
+    int r;
+
+    if (signal != NULL && (signal_flags & KIS_CAP_BATCH_SIGNAL_MASK) == 0)
+        signal = NULL;
+
+    record_sz = batch_packet_record_size(signal != NULL, gps != NULL, packet_sz);
+
+    pthread_mutex_lock(&(caph->out_ringbuf_lock));
+
+    if (caph->batch_enabled && caph->batch_max_bytes != 0 && 
+            record_sz <= caph->batch_max_bytes) {
+
+        /* No room for another record, or the last batch was deflated but 
+         * couldn't be sent yet; send what we have first */
+        if (caph->batch_len + record_sz > caph->batch_max_bytes ||
+                caph->zbatch_len != 0) {
+            if ((r = cf_flush_batch(caph)) <= 0) {
+                pthread_mutex_unlock(&(caph->out_ringbuf_lock));
+                return r;
+            }
+        }
+
+        if (caph->batch_len == 0)
+            gettimeofday(&(caph->batch_start), NULL);
+
+        caph->batch_len += 
+            encode_batch_packet(caph->batch_buf + sizeof(simple_cap_proto_kv_t) + 
+                    caph->batch_len, caph->batch_max_bytes - caph->batch_len, ts, 
+                    signal_flags, signal, gps, packet_sz, pack);
+
+        pthread_mutex_unlock(&(caph->out_ringbuf_lock));
+
+        return 1;
     }
 
-    if (kv_gps != NULL) {
-        kv_pairs[kv_pos] = kv_gps;
-        kv_pos++;
+    pthread_mutex_unlock(&(caph->out_ringbuf_lock));
+
+    /* The server doesn't take batches, or the packet is bigger than a batch;
+     * send it on its own with the blocks turned back into KVs */
+    if (signal != NULL) {
+        kv_signal = encode_kv_signal(
+                (signal_flags & KIS_CAP_BATCH_SIGNAL_DBM) ? 
+                    (int32_t) ntohl(signal->signal_dbm) : 0,
+                (signal_flags & KIS_CAP_BATCH_SIGNAL_RSSI) ? 
+                    ntohl(signal->signal_rssi) : 0,
+                (signal_flags & KIS_CAP_BATCH_NOISE_DBM) ? 
+                    (int32_t) ntohl(signal->noise_dbm) : 0,
+                (signal_flags & KIS_CAP_BATCH_NOISE_RSSI) ? 
+                    ntohl(signal->noise_rssi) : 0,
+                (signal_flags & KIS_CAP_BATCH_FREQ) ? 
+                    (double) ntohl(signal->freq_khz) : 0,
+                NULL,
+                (signal_flags & KIS_CAP_BATCH_DATARATE) ? 
+                    ntohl(signal->datarate) / 1000.0 : 0);
+
+        if (kv_signal == NULL)
+            return -1;
     }
 
-    kv_pairs[kv_pos] = encode_kv_capdata(ts, packet_sz, pack);
-    if (kv_pairs[kv_pos] == NULL) {
-        fprintf(stderr, "FATAL: Unable to allocate KV DATA pair\n");
-        for (i = 0; i < kv_pos; i++) {
-            free(kv_pairs[i]);
+    if (gps != NULL) {
+        kv_gps = encode_kv_gps(
+                (int32_t) ntohl(gps->lat) / 10000000.0,
+                (int32_t) ntohl(gps->lon) / 10000000.0,
+                (int32_t) ntohl(gps->alt) / 1000.0,
+                ntohl(gps->speed) / 1000.0,
+                ntohl(gps->heading) / 1000.0,
+                ntohl(gps->precision) / 1000.0,
+                (int32_t) ntohl(gps->fix),
+                (time_t) cf_batch_ntoh64(gps->time),
+                (char *) "", (char *) "");
+
+        if (kv_gps == NULL) {
+            if (kv_signal != NULL)
+                free(kv_signal);
+            return -1;
         }
-        free(kv_pairs);
-        return -1;
     }
-    kv_pos++;
 
-    return cf_stream_packet(caph, "DATA", kv_pairs, kv_pos);
+    return cf_send_data_frame(caph, NULL, kv_signal, kv_gps, ts, packet_sz, pack);
 }
 
 int cf_send_configresp(kis_capture_handler_t *caph, unsigned int seqno, 
@@ -53,8 +53,13 @@
 
 #include "simple_datasource_proto.h"
 #include "simple_ringbuf_c.h"
+#include "kis_shmring.h"
 #include "msgpuck_buffer.h"
 
+/* Default batching thresholds for DATABATCH frames */
+#define CF_BATCH_MAX_BYTES      (1024 * 32)
+#define CF_BATCH_MAX_USEC       10000
+
 struct kis_capture_handler;
 typedef struct kis_capture_handler kis_capture_handler_t;
 
@@ -225,6 +230,24 @@ typedef int (*cf_callback_spectrumconfig)(kis_capture_handler_t *, uint32_t seqn
     unsigned int amp, uint64_t if_amp, uint64_t baseband_amp, 
     simple_cap_proto_frame_t *in_frame);
 
+/* Capture filter
+ * Compile a pcap filter expression and attach it to the capture, so that
+ * packets the server doesn't want are dropped before they're sent; ideally in
+ * the kernel, as a socket filter.
+ *
+ * Called in response to a FILTER block in a CONFIGURE command.  An empty
+ * filter removes any filter attached to the capture.
+ *
+ * msg is allocated by the framework and can hold up to STATUS_MAX characters.  It 
+ * will be transmitted along with the success or failure value.
+ *
+ * Returns:
+ * -1   Error occurred, such as a filter which does not compile
+ *  0   Success
+ */
+typedef int (*cf_callback_filter)(kis_capture_handler_t *, uint32_t seqno,
+        char *filter, char *msg);
+
 struct kis_capture_handler {
     /* Capture source type */
     char *capsource_type;
@@ -259,17 +282,46 @@ struct kis_capture_handler {
     /* Die when we hit the end of our write buffer */
     int spindown;
 
-    /* Buffers */
+    /* Checksum type used for frames we send; starts as adler32 and switches to
+     * CRC32C once the server shows it supports it */
+    int checksum_type;
+
+    /* Buffers; the output buffer is read by the IO loop without locking, and 
+     * wakes it when a frame is committed */
     kis_simple_ringbuf_t *in_ringbuf;
     kis_simple_ringbuf_t *out_ringbuf;
 
-    /* Lock for output buffer */
+    /* Batched packets, once the server offers DATABATCH; the buffer has room
+     * for the PACKETS KV header in front of the records so a batch is sent
+     * without copying it.  Protected by the output buffer lock */
+    int batch_enabled;
+    uint8_t *batch_buf;
+    size_t batch_len;
+    struct timeval batch_start;
+
+    /* Flush a batch once it holds batch_max_bytes of records or its first
+     * packet is batch_max_usec old; 0 bytes disables batching */
+    size_t batch_max_bytes;
+    unsigned int batch_max_usec;
+
+    /* Compressed batches, once the server offers them; every batch on the 
+     * connection is deflated on the same stream into zbatch_buf, which holds
+     * it until it's sent since the stream can't be rewound.  Protected by the
+     * output buffer lock */
+    int compress_level;
+    struct z_stream_s *zstream;
+    uint8_t *zbatch_buf;
+    size_t zbatch_buf_sz;
+    size_t zbatch_len;
+
+    /* Shared memory ring for DATA frames, when the server launched us locally
+     * and offered one; protected by the output buffer lock */
+    kis_shmring_t *shm_ring;
+
+    /* Lock for output buffer; the buffer has a single producer, so threads
+     * sending frames take this lock among themselves */
     pthread_mutex_t out_ringbuf_lock;
 
-    /* conditional waiter for ringbuf flushing data */
-    pthread_cond_t out_ringbuf_flush_cond;
-    pthread_mutex_t out_ringbuf_flush_cond_mutex;
-
     /* Are we shutting down? */
     int shutdown;
     pthread_mutex_t handler_lock;
@@ -289,6 +341,7 @@ struct kis_capture_handler {
 
     cf_callback_spectrumconfig spectrumconfig_cb;
 
+    cf_callback_filter filter_cb;
 
     /* Arbitrary data blob */
     void *userdata;
@@ -318,6 +371,22 @@ struct kis_capture_handler {
     unsigned int channel_hop_shuffle_spacing;
 
     int channel_hop_offset;
+
+    /* Timer driving the hop thread, so hops stay on schedule no matter how long
+     * tuning takes; -1 where there's no timerfd */
+    int hop_timer_fd;
+
+    /* Hop timing since the last report:  number of hops, total and worst time
+     * spent tuning, and total time the hop timer woke us late, in usec */
+    uint64_t hop_stats_count;
+    uint64_t hop_stats_tune_usec;
+    uint64_t hop_stats_tune_max_usec;
+    uint64_t hop_stats_late_usec;
+    time_t hop_stats_last_report;
+
+    /* Capture drops which couldn't be reported yet because the STATS frame
+     * didn't fit in the output buffer; added to the next report */
+    uint64_t capstats_pending_drops;
 };
 
 
@@ -507,6 +576,8 @@ void cf_handler_set_chanfree_cb(kis_capture_handler_t *capf, cf_callback_chanfre
 void cf_handler_set_spectrumconfig_cb(kis_capture_handler_t *capf, 
         cf_callback_spectrumconfig cb);
 
+void cf_handler_set_filter_cb(kis_capture_handler_t *capf, cf_callback_filter cb);
+
 void cf_handler_set_unknown_cb(kis_capture_handler_t *capf, cf_callback_unknown cb);
 
 /* Set the capture function, which runs inside its own thread */
@@ -527,7 +598,8 @@ int cf_handler_launch_capture_thread(kis_capture_handler_t *caph);
 int cf_handler_launch_hopping_thread(kis_capture_handler_t *caph);
 
 
-/* Perform a blocking wait, waiting for the ringbuffer to free data */
+/* Perform a blocking wait, waiting for the ringbuffer (or the shared memory
+ * ring, when DATA frames go over it) to free data */
 void cf_handler_wait_ringbuffer(kis_capture_handler_t *caph);
 
 
@@ -556,6 +628,34 @@ int cf_handle_rx_data(kis_capture_handler_t *caph);
  */
 int cf_get_DEFINITION(char **ret_definition, simple_cap_proto_frame_t *in_frame);
 
+/* Does a frame from the server show it supports CRC32C checksums, either by
+ * being a CRC32C frame or by offering it in a CHECKSUM KV
+ *
+ * Returns:
+ *  0   No
+ *  1   Yes
+ */
+int cf_peer_offers_crc32c(simple_cap_proto_frame_t *in_frame);
+
+/* Does a frame from the server offer batched DATA in a DATABATCH KV
+ *
+ * Returns:
+ *  0   No
+ *  1   Yes
+ */
+int cf_peer_offers_batch(simple_cap_proto_frame_t *in_frame);
+
+/* Does a frame from the server offer compressed batches in a COMPRESS KV; the
+ * zlib level and batch window the server asks for are returned in ret_level
+ * and ret_window_usec
+ *
+ * Returns:
+ *  0   No
+ *  1   Yes
+ */
+int cf_peer_offers_compress(simple_cap_proto_frame_t *in_frame, int *ret_level,
+        unsigned int *ret_window_usec);
+
 /* Extract a channel set string from a packet, assuming it contains a
  * 'CHANSET' KV pair.
  *
@@ -605,6 +705,19 @@ int cf_get_SPECSET(uint64_t *ret_start_mhz, uint64_t *ret_end_mhz,
         uint8_t *ret_amp, uint64_t *ret_if_amp, uint64_t *ret_baseband_amp,
         simple_cap_proto_frame_t *in_frame);
 
+/* Extract a FILTER kv from a config packet
+ *
+ * If available, returns a newly allocated copy of the filter expression in
+ * ret_filter, which the caller must free.  The filter may be an empty string,
+ * which removes the current filter.
+ *
+ * Returns:
+ * -1   Error
+ *  0   No FILTER key found
+ *  1   Success
+ */
+int cf_get_FILTER(char **ret_filter, simple_cap_proto_frame_t *in_frame);
+
 /* Connect to a network socket, if remote connection is specified; this should
  * not be needed by capture tools using the framework; the capture loop will
  * be managed directly via cf_handler_remote_capture
@@ -706,6 +819,32 @@ int cf_send_warning(kis_capture_handler_t *caph, const char *message,
  */
 int cf_send_error(kis_capture_handler_t *caph, const char *message);
 
+/* Send a STATS frame with the number of packets the capture interface dropped
+ * since the previous report, for sources which can see it.  Drops which can't
+ * be sent are kept and added to the next report, so this can be called with
+ * 0 to retry them; nothing is sent when there's nothing to report.
+ * Can be called from any thread
+ *
+ * Returns:
+ * -1   An error occurred writing the frame
+ *  0   Insufficient space in buffer
+ *  1   Success
+ */
+int cf_send_capstats(kis_capture_handler_t *caph, uint64_t drops);
+
+/* Send a STATS frame with the channel hop timing since the previous report:
+ * the number of hops, the total and worst time spent tuning, and the total
+ * time hops started late, in microseconds.  Sent by the hopping thread.
+ * Can be called from any thread
+ *
+ * Returns:
+ * -1   An error occurred writing the frame
+ *  0   Insufficient space in buffer
+ *  1   Success
+ */
+int cf_send_hopstats(kis_capture_handler_t *caph, uint64_t hops, uint64_t tune_usec,
+        uint64_t tune_max_usec, uint64_t late_usec);
+
 /* Send a LISTRESP response
  * Can be called from any thread.
  *
@@ -765,6 +904,45 @@ int cf_send_data(kis_capture_handler_t *caph,
         simple_cap_proto_kv_t *kv_gps,
         struct timeval ts, uint32_t packet_sz, uint8_t *pack);
 
+/* Send a DATA frame with signal and GPS information in the compact form used
+ * by batched packets, from encode_batch_signal and encode_batch_gps; both are
+ * optional.
+ *
+ * Once the server has offered DATABATCH, packets are queued and sent many to
+ * a frame when the batch fills or ages out; otherwise each packet is sent as a
+ * DATA frame, as cf_send_data.
+ *
+ * Can be called from any thread
+ *
+ * Returns:
+ * -1   An error occurred
+ *  0   Insufficient space in buffer
+ *  1   Success
+ */
+int cf_send_data_compact(kis_capture_handler_t *caph,
+        uint32_t signal_flags, simple_cap_proto_batch_signal_t *signal,
+        simple_cap_proto_batch_gps_t *gps,
+        struct timeval ts, uint32_t packet_sz, uint8_t *pack);
+
+/* Send any queued batched packets
+ *
+ * Returns:
+ * -1   An error occurred
+ *  0   Insufficient space in buffer
+ *  1   Success, or nothing to send
+ */
+int cf_flush_batch(kis_capture_handler_t *caph);
+
+/* Set the batching thresholds; 0 bytes disables batching.  Must be called
+ * before the capture starts.
+ *
+ * Returns:
+ * -1   Unable to allocate the batch buffer
+ *  1   Success
+ */
+int cf_handler_set_batch(kis_capture_handler_t *caph, size_t max_bytes,
+        unsigned int max_usec);
+
 /* Send a CONFIGRESP with only a success and optional message
  *
  * Returns:
@@ -60,6 +60,15 @@
 #include <net/if.h>
 #include <arpa/inet.h>
 
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <linux/if_packet.h>
+#include <linux/if_ether.h>
+#include <linux/filter.h>
+#include <net/if_arp.h>
+
 #include <ifaddrs.h>
 
 #include "../config.h"
@@ -81,10 +90,32 @@
 
 #define MAX_PACKET_LEN  8192
 
+/* TPACKET_V3 capture ring: the kernel fills whole blocks of packets in a shared
+ * mapping, and hands a block to us when it's full or has aged out, so a busy
+ * interface costs one wakeup per block instead of a read per packet */
+#ifdef TPACKET3_HDRLEN
+#define HAVE_TPACKET_V3
+#endif
+
+#define TPACKET_BLOCK_SZ        (1 << 20)
+#define TPACKET_BLOCK_NR        8
+#define TPACKET_FRAME_SZ        2048
+/* Hand over partially filled blocks after this many ms */
+#define TPACKET_BLOCK_TIMEOUT   10
+
+/* Report kernel drops at most this often, in seconds */
+#define TPACKET_STATS_INTERVAL  1
+
 /* State tracking, put in userdata */
 typedef struct {
     pcap_t *pd;
 
+    /* Memory mapped TPACKET_V3 capture instead of pcap */
+    int use_tpacket;
+    int tp_fd;
+    uint8_t *tp_map;
+    size_t tp_map_len;
+
     char *interface;
     char *cap_interface;
 
@@ -157,6 +188,12 @@ typedef struct {
     unsigned int unusual_center1;
     unsigned int center_freq1;
     unsigned int center_freq2;
+
+    /* mac80211 command to tune to this channel, built the first time we hop 
+     * to it, and the socket and interface it was built for */
+    void *nl_msg;
+    void *nl_sock;
+    int nl_ifidx;
 } local_channel_t;
 
 /* Find an interface based on a mac address (or mac address prefix in the case
@@ -431,6 +468,17 @@ void *chantranslate_callback(kis_capture_handler_t *caph, char *chanstr) {
     return ret_localchan;
 }
 
+/* Free a local channel and any mac80211 command we built for it */
+void chanfree_callback(void *privchan) {
+    local_channel_t *channel = (local_channel_t *) privchan;
+
+    if (channel == NULL)
+        return;
+
+    mac80211_free_prebuilt(channel->nl_msg);
+    free(channel);
+}
+
 /* Convert a local interpretation of a channel back info a string;
  * 'chanstr' should hold at least STATUS_MAX characters; we'll never use
  * that many but it lets us do some cheaty stuff and re-use errstrs */
@@ -579,22 +627,45 @@ int chancontrol_callback(kis_capture_handler_t *caph, uint32_t seqno, void *priv
          * what kind of channel we're setting */
         /* fprintf(stderr, "debug - %s setting channel %d w %d\n", local_wifi->cap_interface, channel->control_freq, channel->chan_width); */
 
-        if (channel->chan_width != 0) {
-            /* An explicit channel width means we need to use _set_freq to set
-             * a control freq, a width, and possibly an extended center frequency
-             * for VHT; if center1 is 0 _set_frequency will automatically
-             * exclude it and only set the width */
-            r = mac80211_set_frequency_cache(local_wifi->mac80211_ifidx,
-                    local_wifi->mac80211_socket, local_wifi->mac80211_id,
-                    channel->control_freq, channel->chan_width,
-                    channel->center_freq1, channel->center_freq2, errstr);
-        } else {
-            /* Otherwise for HT40 and non-HT channels, set the channel w/ any
-             * flags present */
-            r = mac80211_set_channel_cache(local_wifi->mac80211_ifidx,
-                    local_wifi->mac80211_socket, local_wifi->mac80211_id,
-                    channel->control_freq, channel->chan_type, errstr);
-        } 
+        /* Hopping sends the same few commands over and over, so build each
+         * channel's command once and re-send it; rebuild it if the interface
+         * has been re-opened since */
+        if (channel->nl_msg != NULL && 
+                (channel->nl_sock != local_wifi->mac80211_socket ||
+                 channel->nl_ifidx != local_wifi->mac80211_ifidx)) {
+            mac80211_free_prebuilt(channel->nl_msg);
+            channel->nl_msg = NULL;
+        }
+
+        if (channel->nl_msg == NULL) {
+            if (channel->chan_width != 0) {
+                /* An explicit channel width means we need to set a control
+                 * freq, a width, and possibly an extended center frequency
+                 * for VHT; if center1 is 0 it is excluded and only the width
+                 * is set */
+                channel->nl_msg = 
+                    mac80211_prebuild_frequency(local_wifi->mac80211_ifidx,
+                            local_wifi->mac80211_id,
+                            channel->control_freq, channel->chan_width,
+                            channel->center_freq1, channel->center_freq2, errstr);
+            } else {
+                /* Otherwise for HT40 and non-HT channels, set the channel w/ any
+                 * flags present */
+                channel->nl_msg = 
+                    mac80211_prebuild_channel(local_wifi->mac80211_ifidx,
+                            local_wifi->mac80211_id,
+                            channel->control_freq, channel->chan_type, errstr);
+            } 
+
+            channel->nl_sock = local_wifi->mac80211_socket;
+            channel->nl_ifidx = local_wifi->mac80211_ifidx;
+        }
+
+        if (channel->nl_msg == NULL)
+            r = -1;
+        else
+            r = mac80211_send_prebuilt(local_wifi->mac80211_socket, 
+                    channel->nl_msg, errstr);
 
         /* Handle channel set results */
         if (r < 0) {
@@ -676,6 +747,201 @@ int probe_callback(kis_capture_handler_t *caph, uint32_t seqno, char *definition
     return 1;
 }
 
+/* Close the TPACKET_V3 ring, if we have one */
+void tpacket_close(local_wifi_t *local_wifi) {
+    if (local_wifi->tp_map != NULL) {
+        munmap(local_wifi->tp_map, local_wifi->tp_map_len);
+        local_wifi->tp_map = NULL;
+        local_wifi->tp_map_len = 0;
+    }
+
+    if (local_wifi->tp_fd >= 0) {
+        close(local_wifi->tp_fd);
+        local_wifi->tp_fd = -1;
+    }
+}
+
+/* Open a TPACKET_V3 capture ring on the capture interface and work out the DLT
+ * from the interface hardware type
+ *
+ * Returns:
+ * -1   Error, errstr is filled in
+ *  1   Success
+ */
+int tpacket_open(local_wifi_t *local_wifi, char *errstr) {
+#ifdef HAVE_TPACKET_V3
+    struct ifreq ifr;
+    struct tpacket_req3 req;
+    struct sockaddr_ll sll;
+    int version = TPACKET_V3;
+
+    /* Open the socket without a protocol so it doesn't see any traffic until
+     * it's bound to the interface */
+    if ((local_wifi->tp_fd = socket(AF_PACKET, SOCK_RAW, 0)) < 0) {
+        snprintf(errstr, STATUS_MAX, "unable to open packet socket: %s",
+                strerror(errno));
+        return -1;
+    }
+
+    memset(&ifr, 0, sizeof(struct ifreq));
+    snprintf(ifr.ifr_name, IFNAMSIZ, "%s", local_wifi->cap_interface);
+
+    if (ioctl(local_wifi->tp_fd, SIOCGIFHWADDR, &ifr) < 0) {
+        snprintf(errstr, STATUS_MAX, "unable to get interface type: %s",
+                strerror(errno));
+        tpacket_close(local_wifi);
+        return -1;
+    }
+
+    switch (ifr.ifr_hwaddr.sa_family) {
+        case ARPHRD_IEEE80211_RADIOTAP:
+            local_wifi->datalink_type = DLT_IEEE802_11_RADIO;
+            break;
+        case ARPHRD_IEEE80211_PRISM:
+            local_wifi->datalink_type = DLT_PRISM_HEADER;
+            break;
+        case ARPHRD_IEEE80211:
+            local_wifi->datalink_type = DLT_IEEE802_11;
+            break;
+        default:
+            snprintf(errstr, STATUS_MAX, "unsupported interface type %u, the "
+                    "interface may not be in monitor mode", 
+                    ifr.ifr_hwaddr.sa_family);
+            tpacket_close(local_wifi);
+            return -1;
+    }
+
+    if (setsockopt(local_wifi->tp_fd, SOL_PACKET, PACKET_VERSION, 
+                &version, sizeof(int)) < 0) {
+        snprintf(errstr, STATUS_MAX, "unable to set TPACKET_V3: %s", strerror(errno));
+        tpacket_close(local_wifi);
+        return -1;
+    }
+
+    memset(&req, 0, sizeof(struct tpacket_req3));
+    req.tp_block_size = TPACKET_BLOCK_SZ;
+    req.tp_block_nr = TPACKET_BLOCK_NR;
+    req.tp_frame_size = TPACKET_FRAME_SZ;
+    req.tp_frame_nr = (TPACKET_BLOCK_SZ / TPACKET_FRAME_SZ) * TPACKET_BLOCK_NR;
+    req.tp_retire_blk_tov = TPACKET_BLOCK_TIMEOUT;
+
+    if (setsockopt(local_wifi->tp_fd, SOL_PACKET, PACKET_RX_RING, 
+                &req, sizeof(struct tpacket_req3)) < 0) {
+        snprintf(errstr, STATUS_MAX, "unable to allocate capture ring: %s", 
+                strerror(errno));
+        tpacket_close(local_wifi);
+        return -1;
+    }
+
+    local_wifi->tp_map_len = (size_t) req.tp_block_size * req.tp_block_nr;
+
+    local_wifi->tp_map = (uint8_t *) mmap(NULL, local_wifi->tp_map_len,
+            PROT_READ | PROT_WRITE, MAP_SHARED | MAP_LOCKED, local_wifi->tp_fd, 0);
+
+    if (local_wifi->tp_map == MAP_FAILED) {
+        /* Locking the ring is only an optimization */
+        local_wifi->tp_map = (uint8_t *) mmap(NULL, local_wifi->tp_map_len,
+                PROT_READ | PROT_WRITE, MAP_SHARED, local_wifi->tp_fd, 0);
+    }
+
+    if (local_wifi->tp_map == MAP_FAILED) {
+        local_wifi->tp_map = NULL;
+        snprintf(errstr, STATUS_MAX, "unable to map capture ring: %s", strerror(errno));
+        tpacket_close(local_wifi);
+        return -1;
+    }
+
+    memset(&sll, 0, sizeof(struct sockaddr_ll));
+    sll.sll_family = AF_PACKET;
+    sll.sll_protocol = htons(ETH_P_ALL);
+    sll.sll_ifindex = if_nametoindex(local_wifi->cap_interface);
+
+    if (bind(local_wifi->tp_fd, (struct sockaddr *) &sll, 
+                sizeof(struct sockaddr_ll)) < 0) {
+        snprintf(errstr, STATUS_MAX, "unable to bind packet socket: %s", 
+                strerror(errno));
+        tpacket_close(local_wifi);
+        return -1;
+    }
+
+    return 1;
+#else
+    snprintf(errstr, STATUS_MAX, "TPACKET_V3 not supported on this system");
+    return -1;
+#endif
+}
+
+/* Compile a pcap filter for our DLT and attach it to the capture socket as a
+ * kernel socket filter.  We attach it ourselves instead of with pcap_setfilter
+ * so that it applies the same to pcap and tpacket capture, and so we never
+ * touch the pcap state the capture thread is using. */
+int filter_callback(kis_capture_handler_t *caph, uint32_t seqno, char *filter,
+        char *msg) {
+    local_wifi_t *local_wifi = (local_wifi_t *) caph->userdata;
+    pcap_t *dead_pd;
+    struct bpf_program bpf;
+    struct sock_fprog fprog;
+    int fd;
+
+    if (local_wifi->use_tpacket)
+        fd = local_wifi->tp_fd;
+    else if (local_wifi->pd != NULL)
+        fd = pcap_fileno(local_wifi->pd);
+    else
+        fd = -1;
+
+    if (fd < 0) {
+        snprintf(msg, STATUS_MAX, "Source '%s' is not capturing, unable to set a "
+                "capture filter", local_wifi->interface);
+        return -1;
+    }
+
+    if (strlen(filter) == 0) {
+        if (setsockopt(fd, SOL_SOCKET, SO_DETACH_FILTER, NULL, 0) < 0 &&
+                errno != ENOENT) {
+            snprintf(msg, STATUS_MAX, "Unable to remove capture filter from "
+                    "source '%s': %s", local_wifi->interface, strerror(errno));
+            return -1;
+        }
+
+        snprintf(msg, STATUS_MAX, "Removed capture filter from source '%s'",
+                local_wifi->interface);
+        return 0;
+    }
+
+    if ((dead_pd = pcap_open_dead(local_wifi->datalink_type, MAX_PACKET_LEN)) == NULL) {
+        snprintf(msg, STATUS_MAX, "Unable to compile capture filter for source '%s'",
+                local_wifi->interface);
+        return -1;
+    }
+
+    if (pcap_compile(dead_pd, &bpf, filter, 1, PCAP_NETMASK_UNKNOWN) < 0) {
+        snprintf(msg, STATUS_MAX, "Unable to compile capture filter '%s' for source "
+                "'%s': %s", filter, local_wifi->interface, pcap_geterr(dead_pd));
+        pcap_close(dead_pd);
+        return -1;
+    }
+
+    pcap_close(dead_pd);
+
+    fprog.len = bpf.bf_len;
+    fprog.filter = (struct sock_filter *) bpf.bf_insns;
+
+    if (setsockopt(fd, SOL_SOCKET, SO_ATTACH_FILTER, &fprog, sizeof(fprog)) < 0) {
+        snprintf(msg, STATUS_MAX, "Unable to attach capture filter to source '%s': %s",
+                local_wifi->interface, strerror(errno));
+        pcap_freecode(&bpf);
+        return -1;
+    }
+
+    pcap_freecode(&bpf);
+
+    snprintf(msg, STATUS_MAX, "Source '%s' capture filter set to '%s'",
+            local_wifi->interface, filter);
+
+    return 0;
+}
+
 int open_callback(kis_capture_handler_t *caph, uint32_t seqno, char *definition,
         char *msg, uint32_t *dlt, char **uuid, simple_cap_proto_frame_t *frame,
         cf_params_interface_t **ret_interface,
@@ -757,6 +1023,8 @@ int open_callback(kis_capture_handler_t *caph, uint32_t seqno, char *definition,
         local_wifi->pd = NULL;
     }
 
+    tpacket_close(local_wifi);
+
     /* Start processing the open */
 
     if ((placeholder_len = cf_parse_interface(&placeholder, definition)) <= 0) {
@@ -1264,22 +1532,55 @@ int open_callback(kis_capture_handler_t *caph, uint32_t seqno, char *definition,
         cf_send_message(caph, errstr, MSGFLAG_INFO);
 
         if (chancontrol_callback(caph, 0, localchan, msg) < 0) {
+            chanfree_callback(localchan);
             return -1;
         }
+
+        chanfree_callback(localchan);
     }
 
-    /* Open the pcap */
-    local_wifi->pd = pcap_open_live(local_wifi->cap_interface, 
-            MAX_PACKET_LEN, 1, 1000, pcap_errstr);
+    local_wifi->use_tpacket = 0;
 
-    if (local_wifi->pd == NULL || strlen(pcap_errstr) != 0) {
-        snprintf(msg, STATUS_MAX, "Could not open capture interface '%s' on '%s' "
-                "as a pcap capture: %s", local_wifi->cap_interface, 
-                local_wifi->interface, pcap_errstr);
-        return -1;
+    if ((placeholder_len = cf_find_flag(&placeholder, "tpacket", definition)) > 0) {
+        if (strncasecmp(placeholder, "true", placeholder_len) == 0) {
+#ifdef HAVE_TPACKET_V3
+            local_wifi->use_tpacket = 1;
+#else
+            snprintf(errstr, STATUS_MAX, "Source '%s' requested tpacket capture, but "
+                    "this system does not support TPACKET_V3; using pcap", 
+                    local_wifi->interface);
+            cf_send_warning(caph, errstr, MSGFLAG_INFO, errstr);
+#endif
+        }
+    }
+
+    if (local_wifi->use_tpacket) {
+        if (tpacket_open(local_wifi, errstr) < 0) {
+            snprintf(msg, STATUS_MAX, "Could not open capture interface '%s' on '%s' "
+                    "as a tpacket capture: %s", local_wifi->cap_interface, 
+                    local_wifi->interface, errstr);
+            return -1;
+        }
+
+        snprintf(errstr, STATUS_MAX, "Source '%s' capturing with a %uKB "
+                "memory-mapped TPACKET_V3 ring", local_wifi->interface,
+                (unsigned int) (local_wifi->tp_map_len / 1024));
+        cf_send_message(caph, errstr, MSGFLAG_INFO);
+    } else {
+        /* Open the pcap */
+        local_wifi->pd = pcap_open_live(local_wifi->cap_interface, 
+                MAX_PACKET_LEN, 1, 1000, pcap_errstr);
+
+        if (local_wifi->pd == NULL || strlen(pcap_errstr) != 0) {
+            snprintf(msg, STATUS_MAX, "Could not open capture interface '%s' on '%s' "
+                    "as a pcap capture: %s", local_wifi->cap_interface, 
+                    local_wifi->interface, pcap_errstr);
+            return -1;
+        }
+
+        local_wifi->datalink_type = pcap_datalink(local_wifi->pd);
     }
 
-    local_wifi->datalink_type = pcap_datalink(local_wifi->pd);
     *dlt = local_wifi->datalink_type;
 
     if (strcmp(local_wifi->interface, local_wifi->cap_interface) != 0) {
@@ -1402,6 +1703,129 @@ void pcap_dispatch_cb(u_char *user, const struct pcap_pkthdr *header,
     }
 }
 
+/* Report the packets the kernel dropped since the last report; reading the
+ * statistics resets them, so the framework holds on to any it couldn't send
+ * and we report every interval to retry them */
+void tpacket_report_stats(kis_capture_handler_t *caph) {
+#ifdef HAVE_TPACKET_V3
+    local_wifi_t *local_wifi = (local_wifi_t *) caph->userdata;
+    struct tpacket_stats_v3 stats;
+    socklen_t len = sizeof(struct tpacket_stats_v3);
+
+    if (getsockopt(local_wifi->tp_fd, SOL_PACKET, PACKET_STATISTICS, 
+                &stats, &len) < 0)
+        return;
+
+    cf_send_capstats(caph, stats.tp_drops);
+#endif
+}
+
+/* Capture from the TPACKET_V3 ring until the source closes; every packet in a
+ * block goes straight into the batched send path, and the block is handed back
+ * to the kernel once they're all queued
+ *
+ * Returns:
+ * -1   Error, errstr is filled in
+ *  0   Capture was shut down
+ */
+int tpacket_capture(kis_capture_handler_t *caph, char *errstr) {
+#ifdef HAVE_TPACKET_V3
+    local_wifi_t *local_wifi = (local_wifi_t *) caph->userdata;
+    unsigned int block_num = 0;
+    struct pollfd pfd;
+    time_t last_stats = time(0);
+    unsigned int p;
+    int ret, err;
+    socklen_t errlen;
+
+    pfd.fd = local_wifi->tp_fd;
+    pfd.events = POLLIN | POLLERR;
+
+    while (!caph->spindown) {
+        struct tpacket_block_desc *block = (struct tpacket_block_desc *) 
+            (local_wifi->tp_map + (block_num * TPACKET_BLOCK_SZ));
+
+        if (time(0) - last_stats >= TPACKET_STATS_INTERVAL) {
+            tpacket_report_stats(caph);
+            last_stats = time(0);
+        }
+
+        if ((__atomic_load_n(&(block->hdr.bh1.block_status), __ATOMIC_ACQUIRE) &
+                    TP_STATUS_USER) == 0) {
+            pfd.revents = 0;
+
+            if (poll(&pfd, 1, 1000) < 0) {
+                if (errno == EINTR)
+                    continue;
+
+                snprintf(errstr, STATUS_MAX, "%s", strerror(errno));
+                return -1;
+            }
+
+            if (pfd.revents & (POLLERR | POLLHUP | POLLNVAL)) {
+                err = 0;
+                errlen = sizeof(int);
+                getsockopt(local_wifi->tp_fd, SOL_SOCKET, SO_ERROR, &err, &errlen);
+
+                snprintf(errstr, STATUS_MAX, "%s", 
+                        err == 0 ? "interface closed" : strerror(err));
+                return -1;
+            }
+
+            continue;
+        }
+
+        size_t pkt_offt = block->hdr.bh1.offset_to_first_pkt;
+        struct tpacket3_hdr *hdr;
+
+        for (p = 0; p < block->hdr.bh1.num_pkts; p++) {
+            struct timeval ts;
+
+            /* V3 packs variable sized frames into the block, so the block is
+             * the bound for every frame; don't trust the frame headers to
+             * stay inside it */
+            if (pkt_offt + sizeof(struct tpacket3_hdr) > TPACKET_BLOCK_SZ)
+                break;
+
+            hdr = (struct tpacket3_hdr *) ((uint8_t *) block + pkt_offt);
+
+            if ((size_t) hdr->tp_mac + hdr->tp_snaplen > TPACKET_BLOCK_SZ - pkt_offt)
+                break;
+
+            ts.tv_sec = hdr->tp_sec;
+            ts.tv_usec = hdr->tp_nsec / 1000;
+
+            /* Wait for the write buffer to drain if it's full, same as the 
+             * pcap path */
+            while ((ret = cf_send_data_compact(caph, 0, NULL, NULL, ts,
+                            hdr->tp_snaplen, (uint8_t *) hdr + hdr->tp_mac)) == 0)
+                cf_handler_wait_ringbuffer(caph);
+
+            if (ret < 0) {
+                snprintf(errstr, STATUS_MAX, "unable to send DATA frame");
+                return -1;
+            }
+
+            if (hdr->tp_next_offset == 0)
+                break;
+
+            pkt_offt += hdr->tp_next_offset;
+        }
+
+        /* Everything in the block has been copied out, give it back */
+        __atomic_store_n(&(block->hdr.bh1.block_status), TP_STATUS_KERNEL, 
+                __ATOMIC_RELEASE);
+
+        block_num = (block_num + 1) % TPACKET_BLOCK_NR;
+    }
+
+    return 0;
+#else
+    snprintf(errstr, STATUS_MAX, "TPACKET_V3 not supported on this system");
+    return -1;
+#endif
+}
+
 void capture_thread(kis_capture_handler_t *caph) {
     local_wifi_t *local_wifi = (local_wifi_t *) caph->userdata;
     char errstr[PCAP_ERRBUF_SIZE];
@@ -1411,15 +1835,27 @@ void capture_thread(kis_capture_handler_t *caph) {
 
     /* Simple capture thread: since we don't care about blocking and 
      * channel control is managed by the channel hopping thread, all we have
-     * to do is enter a blocking pcap loop */
+     * to do is enter a blocking capture loop */
 
-    pcap_loop(local_wifi->pd, -1, pcap_dispatch_cb, (u_char *) caph);
+    if (local_wifi->use_tpacket) {
+        char tperrstr[STATUS_MAX];
 
-    pcap_errstr = pcap_geterr(local_wifi->pd);
+        if (tpacket_capture(caph, tperrstr) == 0) {
+            cf_handler_spindown(caph);
+            return;
+        }
 
-    snprintf(errstr, PCAP_ERRBUF_SIZE, "Interface '%s' closed: %s", 
-            local_wifi->cap_interface, 
-            strlen(pcap_errstr) == 0 ? "interface closed" : pcap_errstr );
+        snprintf(errstr, PCAP_ERRBUF_SIZE, "Interface '%s' closed: %s", 
+                local_wifi->cap_interface, tperrstr);
+    } else {
+        pcap_loop(local_wifi->pd, -1, pcap_dispatch_cb, (u_char *) caph);
+
+        pcap_errstr = pcap_geterr(local_wifi->pd);
+
+        snprintf(errstr, PCAP_ERRBUF_SIZE, "Interface '%s' closed: %s", 
+                local_wifi->cap_interface, 
+                strlen(pcap_errstr) == 0 ? "interface closed" : pcap_errstr );
+    }
 
     cf_send_error(caph, errstr);
 
@@ -1439,6 +1875,10 @@ void capture_thread(kis_capture_handler_t *caph) {
 int main(int argc, char *argv[]) {
     local_wifi_t local_wifi = {
         .pd = NULL,
+        .use_tpacket = 0,
+        .tp_fd = -1,
+        .tp_map = NULL,
+        .tp_map_len = 0,
         .interface = NULL,
         .cap_interface = NULL,
         .datalink_type = -1,
@@ -1492,6 +1932,10 @@ int main(int argc, char *argv[]) {
 
     /* Set the control cb */
     cf_handler_set_chancontrol_cb(caph, chancontrol_callback);
+    cf_handler_set_chanfree_cb(caph, chanfree_callback);
+
+    /* Set the capture filter cb */
+    cf_handler_set_filter_cb(caph, filter_callback);
 
     /* Set the capture thread */
     cf_handler_set_capture_cb(caph, capture_thread);
@@ -240,25 +240,24 @@ nla_put_failure:
 #endif
 }
 
-int mac80211_set_channel_cache(int ifindex, void *nl_sock,
-        int nl80211_id, int channel, unsigned int chmode, char *errstr) {
+void *mac80211_prebuild_channel(int ifindex, int nl80211_id, int channel,
+        unsigned int chmode, char *errstr) {
 #ifndef HAVE_LINUX_NETLINK
     snprintf(errstr, STATUS_MAX, "Kismet was not compiled with netlink/mac80211 "
             "support, check the output of ./configure for why");
-    return -1;
+    return NULL;
 #else
     struct nl_msg *msg;
-    int ret = 0;
 
     if (chmode >= 4) {
         snprintf(errstr, STATUS_MAX, "unable to set channel: invalid channel mode");
-        return -1;
+        return NULL;
     }
 
     if ((msg = nlmsg_alloc()) == NULL) {
         snprintf(errstr, STATUS_MAX, 
                 "unable to set channel: unable to allocate mac80211 control message.");
-        return -1;
+        return NULL;
     }
 
     genlmsg_put(msg, 0, 0, nl80211_id, 0, 0, NL80211_CMD_SET_WIPHY, 0);
@@ -266,20 +265,106 @@ int mac80211_set_channel_cache(int ifindex, void *nl_sock,
     NLA_PUT_U32(msg, NL80211_ATTR_WIPHY_FREQ, mac80211_chan_to_freq(channel));
     NLA_PUT_U32(msg, NL80211_ATTR_WIPHY_CHANNEL_TYPE, chmode);
 
-    if ((ret = nl_send_auto_complete(nl_sock, msg)) >= 0) {
-        if ((ret = nl_wait_for_ack(nl_sock)) < 0) 
-            goto nla_put_failure;
-    }
+    return msg;
 
+nla_put_failure:
+    snprintf(errstr, STATUS_MAX, 
+            "unable to set channel %u/%u mode %u via mac80211: unable to build "
+            "control message", channel, mac80211_chan_to_freq(channel), chmode);
     nlmsg_free(msg);
+    return NULL;
+#endif
+}
 
-    return 0;
+void *mac80211_prebuild_frequency(int ifindex, int nl80211_id, 
+        unsigned int control_freq, unsigned int chan_width, 
+        unsigned int center_freq1, unsigned int center_freq2,
+        char *errstr) {
+#ifndef HAVE_LINUX_NETLINK
+	snprintf(errstr, STATUS_MAX, "Kismet was not compiled with netlink/mac80211 "
+			 "support, check the output of ./configure for why");
+    return NULL;
+#else
+    struct nl_msg *msg;
+
+    if ((msg = nlmsg_alloc()) == NULL) {
+        snprintf(errstr, STATUS_MAX, 
+                "unable to set channel/frequency: unable to allocate "
+                "mac80211 control message.");
+        return NULL;
+    }
+
+    genlmsg_put(msg, 0, 0, nl80211_id, 0, 0, NL80211_CMD_SET_WIPHY, 0);
+    NLA_PUT_U32(msg, NL80211_ATTR_IFINDEX, ifindex);
+    NLA_PUT_U32(msg, NL80211_ATTR_WIPHY_FREQ, control_freq);
+    NLA_PUT_U32(msg, NL80211_ATTR_CHANNEL_WIDTH, chan_width);
+
+    if (center_freq1 != 0) {
+        NLA_PUT_U32(msg, NL80211_ATTR_CENTER_FREQ1, center_freq1);
+    }
+
+    return msg;
 
 nla_put_failure:
-    snprintf(errstr, STATUS_MAX, 
-            "unable to set channel %u/%u mode %u via mac80211: "
-            "error code %d", channel, mac80211_chan_to_freq(channel), chmode, ret);
-    nlmsg_free(msg);
+	snprintf(errstr, STATUS_MAX, 
+            "unable to set frequency %u %u %u via mac80211: unable to build "
+            "control message", control_freq, chan_width, center_freq1);
+	nlmsg_free(msg);
+	return NULL;
+#endif
+}
+
+int mac80211_send_prebuilt(void *nl_sock, void *msg, char *errstr) {
+#ifndef HAVE_LINUX_NETLINK
+    snprintf(errstr, STATUS_MAX, "Kismet was not compiled with netlink/mac80211 "
+            "support, check the output of ./configure for why");
+    return -1;
+#else
+    int ret;
+
+    /* Sending fills in the sequence number; clear it so each send of the same
+     * message gets a fresh one and matches its ack */
+    nlmsg_hdr((struct nl_msg *) msg)->nlmsg_seq = NL_AUTO_SEQ;
+
+    if ((ret = nl_send_auto_complete(nl_sock, msg)) < 0 ||
+            (ret = nl_wait_for_ack(nl_sock)) < 0) {
+        snprintf(errstr, STATUS_MAX, "mac80211 error code %d", ret);
+        return ret < 0 ? ret : -1;
+    }
+
+    return 0;
+#endif
+}
+
+void mac80211_free_prebuilt(void *msg) {
+#ifdef HAVE_LINUX_NETLINK
+    if (msg != NULL)
+        nlmsg_free(msg);
+#endif
+}
+
+int mac80211_set_channel_cache(int ifindex, void *nl_sock,
+        int nl80211_id, int channel, unsigned int chmode, char *errstr) {
+#ifndef HAVE_LINUX_NETLINK
+    snprintf(errstr, STATUS_MAX, "Kismet was not compiled with netlink/mac80211 "
+            "support, check the output of ./configure for why");
+    return -1;
+#else
+    void *msg;
+    int ret;
+
+    if ((msg = mac80211_prebuild_channel(ifindex, nl80211_id, channel, 
+                    chmode, errstr)) == NULL)
+        return -1;
+
+    if ((ret = mac80211_send_prebuilt(nl_sock, msg, errstr)) < 0) {
+        snprintf(errstr, STATUS_MAX, 
+                "unable to set channel %u/%u mode %u via mac80211: "
+                "error code %d", channel, mac80211_chan_to_freq(channel), chmode, ret);
+    }
+
+    mac80211_free_prebuilt(msg);
+
     return ret;
 #endif
 }
@@ -316,40 +401,22 @@ int mac80211_set_frequency_cache(int ifindex, void *nl_sock, int nl80211_id,
 			 "support, check the output of ./configure for why");
     return -1;
 #else
-    struct nl_msg *msg;
-    int ret = 0;
+    void *msg;
+    int ret;
 
-    if ((msg = nlmsg_alloc()) == NULL) {
-        snprintf(errstr, STATUS_MAX, 
-                "unable to set channel/frequency: unable to allocate "
-                "mac80211 control message.");
+    if ((msg = mac80211_prebuild_frequency(ifindex, nl80211_id, control_freq,
+                    chan_width, center_freq1, center_freq2, errstr)) == NULL)
         return -1;
-    }
-
-    genlmsg_put(msg, 0, 0, nl80211_id, 0, 0, NL80211_CMD_SET_WIPHY, 0);
-    NLA_PUT_U32(msg, NL80211_ATTR_IFINDEX, ifindex);
-    NLA_PUT_U32(msg, NL80211_ATTR_WIPHY_FREQ, control_freq);
-    NLA_PUT_U32(msg, NL80211_ATTR_CHANNEL_WIDTH, chan_width);
 
-    if (center_freq1 != 0) {
-        NLA_PUT_U32(msg, NL80211_ATTR_CENTER_FREQ1, center_freq1);
-    }
-
-    if ((ret = nl_send_auto_complete(nl_sock, msg)) >= 0) {
-        if ((ret = nl_wait_for_ack(nl_sock)) < 0) 
-            goto nla_put_failure;
+    if ((ret = mac80211_send_prebuilt(nl_sock, msg, errstr)) < 0) {
+        snprintf(errstr, STATUS_MAX, 
+                "unable to set frequency %u %u %u via mac80211: error code %d",
+                control_freq, chan_width, center_freq1, ret);
     }
 
-    nlmsg_free(msg);
-
-    return 0;
+    mac80211_free_prebuilt(msg);
 
-nla_put_failure:
-	snprintf(errstr, STATUS_MAX, 
-            "unable to set frequency %u %u %u via mac80211: error code %d",
-            control_freq, chan_width, center_freq1, ret);
-	nlmsg_free(msg);
-	return ret;
+    return ret;
 #endif
 }
 
@@ -99,6 +99,34 @@ int mac80211_set_frequency_cache(int ifidx, void *nl_sock, int nl80211_id,
         unsigned int control_freq, unsigned int chan_width, unsigned int center_freq1, 
         unsigned int center_freq2, char *errstr);
 
+/* Build the mac80211 message for a channel or frequency set ahead of time, 
+ * using the cached state from mac80211_connect, so that hopping only has to
+ * send it with mac80211_send_prebuilt.  Arguments are the same as 
+ * mac80211_set_channel_cache and mac80211_set_frequency_cache.
+ *
+ * The message may be sent any number of times on the socket it was built for,
+ * and must be freed with mac80211_free_prebuilt.
+ *
+ * Returns:
+ * NULL Error
+ * ptr  Opaque pre-built message
+ */
+void *mac80211_prebuild_channel(int ifindex, int nl80211_id, int channel, 
+        unsigned int chmode, char *errstr);
+void *mac80211_prebuild_frequency(int ifindex, int nl80211_id, 
+        unsigned int control_freq, unsigned int chan_width, unsigned int center_freq1, 
+        unsigned int center_freq2, char *errstr);
+
+/* Send a pre-built message and wait for the kernel to acknowledge it
+ *
+ * Returns:
+ * <0   Error
+ *  0   Success
+ */
+int mac80211_send_prebuilt(void *nl_sock, void *msg, char *errstr);
+
+void mac80211_free_prebuilt(void *msg);
+
 /* Get the parent phy of an interface.
  *
  * Returns:
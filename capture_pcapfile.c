@@ -36,6 +36,12 @@
  * allows us to expand to interesting options, like realtime pcap replay which
  * delays the IO as if they were real packets.
  *
+ * Replay can be paced at a multiple of the original capture rate, looped, and
+ * the packet timestamps rewritten to the time of replay, which lets a pcap be
+ * used to load the server reproducibly without any capture hardware.  Pacing
+ * runs against an absolute monotonic schedule so that sleep overshoot doesn't
+ * accumulate over a long replay.
+ *
  * The DLT is automatically propagated from the pcap file, or can be overridden
  * with a source command.
  *
@@ -62,6 +68,7 @@
 
 #include <unistd.h>
 #include <errno.h>
+#include <time.h>
 
 #include <arpa/inet.h>
 
@@ -74,10 +81,45 @@ typedef struct {
     char *pcapfname;
     int datalink_type;
     int override_dlt;
-    int realtime;
-    struct timeval last_ts;
+
+    /* Replay speed as a multiple of the capture rate; 0 replays as fast as
+     * possible */
+    double speed;
+    /* Number of passes through the file; 0 loops forever */
+    unsigned long loops;
+    /* Rewrite timestamps to the time of replay */
+    int retime;
+
+    /* Timestamp of the first packet in the file, once we've seen it; synthetic
+     * captures can legitimately start at the epoch */
+    int have_first_ts;
+    struct timeval first_ts;
+    /* Replay time offset of the current pass, in capture-time usec */
+    uint64_t pass_offset_usec;
+    /* Capture time covered by the current pass */
+    uint64_t pass_usec;
+    unsigned long pass_packets;
+
+    /* Start of the replay on the monotonic and wall clocks */
+    struct timespec start_mono;
+    struct timeval start_wall;
+
+    /* Capture filter from the server; there's no socket to attach it to, so we
+     * run it over each packet before sending it.  The lock covers swapping the
+     * filter from the IO thread while the capture thread uses it. */
+    pthread_mutex_t filter_lock;
+    int use_filter;
+    struct bpf_program filter;
 } local_pcap_t;
 
+/* Don't bother sleeping for less than this; the packet is sent late by at most
+ * this much, and is caught up by the absolute schedule */
+#define PCAP_REPLAY_MIN_SLEEP_NS    50000L
+
+/* Longest single sleep, so that a spindown isn't held up by a long gap in the
+ * capture */
+#define PCAP_REPLAY_MAX_SLEEP_NS    1000000000L
+
 int probe_callback(kis_capture_handler_t *caph, uint32_t seqno, char *definition,
         char *msg, char **uuid, simple_cap_proto_frame_t *frame,
         cf_params_interface_t **ret_interface, 
@@ -213,58 +255,237 @@ int open_callback(kis_capture_handler_t *caph, uint32_t seqno, char *definition,
     /* Succesful open with no channel, hop, or chanset data */
     snprintf(msg, STATUS_MAX, "Opened pcapfile '%s' for playback", pcapfname);
 
+    local_pcap->speed = 0;
+    local_pcap->loops = 1;
+    local_pcap->retime = 0;
+
     if ((placeholder_len = cf_find_flag(&placeholder, "realtime", definition)) > 0) {
         if (strncasecmp(placeholder, "true", placeholder_len) == 0) {
-            snprintf(errstr, PCAP_ERRBUF_SIZE, 
-                    "Pcapfile '%s' will replay in realtime", pcapfname);
-            cf_send_message(caph, errstr, MSGFLAG_INFO);
-            local_pcap->realtime = 1;
+            local_pcap->speed = 1;
+        }
+    }
+
+    /* speed= overrides realtime */
+    if ((placeholder_len = cf_find_flag(&placeholder, "speed", definition)) > 0) {
+        char *speedstr = strndup(placeholder, placeholder_len);
+        char *endp = NULL;
+        double speed = strtod(speedstr, &endp);
+
+        if (endp == speedstr || *endp != '\0' || speed < 0) {
+            snprintf(msg, STATUS_MAX, "Unable to parse speed '%s' for pcapfile "
+                    "'%s', expected a multiple of the capture rate such as "
+                    "'speed=2.5', or 0 to replay as fast as possible",
+                    speedstr, pcapfname);
+            free(speedstr);
+            return -1;
+        }
+
+        free(speedstr);
+        local_pcap->speed = speed;
+    }
+
+    if ((placeholder_len = cf_find_flag(&placeholder, "loop", definition)) > 0) {
+        if (strncasecmp(placeholder, "true", placeholder_len) == 0) {
+            local_pcap->loops = 0;
+        } else if (strncasecmp(placeholder, "false", placeholder_len) == 0) {
+            local_pcap->loops = 1;
+        } else {
+            char *loopstr = strndup(placeholder, placeholder_len);
+            char *endp = NULL;
+            unsigned long loops = strtoul(loopstr, &endp, 10);
+
+            if (endp == loopstr || *endp != '\0' || loops == 0) {
+                snprintf(msg, STATUS_MAX, "Unable to parse loop '%s' for pcapfile "
+                        "'%s', expected 'true' or a number of passes",
+                        loopstr, pcapfname);
+                free(loopstr);
+                return -1;
+            }
+
+            free(loopstr);
+            local_pcap->loops = loops;
         }
     }
 
+    if ((placeholder_len = cf_find_flag(&placeholder, "retime", definition)) > 0) {
+        if (strncasecmp(placeholder, "true", placeholder_len) == 0) {
+            local_pcap->retime = 1;
+        }
+    }
+
+    if (local_pcap->speed > 0) {
+        snprintf(errstr, PCAP_ERRBUF_SIZE, 
+                "Pcapfile '%s' will replay at %.2fx the capture rate", 
+                pcapfname, local_pcap->speed);
+        cf_send_message(caph, errstr, MSGFLAG_INFO);
+    }
+
     return 1;
 }
 
+/* Replay time in usec, as a multiple of the capture time, of a packet in the
+ * current pass */
+static uint64_t pcap_replay_usec(local_pcap_t *local_pcap, const struct timeval *ts) {
+    int64_t offt_usec;
+
+    offt_usec = (int64_t) (ts->tv_sec - local_pcap->first_ts.tv_sec) * 1000000L + 
+        (ts->tv_usec - local_pcap->first_ts.tv_usec);
+
+    /* Catch corrupt pcaps w/ inconsistent times; a packet from before the start
+     * of the file is sent immediately */
+    if (offt_usec < 0)
+        offt_usec = 0;
+
+    return local_pcap->pass_offset_usec + (uint64_t) offt_usec;
+}
+
+/* Sleep until the monotonic clock reaches the packet's place in the replay.
+ *
+ * Returns 0 when it's time to send the packet, or -1 if the capture is
+ * spinning down */
+static int pcap_replay_wait(kis_capture_handler_t *caph, local_pcap_t *local_pcap,
+        uint64_t replay_usec) {
+    struct timespec target, now;
+    uint64_t target_ns;
+    int64_t delta_ns;
+
+    target_ns = (uint64_t) ((double) replay_usec * 1000.0 / local_pcap->speed);
+
+    target.tv_sec = local_pcap->start_mono.tv_sec + (target_ns / 1000000000L);
+    target.tv_nsec = local_pcap->start_mono.tv_nsec + (target_ns % 1000000000L);
+    if (target.tv_nsec >= 1000000000L) {
+        target.tv_sec++;
+        target.tv_nsec -= 1000000000L;
+    }
+
+    while (1) {
+        if (caph->spindown)
+            return -1;
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+
+        delta_ns = (int64_t) (target.tv_sec - now.tv_sec) * 1000000000L +
+            (target.tv_nsec - now.tv_nsec);
+
+        if (delta_ns < PCAP_REPLAY_MIN_SLEEP_NS)
+            return 0;
+
+        /* Sleep to the absolute target, or for the longest slice and check for
+         * spindown again */
+        if (delta_ns > PCAP_REPLAY_MAX_SLEEP_NS) {
+            now.tv_sec += 1;
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &now, NULL);
+        } else {
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &target, NULL);
+        }
+    }
+}
+
+int filter_callback(kis_capture_handler_t *caph, uint32_t seqno, char *filter,
+        char *msg) {
+    local_pcap_t *local_pcap = (local_pcap_t *) caph->userdata;
+    pcap_t *dead_pd;
+    struct bpf_program bpf;
+
+    if (strlen(filter) == 0) {
+        pthread_mutex_lock(&(local_pcap->filter_lock));
+        if (local_pcap->use_filter) {
+            pcap_freecode(&(local_pcap->filter));
+            local_pcap->use_filter = 0;
+        }
+        pthread_mutex_unlock(&(local_pcap->filter_lock));
+
+        snprintf(msg, STATUS_MAX, "Removed filter from pcapfile '%s'",
+                local_pcap->pcapfname);
+        return 0;
+    }
+
+    if ((dead_pd = pcap_open_dead(local_pcap->datalink_type, 65535)) == NULL) {
+        snprintf(msg, STATUS_MAX, "Unable to compile filter for pcapfile '%s'",
+                local_pcap->pcapfname);
+        return -1;
+    }
+
+    if (pcap_compile(dead_pd, &bpf, filter, 1, PCAP_NETMASK_UNKNOWN) < 0) {
+        snprintf(msg, STATUS_MAX, "Unable to compile filter '%s' for pcapfile "
+                "'%s': %s", filter, local_pcap->pcapfname, pcap_geterr(dead_pd));
+        pcap_close(dead_pd);
+        return -1;
+    }
+
+    pcap_close(dead_pd);
+
+    pthread_mutex_lock(&(local_pcap->filter_lock));
+    if (local_pcap->use_filter)
+        pcap_freecode(&(local_pcap->filter));
+    local_pcap->filter = bpf;
+    local_pcap->use_filter = 1;
+    pthread_mutex_unlock(&(local_pcap->filter_lock));
+
+    snprintf(msg, STATUS_MAX, "Pcapfile '%s' filter set to '%s'",
+            local_pcap->pcapfname, filter);
+
+    return 0;
+}
+
 void pcap_dispatch_cb(u_char *user, const struct pcap_pkthdr *header,
         const u_char *data)  {
     kis_capture_handler_t *caph = (kis_capture_handler_t *) user;
     local_pcap_t *local_pcap = (local_pcap_t *) caph->userdata;
     int ret;
-    unsigned long delay_usec = 0;
+    uint64_t replay_usec, pkt_usec;
+    struct timeval ts;
+    int match;
 
-    /* If we're doing 'realtime' playback, delay accordingly based on the
-     * previous packet. 
+    if (!local_pcap->have_first_ts) {
+        local_pcap->first_ts = header->ts;
+        local_pcap->have_first_ts = 1;
+    }
+
+    replay_usec = pcap_replay_usec(local_pcap, &header->ts);
+
+    pkt_usec = replay_usec - local_pcap->pass_offset_usec;
+    if (pkt_usec > local_pcap->pass_usec)
+        local_pcap->pass_usec = pkt_usec;
+
+    /* If we're pacing the playback, delay until this packet is due.
      *
      * Because we're in our own thread, we can block as long as we want - this
      * simulates blocking IO for capturing from hardware, too.
      */
-    if (local_pcap->realtime) {
-        if (local_pcap->last_ts.tv_sec == 0 && local_pcap->last_ts.tv_usec == 0) {
-            delay_usec = 0;
-        } else {
-            /* Catch corrupt pcaps w/ inconsistent times */
-            if (header->ts.tv_sec < local_pcap->last_ts.tv_sec) {
-                delay_usec = 0;
-            } else {
-                delay_usec = (header->ts.tv_sec - local_pcap->last_ts.tv_sec) * 1000000L;
-            }
+    if (local_pcap->speed > 0) {
+        if (pcap_replay_wait(caph, local_pcap, replay_usec) < 0) {
+            pcap_breakloop(local_pcap->pd);
+            return;
+        }
+    }
 
-            if (header->ts.tv_usec < local_pcap->last_ts.tv_usec) {
-                delay_usec += (1000000L - local_pcap->last_ts.tv_usec) + 
-                    header->ts.tv_usec;
-            } else {
-                delay_usec += header->ts.tv_usec - local_pcap->last_ts.tv_usec;
+    if (local_pcap->retime) {
+        if (local_pcap->speed > 0) {
+            /* Stamp the packet with when it was scheduled to be sent, which
+             * keeps the spacing of the original capture */
+            replay_usec = (uint64_t) ((double) replay_usec / local_pcap->speed);
+            ts.tv_sec = local_pcap->start_wall.tv_sec + (replay_usec / 1000000L);
+            ts.tv_usec = local_pcap->start_wall.tv_usec + (replay_usec % 1000000L);
+            if (ts.tv_usec >= 1000000L) {
+                ts.tv_sec++;
+                ts.tv_usec -= 1000000L;
             }
-
+        } else {
+            gettimeofday(&ts, NULL);
         }
+    } else {
+        ts = header->ts;
+    }
 
-        local_pcap->last_ts.tv_sec = header->ts.tv_sec;
-        local_pcap->last_ts.tv_usec = header->ts.tv_usec;
+    /* Filtered packets still take their place in the replay schedule */
+    pthread_mutex_lock(&(local_pcap->filter_lock));
+    match = !local_pcap->use_filter || 
+        pcap_offline_filter(&(local_pcap->filter), header, data);
+    pthread_mutex_unlock(&(local_pcap->filter_lock));
 
-        if (delay_usec != 0) {
-            usleep(delay_usec);
-        }
-    }
+    if (!match)
+        return;
 
     /* Try repeatedly to send the packet; go into a thread wait state if
      * the write buffer is full & we'll be woken up as soon as it flushes
@@ -272,17 +493,24 @@ void pcap_dispatch_cb(u_char *user, const struct pcap_pkthdr *header,
     while (1) {
         if ((ret = cf_send_data(caph, 
                         NULL, NULL, NULL,
-                        header->ts, 
+                        ts, 
                         header->caplen, (uint8_t *) data)) < 0) {
             pcap_breakloop(local_pcap->pd);
             cf_send_error(caph, "unable to send DATA frame");
             cf_handler_spindown(caph);
+            break;
         } else if (ret == 0) {
+            if (caph->spindown) {
+                pcap_breakloop(local_pcap->pd);
+                break;
+            }
+
             /* Go into a wait for the write buffer to get flushed */
             // fprintf(stderr, "debug - pcapfile - dispatch_cb - no room in write buffer - waiting for it to have more space\n");
             cf_handler_wait_ringbuffer(caph);
             continue;
         } else {
+            local_pcap->pass_packets++;
             break;
         }
     }
@@ -292,16 +520,84 @@ void capture_thread(kis_capture_handler_t *caph) {
     local_pcap_t *local_pcap = (local_pcap_t *) caph->userdata;
     char errstr[PCAP_ERRBUF_SIZE];
     char *pcap_errstr;
+    unsigned long pass = 0;
+    struct timespec pass_start, pass_end;
+    double pass_sec;
+    int ret;
+
+    clock_gettime(CLOCK_MONOTONIC, &(local_pcap->start_mono));
+    gettimeofday(&(local_pcap->start_wall), NULL);
+
+    while (!caph->spindown) {
+        pass++;
 
-    pcap_loop(local_pcap->pd, -1, pcap_dispatch_cb, (u_char *) caph);
+        local_pcap->pass_usec = 0;
+        local_pcap->pass_packets = 0;
 
-    pcap_errstr = pcap_geterr(local_pcap->pd);
+        clock_gettime(CLOCK_MONOTONIC, &pass_start);
 
-    snprintf(errstr, PCAP_ERRBUF_SIZE, "Pcapfile '%s' closed: %s", 
-            local_pcap->pcapfname, 
-            strlen(pcap_errstr) == 0 ? "end of pcapfile reached" : pcap_errstr );
+        ret = pcap_loop(local_pcap->pd, -1, pcap_dispatch_cb, (u_char *) caph);
 
-    cf_send_message(caph, errstr, MSGFLAG_INFO);
+        /* Push out anything still queued for a batch so the pass is complete
+         * before we measure it */
+        while (!caph->spindown && cf_flush_batch(caph) == 0)
+            cf_handler_wait_ringbuffer(caph);
+
+        clock_gettime(CLOCK_MONOTONIC, &pass_end);
+
+        if (caph->spindown)
+            break;
+
+        if (ret == -1) {
+            pcap_errstr = pcap_geterr(local_pcap->pd);
+            snprintf(errstr, PCAP_ERRBUF_SIZE, "Pcapfile '%s' closed: %s", 
+                    local_pcap->pcapfname, pcap_errstr);
+            cf_send_message(caph, errstr, MSGFLAG_INFO);
+            break;
+        }
+
+        pass_sec = (pass_end.tv_sec - pass_start.tv_sec) +
+            ((pass_end.tv_nsec - pass_start.tv_nsec) / 1000000000.0);
+
+        /* Report how fast we actually replayed, and if we were pacing, how
+         * that compares to the requested rate */
+        if (local_pcap->speed > 0) {
+            snprintf(errstr, PCAP_ERRBUF_SIZE, "Pcapfile '%s' pass %lu: %lu packets "
+                    "in %.3f seconds (%.0f packets/sec), %.2fx the capture rate, "
+                    "requested %.2fx",
+                    local_pcap->pcapfname, pass, local_pcap->pass_packets, pass_sec,
+                    pass_sec > 0 ? local_pcap->pass_packets / pass_sec : 0,
+                    pass_sec > 0 ? (local_pcap->pass_usec / 1000000.0) / pass_sec : 0,
+                    local_pcap->speed);
+        } else {
+            snprintf(errstr, PCAP_ERRBUF_SIZE, "Pcapfile '%s' pass %lu: %lu packets "
+                    "in %.3f seconds (%.0f packets/sec)",
+                    local_pcap->pcapfname, pass, local_pcap->pass_packets, pass_sec,
+                    pass_sec > 0 ? local_pcap->pass_packets / pass_sec : 0);
+        }
+
+        cf_send_message(caph, errstr, MSGFLAG_INFO);
+
+        if (local_pcap->loops != 0 && pass >= local_pcap->loops) {
+            snprintf(errstr, PCAP_ERRBUF_SIZE, "Pcapfile '%s' closed: "
+                    "end of pcapfile reached", local_pcap->pcapfname);
+            cf_send_message(caph, errstr, MSGFLAG_INFO);
+            break;
+        }
+
+        /* Start the next pass where this one ended, so that the schedule and
+         * any rewritten timestamps carry on from the last packet */
+        local_pcap->pass_offset_usec += local_pcap->pass_usec;
+
+        pcap_close(local_pcap->pd);
+        local_pcap->pd = pcap_open_offline(local_pcap->pcapfname, errstr);
+
+        if (local_pcap->pd == NULL) {
+            cf_send_error(caph, errstr);
+            cf_handler_spindown(caph);
+            break;
+        }
+    }
 
     /* Instead of dying, spin forever in a sleep loop */
     while (1) {
@@ -317,9 +613,16 @@ int main(int argc, char *argv[]) {
         .pcapfname = NULL,
         .datalink_type = -1,
         .override_dlt = -1,
-        .realtime = 0,
-        .last_ts.tv_sec = 0,
-        .last_ts.tv_usec = 0
+        .speed = 0,
+        .loops = 1,
+        .retime = 0,
+        .have_first_ts = 0,
+        .first_ts.tv_sec = 0,
+        .first_ts.tv_usec = 0,
+        .pass_offset_usec = 0,
+        .pass_usec = 0,
+        .pass_packets = 0,
+        .use_filter = 0,
     };
 
 #if 0
@@ -339,6 +642,8 @@ int main(int argc, char *argv[]) {
         return -1;
     }
 
+    pthread_mutex_init(&(local_pcap.filter_lock), NULL);
+
     /* Set the local data ptr */
     cf_handler_set_userdata(caph, &local_pcap);
 
@@ -351,6 +656,9 @@ int main(int argc, char *argv[]) {
     /* Set the capture thread */
     cf_handler_set_capture_cb(caph, capture_thread);
 
+    /* Set the filter callback */
+    cf_handler_set_filter_cb(caph, filter_callback);
+
     if (cf_handler_parse_opts(caph, argc, argv) < 1) {
         cf_print_help(caph, argv[0]);
         return -1;
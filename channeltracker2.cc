@@ -40,7 +40,8 @@ Channeltracker_V2::Channeltracker_V2(GlobalRegistry *in_globalreg) :
     std::shared_ptr<Packetchain> packetchain = 
         Globalreg::FetchMandatoryGlobalAs<Packetchain>(globalreg, "PACKETCHAIN");
 
-    packetchain->RegisterHandler(&PacketChainHandler, this, CHAINPOS_LOGGING, 0);
+    packetchain->RegisterHandler(&PacketChainHandler, this, CHAINPOS_LOGGING, 0,
+            "channel tracker");
 
 	pack_comp_device = packetchain->RegisterPacketComponent("DEVICE");
 	pack_comp_common = packetchain->RegisterPacketComponent("COMMON");
@@ -226,6 +227,51 @@ void Channeltracker_V2::update_device_counts(map<double, unsigned int> in_counts
     }
 }
 
+bool Channeltracker_V2::get_channel_activity(const std::string& in_channel,
+        unsigned int in_secs, double *ret_packets, double *ret_devices) {
+    local_locker locker(&lock);
+
+    *ret_packets = 0;
+    *ret_devices = 0;
+
+    TrackerElement::string_map_iterator smi = channel_map->string_find(in_channel);
+
+    if (smi == channel_map->string_end()) {
+        // Channels are recorded as the plain channel number, so try again
+        // without any width or mode modifiers
+        size_t numlen = 0;
+        while (numlen < in_channel.length() && isdigit(in_channel[numlen]))
+            numlen++;
+
+        if (numlen == 0 || numlen == in_channel.length())
+            return false;
+
+        smi = channel_map->string_find(in_channel.substr(0, numlen));
+
+        if (smi == channel_map->string_end())
+            return false;
+    }
+
+    shared_ptr<Channeltracker_V2_Channel> chan = 
+        static_pointer_cast<Channeltracker_V2_Channel>(smi->second);
+
+    time_t now = time(0);
+
+    *ret_packets = chan->get_packets_rrd()->get_recent_average(now, in_secs);
+
+    if (chan->get_frequency() != 0) {
+        TrackerElement::double_map_iterator imi =
+            frequency_map->double_find(chan->get_frequency());
+
+        if (imi != frequency_map->double_end()) {
+            *ret_devices = static_pointer_cast<Channeltracker_V2_Channel>(imi->second)->
+                get_device_rrd()->get_recent_average(now, in_secs);
+        }
+    }
+
+    return true;
+}
+
 int Channeltracker_V2::PacketChainHandler(CHAINCALL_PARMS) {
     Channeltracker_V2 *cv2 = (Channeltracker_V2 *) auxdata;
 
@@ -293,6 +339,11 @@ int Channeltracker_V2::PacketChainHandler(CHAINCALL_PARMS) {
     }
 
     if (chan_channel) {
+        // Remember where the channel was last seen so device counts, which
+        // are per frequency, can be found by channel name
+        if (l1info->freq_khz != 0)
+            chan_channel->set_frequency(l1info->freq_khz);
+
         (*(chan_channel->get_signal_data())) += *(l1info);
         chan_channel->get_packets_rrd()->add_sample(1, stime);
 
@@ -191,6 +191,14 @@ public:
     // Update device counts
     void update_device_counts(map<double, unsigned int> in_counts);
 
+    // Recent activity on a named channel, averaged over the last in_secs
+    // seconds:  packets per second, and devices active on the frequency the
+    // channel was last seen on.  Channels with modifiers (like 6HT40+) fall
+    // back to the plain channel number.  Returns false if the channel has
+    // never been seen.
+    bool get_channel_activity(const std::string& in_channel, unsigned int in_secs,
+            double *ret_packets, double *ret_devices);
+
     int device_decay;
 
 protected:
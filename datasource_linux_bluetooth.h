@@ -112,6 +112,9 @@ public:
 
         // Can't tune a BT
         set_tune_capable(false);
+
+        // No capture filters on HCI scans
+        set_filter_capable(false);
     }
 
 };
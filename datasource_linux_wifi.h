@@ -113,6 +113,9 @@ public:
 
         // We allow tuning, sure
         set_tune_capable(true);
+
+        // Filters are attached to the capture socket in the kernel
+        set_filter_capable(true);
     }
 };
 
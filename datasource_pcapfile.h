@@ -112,6 +112,9 @@ public:
 
         // Can't change channel on a pcapfile
         set_tune_capable(false);
+
+        // We can filter packets before replaying them
+        set_filter_capable(true);
     }
 
 };
@@ -19,6 +19,7 @@
 #include "config.h"
 
 #include <string.h>
+#include <algorithm>
 
 #include "configfile.h"
 #include "getopt.h"
@@ -35,6 +36,7 @@
 #include "streamtracker.h"
 #include "kis_httpd_registry.h"
 #include "endian_magic.h"
+#include "channeltracker2.h"
 
 DST_DatasourceProbe::DST_DatasourceProbe(GlobalRegistry *in_globalreg, 
         std::string in_definition, SharedTrackerElement in_protovec) {
@@ -323,6 +325,7 @@ Datasourcetracker::Datasourcetracker(GlobalRegistry *in_globalreg) :
                 TrackerVector, "Configured sources");
 
     completion_cleanup_id = -1;
+    adaptive_hop_timer = -1;
     next_probe_id = 0;
     next_list_id = 0;
 
@@ -363,6 +366,24 @@ Datasourcetracker::Datasourcetracker(GlobalRegistry *in_globalreg) :
         config_defaults->set_random_channel_order(true);
     }
 
+    if (globalreg->kismet_config->FetchOptBoolean("adaptive_hopping", false)) {
+        _MSG("Enabling adaptive channel hopping; busy channels will be visited "
+                "more often", MSGFLAG_INFO);
+        config_defaults->set_adaptive_hop(true);
+    }
+
+    unsigned int adaptive_interval = 
+        globalreg->kismet_config->FetchOptUInt("adaptive_hop_interval", 30);
+    if (adaptive_interval == 0)
+        adaptive_interval = 30;
+    config_defaults->set_adaptive_hop_interval(adaptive_interval);
+
+    unsigned int adaptive_slots =
+        globalreg->kismet_config->FetchOptUInt("adaptive_hop_slots", 4);
+    if (adaptive_slots == 0)
+        adaptive_slots = 1;
+    config_defaults->set_adaptive_hop_slots(adaptive_slots);
+
     if (globalreg->kismet_config->FetchOptBoolean("retry_on_source_error", true)) {
         _MSG("Sources will be re-opened if they encounter an error", MSGFLAG_INFO);
         config_defaults->set_retry_on_error(true);
@@ -387,6 +408,22 @@ Datasourcetracker::Datasourcetracker(GlobalRegistry *in_globalreg) :
 
     config_defaults->set_remote_cap_timestamp(globalreg->kismet_config->FetchOptBoolean("override_remote_timestamp", true));
 
+    config_defaults->set_remote_cap_compress(
+            globalreg->kismet_config->FetchOptBoolean("remote_capture_compress", false));
+
+    unsigned int compress_level =
+        globalreg->kismet_config->FetchOptUInt("remote_capture_compress_level", 6);
+
+    if (compress_level < 1 || compress_level > 9) {
+        _MSG("Invalid remote_capture_compress_level= in kismet.conf, expected 1-9; "
+                "using 6", MSGFLAG_ERROR);
+        compress_level = 6;
+    }
+
+    config_defaults->set_remote_cap_compress_level(compress_level);
+    config_defaults->set_remote_cap_compress_window(
+            globalreg->kismet_config->FetchOptUInt("remote_capture_compress_window", 100));
+
     httpd_pcap.reset(new Datasourcetracker_Httpd_Pcap(globalreg));
 
     // Register js module for UI
@@ -406,6 +443,9 @@ Datasourcetracker::~Datasourcetracker() {
     if (completion_cleanup_id >= 0)
         timetracker->RemoveTimer(completion_cleanup_id);
 
+    if (adaptive_hop_timer >= 0)
+        timetracker->RemoveTimer(adaptive_hop_timer);
+
     for (auto i = probing_map.begin(); i != probing_map.end(); ++i) {
         i->second->cancel();
     }
@@ -454,6 +494,17 @@ void Datasourcetracker::Deferred_Startup() {
 
     remote_complete_timer = -1;
 
+    // Periodically re-weight hopping sources by channel activity
+    if (config_defaults->get_hop() && config_defaults->get_adaptive_hop()) {
+        adaptive_hop_timer =
+            timetracker->RegisterTimer(SERVER_TIMESLICES_SEC * 
+                    config_defaults->get_adaptive_hop_interval(), NULL, 1,
+                    [this] (int) -> int {
+                        calculate_adaptive_hopping();
+                        return 1;
+                    });
+    }
+
     while (1) {
         int r = getopt_long(globalreg->argc, globalreg->argv, "-c:",
                 packetsource_long_options, &option_idx);
@@ -1058,6 +1109,284 @@ void Datasourcetracker::calculate_source_hopping(SharedDatasource in_ds) {
     }
 }
 
+// DST worker which re-weights the hop lists of hopping sources by recent 
+// channel activity.
+//
+// Sources hopping the same set of channels are planned together:  each gets
+// a share of one combined plan in which every channel has at least one slot
+// and the remaining slots are handed out by the packet rate and number of
+// devices seen on the channel.  The plan is pushed to the sources as a 
+// normal hop list, so the capture helpers don't need to know about it.
+class dst_adaptive_hop_worker : public DST_Worker {
+public:
+    dst_adaptive_hop_worker(GlobalRegistry *in_globalreg,
+            std::shared_ptr<datasourcetracker_defaults> in_defaults,
+            map<uuid, vector<string> > *in_base_map,
+            map<uuid, vector<string> > *in_plan_map) {
+        globalreg = in_globalreg;
+        defaults = in_defaults;
+        base_map = in_base_map;
+        plan_map = in_plan_map;
+
+        channeltracker =
+            Globalreg::FetchGlobalAs<Channeltracker_V2>(globalreg, "CHANNEL_TRACKER");
+    }
+
+    virtual void handle_datasource(SharedDatasource in_src) {
+        if (!in_src->get_source_running() || !in_src->get_source_hopping())
+            return;
+
+        if (!in_src->get_source_builder()->get_tune_capable())
+            return;
+
+        if (!in_src->get_definition_opt_bool("adaptive_hop", true))
+            return;
+
+        if (in_src->get_source_hop_rate() == 0)
+            return;
+
+        vector<string> current;
+        TrackerElementVector hop_vec(in_src->get_source_hop_vec());
+
+        for (auto c : hop_vec)
+            current.push_back(c->get_string());
+
+        if (current.size() == 0)
+            return;
+
+        uuid src_uuid = in_src->get_source_uuid();
+        seen_uuids.push_back(src_uuid);
+
+        // If the source is still hopping the plan we last sent it, plan from
+        // the list it had before; otherwise its list has been changed (or 
+        // this is the first time we've seen it) and becomes the new base
+        auto pi = plan_map->find(src_uuid);
+        auto bi = base_map->find(src_uuid);
+
+        vector<string> base;
+
+        if (pi != plan_map->end() && pi->second == current && bi != base_map->end()) {
+            base = bi->second;
+        } else {
+            for (auto c : current) {
+                if (std::find(base.begin(), base.end(), c) == base.end())
+                    base.push_back(c);
+            }
+
+            (*base_map)[src_uuid] = base;
+            plan_map->erase(src_uuid);
+        }
+
+        // Group sources by the set of channels they cover
+        vector<string> key_vec = base;
+        std::sort(key_vec.begin(), key_vec.end());
+
+        std::stringstream key;
+        for (auto c : key_vec)
+            key << c << ",";
+
+        hop_group& group = groups[key.str()];
+
+        if (group.sources.size() == 0)
+            group.base = base;
+
+        group.sources.push_back(in_src);
+        group.current.push_back(current);
+    }
+
+    virtual void finalize() {
+        // Forget sources which have gone away
+        for (auto i = base_map->begin(); i != base_map->end(); ) {
+            if (std::find(seen_uuids.begin(), seen_uuids.end(), i->first) == 
+                    seen_uuids.end()) {
+                plan_map->erase(i->first);
+                i = base_map->erase(i);
+            } else {
+                ++i;
+            }
+        }
+
+        if (channeltracker == NULL)
+            return;
+
+        for (auto& g : groups)
+            plan_group(g.second);
+    }
+
+protected:
+    static size_t gcd(size_t a, size_t b) {
+        while (b != 0) {
+            size_t t = a % b;
+            a = b;
+            b = t;
+        }
+
+        return a;
+    }
+
+    struct hop_group {
+        vector<string> base;
+        vector<SharedDatasource> sources;
+        vector<vector<string> > current;
+    };
+
+    void plan_group(hop_group& group) {
+        size_t nchans = group.base.size();
+        size_t nsources = group.sources.size();
+
+        // Order the channels so that hopping in order jumps across the band
+        // instead of to the neighboring channel, using a stride with no 
+        // common factor with the number of channels
+        vector<string> order;
+
+        if (defaults->get_random_channel_order() && nchans > 2) {
+            size_t stride = (nchans / 2) + 1;
+
+            while (gcd(stride, nchans) != 1)
+                stride++;
+
+            for (size_t i = 0; i < nchans; i++)
+                order.push_back(group.base[(i * stride) % nchans]);
+        } else {
+            order = group.base;
+        }
+
+        // How much of the time the group currently spends on each channel;
+        // packets are only seen while a source is tuned to the channel, so 
+        // the packet rate is scaled up by how little it was covered
+        map<string, double> coverage;
+
+        for (auto cur : group.current) {
+            for (auto c : cur)
+                coverage[c] += 1.0 / cur.size();
+        }
+
+        vector<double> packets(nchans, 0), devices(nchans, 0);
+        double total_packets = 0, total_devices = 0;
+
+        for (size_t i = 0; i < nchans; i++) {
+            if (!channeltracker->get_channel_activity(order[i], 60, 
+                        &(packets[i]), &(devices[i])))
+                continue;
+
+            double cov = coverage[order[i]];
+
+            if (cov > 0 && cov < 1)
+                packets[i] /= cov;
+
+            total_packets += packets[i];
+            total_devices += devices[i];
+        }
+
+        // Every channel gets one slot; the rest are split by the channel's 
+        // share of packets and devices, by largest remainder
+        size_t nslots = nchans * defaults->get_adaptive_hop_slots();
+        size_t extra = nslots - nchans;
+
+        vector<size_t> slots(nchans, 1);
+        vector<std::pair<double, size_t> > remainders;
+        size_t assigned = 0;
+
+        if (total_packets > 0 || total_devices > 0) {
+            for (size_t i = 0; i < nchans; i++) {
+                double share;
+
+                if (total_packets > 0 && total_devices > 0)
+                    share = ((packets[i] / total_packets) + 
+                            (devices[i] / total_devices)) / 2;
+                else if (total_packets > 0)
+                    share = packets[i] / total_packets;
+                else
+                    share = devices[i] / total_devices;
+
+                double want = share * extra;
+                slots[i] += (size_t) want;
+                assigned += (size_t) want;
+                remainders.push_back(std::make_pair(want - (size_t) want, i));
+            }
+
+            std::stable_sort(remainders.begin(), remainders.end(),
+                    [](const std::pair<double, size_t>& a, 
+                        const std::pair<double, size_t>& b) -> bool {
+                        return a.first > b.first;
+                    });
+
+            for (size_t r = 0; assigned < extra && r < remainders.size(); r++) {
+                slots[remainders[r].second]++;
+                assigned++;
+            }
+        } else {
+            // Nothing seen anywhere; hop evenly
+            nslots = nchans;
+        }
+
+        // Spread each channel's slots evenly through the plan with a smooth 
+        // weighted round robin
+        vector<string> plan;
+        vector<long> credit(nchans, 0);
+
+        for (size_t s = 0; s < nslots; s++) {
+            size_t best = 0;
+
+            for (size_t i = 0; i < nchans; i++) {
+                credit[i] += (long) slots[i];
+
+                if (credit[i] > credit[best])
+                    best = i;
+            }
+
+            credit[best] -= (long) nslots;
+            plan.push_back(order[best]);
+        }
+
+        // Deal the plan out to the sources in the group so that together
+        // they cover every slot, or if there aren't enough slots to go 
+        // around, give each the whole plan at a different offset
+        for (size_t si = 0; si < nsources; si++) {
+            SharedDatasource ds = group.sources[si];
+            vector<string> src_plan;
+            unsigned int offt = 0;
+
+            if (nslots >= nsources) {
+                for (size_t s = si; s < nslots; s += nsources)
+                    src_plan.push_back(plan[s]);
+            } else {
+                src_plan = plan;
+                offt = si % nslots;
+            }
+
+            if (src_plan == group.current[si] && !ds->get_source_hop_shuffle() &&
+                    ds->get_source_hop_offset() == offt)
+                continue;
+
+            (*plan_map)[ds->get_source_uuid()] = src_plan;
+
+            ds->set_channel_hop(ds->get_source_hop_rate(), src_plan, false,
+                    offt, 0, NULL);
+        }
+    }
+
+    GlobalRegistry *globalreg;
+
+    std::shared_ptr<datasourcetracker_defaults> defaults;
+    std::shared_ptr<Channeltracker_V2> channeltracker;
+
+    map<uuid, vector<string> > *base_map;
+    map<uuid, vector<string> > *plan_map;
+
+    vector<uuid> seen_uuids;
+
+    map<string, hop_group> groups;
+};
+
+void Datasourcetracker::calculate_adaptive_hopping() {
+    local_locker lock(&dst_lock);
+
+    dst_adaptive_hop_worker worker(globalreg, config_defaults, 
+            &adaptive_hop_base_map, &adaptive_hop_plan_map);
+    iterate_datasources(&worker);
+}
+
 void Datasourcetracker::queue_dead_remote(dst_incoming_remote *in_dead) {
     local_locker lock(&dst_lock);
 
@@ -1119,6 +1448,10 @@ bool Datasourcetracker::Httpd_VerifyPath(const char *path, const char *method) {
                     return true;
                 }
 
+                if (Httpd_StripSuffix(tokenurl[4]) == "set_filter") {
+                    return true;
+                }
+
                 return false;
             }
         }
@@ -1601,6 +1934,47 @@ int Datasourcetracker::Httpd_PostComplete(Kis_Net_Httpd_Connection *concls) {
                     concls->httpcode = 500;
                 }
 
+                return MHD_YES;
+            } else if (Httpd_StripSuffix(tokenurl[4]) == "set_filter") {
+                if (!structdata->hasKey("filter")) {
+                    throw std::runtime_error("expected filter");
+                }
+
+                std::string filter = structdata->getKeyAsString("filter", "");
+
+                if (filter.length() == 0) {
+                    _MSG("Removing capture filter from source '" + 
+                            ds->get_source_name() + "'", MSGFLAG_INFO);
+                } else {
+                    _MSG("Setting source '" + ds->get_source_name() + "' capture "
+                            "filter '" + filter + "'", MSGFLAG_INFO);
+                }
+
+                bool cmd_complete_success = false;
+
+                cl->lock();
+
+                // Initiate the filter set
+                ds->set_filter(filter, 0,
+                        [this, cl, &cmd_complete_success](unsigned int, bool success, 
+                            std::string reason) {
+
+                            cmd_complete_success = success;
+
+                            cl->unlock(reason);
+                        });
+
+                // Block until the filter cmd unlocks us
+                std::string reason = cl->block_until();
+
+                if (cmd_complete_success) {
+                    concls->response_stream << "Success";
+                    concls->httpcode = 200;
+                } else {
+                    concls->response_stream << reason;
+                    concls->httpcode = 500;
+                }
+
                 return MHD_YES;
             }
         }
@@ -1917,7 +2291,14 @@ void dst_incoming_remote::BufferAvailable(size_t in_amt) {
         // Turn it into a frame header
         frame = (simple_cap_proto_frame_t *) buf;
 
-        if (kis_ntoh32(frame->header.signature) != KIS_CAP_SIMPLE_PROTO_SIG) {
+        int frame_csum_type;
+
+        if (kis_ntoh32(frame->header.signature) == KIS_CAP_SIMPLE_PROTO_SIG) {
+            frame_csum_type = KIS_CAP_CSUM_ADLER32;
+        } else if (kis_ntoh32(frame->header.signature) == 
+                KIS_CAP_SIMPLE_PROTO_SIG_CRC32C) {
+            frame_csum_type = KIS_CAP_CSUM_CRC32C;
+        } else {
             rbuf_handler->PeekFreeReadBufferData(buf);
             _MSG("Got an invalid remote data source connection, disconnecting.",
                     MSGFLAG_ERROR);
@@ -1935,8 +2316,8 @@ void dst_incoming_remote::BufferAvailable(size_t in_amt) {
         frame->header.data_checksum = 0;
 
         // Calc the checksum of the header
-        calc_checksum = Adler32Checksum((const char *) frame, 
-                sizeof(simple_cap_proto_t));
+        calc_checksum = KisDatasource::proto_checksum(frame_csum_type, 
+                (const uint8_t *) frame, sizeof(simple_cap_proto_t));
 
         // Compare to the saved checksum
         if (calc_checksum != header_checksum) {
@@ -1960,7 +2341,8 @@ void dst_incoming_remote::BufferAvailable(size_t in_amt) {
         }
 
         // Calc the checksum of the rest
-        calc_checksum = Adler32Checksum((const char *) buf, frame_sz);
+        calc_checksum = KisDatasource::proto_checksum(frame_csum_type, 
+                (const uint8_t *) buf, frame_sz);
 
         // Compare to the saved checksum
         if (calc_checksum != data_checksum) {
@@ -230,11 +230,21 @@ public:
     __Proxy(random_channel_order, uint8_t, bool, bool, random_channel_order);
     __Proxy(retry_on_error, uint8_t, bool, bool, retry_on_error);
 
+    __Proxy(adaptive_hop, uint8_t, bool, bool, adaptive_hop);
+    __Proxy(adaptive_hop_interval, uint32_t, uint32_t, uint32_t, adaptive_hop_interval);
+    __Proxy(adaptive_hop_slots, uint32_t, uint32_t, uint32_t, adaptive_hop_slots);
+
     __Proxy(remote_cap_listen, string, string, string, remote_cap_listen);
     __Proxy(remote_cap_port, uint32_t, uint32_t, uint32_t, remote_cap_port);
 
     __Proxy(remote_cap_timestamp, uint8_t, bool, bool, remote_cap_timestamp);
 
+    __Proxy(remote_cap_compress, uint8_t, bool, bool, remote_cap_compress);
+    __Proxy(remote_cap_compress_level, uint32_t, uint32_t, uint32_t, 
+            remote_cap_compress_level);
+    __Proxy(remote_cap_compress_window, uint32_t, uint32_t, uint32_t, 
+            remote_cap_compress_window);
+
 protected:
     virtual void register_fields() {
         tracker_component::register_fields();
@@ -251,6 +261,14 @@ protected:
                 &random_channel_order);
         RegisterField("kismet.datasourcetracker.default.retry_on_error", TrackerUInt8,
                 "re-open sources if an error occurs", &retry_on_error);
+        RegisterField("kismet.datasourcetracker.default.adaptive_hop", TrackerUInt8,
+                "weight channel hopping by channel activity", &adaptive_hop);
+        RegisterField("kismet.datasourcetracker.default.adaptive_hop_interval",
+                TrackerUInt32, "seconds between adaptive hopping updates",
+                &adaptive_hop_interval);
+        RegisterField("kismet.datasourcetracker.default.adaptive_hop_slots",
+                TrackerUInt32, "adaptive hop plan slots per channel",
+                &adaptive_hop_slots);
 
         RegisterField("kismet.datasourcetracker.default.remote_cap_listen", 
                 TrackerString, "listen address for remote capture",
@@ -262,6 +280,16 @@ protected:
         RegisterField("kismet.datasourcetracker.default.remote_cap_timestamp",
                 TrackerUInt8, "overwrite remote capture timestamp with server timestamp",
                 &remote_cap_timestamp);
+
+        RegisterField("kismet.datasourcetracker.default.remote_cap_compress",
+                TrackerUInt8, "compress packet batches from remote sources",
+                &remote_cap_compress);
+        RegisterField("kismet.datasourcetracker.default.remote_cap_compress_level",
+                TrackerUInt32, "zlib level for remote capture compression",
+                &remote_cap_compress_level);
+        RegisterField("kismet.datasourcetracker.default.remote_cap_compress_window",
+                TrackerUInt32, "packet batch window for remote capture compression, "
+                "in milliseconds", &remote_cap_compress_window);
     }
 
     // Double hoprate per second
@@ -279,12 +307,27 @@ protected:
     // Boolean, do we retry on errors?
     SharedTrackerElement retry_on_error;
 
+    // Boolean, do we weight hopping by channel activity
+    SharedTrackerElement adaptive_hop;
+
+    // Seconds between recalculating adaptive hopping
+    SharedTrackerElement adaptive_hop_interval;
+
+    // Slots per channel in an adaptive hop plan; each channel gets at least 
+    // one, and the rest are shared out by activity
+    SharedTrackerElement adaptive_hop_slots;
+
     // Remote listen
     SharedTrackerElement remote_cap_listen;
     SharedTrackerElement remote_cap_port;
 
     SharedTrackerElement remote_cap_timestamp;
 
+    // Compressed remote capture
+    SharedTrackerElement remote_cap_compress;
+    SharedTrackerElement remote_cap_compress_level;
+    SharedTrackerElement remote_cap_compress_window;
+
 };
 
 // Intermediary buffer handler which is responsible for parsing the incoming
@@ -479,6 +522,16 @@ protected:
     // and want to do channel split
     void calculate_source_hopping(SharedDatasource in_ds);
 
+    // Re-weight channel hopping of all hopping sources by recent channel 
+    // activity
+    void calculate_adaptive_hopping();
+    int adaptive_hop_timer;
+
+    // Channel list each source hopped before adaptive hopping weighted it,
+    // and the weighted list we last sent it
+    map<uuid, vector<string> > adaptive_hop_base_map;
+    map<uuid, vector<string> > adaptive_hop_plan_map;
+
     // Our pcap http interface
     shared_ptr<Datasourcetracker_Httpd_Pcap> httpd_pcap;
 
@@ -401,7 +401,7 @@ Devicetracker::Devicetracker(GlobalRegistry *in_globalreg) :
 
 	// Common tracker, very early in the tracker chain
 	packetchain->RegisterHandler(&Devicetracker_packethook_commontracker,
-											this, CHAINPOS_TRACKER, -100);
+											this, CHAINPOS_TRACKER, -100, "device tracker");
 
     std::shared_ptr<Timetracker> timetracker = 
         Globalreg::FetchMandatoryGlobalAs<Timetracker>(globalreg, "TIMETRACKER");
@@ -22,6 +22,7 @@
 #include "devicetracker_httpd_pcap.h"
 #include "pcapng_stream_ringbuf.h"
 #include "devicetracker.h"
+#include "packet_retro.h"
 
 bool Devicetracker_Httpd_Pcap::Httpd_VerifyPath(const char *path, const char *method) {
     if (strcmp(method, "GET") == 0) {
@@ -52,7 +53,28 @@ bool Devicetracker_Httpd_Pcap::Httpd_VerifyPath(const char *path, const char *me
 
         string keyurl = tokenurl[3] + ".pcapng";
 
-        if (tokenurl[5] != keyurl)
+        if (tokenurl[5] == keyurl)
+            return true;
+
+        // /devices/by-key/[key]/pcap/last-seconds/[N]/[key].pcapng
+        // /devices/by-key/[key]/pcap/last-packets/[N]/[key].pcapng
+        if (tokenurl.size() < 8)
+            return false;
+
+        if (tokenurl[5] != "last-seconds" && tokenurl[5] != "last-packets")
+            return false;
+
+        unsigned int count;
+        if (sscanf(tokenurl[6].c_str(), "%u", &count) != 1)
+            return false;
+
+        if (tokenurl[7] != keyurl)
+            return false;
+
+        shared_ptr<Packet_Retro_Buffer> retrobuf =
+            Globalreg::FetchGlobalAs<Packet_Retro_Buffer>(http_globalreg, "PACKET_RETRO");
+
+        if (retrobuf == NULL || !retrobuf->get_enabled())
             return false;
 
         return true;
@@ -109,6 +131,27 @@ int Devicetracker_Httpd_Pcap::Httpd_CreateStreamResponse(Kis_Net_Httpd *httpd,
 
     Kis_Net_Httpd_Buffer_Stream_Aux *saux = 
         (Kis_Net_Httpd_Buffer_Stream_Aux *) connection->custom_extension;
+
+    // Dump what we've already seen of the device and finish
+    if (tokenurl.size() >= 8 && 
+            (tokenurl[5] == "last-seconds" || tokenurl[5] == "last-packets")) {
+        unsigned int count;
+        if (sscanf(tokenurl[6].c_str(), "%u", &count) != 1)
+            return MHD_YES;
+
+        shared_ptr<Packet_Retro_Buffer> retrobuf =
+            Globalreg::FetchGlobalAs<Packet_Retro_Buffer>(http_globalreg, "PACKET_RETRO");
+
+        if (retrobuf == NULL)
+            return MHD_YES;
+
+        if (tokenurl[5] == "last-seconds")
+            retrobuf->stream_pcapng(saux->get_rbhandler(), key, count, 0);
+        else
+            retrobuf->stream_pcapng(saux->get_rbhandler(), key, 0, count);
+
+        return MHD_YES;
+    }
       
     // Filter based on the device key
     Pcap_Stream_Ringbuf *psrb = new Pcap_Stream_Ringbuf(http_globalreg,
@@ -0,0 +1,475 @@
+/* test harness for the Kismet 802.11 IE span parsers
+ *
+ * Walks the IE tags of every beacon, probe request, and probe response in a
+ * pcap file, and decodes each tag the 802.11 dissector consumes with both the
+ * kaitai parser and the zero-copy span parser from dot11_ie_span.h.  Any
+ * difference in the decoded fields is printed, followed by the time each
+ * parser took over the whole corpus.
+ *
+ * Known differences:
+ *  - The span parsers are bounded by the IE tag length, the kaitai parsers by
+ *    the end of the frame; tags which are too short for their type parse under
+ *    kaitai but not as spans, and are counted as 'truncated'
+ *  - The kaitai WMM parser reads the OUI type as the WMM subtype
+ *
+ * # configure and build kismet
+ * ./configure
+ * make
+ *
+ * # build test harness
+ * g++ -std=c++11 -O2 -I. -o dot11_ie_parser_test dot11_ie_parser_test.cc \
+ *     kaitai_parsers/dot11_ie*.cc.o kaitaistream.cc.o -lpcap -lz
+ *
+ * ./dot11_ie_parser_test some_capture.pcap [iterations]
+ *
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <string>
+#include <vector>
+#include <iostream>
+
+#include <pcap.h>
+
+#include "util.h"
+#include "dot11_ie_span.h"
+
+#include "kaitai/kaitaistream.h"
+#include "kaitai_parsers/dot11_ie_11_qbss.h"
+#include "kaitai_parsers/dot11_ie_48_rsn.h"
+#include "kaitai_parsers/dot11_ie_54_mobility.h"
+#include "kaitai_parsers/dot11_ie_61_ht.h"
+#include "kaitai_parsers/dot11_ie_133_cisco_ccx.h"
+#include "kaitai_parsers/dot11_ie_192_vht_operation.h"
+#include "kaitai_parsers/dot11_ie_221_vendor.h"
+
+// An IE tag, and the end of the frame it came from
+struct ie_tag {
+    uint8_t tag;
+    const uint8_t *data;
+    size_t length;
+    const uint8_t *frame_end;
+};
+
+unsigned long mismatches = 0;
+unsigned long truncated = 0;
+
+#define CHECK_FIELD(t, f, k, s) \
+    if ((uint64_t) (k) != (uint64_t) (s)) { \
+        mismatches++; \
+        fprintf(stderr, "tag %u field %s mismatch, kaitai %llu span %llu\n", \
+                (t), (f), (unsigned long long) (k), (unsigned long long) (s)); \
+    }
+
+// Stream over a tag for kaitai, which runs to the end of the frame like the
+// dissector used to; lazy kaitai fields read from the stream, so it has to
+// outlive the parsed object
+struct kaitai_tag_stream {
+    kaitai_tag_stream(const ie_tag& in_tag) :
+        tag_membuf((char *) in_tag.data, (char *) in_tag.frame_end),
+        tag_stream(&tag_membuf),
+        ks(&tag_stream) { }
+
+    membuf tag_membuf;
+    std::istream tag_stream;
+    kaitai::kstream ks;
+};
+
+template<class T>
+T *kaitai_parse(kaitai_tag_stream& in_stream) {
+    try {
+        return new T(&in_stream.ks);
+    } catch (const std::exception& e) {
+        return NULL;
+    }
+}
+
+void compare_tag(const ie_tag& in_tag) {
+    dot11_ie_span span(in_tag.data, in_tag.length);
+    kaitai_tag_stream ks(in_tag);
+
+    // Only compare tags which kaitai could parse
+    switch (in_tag.tag) {
+        case 11: {
+            dot11_ie_11_qbss_t *k = kaitai_parse<dot11_ie_11_qbss_t>(ks);
+            dot11_ie_11_qbss_span s;
+
+            if (k == NULL)
+                break;
+
+            if (s.parse(span)) {
+                CHECK_FIELD(11, "station_count", k->station_count(), s.station_count());
+                CHECK_FIELD(11, "channel_utilization", k->channel_utilization(),
+                        s.channel_utilization());
+                CHECK_FIELD(11, "available_admissions", k->available_admissions(),
+                        s.available_admissions());
+            } else {
+                truncated++;
+            }
+
+            delete k;
+            break;
+        }
+        case 54: {
+            dot11_ie_54_mobility_t *k = kaitai_parse<dot11_ie_54_mobility_t>(ks);
+            dot11_ie_54_mobility_span s;
+
+            if (k == NULL)
+                break;
+
+            if (s.parse(span)) {
+                CHECK_FIELD(54, "mobility_domain", k->mobility_domain(), s.mobility_domain());
+                CHECK_FIELD(54, "fast_bss_over_ds", k->ft_policy()->fast_bss_over_ds(),
+                        s.fast_bss_over_ds());
+                CHECK_FIELD(54, "resource_request",
+                        k->ft_policy()->resource_request_capbability(),
+                        s.resource_request_capability());
+            } else {
+                truncated++;
+            }
+
+            delete k;
+            break;
+        }
+        case 61: {
+            dot11_ie_61_ht_t *k = kaitai_parse<dot11_ie_61_ht_t>(ks);
+            dot11_ie_61_ht_span s;
+
+            if (k == NULL)
+                break;
+
+            if (s.parse(span)) {
+                CHECK_FIELD(61, "primary_channel", k->primary_channel(), s.primary_channel());
+                CHECK_FIELD(61, "info_subset_1", k->info_subset_1(), s.info_subset_1());
+                CHECK_FIELD(61, "info_subset_2", k->info_subset_2(), s.info_subset_2());
+                CHECK_FIELD(61, "info_subset_3", k->info_subset_3(), s.info_subset_3());
+                CHECK_FIELD(61, "chan_offset_above", k->ht_info_chan_offset_above(),
+                        s.ht_info_chan_offset_above());
+                CHECK_FIELD(61, "chan_offset_below", k->ht_info_chan_offset_below(),
+                        s.ht_info_chan_offset_below());
+                CHECK_FIELD(61, "chanwidth", k->ht_info_chanwidth() != 0,
+                        s.ht_info_chanwidth() != 0);
+            } else {
+                truncated++;
+            }
+
+            delete k;
+            break;
+        }
+        case 192: {
+            dot11_ie_192_vht_operation_t *k =
+                kaitai_parse<dot11_ie_192_vht_operation_t>(ks);
+            dot11_ie_192_vht_operation_span s;
+
+            if (k == NULL)
+                break;
+
+            if (s.parse(span)) {
+                CHECK_FIELD(192, "channel_width", k->channel_width(), s.channel_width());
+                CHECK_FIELD(192, "center1", k->center1(), s.center1());
+                CHECK_FIELD(192, "center2", k->center2(), s.center2());
+            } else {
+                truncated++;
+            }
+
+            delete k;
+            break;
+        }
+        case 133: {
+            dot11_ie_133_cisco_ccx_t *k = kaitai_parse<dot11_ie_133_cisco_ccx_t>(ks);
+            dot11_ie_133_cisco_ccx_span s;
+
+            if (k == NULL)
+                break;
+
+            if (s.parse(span)) {
+                if (k->ap_name() != std::string(s.ap_name(), s.ap_name_len())) {
+                    mismatches++;
+                    fprintf(stderr, "tag 133 field ap_name mismatch\n");
+                }
+                CHECK_FIELD(133, "station_count", k->station_count(), s.station_count());
+            } else {
+                truncated++;
+            }
+
+            delete k;
+            break;
+        }
+        case 48: {
+            dot11_ie_48_rsn_t *k = kaitai_parse<dot11_ie_48_rsn_t>(ks);
+            dot11_ie_48_rsn_span s;
+
+            if (k == NULL)
+                break;
+
+            if (s.parse(span)) {
+                CHECK_FIELD(48, "group_cipher", k->group_cipher()->cipher_type(),
+                        s.group_cipher_type());
+                CHECK_FIELD(48, "pairwise_count", k->pairwise_count(), s.pairwise_count());
+                CHECK_FIELD(48, "akm_count", k->akm_count(), s.akm_count());
+
+                for (unsigned int i = 0; i < k->pairwise_count() &&
+                        i < s.pairwise_count(); i++) {
+                    CHECK_FIELD(48, "pairwise_cipher",
+                            (*(k->pairwise_ciphers()))[i]->cipher_type(),
+                            s.pairwise_cipher_type(i));
+                }
+
+                for (unsigned int i = 0; i < k->akm_count() && i < s.akm_count(); i++) {
+                    CHECK_FIELD(48, "akm_management",
+                            (*(k->akm_ciphers()))[i]->management_type(),
+                            s.akm_management_type(i));
+                }
+            } else {
+                truncated++;
+            }
+
+            delete k;
+            break;
+        }
+        case 221: {
+            dot11_ie_221_vendor_t *k = kaitai_parse<dot11_ie_221_vendor_t>(ks);
+            dot11_ie_221_vendor_span s;
+
+            if (k == NULL)
+                break;
+
+            if (s.parse(span)) {
+                CHECK_FIELD(221, "vendor_oui_int", k->vendor_oui_int(), s.vendor_oui_int());
+
+                if (s.has_vendor_oui_type()) {
+                    CHECK_FIELD(221, "vendor_oui_type", k->vendor_oui_type(),
+                            s.vendor_oui_type());
+                }
+            } else {
+                truncated++;
+            }
+
+            delete k;
+            break;
+        }
+    }
+}
+
+// Time one full pass of each parser over every tag
+void bench_kaitai(const std::vector<ie_tag>& in_tags) {
+    for (auto t : in_tags) {
+        kaitai_tag_stream ks(t);
+
+        switch (t.tag) {
+            case 11:
+                delete kaitai_parse<dot11_ie_11_qbss_t>(ks);
+                break;
+            case 54:
+                delete kaitai_parse<dot11_ie_54_mobility_t>(ks);
+                break;
+            case 61:
+                delete kaitai_parse<dot11_ie_61_ht_t>(ks);
+                break;
+            case 192:
+                delete kaitai_parse<dot11_ie_192_vht_operation_t>(ks);
+                break;
+            case 133:
+                delete kaitai_parse<dot11_ie_133_cisco_ccx_t>(ks);
+                break;
+            case 48:
+                delete kaitai_parse<dot11_ie_48_rsn_t>(ks);
+                break;
+            case 221:
+                delete kaitai_parse<dot11_ie_221_vendor_t>(ks);
+                break;
+        }
+    }
+}
+
+// Results of each span parse are written here so they can't be optimized away
+volatile unsigned long bench_sink;
+
+void bench_span(const std::vector<ie_tag>& in_tags) {
+    unsigned long sum = 0;
+
+    for (auto t : in_tags) {
+        dot11_ie_span span(t.data, t.length);
+
+        switch (t.tag) {
+            case 11: {
+                dot11_ie_11_qbss_span s;
+                if (s.parse(span))
+                    sum += s.station_count();
+                break;
+            }
+            case 54: {
+                dot11_ie_54_mobility_span s;
+                if (s.parse(span))
+                    sum += s.mobility_domain();
+                break;
+            }
+            case 61: {
+                dot11_ie_61_ht_span s;
+                if (s.parse(span))
+                    sum += s.primary_channel();
+                break;
+            }
+            case 192: {
+                dot11_ie_192_vht_operation_span s;
+                if (s.parse(span))
+                    sum += s.center1();
+                break;
+            }
+            case 133: {
+                dot11_ie_133_cisco_ccx_span s;
+                if (s.parse(span))
+                    sum += s.ap_name_len();
+                break;
+            }
+            case 48: {
+                dot11_ie_48_rsn_span s;
+                if (s.parse(span))
+                    sum += s.akm_count();
+                break;
+            }
+            case 221: {
+                dot11_ie_221_vendor_span s;
+                if (s.parse(span))
+                    sum += s.vendor_oui_int();
+                break;
+            }
+        }
+
+        bench_sink = sum;
+    }
+}
+
+double elapsed(const struct timespec& in_start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (now.tv_sec - in_start.tv_sec) + (now.tv_nsec - in_start.tv_nsec) / 1e9;
+}
+
+int main(int argc, char *argv[]) {
+    char errbuf[PCAP_ERRBUF_SIZE];
+    pcap_t *pd;
+    struct pcap_pkthdr *header;
+    const u_char *data;
+    int dlt;
+    unsigned int iterations = 100;
+
+    // Frames are kept for the benchmark passes
+    std::vector<std::string> frames;
+    std::vector<ie_tag> tags;
+
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s [pcap file] [iterations]\n", argv[0]);
+        exit(1);
+    }
+
+    if (argc > 2)
+        iterations = strtoul(argv[2], NULL, 10);
+
+    if ((pd = pcap_open_offline(argv[1], errbuf)) == NULL) {
+        fprintf(stderr, "Could not open pcap: %s\n", errbuf);
+        exit(1);
+    }
+
+    dlt = pcap_datalink(pd);
+
+    if (dlt != DLT_IEEE802_11 && dlt != DLT_IEEE802_11_RADIO) {
+        fprintf(stderr, "Unsupported link type %d, expected 802.11 or radiotap\n", dlt);
+        exit(1);
+    }
+
+    while (pcap_next_ex(pd, &header, &data) > 0) {
+        size_t offt = 0;
+
+        if (dlt == DLT_IEEE802_11_RADIO) {
+            if (header->caplen < 4)
+                continue;
+
+            offt = data[2] | (data[3] << 8);
+        }
+
+        if (header->caplen < offt + 24)
+            continue;
+
+        frames.push_back(std::string((const char *) data + offt, header->caplen - offt));
+    }
+
+    pcap_close(pd);
+
+    for (auto& f : frames) {
+        const uint8_t *frame = (const uint8_t *) f.data();
+        const uint8_t *frame_end = frame + f.length();
+        size_t offt;
+
+        // Management frames only
+        if ((frame[0] & 0x0C) != 0)
+            continue;
+
+        switch ((frame[0] & 0xF0) >> 4) {
+            case 4:
+                // Probe req
+                offt = 24;
+                break;
+            case 5:
+            case 8:
+                // Probe resp, beacon
+                offt = 36;
+                break;
+            default:
+                continue;
+        }
+
+        while (offt + 2 <= f.length()) {
+            uint8_t tag = frame[offt];
+            uint8_t len = frame[offt + 1];
+
+            if (offt + 2 + len > f.length())
+                break;
+
+            ie_tag t;
+            t.tag = tag;
+            t.data = frame + offt + 2;
+            t.length = len;
+            t.frame_end = frame_end;
+
+            tags.push_back(t);
+
+            offt += 2 + len;
+        }
+    }
+
+    for (auto t : tags)
+        compare_tag(t);
+
+    printf("%lu frames, %lu IE tags, %lu field mismatches, %lu truncated tags\n",
+            frames.size(), tags.size(), mismatches, truncated);
+
+    if (frames.size() == 0)
+        exit(0);
+
+    struct timespec start;
+    double t;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (unsigned int i = 0; i < iterations; i++)
+        bench_kaitai(tags);
+    t = elapsed(start);
+
+    printf("kaitai: %.3fs, %.0f frames/sec\n", t, (frames.size() * iterations) / t);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (unsigned int i = 0; i < iterations; i++)
+        bench_span(tags);
+    t = elapsed(start);
+
+    printf("span:   %.3fs, %.0f frames/sec\n", t, (frames.size() * iterations) / t);
+
+    exit(0);
+}
+
@@ -0,0 +1,360 @@
+/*
+    This file is part of Kismet
+
+    Kismet is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kismet is distributed in the hope that it will be useful,
+      but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Kismet; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef __DOT11_IE_SPAN_H__
+#define __DOT11_IE_SPAN_H__
+
+#include "config.h"
+
+#include <stdint.h>
+#include <string.h>
+
+/* Zero-copy IE tag parsers
+ *
+ * These decode the IE tags the 802.11 dissector consumes directly from the
+ * packet data, without a stream or any allocation.  They follow the layout of
+ * the matching kaitai definitions in kaitai_definitions/; parse() fails in the
+ * same places the kaitai parser would throw, except that reads are bounded by
+ * the IE tag length instead of by the end of the frame.
+ *
+ * Parsers hold pointers into the packet data for variable-length fields, so
+ * they are only valid for the lifetime of the packet they were parsed from.
+ */
+
+// Bounded little/big endian reads over a byte span
+class dot11_ie_span {
+public:
+    dot11_ie_span() :
+        data(NULL), length(0) { }
+
+    dot11_ie_span(const uint8_t *in_data, size_t in_length) :
+        data(in_data), length(in_length) { }
+
+    bool has(size_t in_offt, size_t in_len) const {
+        return in_offt <= length && in_len <= length - in_offt;
+    }
+
+    uint8_t u8(size_t in_offt) const {
+        return data[in_offt];
+    }
+
+    uint16_t u16le(size_t in_offt) const {
+        return (uint16_t) data[in_offt] | ((uint16_t) data[in_offt + 1] << 8);
+    }
+
+    uint16_t u16be(size_t in_offt) const {
+        return ((uint16_t) data[in_offt] << 8) | (uint16_t) data[in_offt + 1];
+    }
+
+    uint32_t u32le(size_t in_offt) const {
+        return (uint32_t) u16le(in_offt) | ((uint32_t) u16le(in_offt + 2) << 16);
+    }
+
+    const uint8_t *data;
+    size_t length;
+};
+
+// IE 11, QBSS load
+class dot11_ie_11_qbss_span {
+public:
+    bool parse(const dot11_ie_span& in_span) {
+        if (!in_span.has(0, 5))
+            return false;
+
+        m_station_count = in_span.u16le(0);
+        m_channel_utilization = in_span.u8(2);
+        m_available_admissions = in_span.u16le(3);
+
+        return true;
+    }
+
+    uint16_t station_count() const { return m_station_count; }
+    uint8_t channel_utilization() const { return m_channel_utilization; }
+    uint16_t available_admissions() const { return m_available_admissions; }
+
+protected:
+    uint16_t m_station_count;
+    uint8_t m_channel_utilization;
+    uint16_t m_available_admissions;
+};
+
+// IE 54, 802.11r mobility domain
+class dot11_ie_54_mobility_span {
+public:
+    bool parse(const dot11_ie_span& in_span) {
+        if (!in_span.has(0, 3))
+            return false;
+
+        m_mobility_domain = in_span.u16le(0);
+        m_ft_policy = in_span.u8(2);
+
+        return true;
+    }
+
+    uint16_t mobility_domain() const { return m_mobility_domain; }
+    bool fast_bss_over_ds() const { return m_ft_policy & 0x80; }
+    bool resource_request_capability() const { return m_ft_policy & 0x40; }
+
+protected:
+    uint16_t m_mobility_domain;
+    uint8_t m_ft_policy;
+};
+
+// IE 61, HT operation
+class dot11_ie_61_ht_span {
+public:
+    bool parse(const dot11_ie_span& in_span) {
+        if (!in_span.has(0, 8))
+            return false;
+
+        m_primary_channel = in_span.u8(0);
+        m_info_subset_1 = in_span.u8(1);
+        m_info_subset_2 = in_span.u16be(2);
+        m_info_subset_3 = in_span.u16be(4);
+        m_rx_coding_scheme = in_span.u16le(6);
+
+        return true;
+    }
+
+    uint8_t primary_channel() const { return m_primary_channel; }
+    uint8_t info_subset_1() const { return m_info_subset_1; }
+    uint16_t info_subset_2() const { return m_info_subset_2; }
+    uint16_t info_subset_3() const { return m_info_subset_3; }
+    uint16_t rx_coding_scheme() const { return m_rx_coding_scheme; }
+
+    uint8_t ht_info_chan_offset() const { return m_info_subset_1 & 0x03; }
+    bool ht_info_chan_offset_none() const { return (m_info_subset_1 & 0x03) == 0x00; }
+    bool ht_info_chan_offset_above() const { return (m_info_subset_1 & 0x03) == 0x01; }
+    bool ht_info_chan_offset_below() const { return (m_info_subset_1 & 0x03) == 0x03; }
+    uint8_t ht_info_chanwidth() const { return m_info_subset_1 & 0x04; }
+
+protected:
+    uint8_t m_primary_channel;
+    uint8_t m_info_subset_1;
+    uint16_t m_info_subset_2;
+    uint16_t m_info_subset_3;
+    uint16_t m_rx_coding_scheme;
+};
+
+// IE 192, VHT operation
+class dot11_ie_192_vht_operation_span {
+public:
+    enum channel_width_t {
+        CHANNEL_WIDTH_CH_20_40 = 0,
+        CHANNEL_WIDTH_CH_80 = 1,
+        CHANNEL_WIDTH_CH_160 = 2,
+        CHANNEL_WIDTH_CH_80_80 = 3
+    };
+
+    bool parse(const dot11_ie_span& in_span) {
+        if (!in_span.has(0, 5))
+            return false;
+
+        m_channel_width = in_span.u8(0);
+        m_center1 = in_span.u8(1);
+        m_center2 = in_span.u8(2);
+        m_basic_mcs_map = in_span.u16be(3);
+
+        return true;
+    }
+
+    uint8_t channel_width() const { return m_channel_width; }
+    uint8_t center1() const { return m_center1; }
+    uint8_t center2() const { return m_center2; }
+    uint16_t basic_mcs_map() const { return m_basic_mcs_map; }
+
+protected:
+    uint8_t m_channel_width;
+    uint8_t m_center1;
+    uint8_t m_center2;
+    uint16_t m_basic_mcs_map;
+};
+
+// IE 133, Cisco CCX1 AP name
+class dot11_ie_133_cisco_ccx_span {
+public:
+    bool parse(const dot11_ie_span& in_span) {
+        if (!in_span.has(0, 30))
+            return false;
+
+        // The name is a null terminated string inside a fixed 16 byte field
+        m_ap_name = (const char *) in_span.data + 10;
+
+        const void *term = memchr(m_ap_name, 0, 16);
+        m_ap_name_len = term == NULL ? 16 : (const char *) term - m_ap_name;
+
+        m_station_count = in_span.u8(26);
+
+        return true;
+    }
+
+    const char *ap_name() const { return m_ap_name; }
+    size_t ap_name_len() const { return m_ap_name_len; }
+    uint8_t station_count() const { return m_station_count; }
+
+protected:
+    const char *m_ap_name;
+    size_t m_ap_name_len;
+    uint8_t m_station_count;
+};
+
+// IE 221, vendor tag header; the vendor payload follows the OUI
+class dot11_ie_221_vendor_span {
+public:
+    bool parse(const dot11_ie_span& in_span) {
+        if (!in_span.has(0, 3))
+            return false;
+
+        m_vendor_oui_int = ((uint32_t) in_span.u8(0) << 16) |
+            ((uint32_t) in_span.u8(1) << 8) | in_span.u8(2);
+
+        m_vendor_data = dot11_ie_span(in_span.data + 3, in_span.length - 3);
+
+        return true;
+    }
+
+    uint32_t vendor_oui_int() const { return m_vendor_oui_int; }
+
+    // The vendor type is the first byte of the vendor data, when there is one
+    bool has_vendor_oui_type() const { return m_vendor_data.has(0, 1); }
+    uint8_t vendor_oui_type() const { return m_vendor_data.u8(0); }
+
+    const dot11_ie_span& vendor_data() const { return m_vendor_data; }
+
+protected:
+    uint32_t m_vendor_oui_int;
+    dot11_ie_span m_vendor_data;
+};
+
+// IE 221, Microsoft WMM; only the subtype, which follows the OUI type
+class dot11_ie_221_ms_wmm_span {
+public:
+    bool parse(const dot11_ie_221_vendor_span& in_vendor) {
+        if (!in_vendor.vendor_data().has(1, 1))
+            return false;
+
+        m_wme_subtype = in_vendor.vendor_data().u8(1);
+
+        return true;
+    }
+
+    uint8_t wme_subtype() const { return m_wme_subtype; }
+
+protected:
+    uint8_t m_wme_subtype;
+};
+
+// IE 48, RSN; cipher and key management lists are left in the packet and
+// indexed in place
+class dot11_ie_48_rsn_span {
+public:
+    bool parse(const dot11_ie_span& in_span) {
+        if (!in_span.has(0, 8))
+            return false;
+
+        m_rsn_version = in_span.u16le(0);
+        m_group_cipher_type = in_span.u8(5);
+        m_pairwise_count = in_span.u16le(6);
+
+        size_t akm_offt = 8 + (size_t) m_pairwise_count * 4;
+
+        if (!in_span.has(8, (size_t) m_pairwise_count * 4) || !in_span.has(akm_offt, 2))
+            return false;
+
+        m_akm_count = in_span.u16le(akm_offt);
+
+        if (!in_span.has(akm_offt + 2, (size_t) m_akm_count * 4))
+            return false;
+
+        m_pairwise = in_span.data + 8;
+        m_akm = in_span.data + akm_offt + 2;
+
+        return true;
+    }
+
+    uint16_t rsn_version() const { return m_rsn_version; }
+    uint8_t group_cipher_type() const { return m_group_cipher_type; }
+
+    uint16_t pairwise_count() const { return m_pairwise_count; }
+    uint8_t pairwise_cipher_type(unsigned int in_n) const { return m_pairwise[in_n * 4 + 3]; }
+
+    uint16_t akm_count() const { return m_akm_count; }
+    uint8_t akm_management_type(unsigned int in_n) const { return m_akm[in_n * 4 + 3]; }
+
+protected:
+    uint16_t m_rsn_version;
+    uint8_t m_group_cipher_type;
+    uint16_t m_pairwise_count;
+    uint16_t m_akm_count;
+    const uint8_t *m_pairwise;
+    const uint8_t *m_akm;
+};
+
+// IE 48, RSN header only, used to look for invalid pairwise counts
+class dot11_ie_48_rsn_partial_span {
+public:
+    bool parse(const dot11_ie_span& in_span) {
+        if (!in_span.has(0, 8))
+            return false;
+
+        m_rsn_version = in_span.u16le(0);
+        m_pairwise_count = in_span.u16le(6);
+
+        return true;
+    }
+
+    uint16_t rsn_version() const { return m_rsn_version; }
+    uint16_t pairwise_count() const { return m_pairwise_count; }
+
+protected:
+    uint16_t m_rsn_version;
+    uint16_t m_pairwise_count;
+};
+
+// IE 52, 802.11k RMM neighbor report
+class dot11_ie_52_rmm_neighbor_span {
+public:
+    bool parse(const dot11_ie_span& in_span) {
+        if (!in_span.has(0, 13))
+            return false;
+
+        m_bssid = in_span.data;
+        m_bssid_info = in_span.u32le(6);
+        m_operating_class = in_span.u8(10);
+        m_channel_number = in_span.u8(11);
+        m_phy_type = in_span.u8(12);
+
+        return true;
+    }
+
+    const uint8_t *bssid() const { return m_bssid; }
+    uint32_t bssid_info() const { return m_bssid_info; }
+    uint8_t operating_class() const { return m_operating_class; }
+    uint8_t channel_number() const { return m_channel_number; }
+    uint8_t phy_type() const { return m_phy_type; }
+
+protected:
+    const uint8_t *m_bssid;
+    uint32_t m_bssid_info;
+    uint8_t m_operating_class;
+    uint8_t m_channel_number;
+    uint8_t m_phy_type;
+};
+
+#endif
+
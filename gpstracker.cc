@@ -43,9 +43,12 @@ GpsTracker::GpsTracker(GlobalRegistry *in_globalreg) :
     _PCM(PACK_COMP_GPS) =
         globalreg->packetchain->RegisterPacketComponent("gps");
 
+    gps_packinfo_pool = 
+        globalreg->packetchain->FetchComponentPool<kis_gps_packinfo>();
+
     // Register the packet chain hook
     globalreg->packetchain->RegisterHandler(&kis_gpspack_hook, this,
-            CHAINPOS_POSTCAP, -100);
+            CHAINPOS_POSTCAP, -100, "gps tagger");
 
     gps_prototypes.reset(new TrackerElement(TrackerVector));
     gps_prototypes_vec = TrackerElementVector(gps_prototypes);
@@ -172,8 +175,9 @@ kis_gps_packinfo *GpsTracker::get_best_location() {
             continue;
 
         if (gps->get_location_valid()) {
-            kis_gps_packinfo *pi = new kis_gps_packinfo(gps->get_location());
+            kis_gps_packinfo *pi = gps_packinfo_pool->acquire();
 
+            pi->set(gps->get_location());
             pi->gpsuuid = gps->get_gps_uuid();
             pi->gpsname  = gps->get_gps_name();
 
@@ -273,7 +277,7 @@ void GpsTracker::Httpd_CreateStreamResponse(
             loctrip->set_valid(pi->fix >= 2);
             loctrip->set_time_sec(pi->tv.tv_sec);
             loctrip->set_time_usec(pi->tv.tv_usec);
-            delete(pi);
+            gps_packinfo_pool->recycle(pi);
         } else {
             loctrip->set_valid(false);
         }
@@ -39,31 +39,43 @@ class kis_gps_packinfo : public packet_component {
 public:
 	kis_gps_packinfo() {
 		self_destruct = 1;
-        lat = lon = alt = speed = heading = 0;
-        precision = 0;
-		fix = 0;
-        tv.tv_sec = 0;
-        tv.tv_usec = 0;
+        reset();
 	}
 
     kis_gps_packinfo(kis_gps_packinfo *src) {
+        reset();
+
         if (src != NULL) {
             self_destruct = src->self_destruct;
-
-            lat = src->lat;
-            lon = src->lon;
-            alt = src->alt;
-            speed = src->speed;
-            heading = src->heading;
-            precision = src->precision;
-            fix = src->fix;
-            tv.tv_sec = src->tv.tv_sec;
-            tv.tv_usec = src->tv.tv_usec;
-            gpsuuid = src->gpsuuid;
-            gpsname = src->gpsname;
+            set(src);
         }
     }
 
+    virtual void reset() {
+        lat = lon = alt = speed = heading = 0;
+        precision = 0;
+		fix = 0;
+        tv.tv_sec = 0;
+        tv.tv_usec = 0;
+        gpsuuid = uuid();
+        gpsname = "";
+    }
+
+    // Copy the location from another record
+    void set(kis_gps_packinfo *src) {
+        lat = src->lat;
+        lon = src->lon;
+        alt = src->alt;
+        speed = src->speed;
+        heading = src->heading;
+        precision = src->precision;
+        fix = src->fix;
+        tv.tv_sec = src->tv.tv_sec;
+        tv.tv_usec = src->tv.tv_usec;
+        gpsuuid = src->gpsuuid;
+        gpsname = src->gpsname;
+    }
+
     shared_ptr<kis_tracked_location_triplet> as_tracked_triplet(GlobalRegistry *globalreg) {
         shared_ptr<kis_tracked_location_triplet> 
             r(new kis_tracked_location_triplet(globalreg, 0));
@@ -138,8 +150,8 @@ public:
     // Set a primary GPS
     bool set_primary_gps(uuid in_uuid);
 
-    // Get the 'best' location - returns a NEW gpspackinfo which the caller is 
-    // responsible for deleting.
+    // Get the 'best' location - returns a gpspackinfo from the component pool
+    // which the caller is responsible for inserting into a packet or recycling.
     kis_gps_packinfo *get_best_location();
 
     // Populate packets that don't have a GPS location
@@ -160,6 +172,9 @@ protected:
 
     // Extra field we insert into a location triplet
     int tracked_uuid_addition_id;
+
+    // Recycled gps packet components
+    packet_component_pool<kis_gps_packinfo> *gps_packinfo_pool;
 };
 
 #endif
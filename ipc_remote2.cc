@@ -56,6 +56,8 @@ IPCRemoteV2::IPCRemoteV2(GlobalRegistry *in_globalreg,
 
     child_pid = -1;
     tracker_free = false;
+
+    shm_ring_size = 0;
 }
 
 IPCRemoteV2::~IPCRemoteV2() {
@@ -90,6 +92,27 @@ string IPCRemoteV2::FindBinaryPath(string in_cmd) {
     return "";
 }
 
+bool IPCRemoteV2::enable_shm_ring(size_t in_size,
+        std::function<void (const uint8_t *, size_t)> in_cb) {
+    local_locker lock(&ipc_locker);
+
+    if (!kis_shmring_supported())
+        return false;
+
+    shm_ring_size = in_size;
+    shm_ring_cb = in_cb;
+
+    return true;
+}
+
+void IPCRemoteV2::close_shm_ring() {
+    if (shmringclient != NULL) {
+        pollabletracker->RemovePollable(shmringclient);
+        shmringclient->CloseRing();
+        shmringclient.reset();
+    }
+}
+
 void IPCRemoteV2::close_ipc() {
     // Remove the IPC entry first, we already are shutting down; let the ipc
     // catcher reap the signal normally, we just don't need to know about it.
@@ -176,7 +199,18 @@ int IPCRemoteV2::launch_kis_explicit_binary(string cmdpath, vector<string> args)
     fcntl(outpipepair[1], F_SETFL, fcntl(outpipepair[1], F_GETFL, 0) | O_NONBLOCK);
 
 #endif
-    
+
+    // Shared memory ring, if we're offering one; if we can't make it the binary
+    // just uses the pipe for everything
+    kis_shmring_t *shm_ring = NULL;
+
+    if (shm_ring_size != 0) {
+        shm_ring = kis_shmring_create(shm_ring_size);
+
+        if (shm_ring == NULL)
+            _MSG("IPC could not create a shared memory ring for '" + cmdpath + "', "
+                    "using the pipe for all data: " + kis_strerror_r(errno), MSGFLAG_ERROR);
+    }
    
     // Mask sigchild until we're done and it's in the list
     sigset_t mask, oldmask;
@@ -217,8 +251,8 @@ int IPCRemoteV2::launch_kis_explicit_binary(string cmdpath, vector<string> args)
 
         cmdarg[args.size() + 7] = NULL;
 #else
-        // argv[0], "--in-fd" "--out-fd" ... NULL
-        cmdarg = new char*[args.size() + 4];
+        // argv[0], "--in-fd" "--out-fd" ["--shm-ring"] ... NULL
+        cmdarg = new char*[args.size() + 5];
         cmdarg[0] = strdup(cmdpath.c_str());
 
         // Child reads from inpair
@@ -229,11 +263,26 @@ int IPCRemoteV2::launch_kis_explicit_binary(string cmdpath, vector<string> args)
         // Child writes to writepair
         arg << "--out-fd=" << outpipepair[1];
         cmdarg[2] = strdup(arg.str().c_str());
+        arg.str("");
+
+        unsigned int argpos = 3;
+
+        // The ring descriptors are close-on-exec so they don't leak into any
+        // other process we launch; let this one keep them
+        if (shm_ring != NULL) {
+            fcntl(shm_ring->mem_fd, F_SETFD, 0);
+            fcntl(shm_ring->data_efd, F_SETFD, 0);
+            fcntl(shm_ring->space_efd, F_SETFD, 0);
+
+            arg << "--shm-ring=" << shm_ring->mem_fd << "," << shm_ring->data_efd << 
+                "," << shm_ring->space_efd;
+            cmdarg[argpos++] = strdup(arg.str().c_str());
+        }
 
         for (unsigned int x = 0; x < args.size(); x++)
-            cmdarg[x+3] = strdup(args[x].c_str());
+            cmdarg[argpos++] = strdup(args[x].c_str());
 
-        cmdarg[args.size() + 3] = NULL;
+        cmdarg[argpos] = NULL;
 #endif
 
         // Close the unused half of the pairs on the child
@@ -264,6 +313,17 @@ int IPCRemoteV2::launch_kis_explicit_binary(string cmdpath, vector<string> args)
     close(inpipepair[0]);
     close(outpipepair[1]);
 
+    if (shm_ring != NULL) {
+        // We only need the mapping, not the memfd itself
+        close(shm_ring->mem_fd);
+        shm_ring->mem_fd = -1;
+
+        shmringclient.reset(new ShmRingClient(globalreg, ipchandler, shm_ring_cb));
+        shmringclient->OpenRing(shm_ring);
+
+        pollabletracker->RegisterPollable(shmringclient);
+    }
+
     binary_path = cmdpath;
     binary_args = args;
 
@@ -423,6 +483,8 @@ int IPCRemoteV2::soft_kill() {
         pipeclient->ClosePipes();
     }
 
+    close_shm_ring();
+
     if (child_pid <= 0)
         return -1;
 
@@ -439,6 +501,8 @@ int IPCRemoteV2::hard_kill() {
         pipeclient->ClosePipes();
     }
 
+    close_shm_ring();
+
     if (child_pid <= 0)
         return -1;
 
@@ -28,6 +28,7 @@
 #include "kis_mutex.h"
 #include "buffer_handler.h"
 #include "pipeclient.h"
+#include "shmringclient.h"
 #include "timetracker.h"
 #include "pollabletracker.h"
 
@@ -74,6 +75,12 @@ public:
     int launch_standard_binary(string cmd, vector<string> args);
     int launch_standard_explicit_binary(string cmdpath, vector<string> args);
 
+    // Offer a shared memory ring of in_size bytes to the next kismet binary we
+    // launch, passed via --shm-ring=; frames the binary sends over the ring are
+    // passed to in_cb instead of arriving in the pipe.  Must be called before
+    // launching.  Returns false if shared memory rings aren't supported.
+    bool enable_shm_ring(size_t in_size, std::function<void (const uint8_t *, size_t)> in_cb);
+
     // Soft-kill a binary (send a sigterm)
     int soft_kill();
 
@@ -105,6 +112,13 @@ protected:
     // Client that reads/writes from the pipes and populates the IPC
     shared_ptr<PipeClient> pipeclient;
 
+    // Optional shared memory ring for frames from the binary
+    size_t shm_ring_size;
+    std::function<void (const uint8_t *, size_t)> shm_ring_cb;
+    shared_ptr<ShmRingClient> shmringclient;
+
+    void close_shm_ring();
+
     bool tracker_free;
 
     vector<string> path_vec;
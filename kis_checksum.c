@@ -0,0 +1,267 @@
+/*
+    This file is part of Kismet
+
+    Kismet is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kismet is distributed in the hope that it will be useful,
+      but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Kismet; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "kis_checksum.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define KIS_CRC32C_SSE42
+#include <nmmintrin.h>
+#endif
+
+#if defined(__aarch64__) && defined(__linux__) && defined(__GNUC__)
+#define KIS_CRC32C_ARMV8
+#include <sys/auxv.h>
+#ifndef HWCAP_CRC32
+#define HWCAP_CRC32 (1 << 7)
+#endif
+#endif
+
+#if defined(__SSE2__)
+static uint32_t hsum_epi32(__m128i v) {
+    v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2)));
+    v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(2, 3, 0, 1)));
+    return (uint32_t) _mm_cvtsi128_si32(v);
+}
+
+/* Adler32 over whole 16 byte blocks.  Per block, s1 gains the sum of the bytes
+ * and s2 gains 16 * s1 plus each byte weighted by how many bytes remain in the
+ * block; all the sums wrap at 32 bits exactly as the byte-wise loop does, so
+ * they can be accumulated in lanes and combined at the end. */
+static void adler32_blocks_sse2(const uint8_t *in_buf, size_t in_blocks,
+        uint32_t *s1, uint32_t *s2) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i weight_lo = _mm_set_epi16(9, 10, 11, 12, 13, 14, 15, 16);
+    const __m128i weight_hi = _mm_set_epi16(1, 2, 3, 4, 5, 6, 7, 8);
+
+    /* Sum of all bytes */
+    __m128i v_s1 = zero;
+    /* Sum of v_s1 at the start of each block */
+    __m128i v_prev = zero;
+    /* Weighted byte sums */
+    __m128i v_s2 = zero;
+
+    size_t b;
+
+    for (b = 0; b < in_blocks; b++) {
+        __m128i bytes = _mm_loadu_si128((const __m128i *) (in_buf + b * 16));
+
+        v_prev = _mm_add_epi32(v_prev, v_s1);
+        v_s1 = _mm_add_epi32(v_s1, _mm_sad_epu8(bytes, zero));
+
+        v_s2 = _mm_add_epi32(v_s2,
+                _mm_madd_epi16(_mm_unpacklo_epi8(bytes, zero), weight_lo));
+        v_s2 = _mm_add_epi32(v_s2,
+                _mm_madd_epi16(_mm_unpackhi_epi8(bytes, zero), weight_hi));
+    }
+
+    *s2 += (uint32_t) (in_blocks * 16) * *s1 + 16 * hsum_epi32(v_prev) + hsum_epi32(v_s2);
+    *s1 += hsum_epi32(v_s1);
+}
+#endif
+
+uint32_t kis_adler32_partial(const uint8_t *in_buf, size_t in_len,
+        uint32_t *s1, uint32_t *s2) {
+    size_t i = 0;
+
+    if (in_len < 4)
+        return 0;
+
+#if defined(__SSE2__)
+    if (in_len >= 16) {
+        adler32_blocks_sse2(in_buf, in_len / 16, s1, s2);
+        i = (in_len / 16) * 16;
+    }
+#endif
+
+    for (; i + 4 <= in_len; i += 4) {
+        *s2 += 4 * (*s1 + in_buf[i]) + 3 * in_buf[i + 1] +
+            2 * in_buf[i + 2] + in_buf[i + 3];
+        *s1 += in_buf[i] + in_buf[i + 1] + in_buf[i + 2] + in_buf[i + 3];
+    }
+
+    for (; i < in_len; i++) {
+        *s1 += in_buf[i];
+        *s2 += *s1;
+    }
+
+    return (*s1 & 0xffff) + (*s2 << 16);
+}
+
+uint32_t kis_adler32(const uint8_t *in_buf, size_t in_len) {
+    uint32_t s1 = 0, s2 = 0;
+
+    return kis_adler32_partial(in_buf, in_len, &s1, &s2);
+}
+
+/* Slice-by-8 tables for the reflected Castagnoli polynomial */
+static uint32_t crc32c_table[8][256];
+
+static void crc32c_init_table(void) {
+    uint32_t i, j, crc;
+
+    for (i = 0; i < 256; i++) {
+        crc = i;
+
+        for (j = 0; j < 8; j++)
+            crc = (crc >> 1) ^ (0x82F63B78 & (0 - (crc & 1)));
+
+        crc32c_table[0][i] = crc;
+    }
+
+    for (i = 0; i < 256; i++) {
+        for (j = 1; j < 8; j++) {
+            crc32c_table[j][i] = (crc32c_table[j - 1][i] >> 8) ^
+                crc32c_table[0][crc32c_table[j - 1][i] & 0xFF];
+        }
+    }
+}
+
+static uint32_t crc32c_sw(uint32_t in_crc, const uint8_t *in_buf, size_t in_len) {
+    uint32_t crc = ~in_crc;
+
+    while (in_len >= 8) {
+        crc ^= (uint32_t) in_buf[0] | ((uint32_t) in_buf[1] << 8) |
+            ((uint32_t) in_buf[2] << 16) | ((uint32_t) in_buf[3] << 24);
+
+        crc = crc32c_table[7][crc & 0xFF] ^ crc32c_table[6][(crc >> 8) & 0xFF] ^
+            crc32c_table[5][(crc >> 16) & 0xFF] ^ crc32c_table[4][crc >> 24] ^
+            crc32c_table[3][in_buf[4]] ^ crc32c_table[2][in_buf[5]] ^
+            crc32c_table[1][in_buf[6]] ^ crc32c_table[0][in_buf[7]];
+
+        in_buf += 8;
+        in_len -= 8;
+    }
+
+    while (in_len--)
+        crc = crc32c_table[0][(crc ^ *in_buf++) & 0xFF] ^ (crc >> 8);
+
+    return ~crc;
+}
+
+#ifdef KIS_CRC32C_SSE42
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_sse42(uint32_t in_crc, const uint8_t *in_buf, size_t in_len) {
+    uint32_t crc = ~in_crc;
+
+#ifdef __x86_64__
+    uint64_t crc64 = crc;
+
+    while (in_len >= 8) {
+        uint64_t v;
+        memcpy(&v, in_buf, 8);
+        crc64 = _mm_crc32_u64(crc64, v);
+        in_buf += 8;
+        in_len -= 8;
+    }
+
+    crc = (uint32_t) crc64;
+#endif
+
+    while (in_len >= 4) {
+        uint32_t v;
+        memcpy(&v, in_buf, 4);
+        crc = _mm_crc32_u32(crc, v);
+        in_buf += 4;
+        in_len -= 4;
+    }
+
+    while (in_len--)
+        crc = _mm_crc32_u8(crc, *in_buf++);
+
+    return ~crc;
+}
+#endif
+
+#ifdef KIS_CRC32C_ARMV8
+#ifdef __clang__
+__attribute__((target("crc")))
+#else
+__attribute__((target("+crc")))
+#endif
+static uint32_t crc32c_armv8(uint32_t in_crc, const uint8_t *in_buf, size_t in_len) {
+    uint32_t crc = ~in_crc;
+
+    while (in_len >= 8) {
+        uint64_t v;
+        memcpy(&v, in_buf, 8);
+        __asm__("crc32cx %w0, %w0, %x1" : "+r" (crc) : "r" (v));
+        in_buf += 8;
+        in_len -= 8;
+    }
+
+    while (in_len--) {
+        uint32_t v = *in_buf++;
+        __asm__("crc32cb %w0, %w0, %w1" : "+r" (crc) : "r" (v));
+    }
+
+    return ~crc;
+}
+#endif
+
+typedef uint32_t (*crc32c_func_t)(uint32_t, const uint8_t *, size_t);
+
+static crc32c_func_t crc32c_func = crc32c_sw;
+static const char *crc32c_name = "software";
+static pthread_once_t crc32c_once = PTHREAD_ONCE_INIT;
+
+static void crc32c_select(void) {
+#ifdef KIS_CRC32C_SSE42
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("sse4.2")) {
+        crc32c_func = crc32c_sse42;
+        crc32c_name = "sse4.2";
+        return;
+    }
+#endif
+
+#ifdef KIS_CRC32C_ARMV8
+    if (getauxval(AT_HWCAP) & HWCAP_CRC32) {
+        crc32c_func = crc32c_armv8;
+        crc32c_name = "armv8 crc";
+        return;
+    }
+#endif
+
+    crc32c_init_table();
+}
+
+uint32_t kis_crc32c_partial(uint32_t in_crc, const uint8_t *in_buf, size_t in_len) {
+    pthread_once(&crc32c_once, crc32c_select);
+
+    return (*crc32c_func)(in_crc, in_buf, in_len);
+}
+
+uint32_t kis_crc32c(const uint8_t *in_buf, size_t in_len) {
+    return kis_crc32c_partial(0, in_buf, in_len);
+}
+
+const char *kis_crc32c_impl(void) {
+    pthread_once(&crc32c_once, crc32c_select);
+
+    return crc32c_name;
+}
+
@@ -0,0 +1,63 @@
+/*
+    This file is part of Kismet
+
+    Kismet is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kismet is distributed in the hope that it will be useful,
+      but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Kismet; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/* Checksums shared by the server and the C datasources
+ *
+ * The adler32 here is the Kismet variant (rsync-style sums without the modulo,
+ * and no checksum of buffers under 4 bytes) used by the capture protocol and
+ * throughout the server; the accelerated version produces identical results.
+ *
+ * CRC32C (Castagnoli) uses the SSE4.2 or ARMv8 CRC instructions when the CPU
+ * supports them, selected at runtime, and a table driven version otherwise.
+ */
+
+#ifndef __KIS_CHECKSUM_H__
+#define __KIS_CHECKSUM_H__
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Incremental adler32; s1 and s2 must be preserved between calls over
+ * multiple chunks, and set to 0 before the first call.  Buffers shorter than 4
+ * bytes are not checksummed and return 0.
+ */
+uint32_t kis_adler32_partial(const uint8_t *in_buf, size_t in_len,
+        uint32_t *s1, uint32_t *s2);
+
+uint32_t kis_adler32(const uint8_t *in_buf, size_t in_len);
+
+/* CRC32C; to checksum multiple chunks pass the result of the previous chunk as
+ * in_crc, starting with 0.
+ */
+uint32_t kis_crc32c_partial(uint32_t in_crc, const uint8_t *in_buf, size_t in_len);
+
+uint32_t kis_crc32c(const uint8_t *in_buf, size_t in_len);
+
+/* Name of the CRC32C implementation selected for this CPU */
+const char *kis_crc32c_impl(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
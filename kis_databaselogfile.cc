@@ -45,6 +45,8 @@ KisDatabaseLogfile::KisDatabaseLogfile(GlobalRegistry *in_globalreg):
 
     last_device_log = 0;
 
+    packet_handler_id = -1;
+
     device_stmt = NULL;
     device_pz = NULL;
 
@@ -98,8 +100,10 @@ bool KisDatabaseLogfile::Log_Open(std::string in_path) {
 
 	_MSG("Opened kismetdb log file '" + in_path + "'", MSGFLAG_INFO);
 
-	packetchain->RegisterHandler(&KisDatabaseLogfile::packet_handler, this, 
-            CHAINPOS_LOGGING, -100);
+    packet_handler_id = 
+        packetchain->RegisterBatchHandler([this](const std::vector<kis_packet *>& in_packs) -> int {
+                return log_packets(in_packs);
+            }, CHAINPOS_LOGGING, -100, "kismetdb logger");
 
     db_enabled = true;
     
@@ -144,8 +148,9 @@ void KisDatabaseLogfile::Log_Close() {
 
     std::shared_ptr<Packetchain> packetchain =
         Globalreg::FetchGlobalAs<Packetchain>(globalreg, "PACKETCHAIN");
-    if (packetchain != NULL) 
-        packetchain->RemoveHandler(&KisDatabaseLogfile::packet_handler, CHAINPOS_LOGGING);
+    if (packetchain != NULL && packet_handler_id > 0) 
+        packetchain->RemoveHandler(packet_handler_id, CHAINPOS_LOGGING);
+    packet_handler_id = -1;
 
     {
         local_eol_locker lock(&device_mutex);
@@ -633,6 +638,24 @@ int KisDatabaseLogfile::log_packet(kis_packet *in_pack) {
     if (!db_enabled)
         return 0;
 
+    return insert_packet(in_pack);
+}
+
+int KisDatabaseLogfile::log_packets(const std::vector<kis_packet *>& in_packs) {
+    // Hold the transaction for the whole batch so the commit timer can't split it
+    local_locker lock(&packet_mutex);
+    local_locker translock(&transaction_mutex);
+
+    if (!db_enabled)
+        return 0;
+
+    for (auto p : in_packs)
+        insert_packet(p);
+
+    return 1;
+}
+
+int KisDatabaseLogfile::insert_packet(kis_packet *in_pack) {
     sqlite3_reset(packet_stmt);
 
     std::string phystring;
@@ -899,14 +922,6 @@ int KisDatabaseLogfile::log_snapshot(kis_gps_packinfo *gps, struct timeval tv,
     return 1;
 }
 
-int KisDatabaseLogfile::packet_handler(CHAINCALL_PARMS) {
-    // Extremely basic shim to our built-in logging
-
-    KisDatabaseLogfile *logfile = (KisDatabaseLogfile *) auxdata;
-
-    return logfile->log_packet(in_pack);
-}
-
 void KisDatabaseLogfile::Usage(const char *argv0) {
 
 }
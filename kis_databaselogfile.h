@@ -115,6 +115,9 @@ public:
     // Log a packet
     virtual int log_packet(kis_packet *in_packet);
 
+    // Log a batch of packets under a single lock and transaction
+    virtual int log_packets(const std::vector<kis_packet *>& in_packets);
+
     // Log data that isn't a packet; this is a slightly more clunky API because we 
     // can't derive the data from the simple packet interface.  GPS may be null,
     // and other attributes may be empty, if that data is not available
@@ -186,7 +189,10 @@ protected:
     sqlite3_stmt *snapshot_stmt;
     const char *snapshot_pz;
 
-    static int packet_handler(CHAINCALL_PARMS);
+    // Bind and insert a packet; caller must hold the packet mutex
+    int insert_packet(kis_packet *in_pack);
+
+    int packet_handler_id;
 
     // Keep track of our commit cycles; to avoid thrashing the filesystem with
     // commit state we run a 10 second tranasction commit loop
@@ -18,11 +18,16 @@
 
 #include "config.h"
 
+#include <zlib.h>
+
 #include "kis_datasource.h"
 #include "simple_datasource_proto.h"
+#include "kis_checksum.h"
+#include "kis_shmring.h"
 #include "endian_magic.h"
 #include "configfile.h"
 #include "msgpack_adapter.h"
+#include "msgpuck.h"
 #include "datasourcetracker.h"
 #include "entrytracker.h"
 #include "alertracker.h"
@@ -57,7 +62,24 @@ KisDatasource::KisDatasource(GlobalRegistry *in_globalreg,
     pack_comp_gps = packetchain->RegisterPacketComponent("GPS");
 	pack_comp_datasrc = packetchain->RegisterPacketComponent("KISDATASRC");
 
+    datachunk_pool = packetchain->FetchComponentPool<kis_datachunk>();
+    l1info_pool = packetchain->FetchComponentPool<kis_layer1_packinfo>();
+    gpsinfo_pool = packetchain->FetchComponentPool<kis_gps_packinfo>();
+    datasrc_pool = packetchain->FetchComponentPool<packetchain_comp_datasource>();
+    frame_pool = packetchain->FetchComponentPool<kis_frame_buffer>();
+
     next_cmd_sequence = rand(); 
+    proto_csum_type = KIS_CAP_CSUM_ADLER32;
+    proto_batch_seen = false;
+
+    proto_compress_seen = false;
+    proto_zstream = NULL;
+    proto_zbatches = 0;
+    proto_zcodec_usec = 0;
+    proto_zdelay_usec = 0;
+
+    hop_tune_usec_total = 0;
+    hop_late_usec_total = 0;
 
     error_timer_id = -1;
     ping_timer_id = -1;
@@ -106,6 +128,8 @@ KisDatasource::~KisDatasource() {
 
     ipc_remote.reset();
 
+    reset_proto_compress();
+
     command_ack_map.empty();
 
     // We don't call a normal close here because we can't risk double-free
@@ -277,6 +301,20 @@ void KisDatasource::set_channel_hop_list(std::vector<std::string> in_chans,
             get_source_hop_offset(), in_transaction, in_cb);
 }
 
+void KisDatasource::set_filter(string in_filter, unsigned int in_transaction,
+        configure_callback_t in_cb) {
+    local_locker lock(&source_lock);
+
+    if (!get_source_builder()->get_filter_capable()) {
+        if (in_cb != NULL) {
+            in_cb(in_transaction, false, "Driver not capable of filtering packets");
+        }
+        return;
+    }
+
+    send_command_set_filter(in_filter, in_transaction, in_cb);
+}
+
 void KisDatasource::connect_buffer(shared_ptr<BufferHandlerGeneric> in_ringbuf,
         string in_definition, open_callback_t in_cb) {
     local_locker lock(&source_lock);
@@ -292,6 +330,9 @@ void KisDatasource::connect_buffer(shared_ptr<BufferHandlerGeneric> in_ringbuf,
 
     // Assign the ringbuffer & set us as the wakeup interface
     ringbuf_handler = in_ringbuf;
+    proto_csum_type = KIS_CAP_CSUM_ADLER32;
+    proto_batch_seen = false;
+    reset_proto_compress();
     ringbuf_handler->SetReadBufferInterface(this);
 
     set_int_source_definition(in_definition);
@@ -359,6 +400,184 @@ void KisDatasource::disable_source() {
     error_timer_id = -1;
 }
 
+int KisDatasource::validate_frame_header(simple_cap_proto_t *in_header,
+        uint32_t *ret_frame_sz, uint32_t *ret_data_checksum) {
+    int frame_csum_type;
+    uint32_t header_checksum, calc_checksum;
+
+    if (kis_ntoh32(in_header->signature) == KIS_CAP_SIMPLE_PROTO_SIG) {
+        frame_csum_type = KIS_CAP_CSUM_ADLER32;
+    } else if (kis_ntoh32(in_header->signature) == KIS_CAP_SIMPLE_PROTO_SIG_CRC32C) {
+        frame_csum_type = KIS_CAP_CSUM_CRC32C;
+    } else {
+        _MSG("Kismet data source " + get_source_name() + " got an invalid "
+                "control from on IPC/Network, closing.", MSGFLAG_ERROR);
+        trigger_error("Source got invalid control frame");
+
+        return -1;
+    }
+
+    // Get the frame header checksum and validate it; to validate we need to clear
+    // both the frame and the data checksum fields so remember them both now
+    header_checksum = kis_ntoh32(in_header->header_checksum);
+    *ret_data_checksum = kis_ntoh32(in_header->data_checksum);
+
+    in_header->header_checksum = 0;
+    in_header->data_checksum = 0;
+
+    // Calc the checksum of the header
+    calc_checksum = proto_checksum(frame_csum_type, (const uint8_t *) in_header, 
+            sizeof(simple_cap_proto_t));
+
+    // Compare to the saved checksum
+    if (calc_checksum != header_checksum) {
+        _MSG("Kismet data source " + get_source_name() + " got an invalid hdr " +
+                "checksum on control from IPC/Network, closing.", MSGFLAG_ERROR);
+        trigger_error("Source got invalid control frame");
+
+        return -1;
+    }
+
+    // Get the size of the frame
+    *ret_frame_sz = kis_ntoh32(in_header->packet_sz);
+
+    if (*ret_frame_sz < sizeof(simple_cap_proto_t)) {
+        _MSG("Kismet data source " + get_source_name() + " got an invalid "
+                "frame (frame too short) from IPC/Network, closing.", MSGFLAG_ERROR);
+        trigger_error("Source got invalid control frame");
+
+        return -1;
+    }
+
+    return frame_csum_type;
+}
+
+simple_cap_proto_kv_t *KisDatasource::next_frame_kv(simple_cap_proto_frame_t *in_frame,
+        uint32_t in_frame_sz, size_t *io_offt) {
+    if (in_frame_sz < sizeof(simple_cap_proto_t) + 
+            sizeof(simple_cap_proto_kv_t) + *io_offt)
+        return NULL;
+
+    simple_cap_proto_kv_t *pkv =
+        (simple_cap_proto_kv_t *) &((in_frame->data)[*io_offt]);
+
+    size_t kv_sz = sizeof(simple_cap_proto_kv_h_t) + kis_ntoh32(pkv->header.obj_sz);
+
+    if (in_frame_sz - sizeof(simple_cap_proto_t) - *io_offt < kv_sz)
+        return NULL;
+
+    *io_offt += kv_sz;
+
+    return pkv;
+}
+
+bool KisDatasource::dispatch_frame(kis_frame_buffer *in_framebuf, uint32_t in_frame_sz,
+        int in_csum_type, uint32_t in_data_checksum) {
+    uint8_t *framedata = in_framebuf->data();
+    simple_cap_proto_frame_t *frame = (simple_cap_proto_frame_t *) framedata;
+    uint32_t calc_checksum;
+
+    // Zero the checksum fields in our copy of the frame and calc the checksum
+    // of the rest
+    frame->header.header_checksum = 0;
+    frame->header.data_checksum = 0;
+
+    calc_checksum = proto_checksum(in_csum_type, framedata, in_frame_sz);
+
+    // Compare to the saved checksum
+    if (calc_checksum != in_data_checksum) {
+        _MSG("Kismet data source " + get_source_name() + " got an invalid checksum "
+                "on control from IPC/Network, closing.", MSGFLAG_ERROR);
+        trigger_error("Source got invalid control frame");
+
+        return false;
+    }
+
+    // A helper which signs with CRC32C understands it; answer in kind
+    if (in_csum_type == KIS_CAP_CSUM_CRC32C)
+        proto_csum_type = KIS_CAP_CSUM_CRC32C;
+
+    unsigned int num_kv = kis_ntoh32(frame->header.num_kv_pairs);
+    size_t data_offt = 0;
+    bool kv_valid = true;
+
+    // Data frames are nearly all of the traffic, and only need the keys the core
+    // understands; decode them in place into a key index on the stack instead of
+    // building a map
+    bool data_frame = strncasecmp(frame->header.type, "DATA", 16) == 0;
+    bool batch_frame = strncasecmp(frame->header.type, "DATABATCH", 16) == 0;
+
+    if (data_frame || batch_frame) {
+        KisDatasourceCapKeyedObject kv_store[kis_cap_key_max];
+        KVindex kv_index;
+
+        kv_index.fill(NULL);
+
+        for (unsigned int kvn = 0; kvn < num_kv; kvn++) {
+            simple_cap_proto_kv_t *pkv = next_frame_kv(frame, in_frame_sz, &data_offt);
+
+            if (pkv == NULL) {
+                kv_valid = false;
+                break;
+            }
+
+            kis_cap_key key_id = 
+                kis_cap_key_lookup(pkv->header.key, strnlen(pkv->header.key, 16));
+
+            if (key_id == kis_cap_key_unknown)
+                continue;
+
+            kv_store[key_id].assign(pkv, in_framebuf);
+            kv_index[key_id] = &(kv_store[key_id]);
+        }
+
+        if (kv_valid) {
+            if (data_frame)
+                proto_packet_data(kv_index);
+            else
+                proto_packet_databatch(kv_index);
+        }
+    } else {
+        KVmap kv_map;
+
+        for (unsigned int kvn = 0; kvn < num_kv; kvn++) {
+            simple_cap_proto_kv_t *pkv = next_frame_kv(frame, in_frame_sz, &data_offt);
+
+            if (pkv == NULL) {
+                kv_valid = false;
+                break;
+            }
+
+            KisDatasourceCapKeyedObject *kv =
+                new KisDatasourceCapKeyedObject(pkv, in_framebuf);
+
+            kv_map[StrLower(kv->key)] = kv;
+        }
+
+        if (kv_valid) {
+            char ctype[17];
+            snprintf(ctype, 17, "%s", frame->header.type);
+
+            proto_dispatch_packet(ctype, kv_map);
+        }
+
+        for (auto i = kv_map.begin(); i != kv_map.end(); ++i) {
+            delete i->second;
+        }
+    }
+
+    if (!kv_valid) {
+        _MSG("Kismet data source " + get_source_name() + " got an invalid "
+                "frame (KV too long for frame) from IPC/Network, closing.",
+                MSGFLAG_ERROR);
+        trigger_error("Source got invalid control frame");
+
+        return false;
+    }
+
+    return true;
+}
+
 void KisDatasource::BufferAvailable(size_t in_amt __attribute__((unused))) {
     // Handle reading raw frames off the incoming buffer and validate their
     // framing, then break them into KVMap records and dispatch them.
@@ -366,13 +585,18 @@ void KisDatasource::BufferAvailable(size_t in_amt __attribute__((unused))) {
     // We can survive unknown frame types, but we can't survive invalid ones -
     // if we get an invalid frame, throw an error and drop into the error
     // processing.
+    //
+    // Each complete frame is copied exactly once, out of the ring buffer and
+    // into a pooled frame buffer; the KV records are decoded in place and 
+    // packet data is handed to the packetchain as a slice of the frame buffer,
+    // so a data frame needs no allocations beyond the pooled objects.
     
     local_locker lock(&source_lock);
     
-    simple_cap_proto_frame_t *frame;
+    simple_cap_proto_t header;
     uint8_t *buf = NULL;
     uint32_t frame_sz;
-    uint32_t header_checksum, data_checksum, calc_checksum;
+    uint32_t data_checksum;
 
     // Loop until we drain the buffer
     while (1) {
@@ -384,157 +608,115 @@ void KisDatasource::BufferAvailable(size_t in_amt __attribute__((unused))) {
             return;
         }
 
-        // Allocate as much as we can and peek it from the buffer
-        buffamt = ringbuf_handler->PeekReadBufferData((void **) &buf, buffamt);
-
-        if (buffamt < sizeof(simple_cap_proto_t)) {
-            ringbuf_handler->PeekFreeReadBufferData(buf);
-            return;
-        }
-
-        // fprintf(stderr, "debug - sig %x header %u data %u sequence %u\n", frame->header.signature, kis_ntoh32(frame->header.header_checksum), kis_ntoh32(frame->header.data_checksum), kis_ntoh32(frame->header.sequence_number));
-
+        // Peek just the header; we validate a local copy of it so we never 
+        // modify the ring buffer.  A zero-copy peek gets the whole header unless
+        // it straddles the end of the ring, which is the only time we need a
+        // copying peek
+        ssize_t hdr_amt = 
+            ringbuf_handler->ZeroCopyPeekReadBufferData((void **) &buf, 
+                    sizeof(simple_cap_proto_t));
 
-        // Turn it into a frame header
-        frame = (simple_cap_proto_frame_t *) buf;
-
-        if (kis_ntoh32(frame->header.signature) != KIS_CAP_SIMPLE_PROTO_SIG) {
+        if (hdr_amt < (ssize_t) sizeof(simple_cap_proto_t)) {
             ringbuf_handler->PeekFreeReadBufferData(buf);
 
-            _MSG("Kismet data source " + get_source_name() + " got an invalid "
-                    "control from on IPC/Network, closing.", MSGFLAG_ERROR);
-            trigger_error("Source got invalid control frame");
-
-            return;
+            if (ringbuf_handler->PeekReadBufferData((void **) &buf, 
+                        sizeof(simple_cap_proto_t)) < (ssize_t) sizeof(simple_cap_proto_t)) {
+                ringbuf_handler->PeekFreeReadBufferData(buf);
+                return;
+            }
         }
 
-        // Get the frame header checksum and validate it; to validate we need to clear
-        // both the frame and the data checksum fields so remember them both now
-        header_checksum = kis_ntoh32(frame->header.header_checksum);
-        data_checksum = kis_ntoh32(frame->header.data_checksum);
-
-        // fprintf(stderr, "debug - sig %x header %u data %u sequence %u\n", frame->header.signature, header_checksum, data_checksum, kis_ntoh32(frame->header.sequence_number));
-
-        // Zero the checksum field in the packet
-        frame->header.header_checksum = 0;
-        frame->header.data_checksum = 0;
-
-        // Calc the checksum of the header
-        calc_checksum = Adler32Checksum((const char *) frame, 
-                sizeof(simple_cap_proto_t));
-
-        // fprintf(stderr, "debug - frame type... %s len %u?\n", string(frame->header.type, 16).c_str(), kis_ntoh32(frame->header.packet_sz));
-
-        // Compare to the saved checksum
-        if (calc_checksum != header_checksum) {
-            // Restore the headers in case
-            frame->header.header_checksum = kis_hton32(header_checksum);
-            frame->header.data_checksum = kis_hton32(data_checksum);
-
-            ringbuf_handler->PeekFreeReadBufferData(buf);
+        memcpy(&header, buf, sizeof(simple_cap_proto_t));
+        ringbuf_handler->PeekFreeReadBufferData(buf);
 
-#if 0
-            fprintf(stderr, "debug - calc %X header %X\n", calc_checksum, header_checksum);
+        int frame_csum_type = validate_frame_header(&header, &frame_sz, &data_checksum);
 
-            for (unsigned int x = 0; x < 100; x++) {
-                fprintf(stderr, "%02X ", ((uint8_t *) frame)[x] & 0xFF);
-            }
-            fprintf(stderr, "\n");
-#endif
-
-            _MSG("Kismet data source " + get_source_name() + " got an invalid hdr " +
-                    "checksum on control from IPC/Network, closing.", MSGFLAG_ERROR);
-            trigger_error("Source got invalid control frame");
+        if (frame_csum_type < 0)
+            return;
 
+        // Nothing we can do right now, not enough data to make up a complete 
+        // packet.
+        if (frame_sz > buffamt) 
             return;
-        }
 
-        // Get the size of the frame
-        frame_sz = kis_ntoh32(frame->header.packet_sz);
+        // Pull the whole frame out of the ring buffer in at most two zero-copy
+        // pieces, consuming it as we go
+        kis_frame_buffer *framebuf = frame_pool->acquire();
+        framebuf->ref();
 
-        // fprintf(stderr, "debug - got frame sz %u\n", frame_sz);
+        uint8_t *framedata = framebuf->reserve(frame_sz);
+        size_t copied = 0;
 
-        if (frame_sz > buffamt) {
-            // fprintf(stderr, "debug - got frame sz %u too big for current buffer %lu\n", frame_sz, buffamt);
-            // Restore the headers in case
-            frame->header.header_checksum = kis_hton32(header_checksum);
-            frame->header.data_checksum = kis_hton32(data_checksum);
+        while (copied < frame_sz) {
+            ssize_t zamt = 
+                ringbuf_handler->ZeroCopyPeekReadBufferData((void **) &buf, 
+                        frame_sz - copied);
 
-#if 0
-            for (unsigned int x = 0; x < buffamt; x++) {
-                fprintf(stderr, "%02X ", buf[x] & 0xFF);
+            if (zamt <= 0) {
+                ringbuf_handler->PeekFreeReadBufferData(buf);
+                break;
             }
-            fprintf(stderr, "\n");
-#endif
 
-            // Nothing we can do right now, not enough data to 
-            // make up a complete packet.
+            memcpy(framedata + copied, buf, zamt);
             ringbuf_handler->PeekFreeReadBufferData(buf);
-            return;
-        }
-
-        // Calc the checksum of the rest
-        calc_checksum = Adler32Checksum((const char *) buf, frame_sz);
+            ringbuf_handler->ConsumeReadBufferData(zamt);
 
-        // Compare to the saved checksum
-        if (calc_checksum != data_checksum) {
-            ringbuf_handler->PeekFreeReadBufferData(buf);
+            copied += zamt;
+        }
 
-            _MSG("Kismet data source " + get_source_name() + " got an invalid checksum "
-                    "on control from IPC/Network, closing.", MSGFLAG_ERROR);
-            trigger_error("Source got invalid control frame");
+        if (copied != frame_sz) {
+            framebuf->unref();
 
+            trigger_error("Source lost data while reading frame");
             return;
         }
 
-        // Extract the kv pairs
-        KVmap kv_map;
+        bool frame_ok = dispatch_frame(framebuf, frame_sz, frame_csum_type, data_checksum);
 
-        size_t data_offt = 0;
-        for (unsigned int kvn = 0; 
-                kvn < kis_ntoh32(frame->header.num_kv_pairs); kvn++) {
+        // Anything which still needs the frame holds its own reference
+        framebuf->unref();
 
-            if (frame_sz < sizeof(simple_cap_proto_t) + 
-                    sizeof(simple_cap_proto_kv_t) + data_offt) {
+        if (!frame_ok)
+            return;
+    }
+}
 
-                // Consume the packet in the ringbuf 
-                ringbuf_handler->PeekFreeReadBufferData(buf);
-                ringbuf_handler->ConsumeReadBufferData(frame_sz);
+void KisDatasource::handle_shm_frame(const uint8_t *in_data, size_t in_len) {
+    // Frames from the shared memory ring are already complete; they get the
+    // same validation as frames from the pipe, and are copied once into a
+    // pooled frame buffer so the ring space is released as soon as we return
+    
+    local_locker lock(&source_lock);
 
-                _MSG("Kismet data source " + get_source_name() + " got an invalid "
-                        "frame (KV too long for frame) from IPC/Network, closing.",
-                        MSGFLAG_ERROR);
-                trigger_error("Source got invalid control frame");
+    simple_cap_proto_t header;
+    uint32_t frame_sz;
+    uint32_t data_checksum;
 
-                return;
-            }
+    if (in_len < sizeof(simple_cap_proto_t)) {
+        trigger_error("Source got invalid frame on shared memory ring");
+        return;
+    }
 
-            simple_cap_proto_kv_t *pkv =
-                (simple_cap_proto_kv_t *) &((frame->data)[data_offt]);
+    memcpy(&header, in_data, sizeof(simple_cap_proto_t));
 
-            data_offt += 
-                sizeof(simple_cap_proto_kv_h_t) +
-                kis_ntoh32(pkv->header.obj_sz);
+    int frame_csum_type = validate_frame_header(&header, &frame_sz, &data_checksum);
 
-            KisDatasourceCapKeyedObject *kv =
-                new KisDatasourceCapKeyedObject(pkv);
+    if (frame_csum_type < 0)
+        return;
 
-            kv_map[StrLower(kv->key)] = kv;
-        }
+    if (frame_sz != in_len) {
+        trigger_error("Source got invalid frame on shared memory ring");
+        return;
+    }
 
-        char ctype[17];
-        snprintf(ctype, 17, "%s", frame->header.type);
+    kis_frame_buffer *framebuf = frame_pool->acquire();
+    framebuf->ref();
 
-        proto_dispatch_packet(ctype, kv_map);
+    memcpy(framebuf->reserve(frame_sz), in_data, frame_sz);
 
-        for (auto i = kv_map.begin(); i != kv_map.end(); ++i) {
-            delete i->second;
-        }
+    dispatch_frame(framebuf, frame_sz, frame_csum_type, data_checksum);
 
-        // Consume the packet in the ringbuf 
-        ringbuf_handler->PeekFreeReadBufferData(buf);
-        ringbuf_handler->ConsumeReadBufferData(frame_sz);
-    }
+    framebuf->unref();
 }
 
 void KisDatasource::BufferError(string in_error) {
@@ -654,6 +836,52 @@ bool KisDatasource::parse_interface_definition(string in_definition) {
 
     clobber_timestamp = get_definition_opt_bool("timestamp", 
             datasourcetracker->get_config_defaults()->get_remote_cap_timestamp());
+
+    // The filter= option is pushed once the source is open, and only reported
+    // once the helper has accepted it
+    set_int_source_filter("");
+
+    // Compressed batches are only offered to remote sources, which may be on
+    // a slow link; local helpers use the pipe or the shared memory ring
+    proto_compress_offer = "";
+
+    auto defaults = datasourcetracker->get_config_defaults();
+
+    if (get_definition_opt_bool("compress", defaults->get_remote_cap_compress())) {
+        unsigned int level = defaults->get_remote_cap_compress_level();
+        unsigned int window = defaults->get_remote_cap_compress_window();
+        std::string opt;
+
+        if ((opt = get_definition_opt("compress_level")) != "" &&
+                (sscanf(opt.c_str(), "%u", &level) != 1 || level < 1 || level > 9)) {
+            _MSG("Invalid compress_level for data source " + get_source_name() + 
+                    ", expected 1-9", MSGFLAG_ERROR);
+            return false;
+        }
+
+        if ((opt = get_definition_opt("compress_window")) != "" &&
+                sscanf(opt.c_str(), "%u", &window) != 1) {
+            _MSG("Invalid compress_window for data source " + get_source_name() + 
+                    ", expected a number of milliseconds", MSGFLAG_ERROR);
+            return false;
+        }
+
+        stringstream stream;
+        msgpack::packer<std::stringstream> packer(&stream);
+
+        packer.pack_map(3);
+
+        packer.pack(string("method"));
+        packer.pack(string(KIS_CAP_COMPRESS_ZLIB_NAME));
+
+        packer.pack(string("level"));
+        packer.pack((uint32_t) level);
+
+        packer.pack(string("window"));
+        packer.pack((uint32_t) window * 1000);
+
+        proto_compress_offer = stream.str();
+    }
    
     return true;
 }
@@ -747,6 +975,10 @@ void KisDatasource::proto_dispatch_packet(string in_type, KVmap in_kvmap) {
         // fprintf(stderr, "debug - ping - got pong %lu\n", last_pong);
     } else if (ltype == "data") {
         proto_packet_data(in_kvmap);
+    } else if (ltype == "databatch") {
+        proto_packet_databatch(in_kvmap);
+    } else if (ltype == "stats") {
+        proto_packet_stats(in_kvmap);
     }
 
     // We don't care about types we don't understand
@@ -902,6 +1134,23 @@ void KisDatasource::proto_packet_open_resp(KVmap in_kvpairs) {
             return 1;
         });
     }
+
+    // Push the capture filter down to the helper now that it's capturing
+    std::string filter = get_definition_opt("filter");
+
+    if (filter.length() != 0 && !get_source_builder()->get_filter_capable()) {
+        _MSG("Source " + get_source_name() + " does not support capture filters "
+                "and will receive all packets", MSGFLAG_ERROR);
+    } else if (filter.length() != 0) {
+        send_command_set_filter(filter, 0, 
+                [this, filter](unsigned int, bool success, std::string reason) {
+                    if (!success) {
+                        _MSG("Source " + get_source_name() + " could not set capture "
+                                "filter '" + filter + "' and will receive all packets: " + 
+                                reason, MSGFLAG_ERROR);
+                    }
+                });
+    }
 }
 
 void KisDatasource::proto_packet_list_resp(KVmap in_kvpairs) {
@@ -992,21 +1241,40 @@ void KisDatasource::proto_packet_configresp(KVmap in_kvpairs) {
 
     // Get the sequence number and look up our command
     uint32_t seq = get_kv_success_sequence(i->second);
+    bool failure_is_error = true;
     auto ci = command_ack_map.find(seq);
     if (ci != command_ack_map.end()) {
         // fprintf(stderr, "debug - erasing command ack from configure %u\n", seq);
         if (ci->second->configure_cb != NULL)
             ci->second->configure_cb(seq, get_kv_success(i->second), msg);
+        failure_is_error = ci->second->failure_is_error;
         command_ack_map.erase(ci);
     }
 
-    if (!get_kv_success(i->second)) {
+    if (!get_kv_success(i->second) && failure_is_error) {
         trigger_error(msg);
         set_int_source_error_reason(msg);
     }
 }
 
+KisDatasource::KVindex KisDatasource::index_kvmap(KVmap& in_kvmap) {
+    KVindex kv_index;
+
+    kv_index.fill(NULL);
+
+    for (auto& i : in_kvmap) {
+        if (i.second->key_id != kis_cap_key_unknown)
+            kv_index[i.second->key_id] = i.second;
+    }
+
+    return kv_index;
+}
+
 void KisDatasource::proto_packet_data(KVmap in_kvpairs) {
+    proto_packet_data(index_kvmap(in_kvpairs));
+}
+
+void KisDatasource::proto_packet_data(const KVindex& in_kvindex) {
     // If we're paused, do nothing
     {
         local_locker lock(&source_lock);
@@ -1015,24 +1283,22 @@ void KisDatasource::proto_packet_data(KVmap in_kvpairs) {
             return;
     }
 
-    KVmap::iterator i;
-
     kis_packet *packet = NULL;
     kis_layer1_packinfo *siginfo = NULL;
     kis_gps_packinfo *gpsinfo = NULL;
 
     // Process any messages
-    if ((i = in_kvpairs.find("message")) != in_kvpairs.end()) {
-        handle_kv_message(i->second);
+    if (in_kvindex[kis_cap_key_message] != NULL) {
+        handle_kv_message(in_kvindex[kis_cap_key_message]);
     }
 
-    if ((i = in_kvpairs.find("warning")) != in_kvpairs.end()) {
-        handle_kv_warning(i->second);
+    if (in_kvindex[kis_cap_key_warning] != NULL) {
+        handle_kv_warning(in_kvindex[kis_cap_key_warning]);
     }
 
     // Do we have a packet?
-    if ((i = in_kvpairs.find("packet")) != in_kvpairs.end()) {
-        packet = handle_kv_packet(i->second);
+    if (in_kvindex[kis_cap_key_packet] != NULL) {
+        packet = handle_kv_packet(in_kvindex[kis_cap_key_packet]);
     }
 
     if (packet == NULL) {
@@ -1040,13 +1306,13 @@ void KisDatasource::proto_packet_data(KVmap in_kvpairs) {
     }
 
     // Gather signal data
-    if ((i = in_kvpairs.find("signal")) != in_kvpairs.end()) {
-        siginfo = handle_kv_signal(i->second);
+    if (in_kvindex[kis_cap_key_signal] != NULL) {
+        siginfo = handle_kv_signal(in_kvindex[kis_cap_key_signal]);
     }
     
     // Gather GPS data
-    if ((i = in_kvpairs.find("gps")) != in_kvpairs.end()) {
-        gpsinfo = handle_kv_gps(i->second);
+    if (in_kvindex[kis_cap_key_gps] != NULL) {
+        gpsinfo = handle_kv_gps(in_kvindex[kis_cap_key_gps]);
     }
 
     // Add them to the packet
@@ -1058,7 +1324,7 @@ void KisDatasource::proto_packet_data(KVmap in_kvpairs) {
         packet->insert(pack_comp_gps, gpsinfo);
     }
 
-    packetchain_comp_datasource *datasrcinfo = new packetchain_comp_datasource();
+    packetchain_comp_datasource *datasrcinfo = datasrc_pool->acquire();
     datasrcinfo->ref_source = this;
 
     packet->insert(pack_comp_datasrc, datasrcinfo);
@@ -1071,6 +1337,184 @@ void KisDatasource::proto_packet_data(KVmap in_kvpairs) {
 
 }
 
+void KisDatasource::proto_packet_databatch(KVmap in_kvpairs) {
+    proto_packet_databatch(index_kvmap(in_kvpairs));
+}
+
+void KisDatasource::proto_packet_databatch(const KVindex& in_kvindex) {
+    // The helper understands batches, stop offering them
+    proto_batch_seen = true;
+
+    KisDatasourceCapKeyedObject *batch = in_kvindex[kis_cap_key_packets];
+    KisDatasourceCapKeyedObject *zbatch = in_kvindex[kis_cap_key_zpackets];
+
+    const uint8_t *data;
+    size_t data_sz;
+    kis_frame_buffer *frame;
+
+    if (batch != NULL) {
+        data = (const uint8_t *) batch->object;
+        data_sz = batch->size;
+        frame = batch->frame;
+    } else if (zbatch != NULL) {
+        // The helper has taken the compression offer
+        proto_compress_seen = true;
+
+        ssize_t zlen = inflate_batch(zbatch);
+
+        if (zlen < 0)
+            return;
+
+        // Inflated records are copied out of the shared inflate buffer
+        data = proto_zbuf.data();
+        data_sz = (size_t) zlen;
+        frame = NULL;
+    } else {
+        return;
+    }
+
+    // If we're paused, do nothing; compressed batches are still inflated above
+    // to keep the stream in step with the helper
+    {
+        local_locker lock(&source_lock);
+
+        if (get_source_paused())
+            return;
+    }
+
+    size_t offt = 0;
+    unsigned int num_packets = 0;
+
+    while (offt < data_sz) {
+        if (data_sz - offt < sizeof(simple_cap_proto_batch_pkt_t)) {
+            trigger_error("truncated packet record in batch");
+            break;
+        }
+
+        const simple_cap_proto_batch_pkt_t *rec = 
+            (const simple_cap_proto_batch_pkt_t *) (data + offt);
+
+        uint32_t record_sz = kis_ntoh32(rec->record_sz);
+        uint32_t flags = kis_ntoh32(rec->flags);
+        uint32_t caplen = kis_ntoh32(rec->caplen);
+
+        size_t needed = sizeof(simple_cap_proto_batch_pkt_t) + caplen;
+
+        if (flags & KIS_CAP_BATCH_SIGNAL_MASK)
+            needed += sizeof(simple_cap_proto_batch_signal_t);
+
+        if (flags & KIS_CAP_BATCH_GPS)
+            needed += sizeof(simple_cap_proto_batch_gps_t);
+
+        if (record_sz < needed || record_sz > data_sz - offt) {
+            trigger_error("invalid packet record in batch");
+            break;
+        }
+
+        const uint8_t *pos = rec->data;
+
+        kis_packet *packet = packetchain->GeneratePacket();
+
+        if (clobber_timestamp && get_source_remote()) {
+            gettimeofday(&(packet->ts), NULL);
+        } else {
+            packet->ts.tv_sec = (time_t) kis_ntoh64(rec->tv_sec);
+            packet->ts.tv_usec = kis_ntoh32(rec->tv_usec);
+        }
+
+        if (flags & KIS_CAP_BATCH_SIGNAL_MASK) {
+            const simple_cap_proto_batch_signal_t *sig =
+                (const simple_cap_proto_batch_signal_t *) pos;
+            kis_layer1_packinfo *siginfo = l1info_pool->acquire();
+
+            if (flags & KIS_CAP_BATCH_SIGNAL_DBM) {
+                siginfo->signal_type = kis_l1_signal_type_dbm;
+                siginfo->signal_dbm = (int32_t) kis_ntoh32(sig->signal_dbm);
+            }
+
+            if (flags & KIS_CAP_BATCH_NOISE_DBM) {
+                siginfo->signal_type = kis_l1_signal_type_dbm;
+                siginfo->noise_dbm = (int32_t) kis_ntoh32(sig->noise_dbm);
+            }
+
+            if (flags & KIS_CAP_BATCH_SIGNAL_RSSI) {
+                siginfo->signal_type = kis_l1_signal_type_rssi;
+                siginfo->signal_rssi = (int32_t) kis_ntoh32(sig->signal_rssi);
+            }
+
+            if (flags & KIS_CAP_BATCH_NOISE_RSSI) {
+                siginfo->signal_type = kis_l1_signal_type_rssi;
+                siginfo->noise_rssi = (int32_t) kis_ntoh32(sig->noise_rssi);
+            }
+
+            if (flags & KIS_CAP_BATCH_FREQ)
+                siginfo->freq_khz = kis_ntoh32(sig->freq_khz);
+
+            if (flags & KIS_CAP_BATCH_DATARATE)
+                siginfo->datarate = kis_ntoh32(sig->datarate) / 1000.0;
+
+            packet->insert(pack_comp_l1info, siginfo);
+
+            pos += sizeof(simple_cap_proto_batch_signal_t);
+        }
+
+        if (flags & KIS_CAP_BATCH_GPS) {
+            const simple_cap_proto_batch_gps_t *gps =
+                (const simple_cap_proto_batch_gps_t *) pos;
+            kis_gps_packinfo *gpsinfo = gpsinfo_pool->acquire();
+
+            gpsinfo->lat = (int32_t) kis_ntoh32(gps->lat) / 10000000.0;
+            gpsinfo->lon = (int32_t) kis_ntoh32(gps->lon) / 10000000.0;
+            gpsinfo->alt = (int32_t) kis_ntoh32(gps->alt) / 1000.0;
+            gpsinfo->speed = kis_ntoh32(gps->speed) / 1000.0;
+            gpsinfo->heading = kis_ntoh32(gps->heading) / 1000.0;
+            gpsinfo->precision = kis_ntoh32(gps->precision) / 1000.0;
+            gpsinfo->fix = (int32_t) kis_ntoh32(gps->fix);
+            gpsinfo->tv.tv_sec = (time_t) kis_ntoh64(gps->time);
+            gpsinfo->tv.tv_usec = 0;
+
+            packet->insert(pack_comp_gps, gpsinfo);
+
+            pos += sizeof(simple_cap_proto_batch_gps_t);
+        }
+
+        // Packet data stays in the frame buffer when we have one
+        kis_datachunk *datachunk = datachunk_pool->acquire();
+
+        if (frame != NULL)
+            datachunk->set_slice(frame, (uint8_t *) pos, caplen);
+        else
+            datachunk->copy_data(pos, caplen);
+
+        datachunk->dlt = get_source_dlt();
+
+        packet->insert(pack_comp_linkframe, datachunk);
+
+        packetchain_comp_datasource *datasrcinfo = datasrc_pool->acquire();
+        datasrcinfo->ref_source = this;
+
+        packet->insert(pack_comp_datasrc, datasrcinfo);
+
+        packetchain->ProcessPacket(packet);
+
+        num_packets++;
+        offt += record_sz;
+    }
+
+    if (num_packets != 0) {
+        inc_source_num_packets(num_packets);
+        get_source_packet_rrd()->add_sample(num_packets, time(0));
+    }
+}
+
+void KisDatasource::proto_packet_stats(KVmap in_kvpairs) {
+    KVmap::iterator i;
+
+    if ((i = in_kvpairs.find("capstats")) != in_kvpairs.end()) {
+        handle_kv_capstats(i->second);
+    }
+}
+
 bool KisDatasource::get_kv_success(KisDatasourceCapKeyedObject *in_obj) {
     if (in_obj->size != sizeof(simple_cap_proto_success_value)) {
         return false;
@@ -1081,6 +1525,14 @@ bool KisDatasource::get_kv_success(KisDatasourceCapKeyedObject *in_obj) {
     return status->success;
 }
 
+uint32_t KisDatasource::proto_checksum(int in_csum_type, const uint8_t *in_data,
+        size_t in_len) {
+    if (in_csum_type == KIS_CAP_CSUM_CRC32C)
+        return kis_crc32c(in_data, in_len);
+
+    return kis_adler32(in_data, in_len);
+}
+
 uint32_t KisDatasource::get_kv_success_sequence(KisDatasourceCapKeyedObject *in_obj) {
     if (in_obj->size != sizeof(simple_cap_proto_success_value)) {
         return 0;
@@ -1181,61 +1633,133 @@ void KisDatasource::handle_kv_channels(KisDatasourceCapKeyedObject *in_obj) {
     return;
 }
 
-kis_layer1_packinfo *KisDatasource::handle_kv_signal(KisDatasourceCapKeyedObject *in_obj) {
-    // Extract l1 info from a KV pair so we can add it to a packet
-    
-    kis_layer1_packinfo *siginfo = new kis_layer1_packinfo();
+// The per-packet KVs are decoded in place with msgpuck instead of unpacking them
+// into a msgpack zone and a string map, so they cost no allocations
 
-    // Unpack the dictionary
-    MsgpackAdapter::MsgpackStrMap dict;
-    msgpack::unpacked result;
-    MsgpackAdapter::MsgpackStrMap::iterator obj_iter;
+// Walk a msgpack map with string keys, calling in_fn(key, key_len, value) with a 
+// pointer to each encoded value; returns false if the object isn't a valid map or
+// in_fn rejects a value
+template<typename F>
+static bool kv_walk_msgpack_map(const char *in_data, size_t in_sz, F in_fn) {
+    const char *pos = in_data;
 
-    try {
-        msgpack::unpack(result, in_obj->object, in_obj->size);
-        msgpack::object deserialized = result.get();
-        dict = deserialized.as<MsgpackAdapter::MsgpackStrMap>();
+    // Check the whole object up front so decoding can't run off the end
+    if (in_sz == 0 || mp_check(&pos, in_data + in_sz) != 0)
+        return false;
 
-        if ((obj_iter = dict.find("signal_dbm")) != dict.end()) {
-            siginfo->signal_type = kis_l1_signal_type_dbm;
-            siginfo->signal_dbm = obj_iter->second.as<int32_t>();
-        }
+    pos = in_data;
 
-        if ((obj_iter = dict.find("noise_dbm")) != dict.end()) {
-            siginfo->signal_type = kis_l1_signal_type_dbm;
-            siginfo->noise_dbm = obj_iter->second.as<int32_t>();
-        }
+    if (mp_typeof(*pos) != MP_MAP)
+        return false;
 
-        if ((obj_iter = dict.find("signal_rssi")) != dict.end()) {
-            siginfo->signal_type = kis_l1_signal_type_rssi;
-            siginfo->signal_rssi = obj_iter->second.as<int32_t>();
-        }
+    uint32_t num_entries = mp_decode_map(&pos);
 
-        if ((obj_iter = dict.find("noise_rssi")) != dict.end()) {
-            siginfo->signal_type = kis_l1_signal_type_rssi;
-            siginfo->noise_rssi = obj_iter->second.as<int32_t>();
-        }
+    for (uint32_t e = 0; e < num_entries; e++) {
+        if (mp_typeof(*pos) != MP_STR)
+            return false;
 
-        if ((obj_iter = dict.find("freq_khz")) != dict.end()) {
-            siginfo->freq_khz = obj_iter->second.as<double>();
-        }
+        uint32_t key_len;
+        const char *key = mp_decode_str(&pos, &key_len);
 
-        if ((obj_iter = dict.find("channel")) != dict.end()) {
-            siginfo->channel = obj_iter->second.as<string>();
-        }
+        if (!in_fn(key, key_len, pos))
+            return false;
 
-        if ((obj_iter = dict.find("datarate")) != dict.end()) {
-            siginfo->datarate = obj_iter->second.as<double>();
-        }
+        mp_next(&pos);
+    }
 
-    } catch (const std::exception& e) {
-        delete(siginfo);
+    return true;
+}
 
-        // Something went wrong with msgpack unpacking
-        stringstream ss;
-        ss << "failed to unpack gps bundle: " << e.what();
+static bool kv_key_is(const char *in_key, uint32_t in_len, const char *in_match) {
+    return strlen(in_match) == in_len && memcmp(in_key, in_match, in_len) == 0;
+}
 
-        trigger_error(ss.str());
+static bool kv_msgpack_uint(const char *in_val, uint64_t *ret_val) {
+    if (mp_typeof(*in_val) != MP_UINT)
+        return false;
+
+    *ret_val = mp_decode_uint(&in_val);
+    return true;
+}
+
+static bool kv_msgpack_int(const char *in_val, int64_t *ret_val) {
+    if (mp_typeof(*in_val) == MP_UINT)
+        *ret_val = (int64_t) mp_decode_uint(&in_val);
+    else if (mp_typeof(*in_val) == MP_INT)
+        *ret_val = mp_decode_int(&in_val);
+    else
+        return false;
+
+    return true;
+}
+
+static bool kv_msgpack_double(const char *in_val, double *ret_val) {
+    switch (mp_typeof(*in_val)) {
+        case MP_UINT:
+            *ret_val = mp_decode_uint(&in_val);
+            return true;
+        case MP_INT:
+            *ret_val = mp_decode_int(&in_val);
+            return true;
+        case MP_FLOAT:
+            *ret_val = mp_decode_float(&in_val);
+            return true;
+        case MP_DOUBLE:
+            *ret_val = mp_decode_double(&in_val);
+            return true;
+        default:
+            return false;
+    }
+}
+
+kis_layer1_packinfo *KisDatasource::handle_kv_signal(KisDatasourceCapKeyedObject *in_obj) {
+    // Extract l1 info from a KV pair so we can add it to a packet
+    
+    kis_layer1_packinfo *siginfo = l1info_pool->acquire();
+
+    bool valid = kv_walk_msgpack_map(in_obj->object, in_obj->size,
+            [siginfo](const char *key, uint32_t key_len, const char *val) -> bool {
+                int64_t ival;
+
+                if (kv_key_is(key, key_len, "signal_dbm")) {
+                    if (!kv_msgpack_int(val, &ival))
+                        return false;
+                    siginfo->signal_type = kis_l1_signal_type_dbm;
+                    siginfo->signal_dbm = (int32_t) ival;
+                } else if (kv_key_is(key, key_len, "noise_dbm")) {
+                    if (!kv_msgpack_int(val, &ival))
+                        return false;
+                    siginfo->signal_type = kis_l1_signal_type_dbm;
+                    siginfo->noise_dbm = (int32_t) ival;
+                } else if (kv_key_is(key, key_len, "signal_rssi")) {
+                    if (!kv_msgpack_int(val, &ival))
+                        return false;
+                    siginfo->signal_type = kis_l1_signal_type_rssi;
+                    siginfo->signal_rssi = (int32_t) ival;
+                } else if (kv_key_is(key, key_len, "noise_rssi")) {
+                    if (!kv_msgpack_int(val, &ival))
+                        return false;
+                    siginfo->signal_type = kis_l1_signal_type_rssi;
+                    siginfo->noise_rssi = (int32_t) ival;
+                } else if (kv_key_is(key, key_len, "freq_khz")) {
+                    return kv_msgpack_double(val, &(siginfo->freq_khz));
+                } else if (kv_key_is(key, key_len, "channel")) {
+                    if (mp_typeof(*val) != MP_STR)
+                        return false;
+
+                    uint32_t chan_len;
+                    const char *chan = mp_decode_str(&val, &chan_len);
+                    siginfo->channel.assign(chan, chan_len);
+                } else if (kv_key_is(key, key_len, "datarate")) {
+                    return kv_msgpack_double(val, &(siginfo->datarate));
+                }
+
+                return true;
+            });
+
+    if (!valid) {
+        l1info_pool->recycle(siginfo);
+        trigger_error("failed to unpack signal bundle");
         return NULL;
     }
 
@@ -1244,141 +1768,234 @@ kis_layer1_packinfo *KisDatasource::handle_kv_signal(KisDatasourceCapKeyedObject
 
 kis_gps_packinfo *KisDatasource::handle_kv_gps(KisDatasourceCapKeyedObject *in_obj) {
     // Extract a GPS record from a packet and turn it into a packinfo gps log
-    kis_gps_packinfo *gpsinfo = new kis_gps_packinfo();
+    kis_gps_packinfo *gpsinfo = gpsinfo_pool->acquire();
+
+    bool valid = kv_walk_msgpack_map(in_obj->object, in_obj->size,
+            [gpsinfo](const char *key, uint32_t key_len, const char *val) -> bool {
+                if (kv_key_is(key, key_len, "lat")) {
+                    return kv_msgpack_double(val, &(gpsinfo->lat));
+                } else if (kv_key_is(key, key_len, "lon")) {
+                    return kv_msgpack_double(val, &(gpsinfo->lon));
+                } else if (kv_key_is(key, key_len, "alt")) {
+                    return kv_msgpack_double(val, &(gpsinfo->alt));
+                } else if (kv_key_is(key, key_len, "speed")) {
+                    return kv_msgpack_double(val, &(gpsinfo->speed));
+                } else if (kv_key_is(key, key_len, "heading")) {
+                    return kv_msgpack_double(val, &(gpsinfo->heading));
+                } else if (kv_key_is(key, key_len, "precision")) {
+                    return kv_msgpack_double(val, &(gpsinfo->precision));
+                } else if (kv_key_is(key, key_len, "fix")) {
+                    int64_t fix;
+                    if (!kv_msgpack_int(val, &fix))
+                        return false;
+                    gpsinfo->fix = (int) fix;
+                } else if (kv_key_is(key, key_len, "time")) {
+                    uint64_t t;
+                    if (!kv_msgpack_uint(val, &t))
+                        return false;
+                    gpsinfo->tv.tv_sec = (time_t) t;
+                    gpsinfo->tv.tv_usec = 0;
+                }
 
-    // Unpack the dictionary
-    MsgpackAdapter::MsgpackStrMap dict;
-    msgpack::unpacked result;
-    MsgpackAdapter::MsgpackStrMap::iterator obj_iter;
+                return true;
+            });
 
-    try {
-        msgpack::unpack(result, in_obj->object, in_obj->size);
-        msgpack::object deserialized = result.get();
-        dict = deserialized.as<MsgpackAdapter::MsgpackStrMap>();
+    if (!valid) {
+        gpsinfo_pool->recycle(gpsinfo);
+        trigger_error("failed to unpack gps bundle");
+        return NULL;
+    }
 
-        if ((obj_iter = dict.find("lat")) != dict.end()) {
-            gpsinfo->lat = obj_iter->second.as<double>();
-        }
+    return gpsinfo;
+}
 
-        if ((obj_iter = dict.find("lon")) != dict.end()) {
-            gpsinfo->lon = obj_iter->second.as<double>();
-        }
+void KisDatasource::handle_kv_capstats(KisDatasourceCapKeyedObject *in_obj) {
+    // Drops and channel hop timing since the previous report
+    uint64_t drops = 0;
+    uint64_t hops = 0, tune_usec = 0, tune_max_usec = 0, late_usec = 0;
+
+    bool valid = kv_walk_msgpack_map(in_obj->object, in_obj->size,
+            [&](const char *key, uint32_t key_len, const char *val) -> bool {
+                if (kv_key_is(key, key_len, "drops"))
+                    return kv_msgpack_uint(val, &drops);
+                if (kv_key_is(key, key_len, "hops"))
+                    return kv_msgpack_uint(val, &hops);
+                if (kv_key_is(key, key_len, "hop_tune_usec"))
+                    return kv_msgpack_uint(val, &tune_usec);
+                if (kv_key_is(key, key_len, "hop_tune_max_usec"))
+                    return kv_msgpack_uint(val, &tune_max_usec);
+                if (kv_key_is(key, key_len, "hop_late_usec"))
+                    return kv_msgpack_uint(val, &late_usec);
+
+                return true;
+            });
+
+    if (!valid) {
+        trigger_error("failed to unpack capture stats bundle");
+        return;
+    }
 
-        if ((obj_iter = dict.find("alt")) != dict.end()) {
-            gpsinfo->alt = obj_iter->second.as<double>();
-        }
+    if (drops != 0)
+        inc_source_num_capture_drops(drops);
 
-        if ((obj_iter = dict.find("speed")) != dict.end()) {
-            gpsinfo->speed = obj_iter->second.as<double>();
-        }
+    if (hops != 0) {
+        hop_tune_usec_total += tune_usec;
+        hop_late_usec_total += late_usec;
 
-        if ((obj_iter = dict.find("heading")) != dict.end()) {
-            gpsinfo->heading = obj_iter->second.as<double>();
-        }
+        set_int_source_hop_count(get_source_hop_count() + hops);
+        set_int_source_hop_latency((double) hop_tune_usec_total / get_source_hop_count());
+        set_int_source_hop_latency_max(tune_max_usec);
+        set_int_source_hop_late((double) hop_late_usec_total / get_source_hop_count());
+    }
+}
 
-        if ((obj_iter = dict.find("precision")) != dict.end()) {
-            gpsinfo->precision = obj_iter->second.as<double>();
-        }
+void KisDatasource::reset_proto_compress() {
+    if (proto_zstream != NULL) {
+        inflateEnd(proto_zstream);
+        delete proto_zstream;
+        proto_zstream = NULL;
+    }
 
-        if ((obj_iter = dict.find("fix")) != dict.end()) {
-            gpsinfo->precision = obj_iter->second.as<int32_t>();
-        }
+    proto_compress_seen = false;
+}
 
-        if ((obj_iter = dict.find("time")) != dict.end()) {
-            gpsinfo->tv.tv_sec = (time_t) obj_iter->second.as<uint64_t>();
-            gpsinfo->tv.tv_usec = 0;
-        }
+ssize_t KisDatasource::inflate_batch(KisDatasourceCapKeyedObject *in_obj) {
+    // Batches are bounded by the helper; anything claiming to be bigger than
+    // this is corrupt or hostile
+    const uint32_t max_raw_sz = 1024 * 1024 * 4;
 
-        /*
-        if ((obj_iter = dict.find("name")) != dict.end()) {
-            gpsinfo->gpsname = obj_iter->second.as<string>();
-        }
-        */
+    if (in_obj->size < sizeof(simple_cap_proto_zbatch_t)) {
+        trigger_error("truncated compressed packet batch");
+        return -1;
+    }
 
-    } catch (const std::exception& e) {
-        // Something went wrong with msgpack unpacking
-        delete(gpsinfo);
-        stringstream ss;
-        ss << "failed to unpack gps bundle: " << e.what();
+    const simple_cap_proto_zbatch_t *zhdr = 
+        (const simple_cap_proto_zbatch_t *) in_obj->object;
 
-        trigger_error(ss.str());
+    uint32_t raw_sz = kis_ntoh32(zhdr->raw_sz);
 
-        return NULL;
+    if (raw_sz == 0 || raw_sz > max_raw_sz) {
+        trigger_error("invalid size in compressed packet batch");
+        return -1;
     }
 
-    return gpsinfo;
-}
+    if (proto_zstream == NULL) {
+        proto_zstream = new z_stream;
+        memset(proto_zstream, 0, sizeof(z_stream));
 
-kis_packet *KisDatasource::handle_kv_packet(KisDatasourceCapKeyedObject *in_obj) {
-    // Extract a packet record
-    
-    kis_packet *packet = packetchain->GeneratePacket();
-    kis_datachunk *datachunk = new kis_datachunk();
+        if (inflateInit(proto_zstream) != Z_OK) {
+            delete proto_zstream;
+            proto_zstream = NULL;
+            trigger_error("unable to initialize decompression");
+            return -1;
+        }
+    }
 
-    // Unpack the dictionary
-    MsgpackAdapter::MsgpackStrMap dict;
-    msgpack::unpacked result;
-    MsgpackAdapter::MsgpackStrMap::iterator obj_iter;
+    // Leave a spare byte of output space so the whole sync flush is consumed
+    if (proto_zbuf.size() < raw_sz + 1)
+        proto_zbuf.resize(raw_sz + 1);
 
-    try {
-        msgpack::unpack(result, in_obj->object, in_obj->size);
-        msgpack::object deserialized = result.get();
-        dict = deserialized.as<MsgpackAdapter::MsgpackStrMap>();
+    struct timeval start, end;
+    gettimeofday(&start, NULL);
 
-        if (clobber_timestamp && get_source_remote()) {
-            gettimeofday(&(packet->ts), NULL);
-        } else {
-            if ((obj_iter = dict.find("tv_sec")) != dict.end()) {
-                packet->ts.tv_sec = (time_t) obj_iter->second.as<uint64_t>();
-            } else {
-                throw std::runtime_error(string("tv_sec timestamp missing"));
-            }
+    proto_zstream->next_in = (Bytef *) zhdr->data;
+    proto_zstream->avail_in = in_obj->size - sizeof(simple_cap_proto_zbatch_t);
+    proto_zstream->next_out = proto_zbuf.data();
+    proto_zstream->avail_out = raw_sz + 1;
 
-            if ((obj_iter = dict.find("tv_usec")) != dict.end()) {
-                packet->ts.tv_usec = (time_t) obj_iter->second.as<uint64_t>();
-            } else {
-                throw std::runtime_error(string("tv_usec timestamp missing"));
-            }
-        }
+    int r = inflate(proto_zstream, Z_SYNC_FLUSH);
 
-        // Record the size
-        uint64_t size = 0;
-        if ((obj_iter = dict.find("size")) != dict.end()) {
-            size = obj_iter->second.as<uint64_t>();
-        } else {
-            throw std::runtime_error(string("size field missing or zero"));
-        }
+    gettimeofday(&end, NULL);
 
-        msgpack::object rawdata;
-        if ((obj_iter = dict.find("packet")) != dict.end()) {
-            rawdata = obj_iter->second;
-        } else {
-            throw std::runtime_error(string("packet data missing"));
-        }
+    if ((r != Z_OK && r != Z_BUF_ERROR) || proto_zstream->avail_in != 0 ||
+            proto_zstream->avail_out != 1) {
+        trigger_error("corrupt compressed packet batch");
+        return -1;
+    }
 
-        if (rawdata.via.bin.size != size) {
-            throw std::runtime_error(string("packet size did not match data size"));
-        }
+    uint64_t inflate_usec = (end.tv_sec - start.tv_sec) * 1000000L +
+        (end.tv_usec - start.tv_usec);
 
-        datachunk->copy_data((const uint8_t *) rawdata.via.bin.ptr, size);
+    proto_zbatches++;
+    proto_zcodec_usec += kis_ntoh32(zhdr->deflate_usec) + inflate_usec;
+    proto_zdelay_usec += kis_ntoh32(zhdr->batch_usec);
 
-    } catch (const std::exception& e) {
-        // Something went wrong with msgpack unpacking
-        //
-        // Destroy the packet appropriately
-        packetchain->DestroyPacket(packet);
-        // Always delete the datachunk, we don't insert it into the packet
-        // until later
-        delete(datachunk);
+    set_int_source_compress_raw_bytes(get_source_compress_raw_bytes() + raw_sz);
+    set_int_source_compress_bytes(get_source_compress_bytes() + in_obj->size);
 
-        stringstream ss;
-        ss << "failed to unpack packet bundle: " << e.what();
+    set_int_source_compress_ratio((double) get_source_compress_raw_bytes() / 
+            get_source_compress_bytes());
+    set_int_source_compress_latency((double) proto_zcodec_usec / proto_zbatches);
+    set_int_source_compress_batch_delay((double) proto_zdelay_usec / proto_zbatches);
 
-        trigger_error(ss.str());
+    return raw_sz;
+}
+
+kis_packet *KisDatasource::handle_kv_packet(KisDatasourceCapKeyedObject *in_obj) {
+    // Extract a packet record; the packet data is left where it is, as a slice
+    // of the frame buffer when the record has one
+    
+    uint64_t tv_sec = 0, tv_usec = 0, size = 0;
+    bool have_tv_sec = false, have_tv_usec = false, have_size = false;
+    const char *rawdata = NULL;
+    uint32_t rawdata_sz = 0;
+
+    bool valid = kv_walk_msgpack_map(in_obj->object, in_obj->size,
+            [&](const char *key, uint32_t key_len, const char *val) -> bool {
+                if (kv_key_is(key, key_len, "tv_sec")) {
+                    have_tv_sec = kv_msgpack_uint(val, &tv_sec);
+                    return have_tv_sec;
+                } else if (kv_key_is(key, key_len, "tv_usec")) {
+                    have_tv_usec = kv_msgpack_uint(val, &tv_usec);
+                    return have_tv_usec;
+                } else if (kv_key_is(key, key_len, "size")) {
+                    have_size = kv_msgpack_uint(val, &size);
+                    return have_size;
+                } else if (kv_key_is(key, key_len, "packet")) {
+                    if (mp_typeof(*val) != MP_BIN)
+                        return false;
+                    rawdata = mp_decode_bin(&val, &rawdata_sz);
+                }
 
+                return true;
+            });
+
+    const char *error = NULL;
+    bool clobber = clobber_timestamp && get_source_remote();
+
+    if (!valid)
+        error = "invalid packet record";
+    else if (!clobber && !have_tv_sec)
+        error = "tv_sec timestamp missing";
+    else if (!clobber && !have_tv_usec)
+        error = "tv_usec timestamp missing";
+    else if (!have_size)
+        error = "size field missing or zero";
+    else if (rawdata == NULL)
+        error = "packet data missing";
+    else if (rawdata_sz != size)
+        error = "packet size did not match data size";
+
+    if (error != NULL) {
+        trigger_error(string("failed to unpack packet bundle: ") + error);
         return NULL;
     }
 
+    kis_packet *packet = packetchain->GeneratePacket();
+    kis_datachunk *datachunk = datachunk_pool->acquire();
+
+    if (clobber) {
+        gettimeofday(&(packet->ts), NULL);
+    } else {
+        packet->ts.tv_sec = (time_t) tv_sec;
+        packet->ts.tv_usec = (time_t) tv_usec;
+    }
+
+    if (in_obj->frame != NULL)
+        datachunk->set_slice(in_obj->frame, (uint8_t *) rawdata, size);
+    else
+        datachunk->copy_data((const uint8_t *) rawdata, size);
+
     datachunk->dlt = get_source_dlt();
 
     packet->insert(pack_comp_linkframe, datachunk);
@@ -1595,6 +2212,29 @@ bool KisDatasource::write_packet(string in_cmd, KVmap in_kvpairs,
 
     uint32_t hcsum, dcsum = 0, csum_s1 = 0, csum_s2 = 0;
 
+    // Offer CRC32C to the helper until it starts using it; helpers which don't 
+    // know the key ignore it
+    KisDatasourceCapKeyedObject csum_offer("CHECKSUM", KIS_CAP_CSUM_CRC32C_NAME, 
+            strlen(KIS_CAP_CSUM_CRC32C_NAME));
+
+    if (proto_csum_type == KIS_CAP_CSUM_ADLER32)
+        in_kvpairs.emplace("CHECKSUM", &csum_offer);
+
+    // Likewise offer batched packets until the helper sends a batch
+    uint32_t batch_version = kis_hton32(KIS_CAP_BATCH_VERSION);
+    KisDatasourceCapKeyedObject batch_offer("DATABATCH", (const char *) &batch_version,
+            sizeof(uint32_t));
+
+    if (!proto_batch_seen)
+        in_kvpairs.emplace("DATABATCH", &batch_offer);
+
+    // And compressed batches to a remote helper which was asked to compress
+    KisDatasourceCapKeyedObject compress_offer("COMPRESS", proto_compress_offer.data(),
+            proto_compress_offer.length());
+
+    if (proto_compress_offer.length() != 0 && !proto_compress_seen && get_source_remote())
+        in_kvpairs.emplace("COMPRESS", &compress_offer);
+
     size_t total_len = sizeof(simple_cap_proto_t);
 
     // Add up the length of all of the kv pairs
@@ -1602,7 +2242,10 @@ bool KisDatasource::write_packet(string in_cmd, KVmap in_kvpairs,
         total_len += sizeof(simple_cap_proto_kv_h_t) + i->second->size;
     }
 
-    proto_hdr.signature = kis_hton32(KIS_CAP_SIMPLE_PROTO_SIG);
+    if (proto_csum_type == KIS_CAP_CSUM_CRC32C)
+        proto_hdr.signature = kis_hton32(KIS_CAP_SIMPLE_PROTO_SIG_CRC32C);
+    else
+        proto_hdr.signature = kis_hton32(KIS_CAP_SIMPLE_PROTO_SIG);
     proto_hdr.header_checksum = 0;
     proto_hdr.data_checksum = 0;
     proto_hdr.packet_sz = kis_hton32(total_len);
@@ -1616,15 +2259,26 @@ bool KisDatasource::write_packet(string in_cmd, KVmap in_kvpairs,
     proto_hdr.num_kv_pairs = kis_hton32(in_kvpairs.size());
 
     // Start calculating the checksum on just the header
-    hcsum = Adler32IncrementalChecksum((const char *) &proto_hdr, 
-            sizeof(simple_cap_proto_t), &csum_s1, &csum_s2);
-    
+    if (proto_csum_type == KIS_CAP_CSUM_CRC32C) {
+        hcsum = csum_s1 = kis_crc32c((const uint8_t *) &proto_hdr, 
+                sizeof(simple_cap_proto_t));
 
-    // Calc the checksum of all the kv pairs
-    for (auto i = in_kvpairs.begin(); i != in_kvpairs.end(); ++i) {
-        dcsum = Adler32IncrementalChecksum((const char *) i->second->kv,
-                sizeof(simple_cap_proto_kv_h_t) + i->second->size,
-                &csum_s1, &csum_s2);
+        // Calc the checksum of all the kv pairs
+        for (auto i = in_kvpairs.begin(); i != in_kvpairs.end(); ++i) {
+            dcsum = csum_s1 = kis_crc32c_partial(csum_s1, 
+                    (const uint8_t *) i->second->kv,
+                    sizeof(simple_cap_proto_kv_h_t) + i->second->size);
+        }
+    } else {
+        hcsum = Adler32IncrementalChecksum((const char *) &proto_hdr, 
+                sizeof(simple_cap_proto_t), &csum_s1, &csum_s2);
+
+        // Calc the checksum of all the kv pairs
+        for (auto i = in_kvpairs.begin(); i != in_kvpairs.end(); ++i) {
+            dcsum = Adler32IncrementalChecksum((const char *) i->second->kv,
+                    sizeof(simple_cap_proto_kv_h_t) + i->second->size,
+                    &csum_s1, &csum_s2);
+        }
     }
 
     if (in_kvpairs.size() == 0)
@@ -1843,6 +2497,56 @@ void KisDatasource::send_command_set_channel_hop(double in_rate,
     command_ack_map.emplace(seqno, cmd);
 }
 
+void KisDatasource::send_command_set_filter(string in_filter,
+        unsigned int in_transaction, configure_callback_t in_cb) {
+    local_locker lock(&source_lock);
+
+    // Pack the filter as a msgpack string so an empty filter (which clears
+    // it) is still a valid KV
+    stringstream stream;
+    msgpack::packer<std::stringstream> packer(&stream);
+
+    packer.pack(in_filter);
+
+    KisDatasourceCapKeyedObject *filter =
+        new KisDatasourceCapKeyedObject("FILTER", stream.str().data(),
+                stream.str().length());
+    KVmap kvmap;
+
+    kvmap.emplace("FILTER", filter);
+
+    uint32_t seqno;
+    bool success;
+    shared_ptr<tracked_command> cmd;
+
+    success = write_packet("CONFIGURE", kvmap, seqno);
+
+    delete(filter);
+
+    if (!success) {
+        if (in_cb != NULL) {
+            in_cb(in_transaction, false, "unable to generate command frame");
+        }
+
+        return;
+    }
+
+    cmd.reset(new tracked_command(in_transaction, seqno, this));
+    cmd->failure_is_error = false;
+
+    // Only record the filter once the helper has it in place
+    cmd->configure_cb = [this, in_filter, in_cb](unsigned int in_trans, bool in_success,
+            std::string in_reason) {
+        if (in_success)
+            set_int_source_filter(in_filter);
+
+        if (in_cb != NULL)
+            in_cb(in_trans, in_success, in_reason);
+    };
+
+    command_ack_map.emplace(seqno, cmd);
+}
+
 void KisDatasource::send_command_ping() {
     local_locker lock(&source_lock);
 
@@ -1930,6 +2634,9 @@ void KisDatasource::register_fields() {
             "Number of channels skipped by source during hop shuffling", 
             &source_hop_shuffle_skip);
 
+    RegisterField("kismet.datasource.filter", TrackerString,
+            "Capture filter applied by the source", &source_filter);
+
     RegisterField("kismet.datasource.error", TrackerUInt8,
             "Source is in error state", &source_error);
     RegisterField("kismet.datasource.error_reason", TrackerString,
@@ -1940,6 +2647,43 @@ void KisDatasource::register_fields() {
     RegisterField("kismet.datasource.num_error_packets", TrackerUInt64,
             "Number of invalid/error packets seen by source",
             &source_num_error_packets);
+    RegisterField("kismet.datasource.num_dedup_checked_packets", TrackerUInt64,
+            "Number of packets from source checked for duplicates",
+            &source_num_dedup_checked_packets);
+    RegisterField("kismet.datasource.num_dedup_packets", TrackerUInt64,
+            "Number of packets from source discarded as duplicates",
+            &source_num_dedup_packets);
+    RegisterField("kismet.datasource.num_capture_drops", TrackerUInt64,
+            "Number of packets dropped by the capture interface before the source "
+            "could read them", &source_num_capture_drops);
+
+    RegisterField("kismet.datasource.compress_raw_bytes", TrackerUInt64,
+            "Packet batch bytes from a remote source before compression",
+            &source_compress_raw_bytes);
+    RegisterField("kismet.datasource.compress_bytes", TrackerUInt64,
+            "Packet batch bytes received from a remote source after compression",
+            &source_compress_bytes);
+    RegisterField("kismet.datasource.compress_ratio", TrackerDouble,
+            "Compression ratio of packet batches from a remote source",
+            &source_compress_ratio);
+    RegisterField("kismet.datasource.compress_latency", TrackerDouble,
+            "Average time spent compressing and decompressing a packet batch, "
+            "in microseconds", &source_compress_latency);
+    RegisterField("kismet.datasource.compress_batch_delay", TrackerDouble,
+            "Average time the first packet of a compressed batch waited for the "
+            "batch to be sent, in microseconds", &source_compress_batch_delay);
+
+    RegisterField("kismet.datasource.hop_count", TrackerUInt64,
+            "Number of channel hops reported by the source", &source_hop_count);
+    RegisterField("kismet.datasource.hop_latency", TrackerDouble,
+            "Average time to tune to a channel when hopping, in microseconds",
+            &source_hop_latency);
+    RegisterField("kismet.datasource.hop_latency_max", TrackerUInt64,
+            "Longest time to tune to a channel when hopping in the most recent "
+            "report, in microseconds", &source_hop_latency_max);
+    RegisterField("kismet.datasource.hop_late", TrackerDouble,
+            "Average time a channel hop started later than scheduled, in "
+            "microseconds", &source_hop_late);
 
     packet_rate_rrd_id = RegisterComplexField("kismet.datasource.packets_rrd", 
             shared_ptr<kis_tracked_minute_rrd<> >(new kis_tracked_minute_rrd<>(globalreg, 0)), 
@@ -2110,10 +2854,36 @@ void KisDatasource::launch_ipc() {
 
     // Make a new handler and new ipc.  Give a generous buffer.
     ringbuf_handler.reset(new BufferHandler<RingbufV2>((1024 * 1024), (1024 * 1024)));
+    proto_csum_type = KIS_CAP_CSUM_ADLER32;
+    proto_batch_seen = false;
+    reset_proto_compress();
     ringbuf_handler->SetReadBufferInterface(this);
 
     ipc_remote.reset(new IPCRemoteV2(globalreg, ringbuf_handler));
 
+    // Offer the helper a shared memory ring for packet data, when enabled;
+    // helpers which don't understand it keep using the pipe
+    size_t shm_ring_kb =
+        globalreg->kismet_config->FetchOptULong("datasource_shm_ring_size", 0);
+
+    // A ring too small to hold the largest frame behind a padding record
+    // would stall the helper for good
+    if (shm_ring_kb != 0 && shm_ring_kb * 1024 < KIS_SHMRING_MIN_SIZE) {
+        ss.str("");
+        ss << "Datasource '" << get_source_name() << "' datasource_shm_ring_size=" <<
+            shm_ring_kb << " is too small to hold the largest capture frames, using " <<
+            KIS_SHMRING_MIN_SIZE / 1024 << "KB";
+        _MSG(ss.str(), MSGFLAG_ERROR);
+
+        shm_ring_kb = KIS_SHMRING_MIN_SIZE / 1024;
+    }
+
+    if (shm_ring_kb != 0)
+        ipc_remote->enable_shm_ring(shm_ring_kb * 1024, 
+                [this](const uint8_t *data, size_t len) {
+                    handle_shm_frame(data, len);
+                });
+
     // Get allowed paths for binaries
     vector<string> bin_paths = 
         globalreg->kismet_config->FetchOptVec("capture_binary_path");
@@ -2138,18 +2908,73 @@ void KisDatasource::launch_ipc() {
     return;
 }
 
-KisDatasourceCapKeyedObject::KisDatasourceCapKeyedObject(simple_cap_proto_kv *in_kp) {
-    char ckey[16];
+kis_cap_key kis_cap_key_lookup(const char *in_key, size_t in_len) {
+    // Perfect hash of the length and the first and last characters of each known
+    // key; keys are case insensitive, and a match is confirmed against the name
+    static const struct {
+        const char *name;
+        kis_cap_key key;
+    } key_table[32] = {
+        { NULL, kis_cap_key_unknown }, { NULL, kis_cap_key_unknown },
+        { "uuid", kis_cap_key_uuid }, { "interfacelist", kis_cap_key_interfacelist },
+        { NULL, kis_cap_key_unknown }, { NULL, kis_cap_key_unknown },
+        { "packets", kis_cap_key_packets }, { NULL, kis_cap_key_unknown },
+        { "signal", kis_cap_key_signal }, { "capif", kis_cap_key_capif },
+        { "packet", kis_cap_key_packet }, { NULL, kis_cap_key_unknown },
+        { "success", kis_cap_key_success }, { "channels", kis_cap_key_channels },
+        { NULL, kis_cap_key_unknown }, { "dlt", kis_cap_key_dlt },
+        { "gps", kis_cap_key_gps }, { "chanset", kis_cap_key_chanset },
+        { NULL, kis_cap_key_unknown }, { NULL, kis_cap_key_unknown },
+        { NULL, kis_cap_key_unknown }, { NULL, kis_cap_key_unknown },
+        { NULL, kis_cap_key_unknown }, { NULL, kis_cap_key_unknown },
+        { "warning", kis_cap_key_warning }, { NULL, kis_cap_key_unknown },
+        { "message", kis_cap_key_message }, { "zpackets", kis_cap_key_zpackets },
+        { NULL, kis_cap_key_unknown }, { "chanhop", kis_cap_key_chanhop },
+        { NULL, kis_cap_key_unknown }, { NULL, kis_cap_key_unknown },
+    };
+
+    if (in_len == 0)
+        return kis_cap_key_unknown;
+
+    unsigned int h = (in_len + 2 * (in_key[0] | 0x20) + 
+            5 * (in_key[in_len - 1] | 0x20)) & 31;
+
+    if (key_table[h].name == NULL || strlen(key_table[h].name) != in_len ||
+            strncasecmp(key_table[h].name, in_key, in_len) != 0)
+        return kis_cap_key_unknown;
+
+    return key_table[h].key;
+}
+
+KisDatasourceCapKeyedObject::KisDatasourceCapKeyedObject(simple_cap_proto_kv *in_kp,
+        kis_frame_buffer *in_frame) {
+    allocated = false;
+
+    assign(in_kp, in_frame);
+}
+
+KisDatasourceCapKeyedObject::KisDatasourceCapKeyedObject() {
+    kv = NULL;
+    allocated = false;
+    key_id = kis_cap_key_unknown;
+    size = 0;
+    object = NULL;
+    frame = NULL;
+}
+
+void KisDatasourceCapKeyedObject::assign(simple_cap_proto_kv *in_kp,
+        kis_frame_buffer *in_frame) {
+    size_t key_len = strnlen(in_kp->header.key, 16);
 
     kv = in_kp;
+    frame = in_frame;
 
-    snprintf(ckey, 16, "%s", in_kp->header.key);
-    key = string(ckey);
+    // Keys fit in the short string buffer, so this doesn't allocate
+    key.assign(in_kp->header.key, key_len > 15 ? 15 : key_len);
+    key_id = kis_cap_key_lookup(in_kp->header.key, key_len);
 
     size = kis_ntoh32(in_kp->header.obj_sz);
     object = (char *) kv->object;
-
-    allocated = false;
 }
 
 KisDatasourceCapKeyedObject::KisDatasourceCapKeyedObject(string in_key,
@@ -2169,6 +2994,9 @@ KisDatasourceCapKeyedObject::KisDatasourceCapKeyedObject(string in_key,
     memcpy(kv->object, in_object, in_len);
     object = (char *) kv->object;
 
+    key_id = kis_cap_key_lookup(key.c_str(), key.length());
+
+    frame = NULL;
 }
 
 KisDatasourceCapKeyedObject::~KisDatasourceCapKeyedObject() {
@@ -21,6 +21,7 @@
 
 #include "config.h"
 
+#include <array>
 #include <functional>
 
 #include "globalregistry.h"
@@ -46,9 +47,39 @@ typedef std::shared_ptr<KisDatasourceInterface> SharedInterface;
 // Simple keyed object derived from the low-level C protocol
 class KisDatasourceCapKeyedObject;
 
+// zlib stream state, for compressed packet batches
+struct z_stream_s;
+
+// KV keys the datasource core understands, found by a perfect hash of the key
+// name (see kis_cap_key_lookup) so frames can be decoded without building a map
+enum kis_cap_key {
+    kis_cap_key_unknown = -1,
+    kis_cap_key_success = 0,
+    kis_cap_key_message,
+    kis_cap_key_warning,
+    kis_cap_key_channels,
+    kis_cap_key_chanset,
+    kis_cap_key_chanhop,
+    kis_cap_key_packet,
+    kis_cap_key_packets,
+    kis_cap_key_signal,
+    kis_cap_key_gps,
+    kis_cap_key_uuid,
+    kis_cap_key_capif,
+    kis_cap_key_dlt,
+    kis_cap_key_interfacelist,
+    kis_cap_key_zpackets,
+    kis_cap_key_max
+};
+
+kis_cap_key kis_cap_key_lookup(const char *in_key, size_t in_len);
+
 // Fwd def for DST
 class Datasourcetracker;
 
+// Packet component linking back to the source
+class packetchain_comp_datasource;
+
 class KisDatasource : public tracker_component, public BufferInterface {
 public:
     // Initialize and tell us what sort of builder
@@ -65,6 +96,11 @@ public:
         return "";
     }
 
+    // Checksum a capture protocol frame or header with the algorithm its 
+    // signature selects (KIS_CAP_CSUM_ADLER32 or KIS_CAP_CSUM_CRC32C)
+    static uint32_t proto_checksum(int in_csum_type, const uint8_t *in_data,
+            size_t in_len);
+
     // Async command API
     // All commands to change non-local state are asynchronous.  Failure, success,
     // and state change will not be known until the command completes.
@@ -125,6 +161,12 @@ public:
     virtual void set_channel_hop_list(std::vector<std::string> in_chans, 
             unsigned int in_transaction, configure_callback_t in_cb);
 
+    // Set a pcap filter expression on the capture, so that unwanted packets
+    // are dropped by the helper (in the kernel, where the capture supports it)
+    // instead of being sent to us; an empty filter removes it
+    virtual void set_filter(std::string in_filter, unsigned int in_transaction,
+            configure_callback_t in_cb);
+
 
     // Connect an interface to a pre-existing buffer (such as from a TCP server
     // connection); This doesn't require async because we're just binding the
@@ -163,6 +205,10 @@ public:
     // hierarchy of key-value parsers.
     virtual void BufferAvailable(size_t in_amt);
 
+    // Handle a complete frame read from the shared memory ring of a local
+    // helper; the frame is only valid for the duration of the call
+    virtual void handle_shm_frame(const uint8_t *in_data, size_t in_len);
+
     // Buffer interface - handles error on IPC or TCP, called when there is a 
     // low-level error on the communications stack (process death, etc).
     // Passes error to the the internal source_error function
@@ -203,6 +249,8 @@ public:
     __ProxyGet(source_hop_shuffle_skip, uint32_t, uint32_t, source_hop_shuffle_skip);
     __ProxyTrackable(source_hop_vec, TrackerElement, source_hop_vec);
 
+    __ProxyGet(source_filter, std::string, std::string, source_filter);
+
     __ProxyGet(source_running, uint8_t, bool, source_running);
 
     __ProxyGet(source_remote, uint8_t, bool, source_remote);
@@ -215,6 +263,38 @@ public:
     __ProxyIncDec(source_num_error_packets, uint64_t, uint64_t, 
             source_num_error_packets);
 
+    __Proxy(source_num_dedup_checked_packets, uint64_t, uint64_t, uint64_t,
+            source_num_dedup_checked_packets);
+    __ProxyIncDec(source_num_dedup_checked_packets, uint64_t, uint64_t,
+            source_num_dedup_checked_packets);
+
+    __Proxy(source_num_dedup_packets, uint64_t, uint64_t, uint64_t,
+            source_num_dedup_packets);
+    __ProxyIncDec(source_num_dedup_packets, uint64_t, uint64_t,
+            source_num_dedup_packets);
+
+    __Proxy(source_num_capture_drops, uint64_t, uint64_t, uint64_t,
+            source_num_capture_drops);
+    __ProxyIncDec(source_num_capture_drops, uint64_t, uint64_t,
+            source_num_capture_drops);
+
+    // Compressed batches from a remote source:  bytes before and after 
+    // compression, and the average time a batch spent being compressed and
+    // decompressed and its first packet waited for it to be sent
+    __ProxyGet(source_compress_raw_bytes, uint64_t, uint64_t, source_compress_raw_bytes);
+    __ProxyGet(source_compress_bytes, uint64_t, uint64_t, source_compress_bytes);
+    __ProxyGet(source_compress_ratio, double, double, source_compress_ratio);
+    __ProxyGet(source_compress_latency, double, double, source_compress_latency);
+    __ProxyGet(source_compress_batch_delay, double, double, source_compress_batch_delay);
+
+    // Channel hop timing reported by the source:  hops made, average and most
+    // recent worst time to tune, and the average time a hop started late, in
+    // microseconds
+    __ProxyGet(source_hop_count, uint64_t, uint64_t, source_hop_count);
+    __ProxyGet(source_hop_latency, double, double, source_hop_latency);
+    __ProxyGet(source_hop_latency_max, uint64_t, uint64_t, source_hop_latency_max);
+    __ProxyGet(source_hop_late, double, double, source_hop_late);
+
     __ProxyDynamicTrackable(source_packet_rrd, kis_tracked_minute_rrd<>, 
             packet_rate_rrd, packet_rate_rrd_id);
 
@@ -267,6 +347,39 @@ protected:
     
     uint32_t next_cmd_sequence;
 
+    // Checksum we sign outgoing frames with; adler32 until the helper sends us
+    // a CRC32C frame
+    int proto_csum_type;
+
+    // Offer batched packets to the helper until it sends us a batch
+    bool proto_batch_seen;
+
+    // Offer compressed batches to a remote helper, when the source definition
+    // asks for them, until it sends us one; the offer is a packed COMPRESS KV
+    std::string proto_compress_offer;
+    bool proto_compress_seen;
+
+    // Inflate stream for compressed batches, shared by every batch on the 
+    // connection, and the buffer they're inflated into
+    struct z_stream_s *proto_zstream;
+    std::vector<uint8_t> proto_zbuf;
+
+    // Totals behind the compression stats
+    uint64_t proto_zbatches;
+    uint64_t proto_zcodec_usec;
+    uint64_t proto_zdelay_usec;
+
+    // Reset the compression state for a new connection
+    void reset_proto_compress();
+
+    // Totals behind the hop timing stats
+    uint64_t hop_tune_usec_total;
+    uint64_t hop_late_usec_total;
+
+    // Inflate a ZPACKETS KV into proto_zbuf, returning the size of the batch
+    // records, or -1 if it's invalid
+    ssize_t inflate_batch(KisDatasourceCapKeyedObject *in_obj);
+
     // Tracker object for our map of commands which haven't finished
     class tracked_command {
     public:
@@ -274,6 +387,7 @@ protected:
             transaction = in_trans;
             command_seq = in_seq;
             command_time = time(0);
+            failure_is_error = true;
 
             timetracker = in_src->timetracker;
 
@@ -304,6 +418,11 @@ protected:
         probe_callback_t probe_cb;
         open_callback_t open_cb;
         configure_callback_t configure_cb;
+
+        // Does a failure response put the source into error?  Most config
+        // changes leave the source in an unknown state if they fail, but a
+        // filter which fails to compile leaves the old one in place
+        bool failure_is_error;
     };
 
     // Tracked commands we need to ack
@@ -326,6 +445,12 @@ protected:
     // to call the parent implementation to get the default packet handling.
     typedef std::map<std::string, KisDatasourceCapKeyedObject *> KVmap;
 
+    // Known KVs of a frame indexed by key; data frames are decoded straight into
+    // one of these on the stack
+    typedef std::array<KisDatasourceCapKeyedObject *, kis_cap_key_max> KVindex;
+
+    static KVindex index_kvmap(KVmap& in_kvmap);
+
     // Datasource protocol - dispatch handler.  Handles dispatching top-level
     // packet types to helper functions.  Automatically handles the default
     // packet types, and can be overridden to handle additional types.
@@ -339,6 +464,10 @@ protected:
     virtual void proto_packet_message(KVmap in_kvpairs);
     virtual void proto_packet_configresp(KVmap in_kvpairs);
     virtual void proto_packet_data(KVmap in_kvpairs);
+    virtual void proto_packet_databatch(KVmap in_kvpairs);
+    virtual void proto_packet_data(const KVindex& in_kvindex);
+    virtual void proto_packet_databatch(const KVindex& in_kvindex);
+    virtual void proto_packet_stats(KVmap in_kvpairs);
 
     // Common K-V pair handlers that are likely to be found in multiple types
     // of packets; these can be used by custom packet handlers to implement automatic
@@ -362,6 +491,7 @@ protected:
     virtual void handle_kv_uuid(KisDatasourceCapKeyedObject *in_obj);
     virtual void handle_kv_capif(KisDatasourceCapKeyedObject *in_obj);
     virtual unsigned int handle_kv_dlt(KisDatasourceCapKeyedObject *in_obj);
+    virtual void handle_kv_capstats(KisDatasourceCapKeyedObject *in_obj);
 
 
     // Assemble a packet it write it out the buffer, returning a command 
@@ -383,6 +513,8 @@ protected:
     virtual void send_command_set_channel_hop(double in_rate,
             SharedTrackerElement in_chans, bool in_shuffle, unsigned int in_offt,
             unsigned int in_transaction, configure_callback_t in_cb);
+    virtual void send_command_set_filter(std::string in_filter,
+            unsigned int in_transaction, configure_callback_t in_cb);
     virtual void send_command_ping();
     virtual void send_command_pong();
 
@@ -419,6 +551,19 @@ protected:
     __ProxySet(int_source_hop_offset, uint32_t, uint32_t, source_hop_offset);
     __ProxyTrackable(int_source_hop_vec, TrackerElement, source_hop_vec);
 
+    __ProxySet(int_source_filter, std::string, std::string, source_filter);
+
+    __ProxySet(int_source_compress_raw_bytes, uint64_t, uint64_t, source_compress_raw_bytes);
+    __ProxySet(int_source_compress_bytes, uint64_t, uint64_t, source_compress_bytes);
+    __ProxySet(int_source_compress_ratio, double, double, source_compress_ratio);
+    __ProxySet(int_source_compress_latency, double, double, source_compress_latency);
+    __ProxySet(int_source_compress_batch_delay, double, double, source_compress_batch_delay);
+
+    __ProxySet(int_source_hop_count, uint64_t, uint64_t, source_hop_count);
+    __ProxySet(int_source_hop_latency, double, double, source_hop_latency);
+    __ProxySet(int_source_hop_latency_max, uint64_t, uint64_t, source_hop_latency_max);
+    __ProxySet(int_source_hop_late, double, double, source_hop_late);
+
     // Prototype object which created us, defines our overall capabilities
     SharedDatasourceBuilder source_builder;
 
@@ -466,8 +611,25 @@ protected:
     SharedTrackerElement source_hop_shuffle;
     SharedTrackerElement source_hop_shuffle_skip;
 
+    // Capture filter pushed to the helper
+    SharedTrackerElement source_filter;
+
     SharedTrackerElement source_num_packets;
     SharedTrackerElement source_num_error_packets;
+    SharedTrackerElement source_num_dedup_checked_packets;
+    SharedTrackerElement source_num_dedup_packets;
+    SharedTrackerElement source_num_capture_drops;
+
+    SharedTrackerElement source_compress_raw_bytes;
+    SharedTrackerElement source_compress_bytes;
+    SharedTrackerElement source_compress_ratio;
+    SharedTrackerElement source_compress_latency;
+    SharedTrackerElement source_compress_batch_delay;
+
+    SharedTrackerElement source_hop_count;
+    SharedTrackerElement source_hop_latency;
+    SharedTrackerElement source_hop_latency_max;
+    SharedTrackerElement source_hop_late;
 
     int packet_rate_rrd_id;
     std::shared_ptr<kis_tracked_minute_rrd<> > packet_rate_rrd;
@@ -586,6 +748,28 @@ protected:
     // Packet components we inject
     int pack_comp_linkframe, pack_comp_l1info, pack_comp_gps, pack_comp_datasrc;
 
+    // Recycling pools for the components we inject
+    packet_component_pool<kis_datachunk> *datachunk_pool;
+    packet_component_pool<kis_layer1_packinfo> *l1info_pool;
+    packet_component_pool<kis_gps_packinfo> *gpsinfo_pool;
+    packet_component_pool<packetchain_comp_datasource> *datasrc_pool;
+    packet_component_pool<kis_frame_buffer> *frame_pool;
+
+    // Validate a copy of a frame header, returning the checksum type and the
+    // frame size and data checksum from it, or -1 after raising an error
+    int validate_frame_header(simple_cap_proto_t *in_header, uint32_t *ret_frame_sz,
+            uint32_t *ret_data_checksum);
+
+    // Find the next KV in a frame, advancing io_offt past it; returns NULL if the
+    // KV would run past the end of the frame
+    simple_cap_proto_kv_t *next_frame_kv(simple_cap_proto_frame_t *in_frame,
+            uint32_t in_frame_sz, size_t *io_offt);
+
+    // Validate the data checksum of a complete frame and dispatch it; returns
+    // false after raising an error
+    bool dispatch_frame(kis_frame_buffer *in_framebuf, uint32_t in_frame_sz,
+            int in_csum_type, uint32_t in_data_checksum);
+
     // Reference to the DST
     std::shared_ptr<Datasourcetracker> datasourcetracker;
 
@@ -659,6 +843,8 @@ public:
 
     __Proxy(tune_capable, uint8_t, bool, bool, tune_capable);
 
+    __Proxy(filter_capable, uint8_t, bool, bool, filter_capable);
+
 protected:
     virtual void register_fields() {
         tracker_component::register_fields();
@@ -695,6 +881,9 @@ protected:
 
         RegisterField("kismet.datasource.driver.tuning_capable", TrackerUInt8,
                 "Datasource can control channels", &tune_capable);
+
+        RegisterField("kismet.datasource.driver.filter_capable", TrackerUInt8,
+                "Datasource can filter packets before sending them", &filter_capable);
     }
 
     std::shared_ptr<EntryTracker> entrytracker;
@@ -718,6 +907,8 @@ protected:
 
     SharedTrackerElement tune_capable;
 
+    SharedTrackerElement filter_capable;
+
 };
 
 
@@ -803,17 +994,27 @@ protected:
 
 class KisDatasourceCapKeyedObject {
 public:
-    KisDatasourceCapKeyedObject(simple_cap_proto_kv *in_kp);
+    KisDatasourceCapKeyedObject(simple_cap_proto_kv *in_kp, 
+            kis_frame_buffer *in_frame = NULL);
     KisDatasourceCapKeyedObject(std::string in_key, const char *in_object, ssize_t in_len);
+    KisDatasourceCapKeyedObject();
     ~KisDatasourceCapKeyedObject();
 
+    // Point at a KV in a received frame
+    void assign(simple_cap_proto_kv *in_kp, kis_frame_buffer *in_frame = NULL);
+
     simple_cap_proto_kv_t *kv;
 
     bool allocated;
 
     string key;
+    kis_cap_key key_id;
     size_t size;
     char *object;
+
+    // Frame buffer the object lives in, if any; handlers can reference slices
+    // of the frame instead of copying out of it
+    kis_frame_buffer *frame;
 };
 
 // Packet chain component; we need to use a raw pointer here but it only exists
@@ -827,6 +1028,10 @@ public:
         ref_source = NULL;
     }
 
+    virtual void reset() {
+        ref_source = NULL;
+    }
+
     virtual ~packetchain_comp_datasource() { }
 };
 
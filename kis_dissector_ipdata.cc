@@ -38,8 +38,9 @@ Kis_Dissector_IPdata::Kis_Dissector_IPdata(GlobalRegistry *in_globalreg) {
 
 	globalreg->InsertGlobal("DISSECTOR_IPDATA", shared_ptr<Kis_Dissector_IPdata>(this));
 
-	globalreg->packetchain->RegisterHandler(&ipdata_packethook, this,
-		 									CHAINPOS_DATADISSECT, -100);
+	int handler_id =
+        globalreg->packetchain->RegisterHandler(&ipdata_packethook, this,
+		 									CHAINPOS_DATADISSECT, -100, "ip data dissector");
 
 	pack_comp_basicdata = 
 		globalreg->packetchain->RegisterPacketComponent("BASICDATA");
@@ -50,6 +51,13 @@ Kis_Dissector_IPdata::Kis_Dissector_IPdata(GlobalRegistry *in_globalreg) {
 	pack_comp_common = 
 		globalreg->packetchain->RegisterPacketComponent("COMMON");
 
+    // We only run when something wants the data info we produce
+    globalreg->packetchain->SetHandlerComponents(handler_id, 
+            {pack_comp_basicdata}, {pack_comp_datapayload, pack_comp_common});
+
+    datainfo_pool =
+        globalreg->packetchain->FetchComponentPool<kis_data_packinfo>();
+
 	alert_dhcpclient_ref =
 		globalreg->alertracker->ActivateConfiguredAlert("DHCPCLIENTID",
                 "A DHCP client sending a DHCP Discovery packet should "
@@ -186,7 +194,7 @@ int Kis_Dissector_IPdata::HandlePacket(kis_packet *in_pack) {
 	if (common == NULL)
 		return 0;
 
-	datainfo = new kis_data_packinfo;
+	datainfo = datainfo_pool->acquire();
 
 	// CDP cisco discovery frames, good for finding unauthorized APs
 	// +1 for the version frame we compare first
@@ -221,7 +229,7 @@ int Kis_Dissector_IPdata::HandlePacket(kis_packet *in_pack) {
 				if (elemlen < 4) {
 					_MSG("Corrupt CDP frame (possibly an exploit attempt), discarded",
 						 MSGFLAG_ERROR);
-					delete(datainfo);
+					datainfo_pool->recycle(datainfo);
 					return 0;
 				}
 
@@ -233,7 +241,7 @@ int Kis_Dissector_IPdata::HandlePacket(kis_packet *in_pack) {
 				if (elemlen < 4) {
 					_MSG("Corrupt CDP frame (possibly an exploit attempt), discarded",
 						 MSGFLAG_ERROR);
-					delete(datainfo);
+					datainfo_pool->recycle(datainfo);
 					return 0;
 				}
 
@@ -323,7 +331,7 @@ int Kis_Dissector_IPdata::HandlePacket(kis_packet *in_pack) {
 
 				// If we have a short/malformed PDU frame, bail
 				if ((pdu_offset + 3 + pdu_len) >= chunk->length) {
-					delete datainfo;
+					datainfo_pool->recycle(datainfo);
 					return 0;
 				}
 
@@ -416,7 +424,7 @@ int Kis_Dissector_IPdata::HandlePacket(kis_packet *in_pack) {
 
 				// This should never be possible, but let's check
 				if ((DHCPD_OFFSET + 32) >= chunk->length) {
-					delete datainfo;
+					datainfo_pool->recycle(datainfo);
 					return 0;
 				}
 
@@ -656,7 +664,7 @@ mdns_end:
 	} // TCP frame
 
 	// Trash the data if we didn't fill it in
-	delete(datainfo);
+	datainfo_pool->recycle(datainfo);
 
 	return 1;
 }
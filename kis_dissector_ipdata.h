@@ -43,6 +43,8 @@ protected:
 
 	int pack_comp_datapayload, pack_comp_basicdata, pack_comp_common;
 	int alert_dhcpclient_ref;
+
+    packet_component_pool<kis_data_packinfo> *datainfo_pool;
 };
 
 #endif
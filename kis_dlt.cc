@@ -37,7 +37,7 @@ Kis_DLT_Handler::Kis_DLT_Handler(GlobalRegistry *in_globalreg) {
 
 	chainid = 
 		globalreg->packetchain->RegisterHandler(&kis_dlt_packethook, this,
-												CHAINPOS_POSTCAP, 0);
+												CHAINPOS_POSTCAP, 0, "dlt decapsulation");
 
 	pack_comp_linkframe =
 		globalreg->packetchain->RegisterPacketComponent("LINKFRAME");
@@ -52,6 +52,13 @@ Kis_DLT_Handler::Kis_DLT_Handler(GlobalRegistry *in_globalreg) {
 	pack_comp_checksum =
 		globalreg->packetchain->RegisterPacketComponent("CHECKSUM");
 
+    datachunk_pool = 
+        globalreg->packetchain->FetchComponentPool<kis_datachunk>();
+    radiodata_pool = 
+        globalreg->packetchain->FetchComponentPool<kis_layer1_packinfo>();
+    checksum_pool =
+        globalreg->packetchain->FetchComponentPool<kis_packet_checksum>();
+
 }
 
 Kis_DLT_Handler::~Kis_DLT_Handler() {
@@ -43,9 +43,16 @@ protected:
 	GlobalRegistry *globalreg;
 	string dlt_name;
 	int dlt;
+	// Postcap handler; subclasses set the DLT dispatch once they know their DLT
+	// so they are only offered their own packets
 	int chainid;
 	int pack_comp_linkframe, pack_comp_decap, pack_comp_datasrc,
 		pack_comp_radiodata, pack_comp_gps, pack_comp_checksum;
+
+    // Recycled components we generate while decapsulating
+    packet_component_pool<kis_datachunk> *datachunk_pool;
+    packet_component_pool<kis_layer1_packinfo> *radiodata_pool;
+    packet_component_pool<kis_packet_checksum> *checksum_pool;
 };
 
 #endif
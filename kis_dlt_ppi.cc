@@ -40,6 +40,10 @@ Kis_DLT_PPI::Kis_DLT_PPI(GlobalRegistry *in_globalreg) :
 	dlt_name = "PPI";
 	dlt = DLT_PPI;
 
+	globalreg->packetchain->SetHandlerDLTDispatch(chainid, {(unsigned int) dlt});
+
+	gps_pool = globalreg->packetchain->FetchComponentPool<kis_gps_packinfo>();
+
 	globalreg->InsertGlobal("DLT_PPI", shared_ptr<Kis_DLT_PPI>(this));
 
 	_MSG("Registering support for DLT_PPI packet header decoding", MSGFLAG_INFO);
@@ -148,7 +152,7 @@ int Kis_DLT_PPI::HandlePacket(kis_packet *in_pack) {
 			}
 
 			if (radioheader == NULL)
-				radioheader = new kis_layer1_packinfo;
+				radioheader = radiodata_pool->acquire();
 
 			// Channel flags
 			tuint = kis_letoh16(ppic->chan_flags);
@@ -179,7 +183,7 @@ int Kis_DLT_PPI::HandlePacket(kis_packet *in_pack) {
 			ppi_11n_mac *ppin = (ppi_11n_mac *) ppi_fh;
 
 			if (radioheader == NULL)
-				radioheader = new kis_layer1_packinfo;
+				radioheader = radiodata_pool->acquire();
 
 			// Decode greenfield notation
 			tuint = kis_letoh16(ppin->flags);
@@ -192,7 +196,7 @@ int Kis_DLT_PPI::HandlePacket(kis_packet *in_pack) {
 			ppi_11n_macphy *ppinp = (ppi_11n_macphy *) ppi_fh;
 
 			if (radioheader == NULL)
-				radioheader = new kis_layer1_packinfo;
+				radioheader = radiodata_pool->acquire();
 
 			// Decode greenfield notation
 			tuint = kis_letoh16(ppinp->flags);
@@ -222,7 +226,7 @@ int Kis_DLT_PPI::HandlePacket(kis_packet *in_pack) {
 					gps_len - data_offt >= 8) {
 
 					if (gpsinfo == NULL)
-						gpsinfo = new kis_gps_packinfo;
+						gpsinfo = gps_pool->acquire();
 
 					u = (block *) &(ppigps->field_data[data_offt]);
 					gpsinfo->lat = fixed3_7_to_double(kis_letoh32(u->u32));
@@ -265,7 +269,7 @@ int Kis_DLT_PPI::HandlePacket(kis_packet *in_pack) {
 	if (applyfcs)
 		applyfcs = 4;
 
-	decapchunk = new kis_datachunk;
+	decapchunk = datachunk_pool->acquire();
 
 	decapchunk->dlt = ppi_dlt;
 
@@ -281,7 +285,7 @@ int Kis_DLT_PPI::HandlePacket(kis_packet *in_pack) {
 
 	kis_packet_checksum *fcschunk = NULL;
 	if (applyfcs && linkchunk->length > 4) {
-		fcschunk = new kis_packet_checksum;
+		fcschunk = checksum_pool->acquire();
 
 		fcschunk->set_data(&(linkchunk->data[linkchunk->length - 4]), 4);
 	
@@ -27,6 +27,7 @@
 #include "packet.h"
 #include "packetchain.h"
 #include "kis_dlt.h"
+#include "gpstracker.h"
 
 class Kis_DLT_PPI : public Kis_DLT_Handler {
 public:
@@ -36,6 +37,9 @@ public:
 	virtual int HandlePacket(kis_packet *in_pack);
 
 	~Kis_DLT_PPI();
+
+protected:
+    packet_component_pool<kis_gps_packinfo> *gps_pool;
 };
 
 #endif
@@ -71,6 +71,8 @@ Kis_DLT_Radiotap::Kis_DLT_Radiotap(GlobalRegistry *in_globalreg) :
 	dlt_name = "Radiotap";
 	dlt = DLT_IEEE802_11_RADIO;
 
+	globalreg->packetchain->SetHandlerDLTDispatch(chainid, {(unsigned int) dlt});
+
 	globalreg->InsertGlobal("DLT_RADIOTAP", shared_ptr<Kis_DLT_Radiotap>(this));
 
 	_MSG("Registering support for DLT_RADIOTAP packet header decoding", MSGFLAG_INFO);
@@ -82,9 +84,6 @@ Kis_DLT_Radiotap::~Kis_DLT_Radiotap() {
     globalreg->RemoveGlobal("DLT_RADIOTAP");
 }
 
-#define ALIGN_OFFSET(offset, width) \
-	    ( (((offset) + ((width) - 1)) & (~((width) - 1))) - offset )
-
 /*
  * Useful combinations of channel characteristics.
  */
@@ -118,12 +117,6 @@ Kis_DLT_Radiotap::~Kis_DLT_Radiotap() {
 #define	IEEE80211_IS_CHAN_T(_flags) \
 	((_flags & IEEE80211_CHAN_T) == IEEE80211_CHAN_T)
 
-#define BITNO_32(x) (((x) >> 16) ? 16 + BITNO_16((x) >> 16) : BITNO_16((x)))
-#define BITNO_16(x) (((x) >> 8) ? 8 + BITNO_8((x) >> 8) : BITNO_8((x)))
-#define BITNO_8(x) (((x) >> 4) ? 4 + BITNO_4((x) >> 4) : BITNO_4((x)))
-#define BITNO_4(x) (((x) >> 2) ? 2 + BITNO_2((x) >> 2) : BITNO_2((x)))
-#define BITNO_2(x) (((x) & 2) ? 1 : 0)
-#define BIT(n)	(1 << n)
 int Kis_DLT_Radiotap::HandlePacket(kis_packet *in_pack) {
     static int packnum = 0;
 
@@ -158,231 +151,115 @@ int Kis_DLT_Radiotap::HandlePacket(kis_packet *in_pack) {
 		return 1;
 	}
 
-	union {
-		int8_t	i8;
-		int16_t	i16;
-		u_int8_t	u8;
-		u_int16_t	u16;
-		u_int32_t	u32;
-		u_int64_t	u64;
-	} u;
-	union {
-		int8_t		i8;
-		int16_t		i16;
-		u_int8_t	u8;
-		u_int16_t	u16;
-		u_int32_t	u32;
-		u_int64_t	u64;
-	} u2;
-
-	u2.u64 = 0;
-
 	struct ieee80211_radiotap_header *hdr;
-	u_int32_t present, next_present;
-	u_int32_t *presentp, *last_presentp;
-	enum ieee80211_radiotap_type bit;
-	int bit0;
-	const u_char *iter;
-	const u_char *iter_start;
-	unsigned int iter_align;
+	unsigned int num_present;
 	int fcs_cut = 0; // Is the FCS bit set?
     bool fcs_flag_invalid = false; // Do we have a flag that tells us the fcs is known bad?
 	char errstr[STATUS_MAX];
 
 	kis_layer1_packinfo *radioheader = NULL;
 
-    if (linkchunk->length < sizeof(*hdr)) {
-		snprintf(errstr, STATUS_MAX, "pcap radiotap converter got corrupted "
-				 "Radiotap header length");
-		globalreg->messagebus->InjectMessage(errstr, MSGFLAG_ERROR);
-        return 0;
-    }
+    int present_r = 
+        radiotap_layout_cache::count_present(linkchunk->data, linkchunk->length,
+                &num_present);
 
-	// Assign it to the callback data
-    hdr = (struct ieee80211_radiotap_header *) linkchunk->data;
-    if (linkchunk->length < EXTRACT_LE_16BITS(&hdr->it_len)) {
+    if (present_r == -1) {
 		snprintf(errstr, STATUS_MAX, "pcap radiotap converter got corrupted "
 				 "Radiotap header length");
 		globalreg->messagebus->InjectMessage(errstr, MSGFLAG_ERROR);
         return 0;
-    }
-
-	// null-statement for-loop
-    for (last_presentp = &hdr->it_present;
-         (EXTRACT_LE_32BITS(last_presentp) & BIT(IEEE80211_RADIOTAP_EXT)) != 0 &&
-         (u_char *) (last_presentp + 1) <= linkchunk->data + 
-		 EXTRACT_LE_16BITS(&(hdr->it_len)); last_presentp++);
-
-    /* are there more bitmap extensions than bytes in header? */
-    if ((EXTRACT_LE_32BITS(last_presentp) & BIT(IEEE80211_RADIOTAP_EXT)) != 0) {
+    } else if (present_r < 0) {
 		snprintf(errstr, STATUS_MAX, "pcap radiotap converter got corrupted "
 				 "Radiotap bitmap length");
 		globalreg->messagebus->InjectMessage(errstr, MSGFLAG_ERROR);
         return 0;
     }
 
-	decapchunk = new kis_datachunk;
-	radioheader = new kis_layer1_packinfo;
+    hdr = (struct ieee80211_radiotap_header *) linkchunk->data;
+
+    // Pull the fields we use, from the cached layout of this present bitmask
+    // when we've seen it before
+    radiotap_fields rtf;
+    layout_cache.decode(linkchunk->data, num_present, &rtf);
+
+	decapchunk = datachunk_pool->acquire();
+	radioheader = radiodata_pool->acquire();
 
 	decapchunk->dlt = KDLT_IEEE802_11;
-	
-    iter = (u_char*)(last_presentp + 1); 
-    // Alignment in Radiotap must be done from the beginning of the header, 
-    // not from the byte following the last bitmap. 
-    iter_start = (u_char*)(linkchunk->data); 
-
-    for (bit0 = 0, presentp = &hdr->it_present; presentp <= last_presentp;
-         presentp++, bit0 += 32) {
-        for (present = EXTRACT_LE_32BITS(presentp); present; present = next_present) {
-            /* clear the least significant bit that is set */
-            next_present = present & (present - 1);
-
-            /* extract the least significant bit that is set */
-            bit = (enum ieee80211_radiotap_type)
-                (bit0 + BITNO_32(present ^ next_present));
-
-            switch (bit) {
-                case IEEE80211_RADIOTAP_FLAGS:
-                case IEEE80211_RADIOTAP_RATE:
-				/*
-                case IEEE80211_RADIOTAP_DB_ANTSIGNAL:
-                case IEEE80211_RADIOTAP_DB_ANTNOISE:
-				*/
-                case IEEE80211_RADIOTAP_DBM_ANTSIGNAL:
-                case IEEE80211_RADIOTAP_DBM_ANTNOISE:
-                case IEEE80211_RADIOTAP_ANTENNA:
-                    u.u8 = *iter++;
-                    break;
-                case IEEE80211_RADIOTAP_DBM_TX_POWER:
-                    u.i8 = *iter++;
-                    break;
-                case IEEE80211_RADIOTAP_CHANNEL:
-					iter_align = ALIGN_OFFSET((unsigned int) (iter - iter_start), 2);
-					iter += iter_align;
-
-                    u.u16 = EXTRACT_LE_16BITS(iter);
-                    iter += sizeof(u.u16);
-                    u2.u16 = EXTRACT_LE_16BITS(iter);
-                    iter += sizeof(u2.u16);
-                    break;
-                case IEEE80211_RADIOTAP_FHSS:
-                case IEEE80211_RADIOTAP_LOCK_QUALITY:
-                case IEEE80211_RADIOTAP_TX_ATTENUATION:
-                case IEEE80211_RADIOTAP_DB_TX_ATTENUATION:
-					iter_align = ALIGN_OFFSET((unsigned int) (iter - iter_start), 2);
-					iter += iter_align;
-
-                    u.u16 = EXTRACT_LE_16BITS(iter);
-                    iter += sizeof(u.u16);
-                    break;
-                case IEEE80211_RADIOTAP_TSFT:
-					iter_align = ALIGN_OFFSET((unsigned int) (iter - iter_start), 8);
-					iter += iter_align;
-
-                    u.u64 = EXTRACT_LE_64BITS(iter);
-                    iter += sizeof(u.u64);
-                    break;
-#if defined(SYS_OPENBSD)
-                case IEEE80211_RADIOTAP_RSSI:
-                    u.u8 = EXTRACT_LE_8BITS(iter);
-                    iter += sizeof(u.u8);
-                    u2.u8 = EXTRACT_LE_8BITS(iter);
-                    iter += sizeof(u2.u8);
-                    break;
-#endif
-                default:
-                    /* this bit indicates a field whose
-                     * size we do not know, so we cannot
-                     * proceed.
-                     */
-                    next_present = 0;
-                    continue;
-            }
-
-			// static int pnum = 0;
-            switch (bit) {
-                case IEEE80211_RADIOTAP_CHANNEL:
-                    // radioheader->channel = ieee80211_mhz2ieee(u.u16, u2.u16);
-                    radioheader->freq_khz = (double) u.u16 * 1000;
-					// printf("debug - %d freq %u\n", pnum++, radioheader->freq_mhz);
-                    if (IEEE80211_IS_CHAN_FHSS(u2.u16))
-                        radioheader->carrier = carrier_80211fhss;
-                    else if (IEEE80211_IS_CHAN_A(u2.u16))
-                        radioheader->carrier = carrier_80211a;
-                    else if (IEEE80211_IS_CHAN_BPLUS(u2.u16))
-                        radioheader->carrier = carrier_80211bplus;
-                    else if (IEEE80211_IS_CHAN_B(u2.u16))
-                        radioheader->carrier = carrier_80211b;
-                    else if (IEEE80211_IS_CHAN_PUREG(u2.u16))
-                        radioheader->carrier = carrier_80211g;
-                    else if (IEEE80211_IS_CHAN_G(u2.u16))
-                        radioheader->carrier = carrier_80211g;
-                    else if (IEEE80211_IS_CHAN_T(u2.u16))
-                        radioheader->carrier = carrier_80211a;/*XXX*/
-                    else
-                        radioheader->carrier = carrier_unknown;
-                    if ((u2.u16 & IEEE80211_CHAN_CCK) == IEEE80211_CHAN_CCK)
-                        radioheader->encoding = encoding_cck;
-                    else if ((u2.u16 & IEEE80211_CHAN_OFDM) == IEEE80211_CHAN_OFDM)
-                        radioheader->encoding = encoding_ofdm;
-                    else if ((u2.u16 & IEEE80211_CHAN_DYN) == IEEE80211_CHAN_DYN)
-                        radioheader->encoding = encoding_dynamiccck;
-                    else if ((u2.u16 & IEEE80211_CHAN_GFSK) == IEEE80211_CHAN_GFSK)
-                        radioheader->encoding = encoding_gfsk;
-                    else
-                        radioheader->encoding = encoding_unknown;
-                    break;
-                case IEEE80211_RADIOTAP_RATE:
-					/* strip basic rate bit & convert to kismet units */
-                    radioheader->datarate = ((u.u8 &~ 0x80) / 2) * 10;
-                    break;
-				/* ignore DB values, they're not helpful
-                case IEEE80211_RADIOTAP_DB_ANTSIGNAL:
-                    radioheader->signal_dbm = u.i8;
-                    break;
-                case IEEE80211_RADIOTAP_DB_ANTNOISE:
-                    radioheader->noise_dbm = u.i8;
-                    break;
-				*/
-				case IEEE80211_RADIOTAP_DBM_ANTSIGNAL:
-                    radioheader->signal_type = kis_l1_signal_type_dbm;
-					radioheader->signal_dbm = u.i8;
-					break;
-				case IEEE80211_RADIOTAP_DBM_ANTNOISE:
-                    radioheader->signal_type = kis_l1_signal_type_dbm;
-					radioheader->noise_dbm = u.i8;
-					break;
-                case IEEE80211_RADIOTAP_FLAGS:
-                    if (u.u8 & IEEE80211_RADIOTAP_F_FCS) {
-						fcs_cut = 4;
-					}
-
-                    if (u.u8 & IEEE80211_RADIOTAP_F_BADFCS) {
-                        fcs_flag_invalid = true;
-                    }
-
-                    break;
-#if defined(SYS_OPENBSD)
-                case IEEE80211_RADIOTAP_RSSI:
-                    /* Convert to Kismet units...  No reason to use RSSI units
-					 * here since we know the conversion factor */
-                    radioheader->signal_type = kis_l1_signal_type_dbm;
-                    radioheader->signal_dbm = int((float(u.u8) / float(u2.u8) * 255));
-                    break;
-#endif
-                default:
-                    break;
-            }
+
+    if (rtf.has_flags) {
+        if (rtf.flags & IEEE80211_RADIOTAP_F_FCS) {
+            fcs_cut = 4;
+        }
+
+        if (rtf.flags & IEEE80211_RADIOTAP_F_BADFCS) {
+            fcs_flag_invalid = true;
         }
     }
 
+    if (rtf.has_rate) {
+        /* strip basic rate bit & convert to kismet units */
+        radioheader->datarate = ((rtf.rate &~ 0x80) / 2) * 10;
+    }
+
+    if (rtf.has_channel) {
+        radioheader->freq_khz = (double) rtf.chan_freq * 1000;
+
+        if (IEEE80211_IS_CHAN_FHSS(rtf.chan_flags))
+            radioheader->carrier = carrier_80211fhss;
+        else if (IEEE80211_IS_CHAN_A(rtf.chan_flags))
+            radioheader->carrier = carrier_80211a;
+        else if (IEEE80211_IS_CHAN_BPLUS(rtf.chan_flags))
+            radioheader->carrier = carrier_80211bplus;
+        else if (IEEE80211_IS_CHAN_B(rtf.chan_flags))
+            radioheader->carrier = carrier_80211b;
+        else if (IEEE80211_IS_CHAN_PUREG(rtf.chan_flags))
+            radioheader->carrier = carrier_80211g;
+        else if (IEEE80211_IS_CHAN_G(rtf.chan_flags))
+            radioheader->carrier = carrier_80211g;
+        else if (IEEE80211_IS_CHAN_T(rtf.chan_flags))
+            radioheader->carrier = carrier_80211a;/*XXX*/
+        else
+            radioheader->carrier = carrier_unknown;
+
+        if ((rtf.chan_flags & IEEE80211_CHAN_CCK) == IEEE80211_CHAN_CCK)
+            radioheader->encoding = encoding_cck;
+        else if ((rtf.chan_flags & IEEE80211_CHAN_OFDM) == IEEE80211_CHAN_OFDM)
+            radioheader->encoding = encoding_ofdm;
+        else if ((rtf.chan_flags & IEEE80211_CHAN_DYN) == IEEE80211_CHAN_DYN)
+            radioheader->encoding = encoding_dynamiccck;
+        else if ((rtf.chan_flags & IEEE80211_CHAN_GFSK) == IEEE80211_CHAN_GFSK)
+            radioheader->encoding = encoding_gfsk;
+        else
+            radioheader->encoding = encoding_unknown;
+    }
+
+    if (rtf.has_signal) {
+        radioheader->signal_type = kis_l1_signal_type_dbm;
+        radioheader->signal_dbm = rtf.signal_dbm;
+    }
+
+    if (rtf.has_noise) {
+        radioheader->signal_type = kis_l1_signal_type_dbm;
+        radioheader->noise_dbm = rtf.noise_dbm;
+    }
+
+#if defined(SYS_OPENBSD)
+    if (rtf.has_rssi) {
+        /* Convert to Kismet units...  No reason to use RSSI units
+         * here since we know the conversion factor */
+        radioheader->signal_type = kis_l1_signal_type_dbm;
+        radioheader->signal_dbm = int((float(rtf.rssi) / float(rtf.max_rssi) * 255));
+    }
+#endif
+
 	if (EXTRACT_LE_16BITS(&(hdr->it_len)) + fcs_cut > (int) linkchunk->length) {
 		/*
 		_MSG("Pcap Radiotap converter got corrupted Radiotap frame, not "
 			 "long enough for radiotap header plus indicated FCS", MSGFLAG_ERROR);
 		*/
-		delete decapchunk;
-		delete radioheader;
+		datachunk_pool->recycle(decapchunk);
+		radiodata_pool->recycle(radioheader);
         return 0;
 	}
 
@@ -397,7 +274,7 @@ int Kis_DLT_Radiotap::HandlePacket(kis_packet *in_pack) {
 
     // If we're slicing the FCS into its own record and we have the space
 	if (fcs_cut && linkchunk->length > 4) {
-		fcschunk = new kis_packet_checksum;
+		fcschunk = checksum_pool->acquire();
 
 		fcschunk->set_data(&(linkchunk->data[linkchunk->length - 4]), 4);
 
@@ -411,7 +288,7 @@ int Kis_DLT_Radiotap::HandlePacket(kis_packet *in_pack) {
     // If we're not slicing the fcs into its own record, but we know
     // it's bad, we make a junk FCS and set it bad
     if (!fcs_cut && fcs_flag_invalid) {
-        fcschunk = new kis_packet_checksum;
+        fcschunk = checksum_pool->acquire();
        
         // Set data of all FF, force a copy
         uint8_t junkfcs[] = {0xFF, 0xFF, 0xFF, 0xFF};
@@ -456,12 +333,6 @@ int Kis_DLT_Radiotap::HandlePacket(kis_packet *in_pack) {
 
     return 1;
 }
-#undef BITNO_32
-#undef BITNO_16
-#undef BITNO_8
-#undef BITNO_4
-#undef BITNO_2
-#undef BIT
 
 // Taken from the BBN USRP 802.11 encoding code
 unsigned int Kis_DLT_Radiotap::update_crc32_80211(unsigned int crc, const unsigned char *data,
@@ -27,6 +27,7 @@
 #include "packet.h"
 #include "packetchain.h"
 #include "kis_dlt.h"
+#include "radiotap_layout.h"
 
 #ifndef DLT_IEEE802_11_RADIO	
 #define DLT_IEEE802_11_RADIO 127
@@ -48,6 +49,9 @@ protected:
     unsigned int crc32_le_80211(unsigned int *crc32_table, const unsigned char *buf, int len);
 
     unsigned int crc32_table[256];
+
+    // Field layouts of the present bitmasks we've seen
+    radiotap_layout_cache layout_cache;
 };
 
 #endif
@@ -77,7 +77,11 @@ bool KisPPILogfile::Log_Open(std::string in_path) {
 
     set_int_log_open(true);
 
-	packetchain->RegisterHandler(&KisPPILogfile::packet_handler, this, CHAINPOS_LOGGING, -100);
+	packetchain->RegisterHandler(&KisPPILogfile::packet_handler, this, CHAINPOS_LOGGING, -100,
+            "ppi logger");
+
+    // We log decrypted frames in place of the originals when we have them
+    packetchain->RegisterComponentConsumer(pack_comp_mangleframe);
 
     return true;
 }
@@ -85,13 +89,19 @@ bool KisPPILogfile::Log_Open(std::string in_path) {
 void KisPPILogfile::Log_Close() {
     local_locker lock(&log_mutex);
 
+    bool was_open = get_log_open();
+
     set_int_log_open(false);
 
     std::shared_ptr<Packetchain> packetchain =
         Globalreg::FetchGlobalAs<Packetchain>(globalreg, "PACKETCHAIN");
-    if (packetchain != NULL) 
+    if (packetchain != NULL) {
         packetchain->RemoveHandler(&KisPPILogfile::packet_handler, CHAINPOS_LOGGING);
 
+        if (was_open)
+            packetchain->RemoveComponentConsumer(pack_comp_mangleframe);
+    }
+
     // Close files
     if (dumper != NULL) {
         pcap_dump_flush(dumper);
@@ -0,0 +1,502 @@
+/*
+    This file is part of Kismet
+
+    Kismet is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kismet is distributed in the hope that it will be useful,
+      but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Kismet; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "config.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#include "kis_shmring.h"
+
+#ifdef SYS_LINUX
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/eventfd.h>
+#endif
+
+#if defined(SYS_LINUX) && defined(SYS_memfd_create)
+#define HAVE_KIS_SHMRING 1
+#endif
+
+/* Record header; len is the payload length, not counting the header or the
+ * alignment padding */
+typedef struct {
+    uint32_t len;
+    uint32_t flags;
+} kis_shmring_rec_t;
+
+/* Record fills the rest of the ring and holds no data */
+#define KIS_SHMRING_REC_PAD     1
+
+#define KIS_SHMRING_ALIGN(x)    (((x) + 7) & ~((uint64_t) 7))
+
+/* Record space starts on its own page */
+#define KIS_SHMRING_DATA_OFFT   4096
+
+#ifdef HAVE_KIS_SHMRING
+
+int kis_shmring_supported(void) {
+    return 1;
+}
+
+static kis_shmring_t *kis_shmring_map(int in_mem_fd, int in_data_efd, int in_space_efd,
+        size_t in_map_len) {
+    kis_shmring_t *ring;
+    void *map;
+
+    map = mmap(NULL, in_map_len, PROT_READ | PROT_WRITE, MAP_SHARED, in_mem_fd, 0);
+
+    if (map == MAP_FAILED)
+        return NULL;
+
+    ring = (kis_shmring_t *) malloc(sizeof(kis_shmring_t));
+
+    if (ring == NULL) {
+        munmap(map, in_map_len);
+        return NULL;
+    }
+
+    ring->hdr = (kis_shmring_hdr_t *) map;
+    ring->data = (uint8_t *) map + KIS_SHMRING_DATA_OFFT;
+    ring->mask = in_map_len - KIS_SHMRING_DATA_OFFT - 1;
+    ring->map_len = in_map_len;
+
+    ring->mem_fd = in_mem_fd;
+    ring->data_efd = in_data_efd;
+    ring->space_efd = in_space_efd;
+
+    ring->reserve_head = 0;
+    ring->peek_tail = 0;
+    ring->consume_tail = 0;
+
+    return ring;
+}
+
+kis_shmring_t *kis_shmring_create(size_t in_size) {
+    kis_shmring_t *ring;
+    uint64_t size = 4096;
+    int mem_fd, data_efd, space_efd;
+
+    while (size < in_size)
+        size <<= 1;
+
+    /* The descriptors only get passed to the helper we launch, which clears
+     * close-on-exec for them in the child */
+    mem_fd = (int) syscall(SYS_memfd_create, "kismet-shmring", 1 /* MFD_CLOEXEC */);
+
+    if (mem_fd < 0)
+        return NULL;
+
+    if (ftruncate(mem_fd, KIS_SHMRING_DATA_OFFT + size) < 0) {
+        close(mem_fd);
+        return NULL;
+    }
+
+    data_efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+    if (data_efd < 0) {
+        close(mem_fd);
+        return NULL;
+    }
+
+    space_efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+    if (space_efd < 0) {
+        close(data_efd);
+        close(mem_fd);
+        return NULL;
+    }
+
+    ring = kis_shmring_map(mem_fd, data_efd, space_efd, KIS_SHMRING_DATA_OFFT + size);
+
+    if (ring == NULL) {
+        close(space_efd);
+        close(data_efd);
+        close(mem_fd);
+        return NULL;
+    }
+
+    memset(ring->hdr, 0, sizeof(kis_shmring_hdr_t));
+
+    ring->hdr->size = size;
+
+    /* The consumer starts out waiting for the first record */
+    ring->hdr->consumer_waiting = 1;
+
+    ring->hdr->version = KIS_SHMRING_VERSION;
+    __atomic_store_n(&(ring->hdr->magic), KIS_SHMRING_MAGIC, __ATOMIC_RELEASE);
+
+    return ring;
+}
+
+kis_shmring_t *kis_shmring_attach(int in_mem_fd, int in_data_efd, int in_space_efd) {
+    kis_shmring_t *ring;
+    struct stat sbuf;
+    uint64_t size;
+
+    if (fstat(in_mem_fd, &sbuf) < 0)
+        return NULL;
+
+    if (sbuf.st_size <= KIS_SHMRING_DATA_OFFT)
+        return NULL;
+
+    size = (uint64_t) sbuf.st_size - KIS_SHMRING_DATA_OFFT;
+
+    if ((size & (size - 1)) != 0)
+        return NULL;
+
+    ring = kis_shmring_map(in_mem_fd, in_data_efd, in_space_efd, sbuf.st_size);
+
+    if (ring == NULL)
+        return NULL;
+
+    if (__atomic_load_n(&(ring->hdr->magic), __ATOMIC_ACQUIRE) != KIS_SHMRING_MAGIC ||
+            ring->hdr->version != KIS_SHMRING_VERSION ||
+            ring->hdr->size != size) {
+        munmap(ring->hdr, ring->map_len);
+        free(ring);
+        return NULL;
+    }
+
+    ring->reserve_head = ring->hdr->head;
+    ring->peek_tail = ring->hdr->tail;
+    ring->consume_tail = ring->peek_tail;
+
+    return ring;
+}
+
+void kis_shmring_free(kis_shmring_t *ring) {
+    if (ring == NULL)
+        return;
+
+    munmap(ring->hdr, ring->map_len);
+
+    if (ring->mem_fd >= 0)
+        close(ring->mem_fd);
+    if (ring->data_efd >= 0)
+        close(ring->data_efd);
+    if (ring->space_efd >= 0)
+        close(ring->space_efd);
+
+    free(ring);
+}
+
+size_t kis_shmring_used(kis_shmring_t *ring) {
+    return __atomic_load_n(&(ring->hdr->head), __ATOMIC_ACQUIRE) -
+        __atomic_load_n(&(ring->hdr->tail), __ATOMIC_ACQUIRE);
+}
+
+/* Ring the doorbell of the other side if it flagged that it's sleeping.  The
+ * caller has just published a new position; the fence orders that against
+ * reading the flag, pairing with the fence in the sleeper between setting the
+ * flag and re-checking the position. */
+static void kis_shmring_doorbell(uint32_t *waiting, int in_efd) {
+    uint64_t one = 1;
+    ssize_t r;
+
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    if (__atomic_load_n(waiting, __ATOMIC_RELAXED) == 0)
+        return;
+
+    if (__atomic_exchange_n(waiting, 0, __ATOMIC_ACQ_REL) == 0)
+        return;
+
+    r = write(in_efd, &one, sizeof(uint64_t));
+    (void) r;
+}
+
+static void kis_shmring_clear_efd(int in_efd) {
+    uint64_t v;
+    ssize_t r;
+
+    r = read(in_efd, &v, sizeof(uint64_t));
+    (void) r;
+}
+
+int kis_shmring_reserve(kis_shmring_t *ring, size_t in_len, uint8_t **ret_data) {
+    uint64_t size = ring->mask + 1;
+    uint64_t head = ring->hdr->head;
+    uint64_t tail = __atomic_load_n(&(ring->hdr->tail), __ATOMIC_ACQUIRE);
+    uint64_t rec_len = KIS_SHMRING_ALIGN(sizeof(kis_shmring_rec_t) + in_len);
+    uint64_t offt = head & ring->mask;
+    uint64_t remaining = size - offt;
+    uint64_t pad = 0;
+    kis_shmring_rec_t *rec;
+
+    /* Waiting won't ever make room for this */
+    if (in_len > UINT32_MAX || rec_len > size)
+        return -1;
+
+    /* Records never wrap; pad out the end of the ring */
+    if (rec_len > remaining)
+        pad = remaining;
+
+    if ((head - tail) + pad + rec_len > size) {
+        /* The record only fits at the start of the ring, and no amount of
+         * draining will get it there while the padding is in the way; publish
+         * the padding by itself so the consumer skips it */
+        if (pad != 0 && head == tail) {
+            rec = (kis_shmring_rec_t *) (ring->data + offt);
+            rec->len = pad - sizeof(kis_shmring_rec_t);
+            rec->flags = KIS_SHMRING_REC_PAD;
+
+            ring->reserve_head = head + pad;
+            kis_shmring_commit(ring);
+        }
+
+        return 0;
+    }
+
+    if (pad != 0) {
+        rec = (kis_shmring_rec_t *) (ring->data + offt);
+        rec->len = pad - sizeof(kis_shmring_rec_t);
+        rec->flags = KIS_SHMRING_REC_PAD;
+
+        head += pad;
+        offt = 0;
+    }
+
+    rec = (kis_shmring_rec_t *) (ring->data + offt);
+    rec->len = in_len;
+    rec->flags = 0;
+
+    ring->reserve_head = head + rec_len;
+
+    *ret_data = ring->data + offt + sizeof(kis_shmring_rec_t);
+
+    return 1;
+}
+
+void kis_shmring_commit(kis_shmring_t *ring) {
+    __atomic_store_n(&(ring->hdr->head), ring->reserve_head, __ATOMIC_RELEASE);
+
+    kis_shmring_doorbell(&(ring->hdr->consumer_waiting), ring->data_efd);
+}
+
+/* Sleep on the space doorbell until the consumer moves the tail away from
+ * in_tail, or until the timeout */
+static int kis_shmring_wait_consumer(kis_shmring_t *ring, uint64_t in_tail,
+        int in_timeout_ms) {
+    struct pollfd pfd;
+    int r;
+
+    __atomic_store_n(&(ring->hdr->producer_waiting), 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    if (__atomic_load_n(&(ring->hdr->tail), __ATOMIC_ACQUIRE) != in_tail) {
+        __atomic_store_n(&(ring->hdr->producer_waiting), 0, __ATOMIC_RELAXED);
+        return 1;
+    }
+
+    pfd.fd = ring->space_efd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+
+    r = poll(&pfd, 1, in_timeout_ms);
+
+    __atomic_store_n(&(ring->hdr->producer_waiting), 0, __ATOMIC_RELAXED);
+
+    if (r < 0) {
+        if (errno == EINTR)
+            return 0;
+        return -1;
+    }
+
+    if (r == 0)
+        return 0;
+
+    kis_shmring_clear_efd(ring->space_efd);
+
+    return 1;
+}
+
+int kis_shmring_wait_space(kis_shmring_t *ring, int in_timeout_ms) {
+    return kis_shmring_wait_consumer(ring,
+            __atomic_load_n(&(ring->hdr->tail), __ATOMIC_ACQUIRE), in_timeout_ms);
+}
+
+int kis_shmring_wait_drain(kis_shmring_t *ring, int in_timeout_ms) {
+    struct timeval start, now;
+    uint64_t tail;
+    int elapsed, r;
+
+    gettimeofday(&start, NULL);
+
+    while (1) {
+        tail = __atomic_load_n(&(ring->hdr->tail), __ATOMIC_ACQUIRE);
+
+        if (tail == ring->hdr->head)
+            return 1;
+
+        gettimeofday(&now, NULL);
+
+        elapsed = (now.tv_sec - start.tv_sec) * 1000 +
+            (now.tv_usec - start.tv_usec) / 1000;
+
+        if (elapsed >= in_timeout_ms)
+            return 0;
+
+        r = kis_shmring_wait_consumer(ring, tail, in_timeout_ms - elapsed);
+
+        if (r < 0)
+            return -1;
+    }
+}
+
+int kis_shmring_peek(kis_shmring_t *ring, const uint8_t **ret_data, size_t *ret_len) {
+    /* Everything in the header can be rewritten by the producer; only trust
+     * our own size and tail, and check the head against them */
+    uint64_t size = ring->mask + 1;
+    uint64_t tail = ring->consume_tail;
+    uint64_t head = __atomic_load_n(&(ring->hdr->head), __ATOMIC_ACQUIRE);
+    uint64_t offt, rec_len;
+    kis_shmring_rec_t rec;
+
+    if (ring->hdr->size != size || head - tail > size)
+        return -1;
+
+    while (1) {
+        if (tail == head)
+            return 0;
+
+        offt = tail & ring->mask;
+
+        /* The record header is written by the other process; copy it once so
+         * it can't change between checking and using it */
+        memcpy(&rec, ring->data + offt, sizeof(kis_shmring_rec_t));
+
+        if (head - tail < sizeof(kis_shmring_rec_t))
+            return -1;
+
+        if (rec.flags & KIS_SHMRING_REC_PAD) {
+            if (rec.len + sizeof(kis_shmring_rec_t) != size - offt ||
+                    head - tail < size - offt)
+                return -1;
+
+            /* Skip the padding straight away; the producer may be waiting on
+             * it to get to the start of the ring */
+            tail += size - offt;
+            ring->consume_tail = tail;
+            __atomic_store_n(&(ring->hdr->tail), tail, __ATOMIC_RELEASE);
+
+            kis_shmring_doorbell(&(ring->hdr->producer_waiting), ring->space_efd);
+
+            continue;
+        }
+
+        rec_len = KIS_SHMRING_ALIGN(sizeof(kis_shmring_rec_t) + (uint64_t) rec.len);
+
+        if (rec_len > size - offt || rec_len > head - tail)
+            return -1;
+
+        *ret_data = ring->data + offt + sizeof(kis_shmring_rec_t);
+        *ret_len = rec.len;
+
+        ring->peek_tail = tail + rec_len;
+
+        return 1;
+    }
+}
+
+void kis_shmring_consume(kis_shmring_t *ring) {
+    ring->consume_tail = ring->peek_tail;
+    __atomic_store_n(&(ring->hdr->tail), ring->consume_tail, __ATOMIC_RELEASE);
+
+    kis_shmring_doorbell(&(ring->hdr->producer_waiting), ring->space_efd);
+}
+
+int kis_shmring_consumer_sleep(kis_shmring_t *ring) {
+    __atomic_store_n(&(ring->hdr->consumer_waiting), 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    if (__atomic_load_n(&(ring->hdr->head), __ATOMIC_ACQUIRE) != ring->consume_tail) {
+        __atomic_store_n(&(ring->hdr->consumer_waiting), 0, __ATOMIC_RELAXED);
+        return 1;
+    }
+
+    return 0;
+}
+
+void kis_shmring_consumer_wake(kis_shmring_t *ring) {
+    kis_shmring_clear_efd(ring->data_efd);
+}
+
+#else
+
+int kis_shmring_supported(void) {
+    return 0;
+}
+
+kis_shmring_t *kis_shmring_create(size_t in_size) {
+    return NULL;
+}
+
+kis_shmring_t *kis_shmring_attach(int in_mem_fd, int in_data_efd, int in_space_efd) {
+    return NULL;
+}
+
+void kis_shmring_free(kis_shmring_t *ring) {
+
+}
+
+size_t kis_shmring_used(kis_shmring_t *ring) {
+    return 0;
+}
+
+int kis_shmring_reserve(kis_shmring_t *ring, size_t in_len, uint8_t **ret_data) {
+    return -1;
+}
+
+void kis_shmring_commit(kis_shmring_t *ring) {
+
+}
+
+int kis_shmring_wait_space(kis_shmring_t *ring, int in_timeout_ms) {
+    return -1;
+}
+
+int kis_shmring_wait_drain(kis_shmring_t *ring, int in_timeout_ms) {
+    return -1;
+}
+
+int kis_shmring_peek(kis_shmring_t *ring, const uint8_t **ret_data, size_t *ret_len) {
+    return -1;
+}
+
+void kis_shmring_consume(kis_shmring_t *ring) {
+
+}
+
+int kis_shmring_consumer_sleep(kis_shmring_t *ring) {
+    return 0;
+}
+
+void kis_shmring_consumer_wake(kis_shmring_t *ring) {
+
+}
+
+#endif
+
@@ -0,0 +1,151 @@
+/*
+    This file is part of Kismet
+
+    Kismet is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kismet is distributed in the hope that it will be useful,
+      but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Kismet; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/* Shared memory frame ring between the server and a local capture helper
+ *
+ * A single-producer, single-consumer ring of variable length records in a
+ * memfd mapped by both processes.  The helper writes complete protocol frames
+ * directly into the ring and the server reads them in place, so a frame costs
+ * no system calls on either side while both are busy.
+ *
+ * Each side only sleeps when the ring gives it nothing to do, and flags that
+ * it is sleeping in the ring header; the other side rings an eventfd doorbell
+ * only when it finds that flag set, so a busy ring runs without any doorbells.
+ *
+ * Records are 8 byte aligned and never wrap; a record which doesn't fit
+ * before the end of the ring is preceded by a padding record filling the
+ * remainder.
+ *
+ * The ring is created by the server, which passes the memfd and the two
+ * eventfds to the helper on the command line when it launches it.
+ */
+
+#ifndef __KIS_SHMRING_H__
+#define __KIS_SHMRING_H__
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define KIS_SHMRING_MAGIC       0x4B534852
+#define KIS_SHMRING_VERSION     1
+
+/* Smallest ring the server offers a helper.  A helper can't send a frame
+ * larger than its 256KB output buffer, and a ring of twice that always has
+ * room for the largest frame once it drains, wherever the padding falls. */
+#define KIS_SHMRING_MIN_SIZE    (1024 * 512)
+
+/* Shared header at the start of the mapping; the producer and consumer
+ * positions are on separate cache lines */
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t size;
+
+    /* Written by the producer */
+    uint64_t head __attribute__((aligned(64)));
+    uint32_t producer_waiting;
+
+    /* Written by the consumer */
+    uint64_t tail __attribute__((aligned(64)));
+    uint32_t consumer_waiting;
+} __attribute__((aligned(64))) kis_shmring_hdr_t;
+
+typedef struct {
+    kis_shmring_hdr_t *hdr;
+    uint8_t *data;
+
+    /* Record space size - 1, from the size of the mapping.  The header is
+     * writeable by the other process, so its size is only trusted when the
+     * ring is set up; bounds checks always use the mask. */
+    uint64_t mask;
+
+    size_t map_len;
+
+    int mem_fd;
+    /* Producer to consumer, frames available */
+    int data_efd;
+    /* Consumer to producer, space available */
+    int space_efd;
+
+    /* Producer position after the pending reservation */
+    uint64_t reserve_head;
+    /* Consumer position after the peeked record */
+    uint64_t peek_tail;
+    /* Consumer position last published in the header */
+    uint64_t consume_tail;
+} kis_shmring_t;
+
+/* Is a shared memory ring supported on this platform */
+int kis_shmring_supported(void);
+
+/* Create a ring with at least in_size bytes of record space (rounded up to a
+ * power of two).  The descriptors are inherited across exec.  Returns NULL on
+ * failure. */
+kis_shmring_t *kis_shmring_create(size_t in_size);
+
+/* Attach to a ring created by the server from the descriptors passed on the
+ * command line */
+kis_shmring_t *kis_shmring_attach(int in_mem_fd, int in_data_efd, int in_space_efd);
+
+/* Unmap the ring and close the descriptors */
+void kis_shmring_free(kis_shmring_t *ring);
+
+/* Bytes of record space in use */
+size_t kis_shmring_used(kis_shmring_t *ring);
+
+/* Producer: reserve space for a record of in_len bytes.  Returns 1 and sets
+ * ret_data to where to write it, 0 if the ring doesn't have room yet, and -1
+ * if the record is too large to ever fit. */
+int kis_shmring_reserve(kis_shmring_t *ring, size_t in_len, uint8_t **ret_data);
+
+/* Producer: publish the reserved record, waking the consumer if it's asleep */
+void kis_shmring_commit(kis_shmring_t *ring);
+
+/* Producer: wait up to in_timeout_ms for the consumer to free space.  Returns
+ * 1 if space may be available, 0 on timeout, and -1 on error. */
+int kis_shmring_wait_space(kis_shmring_t *ring, int in_timeout_ms);
+
+/* Producer: wait up to in_timeout_ms for the consumer to read everything */
+int kis_shmring_wait_drain(kis_shmring_t *ring, int in_timeout_ms);
+
+/* Consumer: get the next record in place.  Returns 1 and sets ret_data and
+ * ret_len when there's a record, 0 when the ring is empty, and -1 if the
+ * ring is corrupt. */
+int kis_shmring_peek(kis_shmring_t *ring, const uint8_t **ret_data, size_t *ret_len);
+
+/* Consumer: release the record returned by peek, waking the producer if it's
+ * waiting for space */
+void kis_shmring_consume(kis_shmring_t *ring);
+
+/* Consumer: flag that we're about to sleep on the data doorbell.  Returns 0
+ * when it's safe to sleep, or 1 if records arrived and should be read first. */
+int kis_shmring_consumer_sleep(kis_shmring_t *ring);
+
+/* Consumer: clear the data doorbell after waking */
+void kis_shmring_consumer_wake(kis_shmring_t *ring);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
@@ -75,6 +75,7 @@
 #include "kis_net_microhttpd.h"
 #include "system_monitor.h"
 #include "channeltracker2.h"
+#include "packet_retro.h"
 #include "kis_httpd_websession.h"
 #include "kis_httpd_registry.h"
 #include "messagebus_restclient.h"
@@ -929,6 +930,9 @@ int main(int argc, char *argv[], char *envp[]) {
     // Add channel tracking
     Channeltracker_V2::create_channeltracker(globalregistry);
 
+    // Keep recent packets per device for retroactive pcap export
+    Packet_Retro_Buffer::create_retrobuffer(globalregistry);
+
     if (globalregistry->fatal_condition)
         CatchShutdown(-1);
 
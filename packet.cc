@@ -38,6 +38,9 @@
 kis_packet::kis_packet(GlobalRegistry *in_globalreg) {
 	globalreg = in_globalreg;
 
+    ts.tv_sec = 0;
+    ts.tv_usec = 0;
+
 	error = 0;
 	filtered = 0;
     duplicate = 0;
@@ -53,19 +56,39 @@ kis_packet::kis_packet(GlobalRegistry *in_globalreg) {
 kis_packet::~kis_packet() {
 	// Delete everything we contain when we die.  I hope whomever put
 	// it there expected this.
+    reset();
+}
+
+void kis_packet::reset() {
 	for (unsigned int y = 0; y < MAX_PACKET_COMPONENTS; y++) {
 		packet_component *pcm = content_vec[y];
 
 		if (pcm == NULL)
 			continue;
 
-		// If it's marked for self-destruction, delete it.  Otherwise, 
-		// someone else is responsible for removing it.
-		if (pcm->self_destruct)
-			delete pcm;
+        release_component(pcm);
 
 		content_vec[y] = NULL;
 	}
+
+    ts.tv_sec = 0;
+    ts.tv_usec = 0;
+
+	error = 0;
+	filtered = 0;
+    duplicate = 0;
+}
+
+void kis_packet::release_component(packet_component *pcm) {
+    // If it's marked for self-destruction, delete it or hand it back to the pool
+    // it came from.  Otherwise, someone else is responsible for removing it.
+    if (!pcm->self_destruct)
+        return;
+
+    if (pcm->recycler != NULL)
+        pcm->recycler->recycle(pcm);
+    else
+        delete pcm;
 }
    
 void kis_packet::insert(const unsigned int index, packet_component *data) {
@@ -93,10 +116,8 @@ void kis_packet::erase(const unsigned int index) {
 	// memory.  Whatever inserted it had better expect this
 	// to happen or it will be very unhappy
 	if (content_vec[index] != NULL) {
-		if (content_vec[index]->self_destruct)
-			delete content_vec[index];
+        release_component(content_vec[index]);
 
 		content_vec[index] = NULL;
 	}
 }
-
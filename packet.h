@@ -29,11 +29,13 @@
 #endif
 
 #include <algorithm>
+#include <atomic>
 #include <string>
 #include <vector>
 #include <map>
 
 #include "globalregistry.h"
+#include "kis_mutex.h"
 #include "macaddr.h"
 #include "packet_ieee80211.h"
 #include "trackedelement.h"
@@ -49,13 +51,130 @@
 // Same as defined in libpcap/system, but we need to know the basic dot11 DLT
 // even when we don't have pcap
 #define KDLT_IEEE802_11			105
+#define KDLT_RADIOTAP           127
+#define KDLT_PPI                192
+
+class packet_component_recycler;
 
 // High-level packet component so that we can provide our own destructors
+//
+// Components which were handed out by a packet_component_pool are returned to 
+// that pool when the packet is destroyed instead of being deleted; reset() must
+// put the component back into the state it was in after construction.
+// Components which don't come from a pool (such as most plugin components) are 
+// deleted as before when self_destruct is set.
 class packet_component {
 public:
-    packet_component() { self_destruct = 1; };
+    packet_component() { 
+        self_destruct = 1; 
+        recycler = NULL;
+    };
 	virtual ~packet_component() { }
+
+    // Return to a freshly constructed state so we can be recycled
+    virtual void reset() { }
+
 	int self_destruct;
+
+    // Pool we came from, if any
+    packet_component_recycler *recycler;
+};
+
+class packet_component_recycler {
+public:
+    virtual ~packet_component_recycler() { }
+
+    virtual void recycle(packet_component *in_comp) = 0;
+
+    // Release the pool from its owner
+    virtual void release_pool() = 0;
+};
+
+// Recycling pool of packet components of a specific type.  Components are 
+// acquired from any thread and returned via recycle() (or automatically when 
+// the packet they are attached to is destroyed).
+//
+// Pools are never deleted directly; the owner calls release_pool() and the pool
+// stays alive until every component it handed out has come back to it.
+template<class T>
+class packet_component_pool : public packet_component_recycler {
+public:
+    packet_component_pool(size_t in_max_pooled) {
+        max_pooled = in_max_pooled;
+        outstanding = 0;
+        orphaned = false;
+    }
+
+    T *acquire() {
+        {
+            local_locker lock(&pool_mutex);
+
+            outstanding++;
+
+            if (pool_vec.size() != 0) {
+                T *r = pool_vec.back();
+                pool_vec.pop_back();
+                return r;
+            }
+        }
+
+        T *r = new T();
+        r->recycler = this;
+
+        return r;
+    }
+
+    virtual void recycle(packet_component *in_comp) {
+        bool destroy_pool = false;
+
+        in_comp->reset();
+
+        {
+            local_locker lock(&pool_mutex);
+
+            outstanding--;
+
+            if (!orphaned && pool_vec.size() < max_pooled) {
+                pool_vec.push_back(static_cast<T *>(in_comp));
+                return;
+            }
+
+            destroy_pool = (orphaned && outstanding == 0);
+        }
+
+        delete in_comp;
+
+        if (destroy_pool)
+            delete this;
+    }
+
+    virtual void release_pool() {
+        bool destroy_pool = false;
+
+        {
+            local_locker lock(&pool_mutex);
+
+            for (auto c : pool_vec)
+                delete c;
+            pool_vec.clear();
+
+            orphaned = true;
+            destroy_pool = (outstanding == 0);
+        }
+
+        if (destroy_pool)
+            delete this;
+    }
+
+protected:
+    virtual ~packet_component_pool() { }
+
+    kis_recursive_timed_mutex pool_mutex;
+
+    std::vector<T *> pool_vec;
+    size_t max_pooled;
+    size_t outstanding;
+    bool orphaned;
 };
 
 // Overall packet container that holds packet information
@@ -84,6 +203,10 @@ public:
 
 	kis_packet(GlobalRegistry *in_globalreg);
     ~kis_packet();
+
+    // Release all components and return to a freshly generated state so the
+    // packet can be recycled by the packetchain
+    void reset();
    
     void insert(const unsigned int index, packet_component *data);
     void *fetch(const unsigned int index) const;
@@ -98,6 +221,9 @@ public:
 
 protected:
 	GlobalRegistry *globalreg;
+
+    // Destroy or recycle a component we own
+    void release_component(packet_component *pcm);
 };
 
 // A generic tracked packet, which allows us to save some frames in a way we
@@ -169,6 +295,65 @@ protected:
 };
 
 // Arbitrary data chunk, decapsulated from the link headers
+// Reference counted buffer holding a complete frame read from a capture source.
+// Datachunks can reference a slice of a frame buffer (see kis_datachunk::set_slice)
+// instead of copying the packet out of it; the buffer goes back to its pool when
+// the last reference is released.  The allocation is kept across uses, so a 
+// pooled frame buffer only allocates when it sees a larger frame.
+class kis_frame_buffer : public packet_component {
+public:
+    kis_frame_buffer() {
+        self_destruct = 1;
+        length = 0;
+        refcount = 0;
+    }
+
+    virtual ~kis_frame_buffer() { }
+
+    virtual void reset() {
+        length = 0;
+    }
+
+    // Size the buffer for a frame and return the space to fill
+    uint8_t *reserve(size_t in_length) {
+        if (buf.size() < in_length)
+            buf.resize(in_length);
+
+        length = in_length;
+
+        return buf.data();
+    }
+
+    uint8_t *data() {
+        return buf.data();
+    }
+
+    // Allocated size, which can be larger than the current frame
+    size_t capacity() {
+        return buf.size();
+    }
+
+    void ref() {
+        refcount.fetch_add(1);
+    }
+
+    void unref() {
+        if (refcount.fetch_sub(1) != 1)
+            return;
+
+        if (recycler != NULL)
+            recycler->recycle(this);
+        else
+            delete this;
+    }
+
+    size_t length;
+
+protected:
+    std::vector<uint8_t> buf;
+    std::atomic<unsigned int> refcount;
+};
+
 class kis_datachunk : public packet_component {
 public:
     uint8_t *data;
@@ -182,44 +367,100 @@ public:
 		self_data = true; // We assume for now we have our own data alloc
         data = NULL;
         length = 0;
+        dlt = 0;
 		source_id = 0;
+        copy_buf = NULL;
+        copy_buf_len = 0;
+        frame_ref = NULL;
     }
 
     virtual ~kis_datachunk() {
-		if (data != NULL && self_data) {
-			delete[] data;
-		}
-        length = 0;
+        free_data();
+
+        if (copy_buf != NULL)
+            delete[] copy_buf;
+    }
+
+    virtual void reset() {
+        free_data();
+        self_data = true;
+        dlt = 0;
+        source_id = 0;
     }
 
 	// Default to copy=true; it's always safe to copy, it's not always safe not to
 	virtual void set_data(uint8_t *in_data, unsigned int in_length, bool copy = true) {
-		if (data != NULL && self_data)
-			delete[] data;
-
 		if (copy) {
-			data = new uint8_t[in_length];
-			memcpy(data, in_data, in_length);
-			self_data = true;
-		} else {
-			data = in_data;
-			self_data = false;
-		}
+            copy_data(in_data, in_length);
+            return;
+        }
+
+        free_data();
 
+        data = in_data;
+        self_data = false;
 		length = in_length;
 	}
 
     virtual void copy_data(const uint8_t *in_data, unsigned int in_length) {
-		if (data != NULL && self_data)
-			delete[] data;
+        free_data();
 
-        data = new uint8_t[in_length];
-        memcpy(data, in_data, in_length);
-        self_data = true;
+        // Copies go into a buffer we keep for the life of the chunk, so a 
+        // recycled chunk only allocates when it sees a larger frame
+        if (copy_buf_len < in_length) {
+            if (copy_buf != NULL)
+                delete[] copy_buf;
+
+            copy_buf = new uint8_t[in_length];
+            copy_buf_len = in_length;
+        }
 
+        memcpy(copy_buf, in_data, in_length);
+
+        data = copy_buf;
+        self_data = true;
 		length = in_length;
+    }
+
+    // Point at a slice of a frame buffer without copying; the chunk holds a 
+    // reference to the frame until it is reset or given new data
+    virtual void set_slice(kis_frame_buffer *in_frame, uint8_t *in_data, 
+            unsigned int in_length) {
+        in_frame->ref();
+
+        free_data();
+
+        frame_ref = in_frame;
+        data = in_data;
+        self_data = false;
+        length = in_length;
+    }
 
+    // Frame buffer the data is a slice of, if any
+    kis_frame_buffer *get_frame() {
+        return frame_ref;
     }
+
+protected:
+    // Release whatever we're currently pointing to, if it's ours and not our
+    // reusable copy buffer
+    void free_data() {
+		if (data != NULL && self_data && data != copy_buf)
+			delete[] data;
+
+        if (frame_ref != NULL) {
+            frame_ref->unref();
+            frame_ref = NULL;
+        }
+
+        data = NULL;
+        length = 0;
+    }
+
+    uint8_t *copy_buf;
+    unsigned int copy_buf_len;
+
+    kis_frame_buffer *frame_ref;
 };
 
 class kis_packet_checksum : public kis_datachunk {
@@ -229,8 +470,15 @@ public:
 
 	kis_packet_checksum() : kis_datachunk() {
 		checksum_valid = 0;
+        checksum_ptr = NULL;
 	}
 
+    virtual void reset() {
+        kis_datachunk::reset();
+        checksum_valid = 0;
+        checksum_ptr = NULL;
+    }
+
 	virtual void set_data(uint8_t *in_data, unsigned int in_length, bool copy = true) {
 		kis_datachunk::set_data(in_data, in_length, copy);
 		checksum_ptr = (uint32_t *) data;
@@ -253,6 +501,10 @@ class kis_common_info : public packet_component {
 public:
 	kis_common_info() {
 		self_destruct = 1;
+        reset();
+	}
+
+    virtual void reset() {
 		type = packet_basic_unknown;
 		phyid = 0;
 		error = 0;
@@ -264,6 +516,7 @@ public:
 		dest = mac_addr(0);
 		device = mac_addr(0);
         transmitter = mac_addr(0);
+        base_device.reset();
 	}
 
 	mac_addr source, dest, device, transmitter;
@@ -324,6 +577,10 @@ class kis_data_packinfo : public packet_component {
 public:
 	kis_data_packinfo() {
 		self_destruct = 1; // Safe to delete us
+        reset();
+	}
+
+    virtual void reset() {
 		proto = proto_unknown;
 		ip_source_port = 0;
 		ip_dest_port = 0;
@@ -331,8 +588,14 @@ public:
 		ip_dest_addr.s_addr = 0;
 		ip_netmask_addr.s_addr = 0;
 		ip_gateway_addr.s_addr = 0;
+        ip_type = proto_unknown;
+        cdp_dev_id = "";
+        cdp_port_id = "";
+        discover_host = "";
+        discover_vendor = "";
 		field1 = 0;
         ivset[0] = ivset[1] = ivset[2] = 0;
+        auxstring = "";
 	}
 
 	kis_protocol_info_type proto;
@@ -377,6 +640,10 @@ class kis_layer1_packinfo : public packet_component {
 public:
 	kis_layer1_packinfo() {
 		self_destruct = 1;  // Safe to delete us
+        reset();
+	}
+
+    virtual void reset() {
         signal_type = kis_l1_signal_type_none;
 		signal_dbm = noise_dbm = 0;
 		signal_rssi = noise_rssi = 0;
@@ -386,6 +653,7 @@ public:
 		freq_khz = 0;
 		accuracy = 0;
 		channel = "0";
+        content_checkum = 0;
 	}
 
 	// How "accurate" are we?  Higher == better.  Nothing uses this yet
@@ -0,0 +1,375 @@
+/*
+    This file is part of Kismet
+
+    Kismet is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kismet is distributed in the hope that it will be useful,
+      but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Kismet; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "config.h"
+
+#include <algorithm>
+
+#include "packet_retro.h"
+#include "configfile.h"
+#include "messagebus.h"
+#include "devicetracker.h"
+#include "kis_datasource.h"
+#include "pcapng_stream_ringbuf.h"
+
+Packet_Retro_Buffer::Packet_Retro_Buffer(GlobalRegistry *in_globalreg) {
+    globalreg = in_globalreg;
+
+    packetchain =
+        Globalreg::FetchMandatoryGlobalAs<Packetchain>(globalreg, "PACKETCHAIN");
+
+    pack_comp_linkframe = packetchain->RegisterPacketComponent("LINKFRAME");
+    pack_comp_datasrc = packetchain->RegisterPacketComponent("KISDATASRC");
+    pack_comp_common = packetchain->RegisterPacketComponent("COMMON");
+    pack_comp_device = packetchain->RegisterPacketComponent("DEVICE");
+
+    max_bytes =
+        globalreg->kismet_config->FetchOptULong("packet_retro_mem", 0) * 1024;
+    max_ring_bytes =
+        globalreg->kismet_config->FetchOptULong("packet_retro_device_mem", 512) * 1024;
+    max_age =
+        globalreg->kismet_config->FetchOptUInt("packet_retro_seconds", 300);
+
+    total_bytes = 0;
+    packethandler_id = -1;
+
+    if (max_bytes == 0)
+        return;
+
+    if (max_ring_bytes == 0 || max_ring_bytes > max_bytes)
+        max_ring_bytes = max_bytes;
+
+    _MSG("Keeping up to " + IntToString(max_ring_bytes / 1024) + "KB of recent packets "
+            "per device (" + IntToString(max_bytes / 1024) + "KB total) for retroactive "
+            "pcap export", MSGFLAG_INFO);
+
+    // Frames are only filed under a device once the tracker has found it
+    packethandler_id =
+        packetchain->RegisterBatchHandler([this](const std::vector<kis_packet *>& in_packs) {
+                handle_packets(in_packs);
+                return 1;
+            }, CHAINPOS_LOGGING, -100, "retroactive packet buffer");
+    packetchain->SetHandlerComponentDispatch(packethandler_id, pack_comp_device);
+}
+
+Packet_Retro_Buffer::~Packet_Retro_Buffer() {
+    if (packethandler_id >= 0)
+        packetchain->RemoveHandler(packethandler_id, CHAINPOS_LOGGING);
+
+    local_eol_locker lock(&retro_mutex);
+
+    for (auto r : ring_map) {
+        while (evict_frame(r.second))
+            ;
+
+        delete r.second;
+    }
+
+    ring_map.clear();
+    lru_list.clear();
+}
+
+bool Packet_Retro_Buffer::make_frame(kis_packet *in_packet, packet_retro_frame& ret_frame) {
+    kis_datachunk *chunk =
+        (kis_datachunk *) in_packet->fetch(pack_comp_linkframe);
+    packetchain_comp_datasource *datasrc =
+        (packetchain_comp_datasource *) in_packet->fetch(pack_comp_datasrc);
+
+    if (chunk == NULL || chunk->data == NULL || chunk->length == 0 || datasrc == NULL)
+        return false;
+
+    unsigned int source_number = datasrc->ref_source->get_source_number();
+
+    auto si = source_map.find(source_number);
+
+    if (si == source_map.end()) {
+        std::shared_ptr<packet_retro_source> src(new packet_retro_source());
+
+        src->source_number = source_number;
+
+        if (datasrc->ref_source->get_source_cap_interface().length() > 0)
+            src->interface = datasrc->ref_source->get_source_cap_interface();
+        else
+            src->interface = datasrc->ref_source->get_source_interface();
+
+        if (datasrc->ref_source->get_source_cap_interface() !=
+                datasrc->ref_source->get_source_interface())
+            src->description = "capture interface for " +
+                datasrc->ref_source->get_source_interface();
+
+        src->dlt = datasrc->ref_source->get_source_dlt();
+
+        si = source_map.emplace(source_number, src).first;
+    }
+
+    ret_frame.source = si->second;
+    ret_frame.ts = in_packet->ts;
+    ret_frame.seen = globalreg->timestamp.tv_sec;
+
+    // Hold on to the capture frame when the packet is most of it; otherwise
+    // keeping it would pin much more memory than the packet, so copy the packet
+    // into a buffer of its own
+    kis_frame_buffer *frame = chunk->get_frame();
+
+    if (frame != NULL && frame->capacity() <= (size_t) chunk->length * 2) {
+        frame->ref();
+
+        ret_frame.frame = frame;
+        ret_frame.data = chunk->data;
+        ret_frame.length = chunk->length;
+        ret_frame.charge = frame->capacity() + sizeof(packet_retro_frame);
+
+        return true;
+    }
+
+    frame = new kis_frame_buffer();
+    frame->ref();
+    memcpy(frame->reserve(chunk->length), chunk->data, chunk->length);
+
+    ret_frame.frame = frame;
+    ret_frame.data = frame->data();
+    ret_frame.length = chunk->length;
+    ret_frame.charge = frame->capacity() + sizeof(packet_retro_frame);
+
+    return true;
+}
+
+void Packet_Retro_Buffer::handle_packets(const std::vector<kis_packet *>& in_packets) {
+    std::shared_ptr<Devicetracker> devicetracker;
+
+    local_locker lock(&retro_mutex);
+
+    for (auto packet : in_packets) {
+        kis_tracked_device_info *devinfo =
+            (kis_tracked_device_info *) packet->fetch(pack_comp_device);
+
+        if (devinfo == NULL || devinfo->devref == NULL)
+            continue;
+
+        packet_retro_frame frame;
+
+        if (!make_frame(packet, frame))
+            continue;
+
+        // File it under the transmitter as well, if the phy has one which
+        // isn't the device itself
+        kis_common_info *common =
+            (kis_common_info *) packet->fetch(pack_comp_common);
+
+        bool file_transmitter = false;
+        uint32_t phy_hash = 0;
+
+        if (common != NULL && common->transmitter != globalreg->empty_mac &&
+                common->transmitter != devinfo->devref->get_macaddr()) {
+            auto phi = phy_hash_map.find(common->phyid);
+
+            if (phi == phy_hash_map.end()) {
+                if (devicetracker == NULL)
+                    devicetracker =
+                        Globalreg::FetchMandatoryGlobalAs<Devicetracker>(globalreg,
+                                "DEVICE_TRACKER");
+
+                Kis_Phy_Handler *phy = devicetracker->FetchPhyHandler(common->phyid);
+
+                if (phy != NULL)
+                    phi = phy_hash_map.emplace(common->phyid,
+                            phy->FetchPhynameHash()).first;
+            }
+
+            if (phi != phy_hash_map.end()) {
+                file_transmitter = true;
+                phy_hash = phi->second;
+            }
+        }
+
+        // Each ring holds its own reference; take both before filing, since
+        // filing can evict
+        if (file_transmitter)
+            frame.frame->ref();
+
+        add_frame(devinfo->devref->get_key(), frame);
+
+        if (file_transmitter)
+            add_frame(TrackedDeviceKey(globalreg->server_uuid_hash, phy_hash,
+                        common->transmitter), frame);
+    }
+}
+
+void Packet_Retro_Buffer::add_frame(const TrackedDeviceKey& in_key,
+        packet_retro_frame& in_frame) {
+    retro_ring *ring;
+
+    auto ri = ring_map.find(in_key);
+
+    if (ri == ring_map.end()) {
+        ring = new retro_ring();
+        ring->bytes = 0;
+        ring->lru_pos = lru_list.insert(lru_list.end(), in_key);
+        ring_map.emplace(in_key, ring);
+    } else {
+        ring = ri->second;
+        lru_list.splice(lru_list.end(), lru_list, ring->lru_pos);
+    }
+
+    expire_ring(ring, in_frame.seen);
+
+    ring->frames.push_back(in_frame);
+    ring->bytes += in_frame.charge;
+    total_bytes += in_frame.charge;
+
+    while (ring->bytes > max_ring_bytes && ring->frames.size() > 1)
+        evict_frame(ring);
+
+    // Evict from the least recently updated devices until we're under the total;
+    // the ring we just added to is the most recent so it goes last
+    while (total_bytes > max_bytes && lru_list.size() != 0) {
+        auto lri = ring_map.find(lru_list.front());
+
+        if (lri == ring_map.end()) {
+            lru_list.pop_front();
+            continue;
+        }
+
+        evict_frame(lri->second);
+
+        if (lri->second->frames.size() == 0)
+            remove_ring(lri);
+    }
+}
+
+bool Packet_Retro_Buffer::evict_frame(retro_ring *in_ring) {
+    if (in_ring->frames.size() == 0)
+        return false;
+
+    packet_retro_frame& f = in_ring->frames.front();
+
+    in_ring->bytes -= f.charge;
+    total_bytes -= f.charge;
+
+    f.frame->unref();
+
+    in_ring->frames.pop_front();
+
+    return true;
+}
+
+void Packet_Retro_Buffer::remove_ring(std::map<TrackedDeviceKey, retro_ring *>::iterator in_ring) {
+    lru_list.erase(in_ring->second->lru_pos);
+    delete in_ring->second;
+    ring_map.erase(in_ring);
+}
+
+void Packet_Retro_Buffer::expire_ring(retro_ring *in_ring, time_t in_now) {
+    while (in_ring->frames.size() != 0 &&
+            in_ring->frames.front().seen + max_age < in_now)
+        evict_frame(in_ring);
+}
+
+void Packet_Retro_Buffer::expire_idle(time_t in_now) {
+    // Devices are ordered by when they last saw a frame, so once we find one 
+    // with frames left after expiring, every device after it has newer frames
+    while (lru_list.size() != 0) {
+        auto lri = ring_map.find(lru_list.front());
+
+        if (lri == ring_map.end()) {
+            lru_list.pop_front();
+            continue;
+        }
+
+        expire_ring(lri->second, in_now);
+
+        if (lri->second->frames.size() != 0)
+            break;
+
+        remove_ring(lri);
+    }
+}
+
+size_t Packet_Retro_Buffer::fetch_frames(const TrackedDeviceKey& in_key, time_t in_seconds,
+        size_t in_max_frames, std::vector<packet_retro_frame>& ret_frames) {
+    local_locker lock(&retro_mutex);
+
+    time_t now = globalreg->timestamp.tv_sec;
+
+    expire_idle(now);
+
+    auto ri = ring_map.find(in_key);
+
+    if (ri == ring_map.end())
+        return 0;
+
+    expire_ring(ri->second, now);
+
+    if (ri->second->frames.size() == 0) {
+        remove_ring(ri);
+        return 0;
+    }
+
+    size_t start = ri->second->frames.size();
+
+    // Walk back from the newest frame to the first one we want
+    while (start > 0) {
+        const packet_retro_frame& f = ri->second->frames[start - 1];
+
+        if (f.seen + max_age < now)
+            break;
+
+        if (in_seconds != 0 && f.seen + in_seconds < now)
+            break;
+
+        if (in_max_frames != 0 && ri->second->frames.size() - start >= in_max_frames)
+            break;
+
+        start--;
+    }
+
+    for (size_t x = start; x < ri->second->frames.size(); x++) {
+        ri->second->frames[x].frame->ref();
+        ret_frames.push_back(ri->second->frames[x]);
+    }
+
+    return ri->second->frames.size() - start;
+}
+
+void Packet_Retro_Buffer::release_frames(std::vector<packet_retro_frame>& in_frames) {
+    for (auto f : in_frames)
+        f.frame->unref();
+
+    in_frames.clear();
+}
+
+int Packet_Retro_Buffer::stream_pcapng(std::shared_ptr<BufferHandlerGeneric> in_handler,
+        const TrackedDeviceKey& in_key, time_t in_seconds, size_t in_max_frames) {
+    std::vector<packet_retro_frame> frames;
+
+    fetch_frames(in_key, in_seconds, in_max_frames, frames);
+
+    // A stream which isn't attached to the packetchain; it's complete once
+    // we've written the buffered frames
+    Pcap_Stream_Ringbuf *psrb =
+        new Pcap_Stream_Ringbuf(globalreg, in_handler, NULL, NULL, false);
+
+    int r = psrb->pcapng_write_retro(frames);
+
+    delete psrb;
+
+    release_frames(frames);
+
+    return r;
+}
+
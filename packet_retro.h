@@ -0,0 +1,166 @@
+/*
+    This file is part of Kismet
+
+    Kismet is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kismet is distributed in the hope that it will be useful,
+      but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Kismet; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef __PACKET_RETRO_H__
+#define __PACKET_RETRO_H__
+
+#include "config.h"
+
+#include <deque>
+#include <list>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "globalregistry.h"
+#include "kis_mutex.h"
+#include "packetchain.h"
+#include "trackedelement.h"
+#include "buffer_handler.h"
+
+/* Retroactive packet buffer
+ *
+ * Keeps the most recent raw frames of each device so that a pcap of a device
+ * can be exported on demand, including the traffic seen before anyone asked
+ * for it.
+ *
+ * Frames are filed under the device the tracker attributed the packet to, and
+ * under the transmitter (the BSSID, for Wi-Fi) when that is a different
+ * device.  A frame is kept as a reference to the capture frame buffer it was
+ * decoded from when the packet is most of that buffer, and copied otherwise,
+ * so a frame filed under several devices is only stored once.
+ *
+ * Memory is bounded per device and in total; once the total is exceeded,
+ * frames are evicted from the device which least recently saw a new frame.
+ * Frames older than the retention time are dropped as new frames arrive, and
+ * from idle devices when a device is exported.
+ */
+
+// Capture interface a frame came from, for the pcapng interface block
+struct packet_retro_source {
+    unsigned int source_number;
+    std::string interface;
+    std::string description;
+    int dlt;
+};
+
+struct packet_retro_frame {
+    // Referenced buffer holding the frame data
+    kis_frame_buffer *frame;
+    const uint8_t *data;
+    unsigned int length;
+
+    // Capture timestamp, and when we received it, for retention
+    struct timeval ts;
+    time_t seen;
+
+    std::shared_ptr<packet_retro_source> source;
+
+    // Bytes charged against the memory limits
+    size_t charge;
+};
+
+class Packet_Retro_Buffer : public LifetimeGlobal {
+public:
+    static std::shared_ptr<Packet_Retro_Buffer>
+        create_retrobuffer(GlobalRegistry *in_globalreg) {
+        std::shared_ptr<Packet_Retro_Buffer> mon(new Packet_Retro_Buffer(in_globalreg));
+        in_globalreg->RegisterLifetimeGlobal(mon);
+        in_globalreg->InsertGlobal("PACKET_RETRO", mon);
+        return mon;
+    }
+
+private:
+    Packet_Retro_Buffer(GlobalRegistry *in_globalreg);
+
+public:
+    virtual ~Packet_Retro_Buffer();
+
+    bool get_enabled() { return max_bytes != 0; }
+
+    // Reference the buffered frames of a device, oldest first; limited to
+    // frames received in the last in_seconds and to the last in_max_frames
+    // frames when they are non-zero.  The frames must be released with
+    // release_frames.
+    size_t fetch_frames(const TrackedDeviceKey& in_key, time_t in_seconds,
+            size_t in_max_frames, std::vector<packet_retro_frame>& ret_frames);
+
+    static void release_frames(std::vector<packet_retro_frame>& in_frames);
+
+    // Write the buffered frames of a device to a pcapng stream and end the
+    // stream.  Returns the number of frames written, or -1 on error.
+    int stream_pcapng(std::shared_ptr<BufferHandlerGeneric> in_handler,
+            const TrackedDeviceKey& in_key, time_t in_seconds, size_t in_max_frames);
+
+protected:
+    GlobalRegistry *globalreg;
+
+    std::shared_ptr<Packetchain> packetchain;
+
+    int pack_comp_linkframe, pack_comp_datasrc, pack_comp_common, pack_comp_device;
+
+    int packethandler_id;
+
+    void handle_packets(const std::vector<kis_packet *>& in_packets);
+
+    struct retro_ring {
+        std::deque<packet_retro_frame> frames;
+        size_t bytes;
+        std::list<TrackedDeviceKey>::iterator lru_pos;
+    };
+
+    // Build a reference to the frame data of a packet
+    bool make_frame(kis_packet *in_packet, packet_retro_frame& ret_frame);
+
+    // File a referenced frame under a device
+    void add_frame(const TrackedDeviceKey& in_key, packet_retro_frame& in_frame);
+
+    // Drop the oldest frame of a ring; returns false when the ring is empty
+    bool evict_frame(retro_ring *in_ring);
+
+    // Remove an empty ring
+    void remove_ring(std::map<TrackedDeviceKey, retro_ring *>::iterator in_ring);
+
+    // Drop frames older than the retention time from a ring
+    void expire_ring(retro_ring *in_ring, time_t in_now);
+
+    // Drop expired frames from the least recently updated devices, which
+    // won't otherwise be expired until they see another frame
+    void expire_idle(time_t in_now);
+
+    kis_recursive_timed_mutex retro_mutex;
+
+    std::map<TrackedDeviceKey, retro_ring *> ring_map;
+
+    // Device keys by least recently updated
+    std::list<TrackedDeviceKey> lru_list;
+
+    std::map<unsigned int, std::shared_ptr<packet_retro_source> > source_map;
+
+    // Cached phy key components by phy id, for filing frames under transmitters
+    std::map<int, uint32_t> phy_hash_map;
+
+    size_t max_bytes, max_ring_bytes;
+    time_t max_age;
+
+    size_t total_bytes;
+};
+
+#endif
+
@@ -30,6 +30,7 @@
 #include "configfile.h"
 #include "packetchain.h"
 #include "alertracker.h"
+#include "entrytracker.h"
 
 class SortLinkPriority {
 public:
@@ -46,7 +47,8 @@ Packetchain::Packetchain() {
 	exit(-1);
 }
 
-Packetchain::Packetchain(GlobalRegistry *in_globalreg) {
+Packetchain::Packetchain(GlobalRegistry *in_globalreg) :
+    Kis_Net_Httpd_CPPStream_Handler(in_globalreg) {
     globalreg = in_globalreg;
     next_componentid = 1;
 	next_handlerid = 1;
@@ -58,6 +60,84 @@ Packetchain::Packetchain(GlobalRegistry *in_globalreg) {
         globalreg->kismet_config->FetchOptUInt("packet_log_warning", 0);
     packet_queue_drop =
         globalreg->kismet_config->FetchOptUInt("packet_backlog_limit", 8192);
+    packet_pool_size =
+        globalreg->kismet_config->FetchOptUInt("packet_pool_size", 1024);
+    packet_batch_size =
+        globalreg->kismet_config->FetchOptUInt("packet_batch_size", 32);
+
+    if (packet_batch_size == 0)
+        packet_batch_size = 1;
+
+    // Reserve a share of the backlog for management and eapol frames, and start
+    // sampling data frames halfway to the shared limit
+    unsigned int reserve_pct = 
+        globalreg->kismet_config->FetchOptUInt("packet_backlog_reserve", 25);
+    if (reserve_pct > 100)
+        reserve_pct = 100;
+
+    packet_queue_shared_limit = 
+        packet_queue_drop - ((uint64_t) packet_queue_drop * reserve_pct / 100);
+    packet_queue_data_limit = packet_queue_shared_limit / 2;
+
+    packet_data_sample =
+        globalreg->kismet_config->FetchOptUInt("packet_backlog_data_sample", 10);
+    packet_data_sample_pos = 0;
+
+    packet_shed_other =
+        globalreg->kismet_config->FetchOptBoolean("packet_backlog_shed_other", false);
+
+    for (unsigned int x = 0; x < pcqueue_class_max; x++)
+        packet_queue_drops[x] = 0;
+
+    for (unsigned int x = 0; x < MAX_PACKET_COMPONENTS; x++) {
+        component_consumers[x] = 0;
+        component_live[x] = false;
+    }
+
+    pack_comp_linkframe = RegisterPacketComponent("LINKFRAME");
+
+    handler_stats =
+        globalreg->kismet_config->FetchOptBoolean("packet_chain_stats", 0);
+
+    shared_ptr<EntryTracker> entrytracker =
+        Globalreg::FetchMandatoryGlobalAs<EntryTracker>(globalreg, "ENTRY_TRACKER");
+
+    queue_backlog_id =
+        entrytracker->RegisterField("kismet.packetchain.queue.backlog", TrackerUInt64,
+                "packets currently waiting in the packet queue");
+    queue_limit_id =
+        entrytracker->RegisterField("kismet.packetchain.queue.limit", TrackerUInt64,
+                "maximum packet queue backlog (packet_backlog_limit)");
+    queue_shared_limit_id =
+        entrytracker->RegisterField("kismet.packetchain.queue.shared_limit", TrackerUInt64,
+                "backlog at which only management and eapol packets are queued");
+    queue_data_limit_id =
+        entrytracker->RegisterField("kismet.packetchain.queue.data_limit", TrackerUInt64,
+                "backlog at which data packets are sampled");
+    queue_drop_mgmt_id =
+        entrytracker->RegisterField("kismet.packetchain.queue.drop.management", TrackerUInt64,
+                "management packets dropped due to queue overload");
+    queue_drop_eapol_id =
+        entrytracker->RegisterField("kismet.packetchain.queue.drop.eapol", TrackerUInt64,
+                "eapol packets dropped due to queue overload");
+    queue_drop_data_id =
+        entrytracker->RegisterField("kismet.packetchain.queue.drop.data", TrackerUInt64,
+                "data packets dropped due to queue overload");
+    queue_drop_control_id =
+        entrytracker->RegisterField("kismet.packetchain.queue.drop.control", TrackerUInt64,
+                "802.11 control packets dropped due to queue overload");
+    queue_drop_other_id =
+        entrytracker->RegisterField("kismet.packetchain.queue.drop.other", TrackerUInt64,
+                "non-802.11 packets dropped due to queue overload");
+
+    std::shared_ptr<packetchain_handler_stats> stats_builder(
+            new packetchain_handler_stats(globalreg, 0));
+    handler_stats_id =
+        entrytracker->RegisterField("kismet.packetchain.handler", stats_builder,
+                "packetchain handler statistics");
+    handler_stats_vec_id =
+        entrytracker->RegisterField("kismet.packetchain.handler_list", TrackerVector,
+                "packetchain handler statistics");
 
     packetchain_shutdown = false;
 
@@ -121,6 +201,19 @@ Packetchain::~Packetchain() {
         }
     }
 
+    {
+        local_eol_locker lock(&packetpool_mutex);
+
+        for (auto p : packet_pool_vec)
+            delete p;
+        packet_pool_vec.clear();
+
+        // Pools stay alive until any outstanding components are returned
+        for (auto cp : component_pool_map)
+            cp.second->release_pool();
+        component_pool_map.clear();
+    }
+
 }
 
 int Packetchain::RegisterPacketComponent(string in_component) {
@@ -162,6 +255,160 @@ int Packetchain::RemovePacketComponent(int in_id) {
     return 1;
 }
 
+void Packetchain::RegisterComponentConsumer(int in_id) {
+    local_locker lock(&packetchain_mutex);
+
+    if (in_id < 0 || in_id >= MAX_PACKET_COMPONENTS)
+        return;
+
+    component_consumers[in_id]++;
+
+    UpdateComponentLiveness();
+}
+
+void Packetchain::RemoveComponentConsumer(int in_id) {
+    local_locker lock(&packetchain_mutex);
+
+    if (in_id < 0 || in_id >= MAX_PACKET_COMPONENTS)
+        return;
+
+    if (component_consumers[in_id] > 0)
+        component_consumers[in_id]--;
+
+    UpdateComponentLiveness();
+}
+
+Packetchain::pc_link *Packetchain::FindLink(int in_id) {
+    std::vector<Packetchain::pc_link *> *chains[] = {
+        &genesis_chain, &postcap_chain, &llcdissect_chain, &decrypt_chain,
+        &datadissect_chain, &classifier_chain, &tracker_chain, &logging_chain,
+        &destruction_chain
+    };
+
+    for (auto c : chains) {
+        for (auto pcl : *c) {
+            if (pcl->id == in_id)
+                return pcl;
+        }
+    }
+
+    return NULL;
+}
+
+int Packetchain::SetHandlerComponents(int in_id, const std::vector<int>& in_produces,
+        const std::vector<int>& in_consumes) {
+    local_locker lock(&packetchain_mutex);
+
+    pc_link *pcl = FindLink(in_id);
+
+    if (pcl == NULL) {
+        _MSG("Packetchain::SetHandlerComponents requested unknown handler", MSGFLAG_ERROR);
+        return -1;
+    }
+
+    pcl->produces = in_produces;
+    pcl->consumes = in_consumes;
+
+    UpdateComponentLiveness();
+
+    return 1;
+}
+
+int Packetchain::SetHandlerComponentDispatch(int in_id, int in_component) {
+    local_locker lock(&packetchain_mutex);
+
+    pc_link *pcl = FindLink(in_id);
+
+    if (pcl == NULL) {
+        _MSG("Packetchain::SetHandlerComponentDispatch requested unknown handler", 
+                MSGFLAG_ERROR);
+        return -1;
+    }
+
+    if (in_component >= MAX_PACKET_COMPONENTS) {
+        _MSG("Packetchain::SetHandlerComponentDispatch requested invalid component",
+                MSGFLAG_ERROR);
+        return -1;
+    }
+
+    pcl->dispatch_component = in_component;
+
+    return 1;
+}
+
+int Packetchain::SetHandlerDLTDispatch(int in_id, const std::vector<unsigned int>& in_dlts) {
+    local_locker lock(&packetchain_mutex);
+
+    pc_link *pcl = FindLink(in_id);
+
+    if (pcl == NULL) {
+        _MSG("Packetchain::SetHandlerDLTDispatch requested unknown handler", MSGFLAG_ERROR);
+        return -1;
+    }
+
+    pcl->dispatch_dlts = in_dlts;
+
+    return 1;
+}
+
+void Packetchain::UpdateComponentLiveness() {
+    std::vector<Packetchain::pc_link *> *chains[] = {
+        &genesis_chain, &postcap_chain, &llcdissect_chain, &decrypt_chain,
+        &datadissect_chain, &classifier_chain, &tracker_chain, &logging_chain,
+        &destruction_chain
+    };
+
+    bool live[MAX_PACKET_COMPONENTS];
+    std::map<pc_link *, bool> link_live;
+
+    for (unsigned int x = 0; x < MAX_PACKET_COMPONENTS; x++)
+        live[x] = component_consumers[x] > 0;
+
+    // Handlers which don't declare any products always run
+    for (auto c : chains) 
+        for (auto pcl : *c) 
+            link_live[pcl] = pcl->produces.size() == 0;
+
+    // Propagate back through the producers until nothing changes; a live 
+    // handler makes its inputs live, which can make their producers live
+    bool changed = true;
+
+    while (changed) {
+        changed = false;
+
+        for (auto c : chains) {
+            for (auto pcl : *c) {
+                if (!link_live[pcl]) {
+                    for (auto p : pcl->produces) {
+                        if (p >= 0 && p < MAX_PACKET_COMPONENTS && live[p]) {
+                            link_live[pcl] = true;
+                            changed = true;
+                            break;
+                        }
+                    }
+                }
+
+                if (!link_live[pcl])
+                    continue;
+
+                for (auto cm : pcl->consumes) {
+                    if (cm >= 0 && cm < MAX_PACKET_COMPONENTS && !live[cm]) {
+                        live[cm] = true;
+                        changed = true;
+                    }
+                }
+            }
+        }
+    }
+
+    for (auto c : chains) 
+        for (auto pcl : *c) 
+            pcl->live.store(link_live[pcl], std::memory_order_relaxed);
+
+    for (unsigned int x = 0; x < MAX_PACKET_COMPONENTS; x++)
+        component_live[x].store(live[x], std::memory_order_relaxed);
+}
+
 string Packetchain::FetchPacketComponentName(int in_id) {
     local_locker lock(&packetchain_mutex);
 
@@ -173,10 +420,24 @@ string Packetchain::FetchPacketComponentName(int in_id) {
 }
 
 kis_packet *Packetchain::GeneratePacket() {
-    local_locker lock(&packetchain_mutex);
-    kis_packet *newpack = new kis_packet(globalreg);
+    kis_packet *newpack = NULL;
     pc_link *pcl;
 
+    // Re-use a recycled packet if we have one
+    {
+        local_locker plock(&packetpool_mutex);
+
+        if (packet_pool_vec.size() != 0) {
+            newpack = packet_pool_vec.back();
+            packet_pool_vec.pop_back();
+        }
+    }
+
+    if (newpack == NULL)
+        newpack = new kis_packet(globalreg);
+
+    local_locker lock(&packetchain_mutex);
+
     // Run the frame through the genesis chain incase anything
     // needs to add something at the beginning
     for (unsigned int x = 0; x < genesis_chain.size(); x++) {
@@ -202,11 +463,103 @@ kis_packet *Packetchain::GeneratePacket() {
     return newpack;
 }
 
+static uint64_t packetchain_ts_ns(const struct timespec& start, 
+        const struct timespec& end) {
+    return (uint64_t) (end.tv_sec - start.tv_sec) * 1000000000ULL + 
+        end.tv_nsec - start.tv_nsec;
+}
+
+static const char *packetchain_chain_name(int in_chain) {
+    switch (in_chain) {
+        case CHAINPOS_GENESIS:
+            return "genesis";
+        case CHAINPOS_POSTCAP:
+            return "postcap";
+        case CHAINPOS_LLCDISSECT:
+            return "llcdissect";
+        case CHAINPOS_DECRYPT:
+            return "decrypt";
+        case CHAINPOS_DATADISSECT:
+            return "datadissect";
+        case CHAINPOS_CLASSIFIER:
+            return "classifier";
+        case CHAINPOS_TRACKER:
+            return "tracker";
+        case CHAINPOS_LOGGING:
+            return "logging";
+        case CHAINPOS_DESTROY:
+            return "destroy";
+    }
+
+    return "unknown";
+}
+
+void Packetchain::ProcessChain(std::vector<Packetchain::pc_link *>& in_chain,
+        std::vector<kis_packet *>& in_batch) {
+    if (!handler_stats) {
+        for (auto pcl : in_chain) {
+            if (!pcl->live.load(std::memory_order_relaxed))
+                continue;
+
+            std::vector<kis_packet *>& batch = DispatchBatch(pcl, in_batch);
+
+            if (batch.size() != 0)
+                CallLink(pcl, batch);
+        }
+        return;
+    }
+
+    struct timespec wall_start, wall_end, cpu_start, cpu_end;
+
+    for (auto pcl : in_chain) {
+        if (!pcl->live.load(std::memory_order_relaxed))
+            continue;
+
+        std::vector<kis_packet *>& batch = DispatchBatch(pcl, in_batch);
+
+        if (batch.size() == 0)
+            continue;
+
+        clock_gettime(CLOCK_MONOTONIC, &wall_start);
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_start);
+
+        CallLink(pcl, batch);
+
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_end);
+        clock_gettime(CLOCK_MONOTONIC, &wall_end);
+
+        uint64_t wall_ns = packetchain_ts_ns(wall_start, wall_end);
+        uint64_t cpu_ns = packetchain_ts_ns(cpu_start, cpu_end);
+
+        // Only the packet thread writes the stats, so relaxed updates are enough
+        pcl->stats.calls.fetch_add(1, std::memory_order_relaxed);
+        pcl->stats.packets.fetch_add(batch.size(), std::memory_order_relaxed);
+        pcl->stats.wall_ns.fetch_add(wall_ns, std::memory_order_relaxed);
+        pcl->stats.cpu_ns.fetch_add(cpu_ns, std::memory_order_relaxed);
+
+        if (wall_ns > pcl->stats.max_ns.load(std::memory_order_relaxed))
+            pcl->stats.max_ns.store(wall_ns, std::memory_order_relaxed);
+
+        uint64_t per_packet_us = wall_ns / 1000 / batch.size();
+        unsigned int bucket = 0;
+
+        while (per_packet_us != 0 && bucket < PC_LATENCY_BUCKETS - 1) {
+            per_packet_us >>= 1;
+            bucket++;
+        }
+
+        pcl->stats.latency_hist[bucket].fetch_add(batch.size(), 
+                std::memory_order_relaxed);
+    }
+}
+
 void Packetchain::packet_queue_processor(Packetchain *packetchain) {
-    kis_packet *packet = NULL;
+    std::vector<kis_packet *> batch;
     local_demand_locker queue_lock(&(packetchain->packetqueue_mutex));
     local_demand_locker chain_lock(&(packetchain->packetchain_mutex));
 
+    batch.reserve(packetchain->packet_batch_size);
+
     while (1) {
         queue_lock.lock();
 
@@ -215,66 +568,30 @@ void Packetchain::packet_queue_processor(Packetchain *packetchain) {
             return;
       
         if (packetchain->packet_queue.size() != 0) {
-            // Get the next packet
-            packet = packetchain->packet_queue.front();
-            packetchain->packet_queue.pop();
-
-            // Unlock the queue while we process that packet
-            queue_lock.unlock();
-
-            // Lock the  packet chain itself because we need to have consistent
-            // packet chain vectors
-            
-            for (auto pcl : packetchain->postcap_chain) {
-                if (pcl->callback != NULL)
-                    pcl->callback(packetchain->globalreg, pcl->auxdata, packet);
-                else if (pcl->l_callback != NULL)
-                    pcl->l_callback(packet);
-            }
+            // Get the next batch of packets
+            batch.clear();
 
-            for (auto pcl : packetchain->llcdissect_chain) {
-                if (pcl->callback != NULL)
-                    pcl->callback(packetchain->globalreg, pcl->auxdata, packet);
-                else if (pcl->l_callback != NULL)
-                    pcl->l_callback(packet);
+            while (packetchain->packet_queue.size() != 0 && 
+                    batch.size() < packetchain->packet_batch_size) {
+                batch.push_back(packetchain->packet_queue.front());
+                packetchain->packet_queue.pop();
             }
 
-            for (auto pcl : packetchain->decrypt_chain) {
-                if (pcl->callback != NULL)
-                    pcl->callback(packetchain->globalreg, pcl->auxdata, packet);
-                else if (pcl->l_callback != NULL)
-                    pcl->l_callback(packet);
-            }
-
-            for (auto pcl : packetchain->datadissect_chain) {
-                if (pcl->callback != NULL)
-                    pcl->callback(packetchain->globalreg, pcl->auxdata, packet);
-                else if (pcl->l_callback != NULL)
-                    pcl->l_callback(packet);
-            }
-
-            for (auto pcl : packetchain->classifier_chain) {
-                if (pcl->callback != NULL)
-                    pcl->callback(packetchain->globalreg, pcl->auxdata, packet);
-                else if (pcl->l_callback != NULL)
-                    pcl->l_callback(packet);
-            }
-
-            for (auto pcl : packetchain->tracker_chain) {
-                if (pcl->callback != NULL)
-                    pcl->callback(packetchain->globalreg, pcl->auxdata, packet);
-                else if (pcl->l_callback != NULL)
-                    pcl->l_callback(packet);
-            }
+            // Unlock the queue while we process those packets
+            queue_lock.unlock();
 
-            for (auto pcl : packetchain->logging_chain) {
-                if (pcl->callback != NULL)
-                    pcl->callback(packetchain->globalreg, pcl->auxdata, packet);
-                else if (pcl->l_callback != NULL)
-                    pcl->l_callback(packet);
-            }
+            // Each chain sees the whole batch before the next chain runs; 
+            // every packet still passes through the chains in order
+            packetchain->ProcessChain(packetchain->postcap_chain, batch);
+            packetchain->ProcessChain(packetchain->llcdissect_chain, batch);
+            packetchain->ProcessChain(packetchain->decrypt_chain, batch);
+            packetchain->ProcessChain(packetchain->datadissect_chain, batch);
+            packetchain->ProcessChain(packetchain->classifier_chain, batch);
+            packetchain->ProcessChain(packetchain->tracker_chain, batch);
+            packetchain->ProcessChain(packetchain->logging_chain, batch);
 
-            packetchain->DestroyPacket(packet);
+            for (auto packet : batch)
+                packetchain->DestroyPacket(packet);
 
             // re-loop in case we have more packets
             continue;
@@ -293,27 +610,120 @@ void Packetchain::packet_queue_processor(Packetchain *packetchain) {
     }
 }
 
+packetchain_queue_class Packetchain::ClassifyPacket(kis_packet *in_pack) {
+    kis_datachunk *chunk = 
+        (kis_datachunk *) in_pack->fetch(pack_comp_linkframe);
+
+    if (chunk == NULL || chunk->data == NULL)
+        return pcqueue_class_other;
+
+    unsigned int offt = 0;
+
+    // Skip the radio headers; both radiotap and ppi keep their length in the 
+    // same place
+    switch (chunk->dlt) {
+        case KDLT_IEEE802_11:
+            break;
+        case KDLT_RADIOTAP:
+        case KDLT_PPI:
+            if (chunk->length < 4)
+                return pcqueue_class_other;
+            offt = chunk->data[2] | (chunk->data[3] << 8);
+            break;
+        default:
+            return pcqueue_class_other;
+    }
+
+    if (offt + 2 > chunk->length)
+        return pcqueue_class_control;
+
+    uint8_t fc0 = chunk->data[offt];
+    uint8_t fc1 = chunk->data[offt + 1];
+
+    switch ((fc0 >> 2) & 0x03) {
+        case 0:
+            return pcqueue_class_mgmt;
+        case 2:
+            break;
+        default:
+            return pcqueue_class_control;
+    }
+
+    // Protected data can't be eapol
+    if (fc1 & 0x40)
+        return pcqueue_class_data;
+
+    // Look for the eapol llc/snap header after the 802.11 header; 4-address 
+    // frames carry an extra address and qos data frames carry qos control
+    const uint8_t eapol_llc[] = { 0xAA, 0xAA, 0x03, 0x00, 0x00, 0x00, 0x88, 0x8E };
+    unsigned int hdrlen = 24;
+
+    if ((fc1 & 0x03) == 0x03)
+        hdrlen += 6;
+
+    if (fc0 & 0x80)
+        hdrlen += 2;
+
+    if (offt + hdrlen + sizeof(eapol_llc) <= chunk->length &&
+            memcmp(chunk->data + offt + hdrlen, eapol_llc, sizeof(eapol_llc)) == 0)
+        return pcqueue_class_eapol;
+
+    return pcqueue_class_data;
+}
+
 int Packetchain::ProcessPacket(kis_packet *in_pack) {
-    local_locker qlock(&packetqueue_mutex);
+    packetchain_queue_class pclass = pcqueue_class_other;
 
-    if (packet_queue.size() > packet_queue_warning &&
-            packet_queue_warning != 0) {
-        time_t offt = time(0) - last_packet_queue_user_warning;
+    // Only look at the packet if we might need to shed it
+    if (packet_queue_drop != 0)
+        pclass = ClassifyPacket(in_pack);
 
-        if (offt > 30) {
-            last_packet_queue_user_warning = time(0);
+    {
+        local_locker qlock(&packetqueue_mutex);
 
-            shared_ptr<Alertracker> alertracker =
-                Globalreg::FetchMandatoryGlobalAs<Alertracker>(globalreg, "ALERTTRACKER");
-            alertracker->RaiseOneShot("PACKETQUEUE", 
-                    "The packet queue has a backlog of " + IntToString(packet_queue.size()) + 
-                    " packets; if you have multiple data sources it's possible that your "
-                    "system is not fast enough.  Kismet will continue to process "
-                    "packets, this may be a momentary spike in packet load.", -1);
+        if (packet_queue.size() > packet_queue_warning &&
+                packet_queue_warning != 0) {
+            time_t offt = time(0) - last_packet_queue_user_warning;
+
+            if (offt > 30) {
+                last_packet_queue_user_warning = time(0);
+
+                shared_ptr<Alertracker> alertracker =
+                    Globalreg::FetchMandatoryGlobalAs<Alertracker>(globalreg, "ALERTTRACKER");
+                alertracker->RaiseOneShot("PACKETQUEUE", 
+                        "The packet queue has a backlog of " + IntToString(packet_queue.size()) + 
+                        " packets; if you have multiple data sources it's possible that your "
+                        "system is not fast enough.  Kismet will continue to process "
+                        "packets, this may be a momentary spike in packet load.", -1);
+            }
         }
-    }
 
-    if (packet_queue_drop != 0 && packet_queue.size() > packet_queue_drop) {
+        bool drop = false;
+
+        if (packet_queue_drop != 0) {
+            size_t backlog = packet_queue.size();
+
+            if (backlog > packet_queue_drop) {
+                drop = true;
+            } else if ((pclass == pcqueue_class_data || pclass == pcqueue_class_control ||
+                        (pclass == pcqueue_class_other && packet_shed_other)) &&
+                    backlog > packet_queue_shared_limit) {
+                drop = true;
+            } else if (pclass == pcqueue_class_data && backlog > packet_queue_data_limit) {
+                if (packet_data_sample == 0 || 
+                        (packet_data_sample_pos++ % packet_data_sample) != 0)
+                    drop = true;
+            }
+        }
+
+        if (!drop) {
+            packet_queue.push(in_pack);
+            packet_condition.unlock();
+            return 1;
+        }
+
+        packet_queue_drops[pclass]++;
+
         time_t offt = time(0) - last_packet_drop_user_warning;
 
         if (offt > 30) {
@@ -325,31 +735,44 @@ int Packetchain::ProcessPacket(kis_packet *in_pack) {
                     "Kismet has started to drop packets; the packet queue has a backlog "
                     "of " + IntToString(packet_queue.size()) + " packets.  Your system "
                     "may not be fast enough to process the number of packets being seen. "
+                    "802.11 data packets are dropped first, management and EAPOL "
+                    "packets and packets from other phys are dropped only when the "
+                    "queue is completely full. "
                     "You change this behavior in 'kismet_memory.conf'.", -1);
         }
-
-        // Don't queue packets
-        return 1;
     }
 
-    packet_queue.push(in_pack);
-
-    packet_condition.unlock();
+    // Don't queue packets
+    DestroyPacket(in_pack);
 
     return 1;
 }
 
 void Packetchain::DestroyPacket(kis_packet *in_pack) {
-    local_locker lock(&packetchain_mutex);
+    {
+        local_locker lock(&packetchain_mutex);
 
-    pc_link *pcl;
+        pc_link *pcl;
 
-    // Push it through the destructors if there are any, we don't care
-    // about error conditions
-    for (unsigned int x = 0; x < destruction_chain.size(); x++) {
-        pcl = destruction_chain[x];
-   
-        (*(pcl->callback))(globalreg, pcl->auxdata, in_pack);
+        // Push it through the destructors if there are any, we don't care
+        // about error conditions
+        for (unsigned int x = 0; x < destruction_chain.size(); x++) {
+            pcl = destruction_chain[x];
+
+            (*(pcl->callback))(globalreg, pcl->auxdata, in_pack);
+        }
+    }
+
+    // Return the components to their pools and recycle the packet itself
+    in_pack->reset();
+
+    {
+        local_locker plock(&packetpool_mutex);
+
+        if (packet_pool_vec.size() < packet_pool_size) {
+            packet_pool_vec.push_back(in_pack);
+            return;
+        }
     }
 
 	delete in_pack;
@@ -357,17 +780,35 @@ void Packetchain::DestroyPacket(kis_packet *in_pack) {
 
 int Packetchain::RegisterIntHandler(pc_callback in_cb, void *in_aux,
         function<int (kis_packet *)> in_l_cb, 
-        int in_chain, int in_prio) {
+        pc_batch_callback in_b_cb,
+        int in_chain, int in_prio, std::string in_name) {
 
     pc_link *link = NULL;
+
+    // Genesis and destruction are always handled one packet at a time
+    if (in_b_cb != NULL && 
+            (in_chain == CHAINPOS_GENESIS || in_chain == CHAINPOS_DESTROY)) {
+        _MSG("Packetchain::RegisterBatchHandler requested genesis or destroy chain",
+                MSGFLAG_ERROR);
+        return -1;
+    }
     
     // Generate packet, we'll nuke it if it's invalid later
-    link = new pc_link;
+    link = new pc_link();
     link->priority = in_prio;
     link->callback = in_cb;
     link->l_callback = in_l_cb;
+    link->b_callback = in_b_cb;
     link->auxdata = in_aux;
 	link->id = next_handlerid++;
+    link->chain = in_chain;
+    link->live = true;
+    link->dispatch_component = -1;
+
+    if (in_name.length() == 0)
+        link->name = "handler " + IntToString(link->id);
+    else
+        link->name = in_name;
             
     switch (in_chain) {
         case CHAINPOS_GENESIS:
@@ -435,13 +876,18 @@ int Packetchain::RegisterIntHandler(pc_callback in_cb, void *in_aux,
 }
 
 int Packetchain::RegisterHandler(pc_callback in_cb, void *in_aux, 
-        int in_chain, int in_prio) {
-    return RegisterIntHandler(in_cb, in_aux, NULL, in_chain, in_prio);
+        int in_chain, int in_prio, std::string in_name) {
+    return RegisterIntHandler(in_cb, in_aux, NULL, NULL, in_chain, in_prio, in_name);
 }
 
 int Packetchain::RegisterHandler(function<int (kis_packet *)> in_cb, int in_chain,
-        int in_prio) {
-    return RegisterIntHandler(NULL, NULL, in_cb, in_chain, in_prio);
+        int in_prio, std::string in_name) {
+    return RegisterIntHandler(NULL, NULL, in_cb, NULL, in_chain, in_prio, in_name);
+}
+
+int Packetchain::RegisterBatchHandler(pc_batch_callback in_cb, int in_chain,
+        int in_prio, std::string in_name) {
+    return RegisterIntHandler(NULL, NULL, NULL, in_cb, in_chain, in_prio, in_name);
 }
 
 int Packetchain::RemoveHandler(int in_id, int in_chain) {
@@ -528,6 +974,8 @@ int Packetchain::RemoveHandler(int in_id, int in_chain) {
             return -1;
     }
 
+    UpdateComponentLiveness();
+
     return 1;
 }
 
@@ -615,6 +1063,109 @@ int Packetchain::RemoveHandler(pc_callback in_cb, int in_chain) {
             return -1;
     }
 
+    UpdateComponentLiveness();
+
     return 1;
 }
 
+
+bool Packetchain::Httpd_VerifyPath(const char *path, const char *method) {
+    if (strcmp(method, "GET") != 0)
+        return false;
+
+    if (!Httpd_CanSerialize(path))
+        return false;
+
+    std::string stripped = Httpd_StripSuffix(path);
+
+    if (stripped == "/packetchain/queue_stats")
+        return true;
+
+    if (stripped == "/packetchain/handler_stats")
+        return true;
+
+    return false;
+}
+
+void Packetchain::Httpd_CreateStreamResponse(
+        Kis_Net_Httpd *httpd,
+        Kis_Net_Httpd_Connection *connection __attribute__((unused)),
+        const char *path, const char *method, 
+        const char *upload_data __attribute__((unused)),
+        size_t *upload_data_size __attribute__((unused)), 
+        std::stringstream &stream) {
+
+    if (strcmp(method, "GET") != 0)
+        return;
+
+    if (!Httpd_CanSerialize(path))
+        return;
+
+    std::string stripped = Httpd_StripSuffix(path);
+
+    shared_ptr<EntryTracker> entrytracker =
+        Globalreg::FetchMandatoryGlobalAs<EntryTracker>(globalreg, "ENTRY_TRACKER");
+
+    if (stripped == "/packetchain/queue_stats") {
+        SharedTrackerElement stats(new TrackerElement(TrackerMap, 0));
+
+        auto add_u64 = [stats](int id, uint64_t v) {
+            SharedTrackerElement e(new TrackerElement(TrackerUInt64, id));
+            e->set(v);
+            stats->add_map(e);
+        };
+
+        {
+            local_locker qlock(&packetqueue_mutex);
+
+            add_u64(queue_backlog_id, packet_queue.size());
+            add_u64(queue_limit_id, packet_queue_drop);
+            add_u64(queue_shared_limit_id, packet_queue_shared_limit);
+            add_u64(queue_data_limit_id, packet_queue_data_limit);
+            add_u64(queue_drop_mgmt_id, packet_queue_drops[pcqueue_class_mgmt]);
+            add_u64(queue_drop_eapol_id, packet_queue_drops[pcqueue_class_eapol]);
+            add_u64(queue_drop_data_id, packet_queue_drops[pcqueue_class_data]);
+            add_u64(queue_drop_control_id, packet_queue_drops[pcqueue_class_control]);
+            add_u64(queue_drop_other_id, packet_queue_drops[pcqueue_class_other]);
+        }
+
+        entrytracker->Serialize(httpd->GetSuffix(path), stream, stats, NULL);
+        return;
+    }
+
+    if (stripped == "/packetchain/handler_stats") {
+        SharedTrackerElement handlers(new TrackerElement(TrackerVector, 
+                    handler_stats_vec_id));
+
+        {
+            local_locker lock(&packetchain_mutex);
+
+            // Genesis and destroy handlers run inline in whatever thread creates or
+            // frees the packet and aren't timed
+            for (auto c : { &postcap_chain, &llcdissect_chain, &decrypt_chain, 
+                    &datadissect_chain, &classifier_chain, &tracker_chain, 
+                    &logging_chain }) {
+                for (auto pcl : *c) {
+                    std::shared_ptr<packetchain_handler_stats> hs(
+                            new packetchain_handler_stats(globalreg, handler_stats_id));
+
+                    hs->set_handler_id(pcl->id);
+                    hs->set_name(pcl->name);
+                    hs->set_chain(packetchain_chain_name(pcl->chain));
+                    hs->set_priority(pcl->priority);
+                    hs->set_calls(pcl->stats.calls.load(std::memory_order_relaxed));
+                    hs->set_packets(pcl->stats.packets.load(std::memory_order_relaxed));
+                    hs->set_time_ns(pcl->stats.wall_ns.load(std::memory_order_relaxed));
+                    hs->set_cpu_ns(pcl->stats.cpu_ns.load(std::memory_order_relaxed));
+                    hs->set_max_ns(pcl->stats.max_ns.load(std::memory_order_relaxed));
+                    hs->set_latency_hist(pcl->stats.latency_hist);
+
+                    handlers->add_vector(hs);
+                }
+            }
+        }
+
+        entrytracker->Serialize(httpd->GetSuffix(path), stream, handlers, NULL);
+        return;
+    }
+}
@@ -35,9 +35,13 @@
 #include <functional>
 #include <queue>
 #include <thread>
+#include <typeindex>
+#include <atomic>
 
 #include "globalregistry.h"
 #include "kis_mutex.h"
+#include "kis_net_microhttpd.h"
+#include "trackedelement.h"
 #include "packet.h"
 
 
@@ -90,7 +94,131 @@
 
 class kis_packet;
 
-class Packetchain : public LifetimeGlobal {
+// Classes of packets used to decide what to shed when the packet queue is 
+// overloaded; determined by a quick look at the link frame when the packet is
+// queued.  Management and EAPOL frames get a reserved share of the queue, data
+// frames are sampled and then shed first.  Packets from other phys are only
+// shed at the hard limit unless packet_backlog_shed_other is set, so a busy
+// 802.11 source doesn't starve them.
+enum packetchain_queue_class {
+    pcqueue_class_other = 0,
+    pcqueue_class_data = 1,
+    pcqueue_class_mgmt = 2,
+    pcqueue_class_eapol = 3,
+    pcqueue_class_control = 4,
+    pcqueue_class_max = 5
+};
+
+// Number of latency histogram buckets kept per handler; bucket 0 counts 
+// packets handled in under 1us, bucket N counts packets handled in under 
+// 2^N us, and the last bucket counts everything slower
+#define PC_LATENCY_BUCKETS      16
+
+// Per-handler accounting, only updated when packet_chain_stats is enabled.  
+// Handlers are timed once per batch; the per-packet latency recorded in the 
+// histogram is the batch time divided over the packets in the batch.
+struct pc_link_stats {
+    std::atomic<uint64_t> calls;
+    std::atomic<uint64_t> packets;
+    std::atomic<uint64_t> wall_ns;
+    std::atomic<uint64_t> cpu_ns;
+    std::atomic<uint64_t> max_ns;
+    std::atomic<uint64_t> latency_hist[PC_LATENCY_BUCKETS];
+};
+
+// Tracked view of the handler stats for the REST interface
+class packetchain_handler_stats : public tracker_component {
+public:
+    packetchain_handler_stats(GlobalRegistry *in_globalreg, int in_id) :
+        tracker_component(in_globalreg, in_id) {
+        register_fields();
+        reserve_fields(NULL);
+    }
+
+    packetchain_handler_stats(GlobalRegistry *in_globalreg, int in_id,
+            SharedTrackerElement e) :
+        tracker_component(in_globalreg, in_id) {
+        register_fields();
+        reserve_fields(e);
+    }
+
+    virtual SharedTrackerElement clone_type() {
+        return SharedTrackerElement(new packetchain_handler_stats(globalreg, get_id()));
+    }
+
+    __Proxy(handler_id, int32_t, int, int, handler_id);
+    __Proxy(name, string, string, string, name);
+    __Proxy(chain, string, string, string, chain);
+    __Proxy(priority, int32_t, int, int, priority);
+    __Proxy(calls, uint64_t, uint64_t, uint64_t, calls);
+    __Proxy(packets, uint64_t, uint64_t, uint64_t, packets);
+    __Proxy(time_ns, uint64_t, uint64_t, uint64_t, time_ns);
+    __Proxy(cpu_ns, uint64_t, uint64_t, uint64_t, cpu_ns);
+    __Proxy(max_ns, uint64_t, uint64_t, uint64_t, max_ns);
+
+    void set_latency_hist(const std::atomic<uint64_t> *in_hist) {
+        TrackerElementVector hv(latency_hist);
+
+        for (unsigned int x = 0; x < PC_LATENCY_BUCKETS && x < hv.size(); x++)
+            hv[x]->set((uint64_t) in_hist[x].load(std::memory_order_relaxed));
+    }
+
+protected:
+    virtual void register_fields() {
+        tracker_component::register_fields();
+
+        RegisterField("kismet.packetchain.handler.id", TrackerInt32,
+                "handler id", &handler_id);
+        RegisterField("kismet.packetchain.handler.name", TrackerString,
+                "handler name", &name);
+        RegisterField("kismet.packetchain.handler.chain", TrackerString,
+                "packet chain position", &chain);
+        RegisterField("kismet.packetchain.handler.priority", TrackerInt32,
+                "priority within the chain", &priority);
+        RegisterField("kismet.packetchain.handler.calls", TrackerUInt64,
+                "number of times the handler was called", &calls);
+        RegisterField("kismet.packetchain.handler.packets", TrackerUInt64,
+                "number of packets seen by the handler", &packets);
+        RegisterField("kismet.packetchain.handler.time_ns", TrackerUInt64,
+                "total wall time spent in the handler (ns)", &time_ns);
+        RegisterField("kismet.packetchain.handler.cpu_ns", TrackerUInt64,
+                "total cpu time spent in the handler (ns)", &cpu_ns);
+        RegisterField("kismet.packetchain.handler.max_ns", TrackerUInt64,
+                "longest single call to the handler (ns)", &max_ns);
+        RegisterField("kismet.packetchain.handler.latency_hist", TrackerVector,
+                "per-packet latency histogram, bucket N counts packets under 2^N us",
+                &latency_hist);
+
+        bucket_id =
+            RegisterField("kismet.packetchain.handler.latency_bucket", TrackerUInt64,
+                    "packets in latency bucket", NULL);
+    }
+
+    virtual void reserve_fields(SharedTrackerElement e) {
+        tracker_component::reserve_fields(e);
+
+        for (unsigned int x = latency_hist->get_vector()->size(); 
+                x < PC_LATENCY_BUCKETS; x++) {
+            SharedTrackerElement b(new TrackerElement(TrackerUInt64, bucket_id));
+            latency_hist->add_vector(b);
+        }
+    }
+
+    SharedTrackerElement handler_id;
+    SharedTrackerElement name;
+    SharedTrackerElement chain;
+    SharedTrackerElement priority;
+    SharedTrackerElement calls;
+    SharedTrackerElement packets;
+    SharedTrackerElement time_ns;
+    SharedTrackerElement cpu_ns;
+    SharedTrackerElement max_ns;
+    SharedTrackerElement latency_hist;
+
+    int bucket_id;
+};
+
+class Packetchain : public LifetimeGlobal, public Kis_Net_Httpd_CPPStream_Handler {
 public:
     static std::shared_ptr<Packetchain> create_packetchain(GlobalRegistry *in_globalreg) {
         std::shared_ptr<Packetchain> mon(new Packetchain(in_globalreg));
@@ -108,10 +236,57 @@ public:
 
     virtual ~Packetchain();
 
+    virtual bool Httpd_VerifyPath(const char *path, const char *method);
+
+    virtual void Httpd_CreateStreamResponse(Kis_Net_Httpd *httpd,
+            Kis_Net_Httpd_Connection *connection,
+            const char *url, const char *method, const char *upload_data,
+            size_t *upload_data_size, std::stringstream &stream);
+
     int RegisterPacketComponent(std::string in_component);
     int RemovePacketComponent(int in_id);
     std::string FetchPacketComponentName(int in_id);
 
+    // Components only worth producing when something downstream uses them 
+    // (decrypted frames, dissected payloads) are tracked by consumer count; a 
+    // consumer registers while it needs a component and removes itself when it 
+    // stops, and producers check ComponentConsumed before doing the work.
+    //
+    // Handlers can also declare the components they produce and consume with
+    // SetHandlerComponents.  A handler which produces something is skipped 
+    // entirely while nothing consumes any of its products, and only counts as
+    // a consumer of its own inputs while it is live, so a chain of dissectors
+    // whose results end up unused is skipped as a whole.
+    void RegisterComponentConsumer(int in_id);
+    void RemoveComponentConsumer(int in_id);
+
+    bool ComponentConsumed(int in_id) {
+        if (in_id < 0 || in_id >= MAX_PACKET_COMPONENTS)
+            return false;
+
+        return component_live[in_id].load(std::memory_order_relaxed);
+    }
+
+    // Fetch the recycling pool for a packet component type, creating it on 
+    // first use.  Pools are owned by the packetchain; callers should fetch the
+    // pools they need once and keep the pointer.
+    template<class T>
+    packet_component_pool<T> *FetchComponentPool() {
+        local_locker lock(&packetpool_mutex);
+
+        auto pi = component_pool_map.find(std::type_index(typeid(T)));
+
+        if (pi != component_pool_map.end())
+            return static_cast<packet_component_pool<T> *>(pi->second);
+
+        packet_component_pool<T> *pool = 
+            new packet_component_pool<T>(packet_pool_size);
+
+        component_pool_map[std::type_index(typeid(T))] = pool;
+
+        return pool;
+    }
+
     // Generate a packet and hand it back
     kis_packet *GeneratePacket();
     // Inject a packet into the chain
@@ -121,35 +296,147 @@ public:
  
     // Callback and information 
     typedef int (*pc_callback)(CHAINCALL_PARMS);
+    typedef std::function<int (const std::vector<kis_packet *>&)> pc_batch_callback;
     typedef struct {
         int priority;
 		Packetchain::pc_callback callback;
         std::function<int (kis_packet *)> l_callback;
+        Packetchain::pc_batch_callback b_callback;
         void *auxdata;
 		int id;
+        int chain;
+        std::string name;
+        pc_link_stats stats;
+        // Components the handler produces and uses; a handler which declares 
+        // what it produces is only called while one of them is consumed
+        std::vector<int> produces;
+        std::vector<int> consumes;
+        std::atomic<bool> live;
+        // Packets the handler is offered; -1 or empty offers every packet
+        int dispatch_component;
+        std::vector<unsigned int> dispatch_dlts;
+        // Packets of the current batch which match the dispatch, only used by
+        // the packet thread
+        std::vector<kis_packet *> dispatch_batch;
     } pc_link;
 
-    // Register a callback, aux data, a chain to put it in, and the priority 
-    int RegisterHandler(pc_callback in_cb, void *in_aux, int in_chain, int in_prio);
-    int RegisterHandler(std::function<int (kis_packet *)> in_cb, int in_chain, int in_prio);
+    // Register a callback, aux data, a chain to put it in, and the priority.  The
+    // optional name identifies the handler in the packetchain statistics.
+    int RegisterHandler(pc_callback in_cb, void *in_aux, int in_chain, int in_prio,
+            std::string in_name = "");
+    int RegisterHandler(std::function<int (kis_packet *)> in_cb, int in_chain, int in_prio,
+            std::string in_name = "");
+
+    // Register a batch callback; batch handlers are called once with every packet
+    // the chain is currently processing (up to packet_batch_size packets) so 
+    // that locking and setup can be amortized across packets.  Batch handlers
+    // are called in priority order alongside per-packet handlers in the same
+    // chain, and may not be registered in the genesis or destruction chains.
+    int RegisterBatchHandler(pc_batch_callback in_cb, int in_chain, int in_prio,
+            std::string in_name = "");
     int RemoveHandler(pc_callback in_cb, int in_chain);
 	int RemoveHandler(int in_id, int in_chain);
 
+    // Declare the components a registered handler produces and consumes
+    int SetHandlerComponents(int in_id, const std::vector<int>& in_produces,
+            const std::vector<int>& in_consumes);
+
+    // Most handlers only understand packets from one phy or link type and
+    // return immediately on everything else.  Setting a dispatch on a handler
+    // offers it only the packets it can handle: packets which carry the given
+    // component, or whose link frame has one of the given DLTs.  Handlers keep
+    // their place in the chain, and batch handlers are called with only the
+    // matching packets, or not at all.  Phy and DLT handlers, including those
+    // in plugins, should set a dispatch when they register.  Dispatch does not
+    // apply to the genesis and destruction chains.
+    int SetHandlerComponentDispatch(int in_id, int in_component);
+    int SetHandlerDLTDispatch(int in_id, const std::vector<unsigned int>& in_dlts);
+
 protected:
     GlobalRegistry *globalreg;
 
     static void packet_queue_processor(Packetchain *packetchain);
 
-    // Common function for both insertion methods
+    // Common function for all insertion methods
     int RegisterIntHandler(pc_callback in_cb, void *in_aux, 
             std::function<int (kis_packet *)> in_l_cb, 
-            int in_chain, int in_prio);
+            pc_batch_callback in_b_cb,
+            int in_chain, int in_prio, std::string in_name);
+
+    // Find the overload class of a packet from the link frame
+    packetchain_queue_class ClassifyPacket(kis_packet *in_pack);
+
+    // Find a registered handler by id; must hold packetchain_mutex
+    pc_link *FindLink(int in_id);
+
+    // Find the packets in the batch a handler is offered
+    inline std::vector<kis_packet *>& DispatchBatch(pc_link *in_link,
+            std::vector<kis_packet *>& in_batch) {
+        if (in_link->dispatch_component < 0 && in_link->dispatch_dlts.size() == 0)
+            return in_batch;
+
+        in_link->dispatch_batch.clear();
+
+        for (auto packet : in_batch) {
+            if (in_link->dispatch_component >= 0 && 
+                    packet->fetch(in_link->dispatch_component) != NULL) {
+                in_link->dispatch_batch.push_back(packet);
+                continue;
+            }
+
+            if (in_link->dispatch_dlts.size() == 0)
+                continue;
+
+            kis_datachunk *chunk = 
+                (kis_datachunk *) packet->fetch(pack_comp_linkframe);
+
+            if (chunk == NULL)
+                continue;
+
+            for (auto d : in_link->dispatch_dlts) {
+                if ((unsigned int) chunk->dlt == d) {
+                    in_link->dispatch_batch.push_back(packet);
+                    break;
+                }
+            }
+        }
+
+        return in_link->dispatch_batch;
+    }
+
+    // Call a single handler for every packet in the batch
+    inline void CallLink(pc_link *in_link, std::vector<kis_packet *>& in_batch) {
+        if (in_link->b_callback != NULL) {
+            in_link->b_callback(in_batch);
+            return;
+        }
+
+        for (auto packet : in_batch) {
+            if (in_link->callback != NULL)
+                in_link->callback(globalreg, in_link->auxdata, packet);
+            else if (in_link->l_callback != NULL)
+                in_link->l_callback(packet);
+        }
+    }
+
+    // Recompute which components are consumed and which handlers are live after
+    // a consumer or handler changes; must hold packetchain_mutex
+    void UpdateComponentLiveness();
+
+    // Run a batch of packets through a chain
+    void ProcessChain(std::vector<Packetchain::pc_link *>& in_chain,
+            std::vector<kis_packet *>& in_batch);
 
     int next_componentid, next_handlerid;
 
     std::map<std::string, int> component_str_map;
     std::map<int, std::string> component_id_map;
 
+    // Number of registered consumers of each component, and whether anything
+    // (registered consumers or live handlers) consumes it
+    int component_consumers[MAX_PACKET_COMPONENTS];
+    std::atomic<bool> component_live[MAX_PACKET_COMPONENTS];
+
     // These two chains get called after a packet is generated and
     // before the final destruction, respectively
     std::vector<Packetchain::pc_link *> genesis_chain;
@@ -174,9 +461,36 @@ protected:
     std::queue<kis_packet *> packet_queue;
     bool packetchain_shutdown;
 
+    // Maximum number of queued packets processed together
+    unsigned int packet_batch_size;
+
+    // Recycled packets and packet component pools
+    kis_recursive_timed_mutex packetpool_mutex;
+    std::vector<kis_packet *> packet_pool_vec;
+    std::map<std::type_index, packet_component_recycler *> component_pool_map;
+    unsigned int packet_pool_size;
+
     // Warning and discard levels for packet queue being full
     unsigned int packet_queue_warning, packet_queue_drop;
     time_t last_packet_queue_user_warning, last_packet_drop_user_warning;
+
+    // Overload shedding; non-priority packets are dropped once the queue reaches
+    // the shared limit, data packets are sampled once the queue reaches the data
+    // limit, keeping one in every packet_data_sample
+    unsigned int packet_queue_shared_limit, packet_queue_data_limit;
+    unsigned int packet_data_sample, packet_data_sample_pos;
+    bool packet_shed_other;
+    uint64_t packet_queue_drops[pcqueue_class_max];
+
+    int pack_comp_linkframe;
+
+    // Per-handler timing, from packet_chain_stats
+    bool handler_stats;
+    int handler_stats_id, handler_stats_vec_id;
+
+    int queue_backlog_id, queue_limit_id, queue_shared_limit_id, 
+        queue_data_limit_id, queue_drop_mgmt_id, queue_drop_eapol_id,
+        queue_drop_data_id, queue_drop_control_id, queue_drop_other_id;
 };
 
 #endif
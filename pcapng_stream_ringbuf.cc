@@ -19,11 +19,13 @@
 #include "config.h"
 
 #include "pcapng_stream_ringbuf.h"
+#include "messagebus.h"
 
 Pcap_Stream_Ringbuf::Pcap_Stream_Ringbuf(GlobalRegistry *in_globalreg,
         shared_ptr<BufferHandlerGeneric> in_handler,
         function<bool (kis_packet *)> accept_filter,
-        function<kis_datachunk * (kis_packet *)> data_selector) : streaming_agent() {
+        function<kis_datachunk * (kis_packet *)> data_selector,
+        bool attach_chain) : streaming_agent() {
 
     globalreg = in_globalreg;
     
@@ -35,10 +37,14 @@ Pcap_Stream_Ringbuf::Pcap_Stream_Ringbuf(GlobalRegistry *in_globalreg,
     accept_cb = accept_filter;
     selector_cb = data_selector;
 
-    packethandler_id = packetchain->RegisterHandler([this](kis_packet *packet) {
-            handle_chain_packet(packet);
-            return 1;
-        }, CHAINPOS_LOGGING, -100);
+    packethandler_id = -1;
+
+    if (attach_chain) {
+        packethandler_id = packetchain->RegisterHandler([this](kis_packet *packet) {
+                handle_chain_packet(packet);
+                return 1;
+            }, CHAINPOS_LOGGING, -100, "pcapng stream");
+    }
 
     pack_comp_linkframe = packetchain->RegisterPacketComponent("LINKFRAME");
     pack_comp_datasrc = packetchain->RegisterPacketComponent("KISDATASRC");
@@ -51,11 +57,15 @@ Pcap_Stream_Ringbuf::Pcap_Stream_Ringbuf(GlobalRegistry *in_globalreg,
 
 Pcap_Stream_Ringbuf::~Pcap_Stream_Ringbuf() {
     handler->ProtocolError();
-    packetchain->RemoveHandler(packethandler_id, CHAINPOS_LOGGING);
+
+    if (packethandler_id >= 0)
+        packetchain->RemoveHandler(packethandler_id, CHAINPOS_LOGGING);
 }
 
 void Pcap_Stream_Ringbuf::stop_stream(string in_reason) {
-    packetchain->RemoveHandler(packethandler_id, CHAINPOS_LOGGING);
+    if (packethandler_id >= 0)
+        packetchain->RemoveHandler(packethandler_id, CHAINPOS_LOGGING);
+
     handler->ProtocolError();
 }
 
@@ -466,6 +476,56 @@ int Pcap_Stream_Ringbuf::pcapng_write_packet(kis_packet *in_packet, kis_datachun
     return pcapng_write_packet(ng_interface_id, &(in_packet->ts), blocks);
 }
 
+int Pcap_Stream_Ringbuf::pcapng_write_retro(const vector<packet_retro_frame>& in_frames) {
+    size_t written = 0;
+
+    for (auto f : in_frames) {
+        // The whole dump is written before the stream starts draining, so stop
+        // once the buffer is full instead of writing partial blocks
+        size_t block_sz = sizeof(pcapng_epb) + PAD_TO_32BIT(f.length) + 
+            sizeof(pcapng_option) + 4;
+
+        if (handler->GetWriteBufferAvailable() < (ssize_t) block_sz)
+            break;
+
+        auto ds_id_rec = datasource_id_map.find(f.source->source_number);
+
+        int ng_interface_id;
+
+        if (ds_id_rec == datasource_id_map.end()) {
+            if ((ng_interface_id = pcapng_make_idb(f.source->source_number,
+                            f.source->interface, f.source->description, 
+                            f.source->dlt)) < 0)
+                return -1;
+        } else {
+            ng_interface_id = ds_id_rec->second;
+        }
+
+        vector<data_block> blocks;
+        blocks.push_back(data_block((uint8_t *) f.data, f.length));
+
+        int r = pcapng_write_packet(ng_interface_id, &(f.ts), blocks);
+
+        if (r < 0)
+            return -1;
+
+        if (r == 0)
+            break;
+
+        written++;
+        log_packets++;
+    }
+
+    if (written < in_frames.size()) {
+        _MSG("Retroactive pcap export truncated; the stream buffer filled after " +
+                IntToString(written) + " packets, " + 
+                IntToString(in_frames.size() - written) + " newer packets were "
+                "not written.  Request fewer packets or a shorter time.", MSGFLAG_ERROR);
+    }
+
+    return written;
+}
+
 // Handle a packet from the chain; given the accept_cb and selector_cb we
 // should be able to generically handle any sort of filtering - an advanced
 // filter can be applied by the caller function to filter to a specific device
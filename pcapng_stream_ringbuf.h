@@ -37,6 +37,7 @@
 #include "packetchain.h"
 #include "kis_datasource.h"
 #include "streamtracker.h"
+#include "packet_retro.h"
 
 /* PCAP-NG basic structs, as defined in:
  * http://xml2rfc.tools.ietf.org/cgi-bin/xml2rfc.cgi?url=https://raw.githubusercontent.com/pcapng/pcapng/master/draft-tuexen-opsawg-pcapng.xml&modeAsFormat=html/ascii&type=ascii#section_shb
@@ -123,6 +124,8 @@ typedef struct pcapng_epb pcapng_epb_t;
  *
  * The data selector function, if present, should return the kis_datachunk component
  * of the packet destined for export.
+ * * A stream which is not attached to the packetchain only writes what is
+ * explicitly given to it, such as frames from the retroactive packet buffer.
  *
  */
 class Pcap_Stream_Ringbuf : public streaming_agent {
@@ -130,12 +133,16 @@ public:
     Pcap_Stream_Ringbuf(GlobalRegistry *in_globalreg, 
             shared_ptr<BufferHandlerGeneric> in_handler,
             function<bool (kis_packet *)> accept_filter,
-            function<kis_datachunk * (kis_packet *)> data_selector);
+            function<kis_datachunk * (kis_packet *)> data_selector,
+            bool attach_chain = true);
 
     virtual ~Pcap_Stream_Ringbuf();
 
     virtual void stop_stream(string in_reason);
 
+    // Write frames from the retroactive packet buffer
+    virtual int pcapng_write_retro(const vector<packet_retro_frame>& in_frames);
+
     struct data_block {
         data_block(uint8_t *in_d, size_t in_l) {
             data = in_d;
@@ -237,10 +237,6 @@ void dot11_tracked_nonce::set_from_eapol(SharedTrackerElement in_tracked_eapol)
     set_eapol_nonce(e->get_eapol_nonce());
 }
 
-int phydot11_packethook_wep(CHAINCALL_PARMS) {
-	return ((Kis_80211_Phy *) auxdata)->PacketWepDecryptor(in_pack);
-}
-
 int phydot11_packethook_dot11(CHAINCALL_PARMS) {
 	return ((Kis_80211_Phy *) auxdata)->PacketDot11dissector(in_pack);
 }
@@ -274,16 +270,20 @@ Kis_80211_Phy::Kis_80211_Phy(GlobalRegistry *in_globalreg,
                 "IEEE802.11 device");
 
 	// Packet classifier - makes basic records plus dot11 data
-	packetchain->RegisterHandler(&CommonClassifierDot11, this,
-            CHAINPOS_CLASSIFIER, -100);
-
-	packetchain->RegisterHandler(&phydot11_packethook_wep, this,
-            CHAINPOS_DECRYPT, -100);
+	classifier_handler_id = 
+        packetchain->RegisterHandler(&CommonClassifierDot11, this,
+            CHAINPOS_CLASSIFIER, -100, "dot11 classifier");
+
+	wep_decrypt_handler_id = 
+        packetchain->RegisterBatchHandler([this](const std::vector<kis_packet *>& in_packs) -> int {
+                return PacketWepDecryptor(in_packs);
+            }, CHAINPOS_DECRYPT, -100, "dot11 wep decrypt");
 	packetchain->RegisterHandler(&phydot11_packethook_dot11, this,
-            CHAINPOS_LLCDISSECT, -100);
+            CHAINPOS_LLCDISSECT, -100, "dot11 dissector");
 
-	packetchain->RegisterHandler(&phydot11_packethook_dot11tracker, this,
-											CHAINPOS_TRACKER, 100);
+	tracker_handler_id = 
+        packetchain->RegisterHandler(&phydot11_packethook_dot11tracker, this,
+											CHAINPOS_TRACKER, 100, "dot11 tracker");
 
 	// If we haven't registered packet components yet, do so.  We have to
 	// co-exist with the old tracker core for some time
@@ -317,6 +317,14 @@ Kis_80211_Phy::Kis_80211_Phy(GlobalRegistry *in_globalreg,
     pack_comp_l1info =
         packetchain->RegisterPacketComponent("RADIODATA");
 
+    pack_comp_datasrc =
+        packetchain->RegisterPacketComponent("KISDATASRC");
+
+    packinfo_pool = packetchain->FetchComponentPool<dot11_packinfo>();
+    common_pool = packetchain->FetchComponentPool<kis_common_info>();
+    datachunk_pool = packetchain->FetchComponentPool<kis_datachunk>();
+    datainfo_pool = packetchain->FetchComponentPool<kis_data_packinfo>();
+
     ssid_regex_vec =
         entrytracker->RegisterAndGetField("phy80211.ssid_alerts", TrackerVector,
                 "Regex SSID alert configuration");
@@ -555,6 +563,22 @@ Kis_80211_Phy::Kis_80211_Phy(GlobalRegistry *in_globalreg,
 		dissect_data = 1;
 	}
 
+    // Everything past the dissector only looks at packets it decoded
+    packetchain->SetHandlerComponentDispatch(classifier_handler_id, pack_comp_80211);
+    packetchain->SetHandlerComponentDispatch(wep_decrypt_handler_id, pack_comp_80211);
+    packetchain->SetHandlerComponentDispatch(tracker_handler_id, pack_comp_80211);
+
+    // Decrypted frames are only worth producing for something that logs them
+    // or dissects their payload
+    packetchain->SetHandlerComponents(wep_decrypt_handler_id,
+            {pack_comp_mangleframe, pack_comp_datapayload}, 
+            {pack_comp_80211, pack_comp_decap});
+
+    // The tracker uses the IP dissector results for client DHCP, CDP, and EAP 
+    // info, but only when we're allowed to look at data
+    if (dissect_data)
+        packetchain->SetHandlerComponents(tracker_handler_id, {}, {pack_comp_basicdata});
+
     // Do we process phy and control frames?  They seem to be the glitchiest
     // on many cards including the ath9k which is otherwise excellent
     if (globalreg->kismet_config->FetchOptBoolean("dot11_process_phy", 0)) {
@@ -633,14 +657,17 @@ Kis_80211_Phy::Kis_80211_Phy(GlobalRegistry *in_globalreg,
         Globalreg::FetchGlobalAs<Kis_Httpd_Registry>(globalreg, "WEBREGISTRY");
     httpregistry->register_js_module("kismet_ui_dot11", "/js/kismet.ui.dot11.js");
 
-    // Set up the de-duplication list
-    recent_packet_checksums_sz = 
-        globalreg->kismet_config->FetchOptUInt("packet_dedup_size", 2048);
-    recent_packet_checksums = new uint32_t[recent_packet_checksums_sz];
-    for (unsigned int x = 0; x < recent_packet_checksums_sz; x++) {
-        recent_packet_checksums[x] = 0;
-    }
-    recent_packet_checksum_pos = 0;
+    // Set up the de-duplication window
+    dedup_max =
+        globalreg->kismet_config->FetchOptUInt("packet_dedup_size", 16384);
+    dedup_window_usec = 1000ULL *
+        globalreg->kismet_config->FetchOptUInt("packet_dedup_window", 1000);
+    dedup_hash_set.reserve(dedup_max);
+
+    // Size the per-BSSID beacon IE cache
+    beacon_ie_cache_max =
+        globalreg->kismet_config->FetchOptUInt("beacon_ie_cache_size", 4096);
+    beacon_ie_cache.reserve(beacon_ie_cache_max);
 
     // Parse the ssid regex options
     auto apspoof_lines = globalreg->kismet_config->FetchOptVec("apspoof");
@@ -707,7 +734,7 @@ Kis_80211_Phy::Kis_80211_Phy(GlobalRegistry *in_globalreg,
 }
 
 Kis_80211_Phy::~Kis_80211_Phy() {
-	packetchain->RemoveHandler(&phydot11_packethook_wep, CHAINPOS_DECRYPT);
+	packetchain->RemoveHandler(wep_decrypt_handler_id, CHAINPOS_DECRYPT);
 	packetchain->RemoveHandler(&phydot11_packethook_dot11, 
 										  CHAINPOS_LLCDISSECT);
 	/*
@@ -724,7 +751,6 @@ Kis_80211_Phy::~Kis_80211_Phy() {
 
     timetracker->RemoveTimer(device_idle_timer);
 
-    delete[] recent_packet_checksums;
 }
 
 int Kis_80211_Phy::LoadWepkeys() {
@@ -768,6 +794,7 @@ int Kis_80211_Phy::LoadWepkeys() {
         keyinfo->failed = 0;
         keyinfo->len = len;
         memcpy(keyinfo->key, key, sizeof(unsigned char) * WEPKEY_MAX);
+        keyinfo->prepare_seed();
 
         wepkeys.insert(bssid_mac, keyinfo);
 
@@ -833,7 +860,7 @@ int Kis_80211_Phy::CommonClassifierDot11(CHAINCALL_PARMS) {
         (kis_common_info *) in_pack->fetch(d11phy->pack_comp_common);
 
     if (ci == NULL) {
-        ci = new kis_common_info;
+        ci = d11phy->common_pool->acquire();
         in_pack->insert(d11phy->pack_comp_common, ci);
     } 
 
@@ -949,6 +976,7 @@ void Kis_80211_Phy::AddWepKey(mac_addr bssid, uint8_t *key, unsigned int len,
     winfo->len = len;
 
     memcpy(winfo->key, key, len);
+    winfo->prepare_seed();
 
     // Replace exiting ones
 	if (wepkeys.find(winfo->bssid) != wepkeys.end()) {
@@ -1084,50 +1112,50 @@ void Kis_80211_Phy::HandleSSID(shared_ptr<kis_tracked_device_base> basedev,
             ssid->set_ssid_beacon(true);
 
             // Set the mobility
-            if (dot11info->dot11r_mobility != NULL) {
+            if (dot11info->has_dot11r_mobility) {
                 ssid->set_dot11r_mobility(true);
-                ssid->set_dot11r_mobility_domain_id(dot11info->dot11r_mobility->mobility_domain());
+                ssid->set_dot11r_mobility_domain_id(dot11info->dot11r_mobility.mobility_domain());
             }
 
             // Set QBSS
-            if (dot11info->qbss != NULL) {
+            if (dot11info->has_qbss) {
                 ssid->set_dot11e_qbss(true);
-                ssid->set_dot11e_qbss_stations(dot11info->qbss->station_count());
+                ssid->set_dot11e_qbss_stations(dot11info->qbss.station_count());
 
                 // Percentage is value / max (1 byte, 255)
-                double chperc = (double) ((double) dot11info->qbss->channel_utilization() / 
+                double chperc = (double) ((double) dot11info->qbss.channel_utilization() / 
                     (double) 255.0f) * 100.0f;
                 ssid->set_dot11e_qbss_channel_load(chperc);
             }
 
             // Do we have HT or VHT data?  I don't think we can have one
             // without the other
-            if (dot11info->dot11vht != NULL && dot11info->dot11ht != NULL) {
+            if (dot11info->has_dot11vht && dot11info->has_dot11ht) {
                 // Grab the primary channel from the HT data
-                ssid->set_channel(IntToString(dot11info->dot11ht->primary_channel()));
+                ssid->set_channel(IntToString(dot11info->dot11ht.primary_channel()));
 
-                if (dot11info->dot11vht->channel_width() ==
-                        dot11_ie_192_vht_operation_t::CHANNEL_WIDTH_CH_80) {
+                if (dot11info->dot11vht.channel_width() ==
+                        dot11_ie_192_vht_operation_span::CHANNEL_WIDTH_CH_80) {
                     ssid->set_ht_mode("HT40");
-                    ssid->set_ht_center_1(5000 + (5 * dot11info->dot11vht->center1()));
+                    ssid->set_ht_center_1(5000 + (5 * dot11info->dot11vht.center1()));
                     ssid->set_ht_center_2(0);
-                } else if (dot11info->dot11vht->channel_width() ==
-                        dot11_ie_192_vht_operation_t::CHANNEL_WIDTH_CH_160) {
+                } else if (dot11info->dot11vht.channel_width() ==
+                        dot11_ie_192_vht_operation_span::CHANNEL_WIDTH_CH_160) {
                     ssid->set_ht_mode("HT160");
-                    ssid->set_ht_center_1(5000 + (5 * dot11info->dot11vht->center1()));
+                    ssid->set_ht_center_1(5000 + (5 * dot11info->dot11vht.center1()));
                     ssid->set_ht_center_2(0);
-                } else if (dot11info->dot11vht->channel_width() ==
-                        dot11_ie_192_vht_operation_t::CHANNEL_WIDTH_CH_80_80) {
+                } else if (dot11info->dot11vht.channel_width() ==
+                        dot11_ie_192_vht_operation_span::CHANNEL_WIDTH_CH_80_80) {
                     ssid->set_ht_mode("HT80+80");
-                    ssid->set_ht_center_1(5000 + (5 * dot11info->dot11vht->center1()));
-                    ssid->set_ht_center_2(5000 + (5 * dot11info->dot11vht->center2()));
-                } else if (dot11info->dot11vht->channel_width() ==
-                        dot11_ie_192_vht_operation_t::CHANNEL_WIDTH_CH_20_40) {
-                    if (dot11info->dot11ht->ht_info_chan_offset_none()) {
+                    ssid->set_ht_center_1(5000 + (5 * dot11info->dot11vht.center1()));
+                    ssid->set_ht_center_2(5000 + (5 * dot11info->dot11vht.center2()));
+                } else if (dot11info->dot11vht.channel_width() ==
+                        dot11_ie_192_vht_operation_span::CHANNEL_WIDTH_CH_20_40) {
+                    if (dot11info->dot11ht.ht_info_chan_offset_none()) {
                         ssid->set_ht_mode("HT20");
-                    } else if (dot11info->dot11ht->ht_info_chan_offset_above()) {
+                    } else if (dot11info->dot11ht.ht_info_chan_offset_above()) {
                         ssid->set_ht_mode("HT40+");
-                    } else if (dot11info->dot11ht->ht_info_chan_offset_below()) {
+                    } else if (dot11info->dot11ht.ht_info_chan_offset_below()) {
                         ssid->set_ht_mode("HT40-");
                     }
 
@@ -1135,19 +1163,19 @@ void Kis_80211_Phy::HandleSSID(shared_ptr<kis_tracked_device_base> basedev,
                     ssid->set_ht_center_2(0);
 
                 } 
-            } else if (dot11info->dot11ht != NULL) {
+            } else if (dot11info->has_dot11ht) {
                 // Only HT info no VHT
-                if (dot11info->dot11ht->ht_info_chan_offset_none()) {
+                if (dot11info->dot11ht.ht_info_chan_offset_none()) {
                     ssid->set_ht_mode("HT20");
-                } else if (dot11info->dot11ht->ht_info_chan_offset_above()) {
+                } else if (dot11info->dot11ht.ht_info_chan_offset_above()) {
                     ssid->set_ht_mode("HT40+");
-                } else if (dot11info->dot11ht->ht_info_chan_offset_below()) {
+                } else if (dot11info->dot11ht.ht_info_chan_offset_below()) {
                     ssid->set_ht_mode("HT40-");
                 }
 
                 ssid->set_ht_center_1(0);
                 ssid->set_ht_center_2(0);
-                ssid->set_channel(IntToString(dot11info->dot11ht->primary_channel()));
+                ssid->set_channel(IntToString(dot11info->dot11ht.primary_channel()));
             }
 
 
@@ -1357,9 +1385,9 @@ void Kis_80211_Phy::HandleProbedSSID(shared_ptr<kis_tracked_device_base> basedev
 
             }
 
-            if (dot11info->dot11r_mobility != NULL) {
+            if (dot11info->has_dot11r_mobility) {
                 probessid->set_dot11r_mobility(true);
-                probessid->set_dot11r_mobility_domain_id(dot11info->dot11r_mobility->mobility_domain());
+                probessid->set_dot11r_mobility_domain_id(dot11info->dot11r_mobility.mobility_domain());
             }
         }
     }
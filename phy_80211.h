@@ -27,6 +27,9 @@
 #include <time.h>
 #include <list>
 #include <map>
+#include <deque>
+#include <unordered_set>
+#include <unordered_map>
 #include <vector>
 #include <algorithm>
 #include <string>
@@ -46,12 +49,10 @@
 #include "kis_net_microhttpd.h"
 #include "phy_80211_httpd_pcap.h"
 
+#include "dot11_ie_span.h"
+
 #include "kaitai/kaitaistream.h"
 #include "kaitai_parsers/wpaeap.h"
-#include "kaitai_parsers/dot11_ie_11_qbss.h"
-#include "kaitai_parsers/dot11_ie_54_mobility.h"
-#include "kaitai_parsers/dot11_ie_61_ht.h"
-#include "kaitai_parsers/dot11_ie_192_vht_operation.h"
 #include "kaitai_parsers/dot11_ie_221_dji_droneid.h"
 
 /*
@@ -87,6 +88,21 @@ class dot11_wep_key {
         unsigned int len;
         unsigned int decrypted;
         unsigned int failed;
+
+        // The RC4 key for each frame is the 3 byte IV followed by the WEP key,
+        // repeated across the 256 bytes of the key schedule.  The key bytes are
+        // the same for every frame, so we lay them out once and each frame only
+        // fills in its IV.  Call prepare_seed() whenever the key changes.
+        uint8_t rc4_seed[256];
+
+        void prepare_seed() {
+            unsigned int seedlen = 3 + len;
+
+            for (unsigned int i = 0; i < 256; i++) {
+                unsigned int ki = i % seedlen;
+                rc4_seed[i] = ki < 3 ? 0 : key[ki - 3];
+            }
+        }
 };
 
 // dot11 packet components
@@ -118,6 +134,10 @@ class dot11_packinfo : public packet_component {
     public:
         dot11_packinfo() {
             self_destruct = 1; // Our delete() handles this
+            reset();
+        }
+
+        virtual void reset() {
             corrupt = 0;
             header_offset = 0;
             type = packet_unknown;
@@ -156,6 +176,14 @@ class dot11_packinfo : public packet_component {
             wps_device_name = "";
             wps_model_name = "";
             wps_model_number = "";
+            ssid = "";
+            beacon_info = "";
+            dot11d_vec.clear();
+            has_qbss = false;
+            has_dot11r_mobility = false;
+            has_dot11ht = false;
+            has_dot11vht = false;
+            droneid.reset();
         }
 
         // Corrupt 802.11 frame
@@ -236,12 +264,17 @@ class dot11_packinfo : public packet_component {
         // There's also the serial number field but we don't care
         // about it because it's almost always bogus.
 
-        // Direct kaitai structs pulled from the beacon
-        std::shared_ptr<dot11_ie_11_qbss_t> qbss;
-        std::shared_ptr<dot11_ie_54_mobility_t> dot11r_mobility;
-        std::shared_ptr<dot11_ie_61_ht_t> dot11ht;
-        std::shared_ptr<dot11_ie_192_vht_operation_t> dot11vht;
-
+        // IE tags pulled from the beacon, valid when the matching has_ flag is set
+        bool has_qbss;
+        dot11_ie_11_qbss_span qbss;
+        bool has_dot11r_mobility;
+        dot11_ie_54_mobility_span dot11r_mobility;
+        bool has_dot11ht;
+        dot11_ie_61_ht_span dot11ht;
+        bool has_dot11vht;
+        dot11_ie_192_vht_operation_span dot11vht;
+
+        // Direct kaitai struct, only built for DJI vendor tags
         std::shared_ptr<dot11_ie_221_dji_droneid_t> droneid;
 };
 
@@ -1270,7 +1303,7 @@ public:
     int WPAKeyMgtConv(uint8_t mgt_index);
 
     // Dot11 decoders, wep decryptors, etc
-    int PacketWepDecryptor(kis_packet *in_pack);
+    int PacketWepDecryptor(const std::vector<kis_packet *>& in_packs);
     int PacketDot11dissector(kis_packet *in_pack);
 
     // Special decoders, not called as part of a chain
@@ -1288,6 +1321,11 @@ public:
             unsigned char *in_key, int in_key_len,
             unsigned char *in_id);
 
+    // Decrypt a WEP frame with a prepared key into an existing (usually pooled)
+    // chunk; returns false if the frame can't be decrypted or fails the ICV
+    static bool DecryptWEP(dot11_packinfo *in_packinfo, kis_datachunk *in_chunk,
+            dot11_wep_key *in_key, kis_datachunk *out_chunk);
+
     // TODO - what do we do with the strings?  Can we make them phy-neutral?
     // int packet_dot11string_dissector(kis_packet *in_pack);
 
@@ -1328,10 +1366,76 @@ protected:
     std::shared_ptr<Packetchain> packetchain;
     std::shared_ptr<Timetracker> timetracker;
 
-    // Checksum of recent packets for duplication filtering
-    uint32_t *recent_packet_checksums;
-    size_t recent_packet_checksums_sz;
-    unsigned int recent_packet_checksum_pos;
+    // Recent packets for duplicate filtering; hashes are looked up in the set
+    // and expired from the fifo once they fall out of the time window or the
+    // fifo is full
+    struct dot11_dedup_rec {
+        uint64_t hash;
+        uint64_t ts_usec;
+    };
+
+    std::unordered_set<uint64_t> dedup_hash_set;
+    std::deque<dot11_dedup_rec> dedup_fifo;
+    size_t dedup_max;
+    uint64_t dedup_window_usec;
+
+    // Returns true if the frame was seen within the dedup window, and remembers
+    // it if it wasn't
+    bool CheckDuplicate(const uint8_t *in_data, size_t in_len);
+
+    // IE tag offsets of the frame being dissected, reused between frames
+    length_tag_offsets ie_tag_offsets;
+
+    // IE tag results from the most recent clean beacon of each BSSID.  Beacons
+    // rarely change, so when the tagged parameters are identical to the cached
+    // beacon the dissector copies these instead of parsing the tags again.
+    // BSSIDs are evicted in the order they were first cached.
+    struct dot11_beacon_ie_rec {
+        // Cache key: the tagged parameters themselves, and the privacy bit from
+        // the fixed parameters which changes how they're parsed.  A hit skips
+        // every check made while parsing the tags, so it has to be an exact
+        // match; the checksum only rejects a changed beacon without comparing.
+        uint32_t ietag_csum;
+        std::string ietags;
+        uint64_t fixed_cryptset;
+
+        uint64_t cryptset;
+        std::string ssid;
+        int ssid_len;
+        int ssid_blank;
+        uint32_t ssid_csum;
+        std::string channel;
+        double maxrate;
+        std::string beacon_info;
+        std::string dot11d_country;
+        std::vector<dot11_packinfo_dot11d_entry> dot11d_vec;
+        uint8_t wps;
+        std::string wps_manuf;
+        std::string wps_device_name;
+        std::string wps_model_name;
+        std::string wps_model_number;
+        bool has_qbss;
+        dot11_ie_11_qbss_span qbss;
+        bool has_dot11r_mobility;
+        dot11_ie_54_mobility_span dot11r_mobility;
+        bool has_dot11ht;
+        dot11_ie_61_ht_span dot11ht;
+        bool has_dot11vht;
+        dot11_ie_192_vht_operation_span dot11vht;
+    };
+
+    std::unordered_map<uint64_t, dot11_beacon_ie_rec> beacon_ie_cache;
+    std::deque<uint64_t> beacon_ie_fifo;
+    size_t beacon_ie_cache_max;
+
+    // Fill in the IE fields of a beacon from the cache; returns false if the
+    // tags differ from the last beacon seen from this BSSID
+    bool FetchBeaconIE(dot11_packinfo *in_info, const uint8_t *in_ietags,
+            unsigned int in_ietag_len);
+
+    // Cache the IE fields of a cleanly parsed beacon
+    void StoreBeaconIE(dot11_packinfo *in_info, const uint8_t *in_ietags,
+            unsigned int in_ietag_len, uint64_t in_fixed_cryptset);
 
     void HandleSSID(shared_ptr<kis_tracked_device_base> basedev, 
             shared_ptr<dot11_tracked_device> dot11dev,
@@ -1372,7 +1476,13 @@ protected:
     int pack_comp_80211, pack_comp_basicdata, pack_comp_mangleframe,
         pack_comp_strings, pack_comp_checksum, pack_comp_linkframe,
         pack_comp_decap, pack_comp_common, pack_comp_datapayload,
-        pack_comp_gps, pack_comp_l1info;
+        pack_comp_gps, pack_comp_l1info, pack_comp_datasrc;
+
+    // Recycled components we generate while dissecting
+    packet_component_pool<dot11_packinfo> *packinfo_pool;
+    packet_component_pool<kis_common_info> *common_pool;
+    packet_component_pool<kis_datachunk> *datachunk_pool;
+    packet_component_pool<kis_data_packinfo> *datainfo_pool;
 
     // Do we do any data dissection or do we hide it all (legal safety
     // cutout)
@@ -1400,6 +1510,10 @@ protected:
     // Map of wepkeys to BSSID (or bssid masks)
     macmap<dot11_wep_key *> wepkeys;
 
+    // Chain handlers which declare the components they use or the packets
+    // they're offered
+    int classifier_handler_id, wep_decrypt_handler_id, tracker_handler_id;
+
     // Generated WEP identity / base
     unsigned char wep_identity[256];
 
@@ -36,22 +36,12 @@
 #include "packetchain.h"
 #include "alertracker.h"
 #include "configfile.h"
+#include "kis_datasource.h"
 
 #include "kaitai/kaitaistream.h"
 #include "kaitai_parsers/wpaeap.h"
 #include "kaitai_parsers/dot11_action.h"
-#include "kaitai_parsers/dot11_ie_11_qbss.h"
-#include "kaitai_parsers/dot11_ie_48_rsn.h"
-#include "kaitai_parsers/dot11_ie_48_rsn_partial.h"
-#include "kaitai_parsers/dot11_ie_52_rmm_neighbor.h"
-#include "kaitai_parsers/dot11_ie_54_mobility.h"
-#include "kaitai_parsers/dot11_ie_61_ht.h"
-#include "kaitai_parsers/dot11_ie_133_cisco_ccx.h"
-#include "kaitai_parsers/dot11_ie_192_vht_operation.h"
-#include "kaitai_parsers/dot11_ie_221_vendor.h"
 #include "kaitai_parsers/dot11_ie_221_dji_droneid.h"
-#include "kaitai_parsers/dot11_ie_221_ms_wmm.h"
-#include "kaitai_parsers/dot11_ie_221_ms_wps.h"
 
 // Handy little global so that it only has to do the ascii->mac_addr transform once
 mac_addr broadcast_mac = "FF:FF:FF:FF:FF:FF";
@@ -206,6 +196,128 @@ int Kis_80211_Phy::WPAKeyMgtConv(uint8_t mgt_index) {
     return ret;
 }
 
+bool Kis_80211_Phy::CheckDuplicate(const uint8_t *in_data, size_t in_len) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    uint64_t now_usec = (uint64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+
+    // Expire anything outside the window, and make room if we're full
+    while (dedup_fifo.size() != 0 &&
+            (dedup_fifo.size() >= dedup_max ||
+             now_usec - dedup_fifo.front().ts_usec > dedup_window_usec)) {
+        dedup_hash_set.erase(dedup_fifo.front().hash);
+        dedup_fifo.pop_front();
+    }
+
+    uint64_t hash = Hash64(in_data, in_len);
+
+    if (dedup_hash_set.find(hash) != dedup_hash_set.end())
+        return true;
+
+    if (dedup_max == 0)
+        return false;
+
+    dedup_hash_set.insert(hash);
+    dedup_fifo.push_back({hash, now_usec});
+
+    return false;
+}
+
+bool Kis_80211_Phy::FetchBeaconIE(dot11_packinfo *in_info, const uint8_t *in_ietags,
+        unsigned int in_ietag_len) {
+    auto bi = beacon_ie_cache.find(in_info->bssid_mac.longmac);
+
+    if (bi == beacon_ie_cache.end())
+        return false;
+
+    dot11_beacon_ie_rec& rec = bi->second;
+
+    if (rec.ietag_csum != in_info->ietag_csum || rec.ietags.length() != in_ietag_len ||
+            rec.fixed_cryptset != in_info->cryptset)
+        return false;
+
+    // The checksum is trivial to collide; only identical tags can skip parsing
+    if (memcmp(rec.ietags.data(), in_ietags, in_ietag_len) != 0)
+        return false;
+
+    in_info->cryptset = rec.cryptset;
+    in_info->ssid = rec.ssid;
+    in_info->ssid_len = rec.ssid_len;
+    in_info->ssid_blank = rec.ssid_blank;
+    in_info->ssid_csum = rec.ssid_csum;
+    in_info->channel = rec.channel;
+    in_info->maxrate = rec.maxrate;
+    in_info->beacon_info = rec.beacon_info;
+    in_info->dot11d_country = rec.dot11d_country;
+    in_info->dot11d_vec = rec.dot11d_vec;
+    in_info->wps = rec.wps;
+    in_info->wps_manuf = rec.wps_manuf;
+    in_info->wps_device_name = rec.wps_device_name;
+    in_info->wps_model_name = rec.wps_model_name;
+    in_info->wps_model_number = rec.wps_model_number;
+    in_info->has_qbss = rec.has_qbss;
+    in_info->qbss = rec.qbss;
+    in_info->has_dot11r_mobility = rec.has_dot11r_mobility;
+    in_info->dot11r_mobility = rec.dot11r_mobility;
+    in_info->has_dot11ht = rec.has_dot11ht;
+    in_info->dot11ht = rec.dot11ht;
+    in_info->has_dot11vht = rec.has_dot11vht;
+    in_info->dot11vht = rec.dot11vht;
+
+    return true;
+}
+
+void Kis_80211_Phy::StoreBeaconIE(dot11_packinfo *in_info, const uint8_t *in_ietags,
+        unsigned int in_ietag_len, uint64_t in_fixed_cryptset) {
+    if (beacon_ie_cache_max == 0)
+        return;
+
+    auto bi = beacon_ie_cache.find(in_info->bssid_mac.longmac);
+
+    if (bi == beacon_ie_cache.end()) {
+        // Make room for a new BSSID
+        while (beacon_ie_fifo.size() != 0 && beacon_ie_fifo.size() >= beacon_ie_cache_max) {
+            beacon_ie_cache.erase(beacon_ie_fifo.front());
+            beacon_ie_fifo.pop_front();
+        }
+
+        beacon_ie_fifo.push_back(in_info->bssid_mac.longmac);
+        bi = beacon_ie_cache.insert(std::make_pair(in_info->bssid_mac.longmac,
+                    dot11_beacon_ie_rec())).first;
+    }
+
+    dot11_beacon_ie_rec& rec = bi->second;
+
+    rec.ietag_csum = in_info->ietag_csum;
+    rec.ietags.assign((const char *) in_ietags, in_ietag_len);
+    rec.fixed_cryptset = in_fixed_cryptset;
+
+    rec.cryptset = in_info->cryptset;
+    rec.ssid = in_info->ssid;
+    rec.ssid_len = in_info->ssid_len;
+    rec.ssid_blank = in_info->ssid_blank;
+    rec.ssid_csum = in_info->ssid_csum;
+    rec.channel = in_info->channel;
+    rec.maxrate = in_info->maxrate;
+    rec.beacon_info = in_info->beacon_info;
+    rec.dot11d_country = in_info->dot11d_country;
+    rec.dot11d_vec = in_info->dot11d_vec;
+    rec.wps = in_info->wps;
+    rec.wps_manuf = in_info->wps_manuf;
+    rec.wps_device_name = in_info->wps_device_name;
+    rec.wps_model_name = in_info->wps_model_name;
+    rec.wps_model_number = in_info->wps_model_number;
+    rec.has_qbss = in_info->has_qbss;
+    rec.qbss = in_info->qbss;
+    rec.has_dot11r_mobility = in_info->has_dot11r_mobility;
+    rec.dot11r_mobility = in_info->dot11r_mobility;
+    rec.has_dot11ht = in_info->has_dot11ht;
+    rec.dot11ht = in_info->dot11ht;
+    rec.has_dot11vht = in_info->has_dot11vht;
+    rec.dot11vht = in_info->dot11vht;
+}
+
 // This needs to be optimized and it needs to not use casting to do its magic
 int Kis_80211_Phy::PacketDot11dissector(kis_packet *in_pack) {
     static int debugpcknum = 0;
@@ -235,22 +347,25 @@ int Kis_80211_Phy::PacketDot11dissector(kis_packet *in_pack) {
     if (chunk->dlt != KDLT_IEEE802_11)
         return 0;
 
-    // Compare the checksum and see if we've recently seen this exact packet
-    uint32_t chunk_csum = Adler32Checksum((const char *) chunk->data, chunk->length);
+    // See if we've recently seen this exact packet, typically the same frame
+    // captured by multiple sources
+    bool duplicate = CheckDuplicate(chunk->data, chunk->length);
 
-    for (unsigned int c = 0; c < recent_packet_checksums_sz; c++) {
-        if (recent_packet_checksums[c] == 0)
-            break;
+    packetchain_comp_datasource *pack_datasrc =
+        (packetchain_comp_datasource *) in_pack->fetch(pack_comp_datasrc);
 
-        if (recent_packet_checksums[c] == chunk_csum) {
-            in_pack->filtered = 1;
-            in_pack->duplicate = 1;
-            return 0;
-        }
+    if (pack_datasrc != NULL && pack_datasrc->ref_source != NULL) {
+        pack_datasrc->ref_source->inc_source_num_dedup_checked_packets();
+
+        if (duplicate)
+            pack_datasrc->ref_source->inc_source_num_dedup_packets();
     }
 
-    recent_packet_checksums[(recent_packet_checksum_pos++ % recent_packet_checksums_sz)] = 
-        chunk_csum;
+    if (duplicate) {
+        in_pack->filtered = 1;
+        in_pack->duplicate = 1;
+        return 0;
+    }
 
     // Flat-out dump if it's not big enough to be 80211, don't even bother making a
     // packinfo record for it because we're completely broken
@@ -262,13 +377,13 @@ int Kis_80211_Phy::PacketDot11dissector(kis_packet *in_pack) {
         (kis_common_info *) in_pack->fetch(pack_comp_common);
 
     if (common == NULL) {
-        common = new kis_common_info;
+        common = common_pool->acquire();
         in_pack->insert(pack_comp_common, common);
     }
 
     common->phyid = phyid;
 
-    packinfo = new dot11_packinfo;
+    packinfo = packinfo_pool->acquire();
 
     frame_control *fc = (frame_control *) chunk->data;
 
@@ -639,31 +754,28 @@ int Kis_80211_Phy::PacketDot11dissector(kis_packet *in_pack) {
                     action->action_frame() != NULL) {
                 for (auto t : *(action->action_frame()->tags())) {
                     if (t->ie() == 52) {
-                        std::istringstream tag_stream(t->ie_data());
-                       
-                        try {
-                            kaitai::kstream wmkstream(&tag_stream);;
-
-                            dot11_ie_52_rmm_neighbor_t rmm(&wmkstream);
+                        dot11_ie_52_rmm_neighbor_span rmm;
 
-                            if (rmm.channel_number() > 0xE0) {
-                                std::stringstream ss;
+                        if (!rmm.parse(dot11_ie_span((const uint8_t *) t->ie_data().data(),
+                                        t->ie_data().length()))) {
+                            fprintf(stderr, "debug - unable to parse rmm neighbor\n");
+                            continue;
+                        }
 
-                                ss << "IEE80211 Access Point BSSID " <<
-                                    packinfo->bssid_mac.Mac2String() << " reporting an 802.11k " <<
-                                    "neighbor channel of " << rmm.channel_number() << " which is " <<
-                                    "greater than the maximum channel, 224.  This may be an " << 
-                                    "exploit attempt against Broadcom chipsets used in mobile " <<
-                                    "devices.";
+                        if (rmm.channel_number() > 0xE0) {
+                            std::stringstream ss;
 
-                                alertracker->RaiseAlert(alert_11kneighborchan_ref, in_pack, 
-                                        packinfo->bssid_mac, packinfo->source_mac, 
-                                        packinfo->dest_mac, packinfo->other_mac, 
-                                        packinfo->channel, ss.str());
-                            }
+                            ss << "IEE80211 Access Point BSSID " <<
+                                packinfo->bssid_mac.Mac2String() << " reporting an 802.11k " <<
+                                "neighbor channel of " << (unsigned int) rmm.channel_number() << 
+                                " which is greater than the maximum channel, 224.  This may " <<
+                                "be an exploit attempt against Broadcom chipsets used in " <<
+                                "mobile devices.";
 
-                        } catch (const std::exception& e) {
-                            fprintf(stderr, "debug - unable to parse rmm neighbor - %s\n", e.what());
+                            alertracker->RaiseAlert(alert_11kneighborchan_ref, in_pack, 
+                                    packinfo->bssid_mac, packinfo->source_mac, 
+                                    packinfo->dest_mac, packinfo->other_mac, 
+                                    packinfo->channel, ss.str());
                         }
                     }
                 }
@@ -724,10 +836,27 @@ int Kis_80211_Phy::PacketDot11dissector(kis_packet *in_pack) {
                        "driver attack");
         }
 
-        map<int, vector<int> > tag_cache_map;
-        map<int, vector<int> >::iterator tcitr;
+        // Beacons which repeat the tagged parameters of the last beacon from the 
+        // same BSSID take the parsed tags from the cache
+        bool beacon_ie_cached = false;
+        unsigned int ietag_len = 0;
+        uint64_t fixed_cryptset = packinfo->cryptset;
+        bool ie_alerted = false;
+
+        if (fc->subtype == packet_sub_beacon && chunk->length > packinfo->header_offset) {
+            ietag_len = chunk->length - packinfo->header_offset;
 
-        if (fc->subtype == packet_sub_beacon || 
+            packinfo->ietag_csum = 
+                Adler32Checksum((const char *) (chunk->data + packinfo->header_offset),
+                                ietag_len);
+
+            beacon_ie_cached = FetchBeaconIE(packinfo, 
+                    chunk->data + packinfo->header_offset, ietag_len);
+        }
+
+        if (beacon_ie_cached) {
+            packinfo->beacon_interval = kis_letoh16(fixparm->beacon);
+        } else if (fc->subtype == packet_sub_beacon || 
             fc->subtype == packet_sub_probe_req || 
             fc->subtype == packet_sub_probe_resp ||
             fc->subtype == packet_sub_association_resp ||
@@ -736,14 +865,16 @@ int Kis_80211_Phy::PacketDot11dissector(kis_packet *in_pack) {
             if (fc->subtype == packet_sub_beacon)
                 packinfo->beacon_interval = kis_letoh16(fixparm->beacon);
 
-            packinfo->ietag_csum = 
-                Adler32Checksum((const char *) (chunk->data + packinfo->header_offset),
-                                chunk->length - packinfo->header_offset);
+            // Beacons were already checksummed for the cache lookup
+            if (ietag_len == 0)
+                packinfo->ietag_csum = 
+                    Adler32Checksum((const char *) (chunk->data + packinfo->header_offset),
+                                    chunk->length - packinfo->header_offset);
 
             // This is guaranteed to only give us tags that fit within the packets,
             // so we don't have to do more error checking
             if (GetLengthTagOffsets(packinfo->header_offset, chunk, 
-                                    &tag_cache_map) < 0) {
+                                    &ie_tag_offsets) < 0) {
                 // The frame is corrupt, bail.  This is a good indication that it's
                 // corrupt but snuck past the FCS check, so we set the whole packet
                 // as a failure condition
@@ -754,8 +885,8 @@ int Kis_80211_Phy::PacketDot11dissector(kis_packet *in_pack) {
                 return 0;
             }
      
-            if ((tcitr = tag_cache_map.find(0)) != tag_cache_map.end()) {
-                tag_offset = tcitr->second[0];
+            if (ie_tag_offsets.has(0)) {
+                tag_offset = ie_tag_offsets.offset(0);
 
                 taglen = (chunk->data[tag_offset] & 0xFF);
                 packinfo->ssid_len = taglen;
@@ -802,113 +933,67 @@ int Kis_80211_Phy::PacketDot11dissector(kis_packet *in_pack) {
             }
 
             // Look for the qbss tag
-            if ((tcitr = tag_cache_map.find(11)) != tag_cache_map.end()) {
-                tag_offset = tcitr->second[0];
+            if (ie_tag_offsets.has(11)) {
+                tag_offset = ie_tag_offsets.offset(11);
                 taglen = (chunk->data[tag_offset] & 0xFF);
 
-                membuf tag_membuf((char *) &(chunk->data[tag_offset + 1]), 
-                        (char *) &(chunk->data[chunk->length]));
-                std::istream tag_stream(&tag_membuf);
-
-                try {
-                    kaitai::kstream ks(&tag_stream);
-                    std::shared_ptr<dot11_ie_11_qbss_t> qbss(new dot11_ie_11_qbss_t(&ks));
-
-                    packinfo->qbss = qbss;
-
-                } catch (const std::exception& e) {
+                if (packinfo->qbss.parse(dot11_ie_span(&(chunk->data[tag_offset + 1]), taglen))) {
+                    packinfo->has_qbss = true;
+                } else {
                     packinfo->corrupt = 1;
-                    in_pack->insert(_PCM(PACK_COMP_80211), packinfo);
                 }
             }
 
             // Look for the mobility tag
-            if ((tcitr = tag_cache_map.find(54)) != tag_cache_map.end()) {
-                tag_offset = tcitr->second[0];
+            if (ie_tag_offsets.has(54)) {
+                tag_offset = ie_tag_offsets.offset(54);
                 taglen = (chunk->data[tag_offset] & 0xFF);
 
-                membuf tag_membuf((char *) &(chunk->data[tag_offset + 1]), 
-                        (char *) &(chunk->data[chunk->length]));
-                std::istream tag_stream(&tag_membuf);
-
-                try {
-                    kaitai::kstream ks(&tag_stream);
-                    std::shared_ptr<dot11_ie_54_mobility_t> mobility(new dot11_ie_54_mobility_t(&ks));
-
-                    packinfo->dot11r_mobility = mobility;
-
-                } catch (const std::exception& e) {
+                if (packinfo->dot11r_mobility.parse(dot11_ie_span(&(chunk->data[tag_offset + 1]), 
+                                taglen))) {
+                    packinfo->has_dot11r_mobility = true;
+                } else {
                     packinfo->corrupt = 1;
-                    in_pack->insert(_PCM(PACK_COMP_80211), packinfo);
                 }
             }
 
-            // Look for the HT tag
+            // Look for the HT tag; don't consider unparseable HT a corrupt packet 
+            // (for now)
             // TODO move the maxrate calc to here too
-            if ((tcitr = tag_cache_map.find(61)) != tag_cache_map.end()) {
-                tag_offset = tcitr->second[0];
+            if (ie_tag_offsets.has(61)) {
+                tag_offset = ie_tag_offsets.offset(61);
                 taglen = (chunk->data[tag_offset] & 0xFF);
 
-                membuf tag_membuf((char *) &(chunk->data[tag_offset + 1]), 
-                        (char *) &(chunk->data[chunk->length]));
-                std::istream tag_stream(&tag_membuf);
-
-                try {
-                    kaitai::kstream ks(&tag_stream);
-                    std::shared_ptr<dot11_ie_61_ht_t> ht(new dot11_ie_61_ht_t(&ks));
-
-                    packinfo->dot11ht = ht;
-
-                } catch (const std::exception& e) {
-                    // Don't consider unparseable HT a corrupt packet (for now)
-                }
+                packinfo->has_dot11ht = 
+                    packinfo->dot11ht.parse(dot11_ie_span(&(chunk->data[tag_offset + 1]), taglen));
             }
 
-            // Look for the VHT tag
-            if ((tcitr = tag_cache_map.find(192)) != tag_cache_map.end()) {
-                tag_offset = tcitr->second[0];
+            // Look for the VHT tag; don't consider this a corrupt packet just because
+            // we didn't parse it
+            if (ie_tag_offsets.has(192)) {
+                tag_offset = ie_tag_offsets.offset(192);
                 taglen = (chunk->data[tag_offset] & 0xFF);
 
-                membuf tag_membuf((char *) &(chunk->data[tag_offset + 1]), 
-                        (char *) &(chunk->data[chunk->length]));
-                std::istream tag_stream(&tag_membuf);
-
-                try {
-                    kaitai::kstream ks(&tag_stream);
-                    std::shared_ptr<dot11_ie_192_vht_operation_t> vht(new dot11_ie_192_vht_operation_t(&ks));
-
-                    packinfo->dot11vht = vht;
-
-                } catch (const std::exception& e) {
-                    // Don't consider this a corrupt packet just because we didn't parse it
-                }
+                packinfo->has_dot11vht =
+                    packinfo->dot11vht.parse(dot11_ie_span(&(chunk->data[tag_offset + 1]), taglen));
             }
 
             // Extract the CISCO beacon info
-            if ((tcitr = tag_cache_map.find(133)) != tag_cache_map.end()) {
-                tag_offset = tcitr->second[0];
+            if (ie_tag_offsets.has(133)) {
+                tag_offset = ie_tag_offsets.offset(133);
                 taglen = (chunk->data[tag_offset] & 0xFF);
 
-                membuf tag_membuf((char *) &(chunk->data[tag_offset + 1]), 
-                        (char *) &(chunk->data[chunk->length]));
-                std::istream tag_stream(&tag_membuf);
+                dot11_ie_133_cisco_ccx_span ccx1;
 
-                try {
-                    kaitai::kstream ks(&tag_stream);
-                    std::shared_ptr<dot11_ie_133_cisco_ccx_t> ccx1(new dot11_ie_133_cisco_ccx_t(&ks));
-
-                    packinfo->beacon_info = MungeToPrintable(ccx1->ap_name());
-
-                } catch (const std::exception& e) {
-                    fprintf(stderr, "debug - ccx error %s\n", e.what());
-                    // Not a datal error
+                if (ccx1.parse(dot11_ie_span(&(chunk->data[tag_offset + 1]), taglen))) {
+                    packinfo->beacon_info = 
+                        MungeToPrintable(ccx1.ap_name(), ccx1.ap_name_len(), 0);
                 }
-
             }
 
             // Extract the supported rates
-            if ((tcitr = tag_cache_map.find(1)) != tag_cache_map.end()) {
-                tag_offset = tcitr->second[0];
+            if (ie_tag_offsets.has(1)) {
+                tag_offset = ie_tag_offsets.offset(1);
                 taglen = (chunk->data[tag_offset] & 0xFF);
 
                 if (tag_offset + taglen > chunk->length) {
@@ -919,8 +1004,8 @@ int Kis_80211_Phy::PacketDot11dissector(kis_packet *in_pack) {
                     return 0;
                 }
 
-                for (unsigned int t = 0; t < tcitr->second.size(); t++) {
-                    int moffset = tcitr->second[t];
+                for (unsigned int t = 0; t < ie_tag_offsets.count(1); t++) {
+                    int moffset = ie_tag_offsets.offset(1, t);
 
                     if ((chunk->data[moffset] & 0xFF) == 75 &&
                         memcmp(&(chunk->data[moffset + 1]), "\xEB\x49", 2) == 0) {
@@ -945,8 +1030,8 @@ int Kis_80211_Phy::PacketDot11dissector(kis_packet *in_pack) {
             }
 
             // And the extended supported rates
-            if ((tcitr = tag_cache_map.find(50)) != tag_cache_map.end()) {
-                tag_offset = tcitr->second[0];
+            if (ie_tag_offsets.has(50)) {
+                tag_offset = ie_tag_offsets.offset(50);
                 taglen = (chunk->data[tag_offset] & 0xFF);
 
                 if (tag_offset + taglen > chunk->length) {
@@ -974,8 +1059,8 @@ int Kis_80211_Phy::PacketDot11dissector(kis_packet *in_pack) {
             */
 
             // Match HT 802.11n tag
-            if ((tcitr = tag_cache_map.find(45)) != tag_cache_map.end()) {
-                tag_offset = tcitr->second[0];
+            if (ie_tag_offsets.has(45)) {
+                tag_offset = ie_tag_offsets.offset(45);
                 // GetTagOffset returns us on the size byte
                 taglen = (chunk->data[tag_offset] & 0xFF);
                 if (tag_offset + taglen > chunk->length || taglen < 7) {
@@ -1050,8 +1135,8 @@ int Kis_80211_Phy::PacketDot11dissector(kis_packet *in_pack) {
             // Find the offset of flag 3 and get the channel.   802.11a doesn't have 
             // this tag so we use the hardware channel, assigned at the beginning of 
             // GetPacketInfo
-            if ((tcitr = tag_cache_map.find(3)) != tag_cache_map.end()) {
-                tag_offset = tcitr->second[0];
+            if (ie_tag_offsets.has(3)) {
+                tag_offset = ie_tag_offsets.offset(3);
                 // Extract the channel from the next byte (GetTagOffset returns
                 // us on the size byte)
                 taglen = (chunk->data[tag_offset] & 0xFF);
@@ -1071,8 +1156,8 @@ int Kis_80211_Phy::PacketDot11dissector(kis_packet *in_pack) {
             // Find the offset of flag 3 and get the channel.   802.11a doesn't have 
             // this tag so we use the hardware channel, assigned at the beginning of 
             // GetPacketInfo
-            if ((tcitr = tag_cache_map.find(3)) != tag_cache_map.end()) {
-                tag_offset = tcitr->second[0];
+            if (ie_tag_offsets.has(3)) {
+                tag_offset = ie_tag_offsets.offset(3);
                 // Extract the channel from the next byte (GetTagOffset returns
                 // us on the size byte)
                 taglen = (chunk->data[tag_offset] & 0xFF);
@@ -1088,13 +1173,13 @@ int Kis_80211_Phy::PacketDot11dissector(kis_packet *in_pack) {
             } // channel
 
             // Match sub-tags inside 221
-            if ((tcitr = tag_cache_map.find(221)) != tag_cache_map.end()) {
+            if (ie_tag_offsets.has(221)) {
                 // Count WMMTSPEC responses
                 unsigned int wmmtspec_responses = 0;
 
                 // For every copy of the 221 tag
-                for (unsigned int tagct = 0; tagct < tcitr->second.size(); tagct++) {
-                    tag_offset = tcitr->second[tagct];
+                for (unsigned int tagct = 0; tagct < ie_tag_offsets.count(221); tagct++) {
+                    tag_offset = ie_tag_offsets.offset(221, tagct);
                     unsigned int tag_orig = tag_offset + 1;
                     unsigned int taglen = (chunk->data[tag_offset] & 0xFF);
                     unsigned int offt = 0;
@@ -1106,20 +1191,14 @@ int Kis_80211_Phy::PacketDot11dissector(kis_packet *in_pack) {
                         return 0;
                     }
 
-                    // Split a kaitai parser off for the 221 tag
-                    membuf tag_membuf((char *) &(chunk->data[tag_offset + 1]),
-                            (char *) &(chunk->data[chunk->length]));
-                    std::istream tag_stream(&tag_membuf);
+                    dot11_ie_221_vendor_span vendor;
 
-                    try {
-                        kaitai::kstream ks(&tag_stream);
-                        std::shared_ptr<dot11_ie_221_vendor_t> vendor(new dot11_ie_221_vendor_t(&ks));
+                    if (vendor.parse(dot11_ie_span(&(chunk->data[tag_orig]), taglen))) {
+                        bool ms_wmm = vendor.vendor_oui_int() == 0x0050f2 &&
+                            vendor.has_vendor_oui_type() && vendor.vendor_oui_type() == 2;
 
                         // Match mis-sized WMM
-                        if (fc->subtype == packet_sub_beacon &&
-                                vendor->vendor_oui_int() == 0x0050f2 &&
-                                vendor->vendor_oui_type() == 2 &&
-                                taglen > 24) {
+                        if (fc->subtype == packet_sub_beacon && ms_wmm && taglen > 24) {
 
                             string al = "IEEE80211 Access Point BSSID " + 
                                 packinfo->bssid_mac.Mac2String() + " sent association "
@@ -1131,38 +1210,46 @@ int Kis_80211_Phy::PacketDot11dissector(kis_packet *in_pack) {
                                     packinfo->bssid_mac, packinfo->source_mac, 
                                     packinfo->dest_mac, packinfo->other_mac, 
                                     packinfo->channel, al);
+
+                            ie_alerted = true;
                         }
 
                         // Count wmmtspec frames; per
                         // CVE-2017-11013 
                         // https://pleasestopnamingvulnerabilities.com/
-                        if (fc->subtype == packet_sub_association_resp &&
-                                vendor->vendor_oui_int() == 0x0050f2 &&
-                                vendor->vendor_oui_type() == 2) {
-                            std::stringstream wmmstream(vendor->vendor_tag()->vendor_data());
-                            kaitai::kstream kds(&wmmstream);
-                            dot11_ie_221_ms_wmm_t wmm(&kds);
-
-                            if (wmm.wme_subtype() == 0x02) {
+                        if (fc->subtype == packet_sub_association_resp && ms_wmm) {
+                            dot11_ie_221_ms_wmm_span wmm;
+
+                            if (wmm.parse(vendor) && wmm.wme_subtype() == 0x02) {
                                 wmmtspec_responses++;
                             }
-
                         }
 
-                        // Look for DJI DroneID OUIs
-                        if (vendor->vendor_oui_int() == 0x263712) {
-                            std::stringstream dronestream(vendor->vendor_tag()->vendor_data());
-                            kaitai::kstream kds(&dronestream);
-
-                            std::shared_ptr<dot11_ie_221_dji_droneid_t> droneid(new dot11_ie_221_dji_droneid_t(&kds));
-
-                            packinfo->droneid = droneid;
+                        // Look for DJI DroneID OUIs; these are rare enough that we 
+                        // still hand them to the full kaitai parser, directly over 
+                        // the vendor data
+                        if (vendor.vendor_oui_int() == 0x263712) {
+                            membuf drone_membuf((char *) vendor.vendor_data().data,
+                                    (char *) vendor.vendor_data().data + 
+                                    vendor.vendor_data().length);
+                            std::istream drone_stream(&drone_membuf);
+
+                            try {
+                                kaitai::kstream kds(&drone_stream);
+
+                                std::shared_ptr<dot11_ie_221_dji_droneid_t> 
+                                    droneid(new dot11_ie_221_dji_droneid_t(&kds));
+
+                                packinfo->droneid = droneid;
+                            } catch (const std::exception &e) {
+                                fprintf(stderr, "debug - 221 droneid ie tag corrupt\n");
+                                packinfo->corrupt = 1;
+                            }
                         }
 
-                    } catch (const std::exception &e) {
+                    } else {
                         fprintf(stderr, "debug - 221 ie tag corrupt\n");
                         packinfo->corrupt = 1;
-                        in_pack->insert(_PCM(PACK_COMP_80211), packinfo);
                     }
 
                     // Match 221 tag header for WPS
@@ -1289,8 +1376,8 @@ int Kis_80211_Phy::PacketDot11dissector(kis_packet *in_pack) {
 
 
             // Parse 802.11d tags
-            if ((tcitr = tag_cache_map.find(7)) != tag_cache_map.end()) {
-                tag_offset = tcitr->second[0];
+            if (ie_tag_offsets.has(7)) {
+                tag_offset = ie_tag_offsets.offset(7);
 
                 taglen = (chunk->data[tag_offset] & 0xFF);
 
@@ -1327,10 +1414,10 @@ int Kis_80211_Phy::PacketDot11dissector(kis_packet *in_pack) {
             // WPA frame matching if we have the privacy bit set
             if ((packinfo->cryptset & crypt_wep)) {
                 // Liberally borrowed from Ethereal
-                if ((tcitr = tag_cache_map.find(221)) != tag_cache_map.end()) {
-                    for (unsigned int tagct = 0; tagct < tcitr->second.size(); 
+                if (ie_tag_offsets.has(221)) {
+                    for (unsigned int tagct = 0; tagct < ie_tag_offsets.count(221); 
                          tagct++) {
-                        tag_offset = tcitr->second[tagct];
+                        tag_offset = ie_tag_offsets.offset(221, tagct);
                         unsigned int tag_orig = tag_offset + 1;
                         unsigned int taglen = (chunk->data[tag_offset] & 0xFF);
                         unsigned int offt = 0;
@@ -1403,59 +1490,44 @@ int Kis_80211_Phy::PacketDot11dissector(kis_packet *in_pack) {
                 } /* 221 */
 
                 // Tag 48, RSN
-                if ((tcitr = tag_cache_map.find(48)) != tag_cache_map.end()) {
-                    tag_offset = tcitr->second[0];
+                if (ie_tag_offsets.has(48)) {
+                    tag_offset = ie_tag_offsets.offset(48);
                     taglen = (chunk->data[tag_offset] & 0xFF);
 
-                    membuf tag_membuf((char *) &(chunk->data[tag_offset + 1]), 
-                            (char *) &(chunk->data[chunk->length]));
-                    std::istream tag_stream(&tag_membuf);
-
-                    bool rsn_invalid = false;
-
-                    try {
-                        kaitai::kstream ks(&tag_stream);
-                        std::shared_ptr<dot11_ie_48_rsn_t> rsn(new dot11_ie_48_rsn_t(&ks));
+                    dot11_ie_span rsn_span(&(chunk->data[tag_offset + 1]), taglen);
+                    dot11_ie_48_rsn_span rsn;
 
+                    if (rsn.parse(rsn_span)) {
                         // TODO - don't aggregate these in the future
                         
                         // Merge the group cipher
-                        packinfo->cryptset |= 
-                            WPACipherConv(rsn->group_cipher()->cipher_type());
+                        packinfo->cryptset |= WPACipherConv(rsn.group_cipher_type());
 
                         // Merge the unicast ciphers
-                        for (auto i : *(rsn->pairwise_ciphers())) {
-                            packinfo->cryptset |= WPACipherConv(i->cipher_type());
+                        for (unsigned int i = 0; i < rsn.pairwise_count(); i++) {
+                            packinfo->cryptset |= WPACipherConv(rsn.pairwise_cipher_type(i));
                         }
 
                         // Merge the authkey types
-                        for (auto i : *(rsn->akm_ciphers())) {
-                            packinfo->cryptset |= WPAKeyMgtConv(i->management_type());
+                        for (unsigned int i = 0; i < rsn.akm_count(); i++) {
+                            packinfo->cryptset |= WPAKeyMgtConv(rsn.akm_management_type(i));
                         }
 
                         // Set version flag - this is probably wrong but keep it 
                         // for now
                         packinfo->cryptset |= crypt_version_wpa2;
 
-                    } catch (const std::exception& e) {
-                        rsn_invalid = true;
+                    } else {
                         packinfo->corrupt = 1;
-                    }
 
-                    // Re-parse using the limited RSN object to see if we're 
-                    // getting hit with something that looks like
-                    // https://pleasestopnamingvulnerabilities.com/
-                    // CVE-2017-9714
-                    if (rsn_invalid) {
-                        membuf tag_membuf((char *) &(chunk->data[tag_offset + 1]), 
-                                (char *) &(chunk->data[chunk->length]));
-                        std::istream tag_stream(&tag_membuf);
-
-                        try {
-                            kaitai::kstream ks(&tag_stream);
-                            std::shared_ptr<dot11_ie_48_rsn_partial_t> rsn(new dot11_ie_48_rsn_partial_t(&ks));
+                        // Re-parse using the limited RSN object to see if we're 
+                        // getting hit with something that looks like
+                        // https://pleasestopnamingvulnerabilities.com/
+                        // CVE-2017-9714
+                        dot11_ie_48_rsn_partial_span rsn_partial;
 
-                            if (rsn->pairwise_count() > 1024) {
+                        if (rsn_partial.parse(rsn_span)) {
+                            if (rsn_partial.pairwise_count() > 1024) {
                                 alertracker->RaiseAlert(alert_atheros_rsnloop_ref, 
                                         in_pack,
                                         packinfo->bssid_mac, packinfo->source_mac, 
@@ -1467,17 +1539,25 @@ int Kis_80211_Phy::PacketDot11dissector(kis_packet *in_pack) {
                                         "CVE-2017-9714 and "
                                         "https://pleasestopnamingvulnerabilities.com/");
                             }
-
-                        } catch (const std::exception& e) {
-                            // Do nothing with the secondary error; we already know
-                            // something is wrong we're just trying to extract the
-                            // better errors
                         }
+
+                        // Do nothing with a secondary error; we already know
+                        // something is wrong we're just trying to extract the
+                        // better errors
                     }
                 }
 
             } /* protected frame */
 
+            // Only cache beacons which parsed cleanly and didn't raise an alert, so
+            // that a repeat of a bad beacon is dissected (and alerted) again.  DJI 
+            // beacons carry live telemetry and are never cached.
+            if (fc->subtype == packet_sub_beacon && ietag_len != 0 &&
+                    packinfo->corrupt == 0 && !ie_alerted && packinfo->droneid == NULL) {
+                StoreBeaconIE(packinfo, chunk->data + packinfo->header_offset,
+                        ietag_len, fixed_cryptset);
+            }
+
         } else if (fc->subtype == packet_sub_deauthentication) {
             if ((packinfo->mgt_reason_code >= 25 && packinfo->mgt_reason_code <= 31) ||
                 packinfo->mgt_reason_code > 45) {
@@ -1672,7 +1752,7 @@ int Kis_80211_Phy::PacketDot11dissector(kis_packet *in_pack) {
             if (datachunk == NULL) {
                 // Don't set a DLT on the data payload, since we don't know what it is
                 // but it's not 802.11.
-                datachunk = new kis_datachunk;
+                datachunk = datachunk_pool->acquire();
                 datachunk->set_data(chunk->data + packinfo->header_offset,
                                     chunk->length - packinfo->header_offset, false);
                 in_pack->insert(pack_comp_datapayload, datachunk);
@@ -1743,7 +1823,7 @@ int Kis_80211_Phy::PacketDot11dissector(kis_packet *in_pack) {
                 memcmp(&(chunk->data[LLC_UI_OFFSET + 3]),
                        DOT1X_PROTO, sizeof(DOT1X_PROTO)) == 0) {
 
-                kis_data_packinfo *datainfo = new kis_data_packinfo;
+                kis_data_packinfo *datainfo = datainfo_pool->acquire();
 
                 datainfo->proto = proto_eap;
 
@@ -1762,7 +1842,7 @@ int Kis_80211_Phy::PacketDot11dissector(kis_packet *in_pack) {
 
                 if (dot1x_version != 1 || dot1x_type != 0 || 
                     offset + EAP_PACKET_SIZE > chunk->length) {
-                    delete datainfo;
+                    datainfo_pool->recycle(datainfo);
                     goto eap_end;
                 }
 
@@ -1776,7 +1856,7 @@ int Kis_80211_Phy::PacketDot11dissector(kis_packet *in_pack) {
                 char *rawid;
 
                 if (offset + eap_length > chunk->length) {
-                    delete datainfo;
+                    datainfo_pool->recycle(datainfo);
                     goto eap_end;
                 }
 
@@ -1841,92 +1921,93 @@ eap_end:
 kis_datachunk *Kis_80211_Phy::DecryptWEP(dot11_packinfo *in_packinfo,
                                                kis_datachunk *in_chunk,
                                                unsigned char *in_key, int in_key_len,
-                                               unsigned char *in_id) {
-    kis_datachunk *manglechunk = NULL;
+                                               unsigned char *in_id __attribute__((unused))) {
+    if (in_key_len < 0 || in_key_len > DOT11_WEPKEY_MAX)
+        return NULL;
 
-    // printf("debug - decryptwep\n");
-    if (in_packinfo->corrupt)
+    dot11_wep_key key;
+    key.len = in_key_len;
+    memcpy(key.key, in_key, in_key_len);
+    key.prepare_seed();
+
+    kis_datachunk *manglechunk = new kis_datachunk;
+
+    if (!DecryptWEP(in_packinfo, in_chunk, &key, manglechunk)) {
+        delete manglechunk;
         return NULL;
+    }
+
+    return manglechunk;
+}
+
+bool Kis_80211_Phy::DecryptWEP(dot11_packinfo *in_packinfo, kis_datachunk *in_chunk,
+        dot11_wep_key *in_key, kis_datachunk *out_chunk) {
+    if (in_packinfo->corrupt)
+        return false;
 
-    // printf("debug - decryptwep dlt %u want %u\n", in_chunk->dlt, KDLT_IEEE802_11);
     // If we don't have a dot11 frame, throw it away
     if (in_chunk->dlt != KDLT_IEEE802_11)
-        return NULL;
+        return false;
 
-    // printf("debug - decryptwep size len %u offt %u\n", in_chunk->length, in_packinfo->header_offset);
     // Bail on size check
     if (in_chunk->length < in_packinfo->header_offset ||
         in_chunk->length - in_packinfo->header_offset <= 8)
-        return NULL;
+        return false;
 
-    // printf("debug - decryptwep data header offt %u test head %02x %02x %02x %02x offt %02x %02x %02x %02x\n", in_packinfo->header_offset, in_chunk->data[0], in_chunk->data[1], in_chunk->data[2], in_chunk->data[3], in_chunk->data[in_packinfo->header_offset], in_chunk->data[in_packinfo->header_offset+1], in_chunk->data[in_packinfo->header_offset+2], in_chunk->data[in_packinfo->header_offset+3]);
+    const uint8_t *iv = in_chunk->data + in_packinfo->header_offset;
+    unsigned int seedlen = 3 + in_key->len;
 
-    // printf("debug - password\n");
-    // Password field
-    char pwd[WEPKEY_MAX + 3];
-    memset(pwd, 0, WEPKEY_MAX + 3);
+    // Fill the IV in ahead of each copy of the key in the prepared seed
+    uint8_t seed[256];
+    memcpy(seed, in_key->rc4_seed, 256);
 
-    // Extract the IV and add it to the key
-    pwd[0] = in_chunk->data[in_packinfo->header_offset + 0] & 0xFF;
-    pwd[1] = in_chunk->data[in_packinfo->header_offset + 1] & 0xFF;
-    pwd[2] = in_chunk->data[in_packinfo->header_offset + 2] & 0xFF;
+    for (unsigned int p = 0; p < 256; p += seedlen) {
+        seed[p] = iv[0];
+        if (p + 1 < 256)
+            seed[p + 1] = iv[1];
+        if (p + 2 < 256)
+            seed[p + 2] = iv[2];
+    }
 
-    // Add the supplied password to the key
-    memcpy(pwd + 3, in_key, WEPKEY_MAX);
-    int pwdlen = 3 + in_key_len;
+    // RC4 key schedule
+    uint8_t keyblock[256];
+    uint8_t kba = 0, kbb = 0, oldkey;
 
-    // printf("debug - wep stuff\n");
+    for (unsigned int i = 0; i < 256; i++)
+        keyblock[i] = i;
 
-    // Prepare the keyblock for the rc4 cipher
-    unsigned char keyblock[256];
-    memcpy(keyblock, in_id, 256);
-    int kba = 0, kbb = 0;
-    for (kba = 0; kba < 256; kba++) {
-        kbb = (kbb + keyblock[kba] + pwd[kba % pwdlen]) & 0xFF;
-        unsigned char oldkey = keyblock[kba];
-        keyblock[kba] = keyblock[kbb];
+    for (unsigned int i = 0; i < 256; i++) {
+        kbb = kbb + keyblock[i] + seed[i];
+        oldkey = keyblock[i];
+        keyblock[i] = keyblock[kbb];
         keyblock[kbb] = oldkey;
     }
 
-    // Allocate the mangled chunk -- 4 byte IV/Key# gone, 4 byte ICV gone
-    manglechunk = new kis_datachunk;
-    manglechunk->dlt = KDLT_IEEE802_11;
-
-#if 0
-    manglechunk->length = in_chunk->length - 8;
-    manglechunk->data = new uint8_t[manglechunk->length];
-
-    // Copy the packet headers to the new chunk
-    memcpy(manglechunk->data, in_chunk->data, in_packinfo->header_offset);
-#endif
-    
-    // Copy because we're modifying
-    manglechunk->set_data(in_chunk->data, in_chunk->length - 8, true);
+    // 4 byte IV/Key# gone, 4 byte ICV gone; copy because we're modifying.  Pooled
+    // chunks reuse their copy buffer so this doesn't allocate once warmed up.
+    out_chunk->copy_data(in_chunk->data, in_chunk->length - 8);
+    out_chunk->dlt = KDLT_IEEE802_11;
 
     // Decrypt the data payload and check the CRC
-    kba = kbb = 0;
+    kbb = 0;
     uint32_t crc = ~0;
     uint8_t c_crc[4];
-    uint8_t icv[4];
-
-    // Copy the ICV into the CRC buffer for checking
-    memcpy(icv, &(in_chunk->data[in_chunk->length - 4]), 4);
-    // printf("debug - icv %02x %02x %02x %02x\n", icv[0], icv[1], icv[2], icv[3]);
+    const uint8_t *icv = &(in_chunk->data[in_chunk->length - 4]);
 
     for (unsigned int dpos = in_packinfo->header_offset + 4; 
          dpos < in_chunk->length - 4; dpos++) {
-        kba = (kba + 1) & 0xFF;
-        kbb = (kbb + keyblock[kba]) & 0xFF;
+        kba++;
+        kbb += keyblock[kba];
 
-        unsigned char oldkey = keyblock[kba];
+        oldkey = keyblock[kba];
         keyblock[kba] = keyblock[kbb];
         keyblock[kbb] = oldkey;
 
         // Decode the packet into the mangle chunk
-        manglechunk->data[dpos - 4] = 
-            in_chunk->data[dpos] ^ keyblock[(keyblock[kba] + keyblock[kbb]) & 0xFF];
+        out_chunk->data[dpos - 4] = 
+            in_chunk->data[dpos] ^ keyblock[(uint8_t) (keyblock[kba] + keyblock[kbb])];
 
-        crc = dot11_wep_crc32_table[(crc ^ manglechunk->data[dpos - 4]) & 0xFF] ^ (crc >> 8);
+        crc = dot11_wep_crc32_table[(crc ^ out_chunk->data[dpos - 4]) & 0xFF] ^ (crc >> 8);
     }
 
     // Check the CRC
@@ -1936,105 +2017,119 @@ kis_datachunk *Kis_80211_Phy::DecryptWEP(dot11_packinfo *in_packinfo,
     c_crc[2] = crc >> 16;
     c_crc[3] = crc >> 24;
 
-    int crcfailure = 0;
     for (unsigned int crcpos = 0; crcpos < 4; crcpos++) {
-        kba = (kba + 1) & 0xFF;
-        kbb = (kbb + keyblock[kba]) & 0xFF;
+        kba++;
+        kbb += keyblock[kba];
 
-        unsigned char oldkey = keyblock[kba];
+        oldkey = keyblock[kba];
         keyblock[kba] = keyblock[kbb];
         keyblock[kbb] = oldkey;
 
-        if ((c_crc[crcpos] ^ keyblock[(keyblock[kba] + 
-                                       keyblock[kbb]) & 0xFF]) != icv[crcpos]) {
-            crcfailure = 1;
-            break;
-        }
-    }
-
-    // If the CRC check failed, delete the moddata
-    if (crcfailure) {
-        delete manglechunk;
-        return NULL;
+        if ((c_crc[crcpos] ^ keyblock[(uint8_t) (keyblock[kba] + keyblock[kbb])]) != 
+                icv[crcpos])
+            return false;
     }
 
     // Remove the privacy flag in the mangled data
-    frame_control *fc = (frame_control *) manglechunk->data;
+    frame_control *fc = (frame_control *) out_chunk->data;
     fc->wep = 0;
 
-    return manglechunk;
+    return true;
 }
 
-int Kis_80211_Phy::PacketWepDecryptor(kis_packet *in_pack) {
-    kis_datachunk *manglechunk = NULL;
-
-    if (in_pack->error)
+int Kis_80211_Phy::PacketWepDecryptor(const std::vector<kis_packet *>& in_packs) {
+    // Nothing to decrypt with
+    if (wepkeys.size() == 0)
         return 0;
 
-    // Grab the 80211 info, compare, bail
-    dot11_packinfo *packinfo;
-    if ((packinfo = 
-         (dot11_packinfo *) in_pack->fetch(_PCM(PACK_COMP_80211))) == NULL)
-        return 0;
-    if (packinfo->corrupt)
-        return 0;
-    if (packinfo->type != packet_data || 
-        (packinfo->subtype != packet_sub_data &&
-         packinfo->subtype != packet_sub_data_qos_data))
+    // Decrypted frames are only used by loggers which write them and by the 
+    // data dissectors; skip the work entirely if nothing wants them
+    if (!packetchain->ComponentConsumed(pack_comp_mangleframe) &&
+            !(dissect_data && packetchain->ComponentConsumed(pack_comp_datapayload)))
         return 0;
 
-    // No need to look at data thats already been decoded
-    if (packinfo->cryptset == 0 || packinfo->decrypted == 1)
-        return 0;
+    // A batch tends to hold runs of frames from the same network, so keep the 
+    // last key lookup
+    uint64_t last_bssid = 0;
+    dot11_wep_key *last_key = NULL;
+    bool have_last = false;
+
+    for (auto in_pack : in_packs) {
+        if (in_pack->error)
+            continue;
+
+        // Grab the 80211 info, compare, bail
+        dot11_packinfo *packinfo;
+        if ((packinfo = 
+             (dot11_packinfo *) in_pack->fetch(_PCM(PACK_COMP_80211))) == NULL)
+            continue;
+        if (packinfo->corrupt)
+            continue;
+        if (packinfo->type != packet_data || 
+            (packinfo->subtype != packet_sub_data &&
+             packinfo->subtype != packet_sub_data_qos_data))
+            continue;
 
-    // Grab the 80211 frame, if that doesn't exist, grab the link frame
-    kis_datachunk *chunk = 
-        (kis_datachunk *) in_pack->fetch(pack_comp_decap);
+        // No need to look at data thats already been decoded
+        if (packinfo->cryptset == 0 || packinfo->decrypted == 1)
+            continue;
 
-    if (chunk == NULL) {
-        if ((chunk = 
-             (kis_datachunk *) in_pack->fetch(pack_comp_linkframe)) == NULL) {
-            return 0;
+        // Grab the 80211 frame, if that doesn't exist, grab the link frame
+        kis_datachunk *chunk = 
+            (kis_datachunk *) in_pack->fetch(pack_comp_decap);
+
+        if (chunk == NULL) {
+            if ((chunk = 
+                 (kis_datachunk *) in_pack->fetch(pack_comp_linkframe)) == NULL) {
+                continue;
+            }
         }
-    }
 
-    // If we don't have a dot11 frame, throw it away
-    if (chunk->dlt != KDLT_IEEE802_11)
-        return 0;
+        // If we don't have a dot11 frame, throw it away
+        if (chunk->dlt != KDLT_IEEE802_11)
+            continue;
 
-    // Bail if we can't find a key match
-    macmap<dot11_wep_key *>::iterator bwmitr = wepkeys.find(packinfo->bssid_mac);
-    if (bwmitr == wepkeys.end())
-        return 0;
+        // Bail if we can't find a key match
+        if (!have_last || last_bssid != packinfo->bssid_mac.longmac) {
+            macmap<dot11_wep_key *>::iterator bwmitr = wepkeys.find(packinfo->bssid_mac);
 
-    manglechunk = DecryptWEP(packinfo, chunk, (*bwmitr->second)->key,
-                             (*bwmitr->second)->len, wep_identity);
+            if (bwmitr == wepkeys.end())
+                last_key = NULL;
+            else
+                last_key = *bwmitr->second;
 
-    if (manglechunk == NULL) {
-        (*bwmitr->second)->failed++;
-        return 0;
-    }
+            last_bssid = packinfo->bssid_mac.longmac;
+            have_last = true;
+        }
 
-    (*bwmitr->second)->decrypted++;
-    // printf("debug - flagging packet as decrypted\n");
-    packinfo->decrypted = 1;
+        if (last_key == NULL)
+            continue;
 
-    in_pack->insert(pack_comp_mangleframe, manglechunk);
+        kis_datachunk *manglechunk = datachunk_pool->acquire();
 
-    kis_datachunk *datachunk = 
-        (kis_datachunk *) in_pack->fetch(pack_comp_datapayload);
+        if (!DecryptWEP(packinfo, chunk, last_key, manglechunk)) {
+            datachunk_pool->recycle(manglechunk);
+            last_key->failed++;
+            continue;
+        }
+
+        last_key->decrypted++;
+        packinfo->decrypted = 1;
 
-    in_pack->insert(pack_comp_datapayload, NULL);
+        in_pack->insert(pack_comp_mangleframe, manglechunk);
 
-    if (datachunk != NULL)
-        delete datachunk;
+        // Replace any payload we already found with the decrypted payload
+        in_pack->erase(pack_comp_datapayload);
 
-    if (manglechunk->length > packinfo->header_offset) {
-        datachunk = new kis_datachunk;
+        if (manglechunk->length > packinfo->header_offset) {
+            kis_datachunk *datachunk = datachunk_pool->acquire();
 
-        datachunk->set_data(manglechunk->data + packinfo->header_offset,
-                            manglechunk->length - packinfo->header_offset,
-                            false);
+            datachunk->set_data(manglechunk->data + packinfo->header_offset,
+                                manglechunk->length - packinfo->header_offset,
+                                false);
+
+            in_pack->insert(pack_comp_datapayload, datachunk);
+        }
     }
 
     return 1;
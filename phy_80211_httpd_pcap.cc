@@ -23,6 +23,7 @@
 #include "pcapng_stream_ringbuf.h"
 #include "devicetracker.h"
 #include "phy_80211.h"
+#include "packet_retro.h"
 
 bool Phy_80211_Httpd_Pcap::Httpd_VerifyPath(const char *path, const char *method) {
     if (strcmp(method, "GET") == 0) {
@@ -50,9 +51,31 @@ bool Phy_80211_Httpd_Pcap::Httpd_VerifyPath(const char *path, const char *method
         if (tokenurl[5] != "pcap")
             return false;
 
-        // Valid requested file?
-        if (tokenurl[6] != tokenurl[4] + ".pcapng")
-            return false;
+        // Valid requested file?  Either the live stream or a dump of the 
+        // retroactive buffer:
+        // /phy/phy80211/by-bssid/[mac]/pcap/last-seconds/[N]/[mac].pcapng
+        // /phy/phy80211/by-bssid/[mac]/pcap/last-packets/[N]/[mac].pcapng
+        if (tokenurl[6] != tokenurl[4] + ".pcapng") {
+            if (tokenurl.size() < 9)
+                return false;
+
+            if (tokenurl[6] != "last-seconds" && tokenurl[6] != "last-packets")
+                return false;
+
+            unsigned int count;
+            if (sscanf(tokenurl[7].c_str(), "%u", &count) != 1)
+                return false;
+
+            if (tokenurl[8] != tokenurl[4] + ".pcapng")
+                return false;
+
+            shared_ptr<Packet_Retro_Buffer> retrobuf =
+                Globalreg::FetchGlobalAs<Packet_Retro_Buffer>(http_globalreg, 
+                        "PACKET_RETRO");
+
+            if (retrobuf == NULL || !retrobuf->get_enabled())
+                return false;
+        }
 
         shared_ptr<Devicetracker> devicetracker =
             static_pointer_cast<Devicetracker>(http_globalreg->FetchGlobal("DEVICE_TRACKER"));
@@ -118,8 +141,24 @@ int Phy_80211_Httpd_Pcap::Httpd_CreateStreamResponse(Kis_Net_Httpd *httpd,
         return MHD_YES;
 
     // Valid requested file?
-    if (tokenurl[6] != tokenurl[4] + ".pcapng")
-        return MHD_YES;
+    bool retro = false;
+    unsigned int count = 0;
+
+    if (tokenurl[6] != tokenurl[4] + ".pcapng") {
+        if (tokenurl.size() < 9)
+            return MHD_YES;
+
+        if (tokenurl[6] != "last-seconds" && tokenurl[6] != "last-packets")
+            return MHD_YES;
+
+        if (sscanf(tokenurl[7].c_str(), "%u", &count) != 1)
+            return MHD_YES;
+
+        if (tokenurl[8] != tokenurl[4] + ".pcapng")
+            return MHD_YES;
+
+        retro = true;
+    }
 
     // Does it exist?
     TrackedDeviceKey targetkey(http_globalreg->server_uuid_hash, 
@@ -138,6 +177,22 @@ int Phy_80211_Httpd_Pcap::Httpd_CreateStreamResponse(Kis_Net_Httpd *httpd,
 
     Kis_Net_Httpd_Buffer_Stream_Aux *saux = 
         (Kis_Net_Httpd_Buffer_Stream_Aux *) connection->custom_extension;
+
+    // Dump what we've already seen of the BSSID and finish
+    if (retro) {
+        shared_ptr<Packet_Retro_Buffer> retrobuf =
+            Globalreg::FetchGlobalAs<Packet_Retro_Buffer>(http_globalreg, "PACKET_RETRO");
+
+        if (retrobuf == NULL)
+            return MHD_YES;
+
+        if (tokenurl[6] == "last-seconds")
+            retrobuf->stream_pcapng(saux->get_rbhandler(), targetkey, count, 0);
+        else
+            retrobuf->stream_pcapng(saux->get_rbhandler(), targetkey, 0, count);
+
+        return MHD_YES;
+    }
       
     // Filter based on the device key
     Pcap_Stream_Ringbuf *psrb = new Pcap_Stream_Ringbuf(http_globalreg,
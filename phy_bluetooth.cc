@@ -54,11 +54,20 @@ Kis_Bluetooth_Phy::Kis_Bluetooth_Phy(GlobalRegistry *in_globalreg, Devicetracker
                 shared_ptr<bluetooth_tracked_device>(new bluetooth_tracked_device(globalreg, 0)),
                 "Bluetooth device");
 
-    packetchain->RegisterHandler(&CommonClassifierBluetooth, this, CHAINPOS_CLASSIFIER, -100);
-    packetchain->RegisterHandler(&PacketTrackerBluetooth, this, CHAINPOS_TRACKER, -100);
+    classifier_handler_id =
+        packetchain->RegisterHandler(&CommonClassifierBluetooth, this, 
+                CHAINPOS_CLASSIFIER, -100, "bluetooth classifier");
+    tracker_handler_id =
+        packetchain->RegisterHandler(&PacketTrackerBluetooth, this, 
+                CHAINPOS_TRACKER, -100, "bluetooth tracker");
     
     pack_comp_btdevice = packetchain->RegisterPacketComponent("BTDEVICE");
+
+    // Only bluetooth packets are worth locking the device list for
+    packetchain->SetHandlerComponentDispatch(classifier_handler_id, pack_comp_btdevice);
+    packetchain->SetHandlerComponentDispatch(tracker_handler_id, pack_comp_btdevice);
 	pack_comp_common = packetchain->RegisterPacketComponent("COMMON");
+    common_pool = packetchain->FetchComponentPool<kis_common_info>();
     pack_comp_l1info = packetchain->RegisterPacketComponent("RADIODATA");
 
     // Register js module for UI
@@ -87,7 +96,7 @@ int Kis_Bluetooth_Phy::CommonClassifierBluetooth(CHAINCALL_PARMS) {
     kis_common_info *ci = (kis_common_info *) in_pack->fetch(btphy->pack_comp_common);
 
     if (ci == NULL) {
-        ci = new kis_common_info();
+        ci = btphy->common_pool->acquire();
         in_pack->insert(btphy->pack_comp_common, ci);
     }
 
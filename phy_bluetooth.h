@@ -141,6 +141,10 @@ protected:
 
 	// Packet components
 	int pack_comp_btdevice, pack_comp_common, pack_comp_l1info;
+
+    int classifier_handler_id, tracker_handler_id;
+
+    packet_component_pool<kis_common_info> *common_pool;
 };
 
 #endif
@@ -47,8 +47,12 @@ Kis_UAV_Phy::Kis_UAV_Phy(GlobalRegistry *in_globalreg,
 
     // Tag into the packet chain at the very end so we've gotten all the other tracker
     // elements already
-    packetchain->RegisterHandler(Kis_UAV_Phy::CommonClassifier, 
-            this, CHAINPOS_TRACKER, 65535);
+    int classifier_id = 
+        packetchain->RegisterHandler(Kis_UAV_Phy::CommonClassifier, 
+                this, CHAINPOS_TRACKER, 65535, "uav classifier");
+
+    // Drone IDs only come from 802.11 frames
+    packetchain->SetHandlerComponentDispatch(classifier_id, pack_comp_80211);
 
     // Register js module for UI
     shared_ptr<Kis_Httpd_Registry> httpregistry = 
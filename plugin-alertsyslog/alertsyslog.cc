@@ -82,7 +82,7 @@ int alertsyslog_openlog(GlobalRegistry *in_globalreg) {
     openlog(in_globalreg->servername.c_str(), LOG_NDELAY, LOG_USER);
 
     packetchain->RegisterHandler(&alertsyslog_chain_hook, NULL,
-            CHAINPOS_LOGGING, -100);
+            CHAINPOS_LOGGING, -100, "alert syslog");
 
     return 1;
 }
@@ -0,0 +1,238 @@
+/*
+    This file is part of Kismet
+
+    Kismet is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kismet is distributed in the hope that it will be useful,
+      but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Kismet; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "config.h"
+
+#include "radiotap_layout.h"
+#include "tcpdump-extract.h"
+
+#if defined(SYS_OPENBSD) || defined(SYS_NETBSD)
+#include <net80211/ieee80211.h>
+#include <net80211/ieee80211_ioctl.h>
+#include <net80211/ieee80211_radiotap.h>
+#endif // Open/Net
+
+#ifdef SYS_FREEBSD
+#include <net80211/ieee80211_radiotap.h>
+#endif // FreeBSD
+
+// Include the linux system radiotap headers
+#ifdef HAVE_LINUX_SYS_RADIOTAP
+#include <net/ieee80211_radiotap.h>
+#endif
+
+// If we couldn't make any sense of system rt headers (OSX perhaps, or
+// win32, or an older linux) then pull in the local radiotap copy
+#ifdef HAVE_LOCAL_RADIOTAP
+#include "local_ieee80211_radiotap.h"
+#endif
+
+// Radiotap header: version, pad, length, and the first present word
+#define RADIOTAP_HDR_LEN        8
+#define RADIOTAP_PRESENT_OFFT   4
+#define RADIOTAP_PRESENT_EXT    (1U << 31)
+
+radiotap_layout_cache::radiotap_layout_cache() {
+    num_layouts = 0;
+    next_replace = 0;
+    last_hit = 0;
+}
+
+int radiotap_layout_cache::count_present(const uint8_t *in_data, size_t in_len,
+        unsigned int *ret_num_present) {
+    if (in_len < RADIOTAP_HDR_LEN)
+        return -1;
+
+    unsigned int it_len = EXTRACT_LE_16BITS(in_data + 2);
+
+    if (it_len < RADIOTAP_HDR_LEN || in_len < it_len)
+        return -1;
+
+    // Find the last present word; every word but the last has the extension
+    // bit set
+    unsigned int last_offt = RADIOTAP_PRESENT_OFFT;
+
+    while ((EXTRACT_LE_32BITS(in_data + last_offt) & RADIOTAP_PRESENT_EXT) &&
+            last_offt + 8 <= it_len)
+        last_offt += 4;
+
+    // More bitmap extensions than bytes in the header
+    if (EXTRACT_LE_32BITS(in_data + last_offt) & RADIOTAP_PRESENT_EXT)
+        return -2;
+
+    *ret_num_present = ((last_offt - RADIOTAP_PRESENT_OFFT) / 4) + 1;
+
+    return 0;
+}
+
+void radiotap_layout_cache::compile(uint32_t in_present, unsigned int in_num_present,
+        radiotap_layout *ret_layout) {
+    ret_layout->present = in_present;
+    ret_layout->num_present = in_num_present;
+
+    ret_layout->flags_off = RADIOTAP_LAYOUT_NONE;
+    ret_layout->rate_off = RADIOTAP_LAYOUT_NONE;
+    ret_layout->channel_off = RADIOTAP_LAYOUT_NONE;
+    ret_layout->signal_off = RADIOTAP_LAYOUT_NONE;
+    ret_layout->noise_off = RADIOTAP_LAYOUT_NONE;
+    ret_layout->rssi_off = RADIOTAP_LAYOUT_NONE;
+
+    // Fields start after the last present word; alignment is from the start of
+    // the radiotap header
+    unsigned int offt = RADIOTAP_PRESENT_OFFT + (4 * in_num_present);
+
+    for (unsigned int bit = 0; bit < 32; bit++) {
+        if ((in_present & (1U << bit)) == 0)
+            continue;
+
+        // Anything past here can't be in a radiotap header
+        if (offt >= RADIOTAP_LAYOUT_NONE - 8)
+            return;
+
+        switch (bit) {
+            case IEEE80211_RADIOTAP_FLAGS:
+                ret_layout->flags_off = offt;
+                offt += 1;
+                break;
+            case IEEE80211_RADIOTAP_RATE:
+                ret_layout->rate_off = offt;
+                offt += 1;
+                break;
+            case IEEE80211_RADIOTAP_DBM_ANTSIGNAL:
+                ret_layout->signal_off = offt;
+                offt += 1;
+                break;
+            case IEEE80211_RADIOTAP_DBM_ANTNOISE:
+                ret_layout->noise_off = offt;
+                offt += 1;
+                break;
+            case IEEE80211_RADIOTAP_ANTENNA:
+            case IEEE80211_RADIOTAP_DBM_TX_POWER:
+                offt += 1;
+                break;
+            case IEEE80211_RADIOTAP_CHANNEL:
+                offt = (offt + 1) & ~1U;
+                ret_layout->channel_off = offt;
+                offt += 4;
+                break;
+            case IEEE80211_RADIOTAP_FHSS:
+            case IEEE80211_RADIOTAP_LOCK_QUALITY:
+            case IEEE80211_RADIOTAP_TX_ATTENUATION:
+            case IEEE80211_RADIOTAP_DB_TX_ATTENUATION:
+                offt = (offt + 1) & ~1U;
+                offt += 2;
+                break;
+            case IEEE80211_RADIOTAP_TSFT:
+                offt = (offt + 7) & ~7U;
+                offt += 8;
+                break;
+#if defined(SYS_OPENBSD)
+            case IEEE80211_RADIOTAP_RSSI:
+                ret_layout->rssi_off = offt;
+                offt += 2;
+                break;
+#endif
+            default:
+                // A field whose size we don't know, so we can't find anything
+                // after it
+                return;
+        }
+    }
+}
+
+void radiotap_layout_cache::apply(const radiotap_layout *in_layout,
+        const uint8_t *in_data, radiotap_fields *ret_fields) {
+    // Absent fields have an offset past any possible header length so each
+    // field is a single bounds check
+    unsigned int it_len = EXTRACT_LE_16BITS(in_data + 2);
+
+    if ((unsigned int) in_layout->flags_off + 1 <= it_len) {
+        ret_fields->has_flags = true;
+        ret_fields->flags = in_data[in_layout->flags_off];
+    }
+
+    if ((unsigned int) in_layout->rate_off + 1 <= it_len) {
+        ret_fields->has_rate = true;
+        ret_fields->rate = in_data[in_layout->rate_off];
+    }
+
+    if ((unsigned int) in_layout->channel_off + 4 <= it_len) {
+        ret_fields->has_channel = true;
+        ret_fields->chan_freq = EXTRACT_LE_16BITS(in_data + in_layout->channel_off);
+        ret_fields->chan_flags = EXTRACT_LE_16BITS(in_data + in_layout->channel_off + 2);
+    }
+
+    if ((unsigned int) in_layout->signal_off + 1 <= it_len) {
+        ret_fields->has_signal = true;
+        ret_fields->signal_dbm = (int8_t) in_data[in_layout->signal_off];
+    }
+
+    if ((unsigned int) in_layout->noise_off + 1 <= it_len) {
+        ret_fields->has_noise = true;
+        ret_fields->noise_dbm = (int8_t) in_data[in_layout->noise_off];
+    }
+
+    if ((unsigned int) in_layout->rssi_off + 2 <= it_len) {
+        ret_fields->has_rssi = true;
+        ret_fields->rssi = in_data[in_layout->rssi_off];
+        ret_fields->max_rssi = in_data[in_layout->rssi_off + 1];
+    }
+}
+
+void radiotap_layout_cache::decode(const uint8_t *in_data, unsigned int in_num_present,
+        radiotap_fields *ret_fields) {
+    uint32_t present = EXTRACT_LE_32BITS(in_data + RADIOTAP_PRESENT_OFFT);
+
+    // Most sources only emit one or two bitmasks, so try the last match first
+    if (last_hit < num_layouts && layouts[last_hit].present == present &&
+            layouts[last_hit].num_present == in_num_present) {
+        apply(&(layouts[last_hit]), in_data, ret_fields);
+        return;
+    }
+
+    for (unsigned int i = 0; i < num_layouts; i++) {
+        if (layouts[i].present == present && layouts[i].num_present == in_num_present) {
+            last_hit = i;
+            apply(&(layouts[i]), in_data, ret_fields);
+            return;
+        }
+    }
+
+    unsigned int slot;
+
+    if (num_layouts < max_layouts) {
+        slot = num_layouts++;
+    } else {
+        slot = next_replace;
+        next_replace = (next_replace + 1) % max_layouts;
+    }
+
+    compile(present, in_num_present, &(layouts[slot]));
+    last_hit = slot;
+
+    apply(&(layouts[slot]), in_data, ret_fields);
+}
+
+void radiotap_layout_cache::decode_uncached(const uint8_t *in_data,
+        unsigned int in_num_present, radiotap_fields *ret_fields) {
+    radiotap_layout layout;
+
+    compile(EXTRACT_LE_32BITS(in_data + RADIOTAP_PRESENT_OFFT), in_num_present, &layout);
+    apply(&layout, in_data, ret_fields);
+}
+
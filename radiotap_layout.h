@@ -0,0 +1,126 @@
+/*
+    This file is part of Kismet
+
+    Kismet is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kismet is distributed in the hope that it will be useful,
+      but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Kismet; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef __RADIOTAP_LAYOUT_H__
+#define __RADIOTAP_LAYOUT_H__
+
+#include "config.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+
+/* Radiotap field layouts
+ *
+ * Finding a radiotap field means walking every bit of the present bitmask
+ * before it, aligning each field along the way.  A capture driver only ever
+ * emits a handful of bitmasks, so instead we walk each bitmask once, record
+ * the offset of every field we use as a layout, and decode later frames with
+ * the same bitmask with direct loads from the cached offsets.
+ *
+ * Only fields in the first present word are decoded, and the walk stops at
+ * the first field of unknown size, so the layout depends only on the first
+ * present word and the number of present words in the chain; together they
+ * make the cache key.
+ */
+
+// Offset of a field not in the layout; larger than any radiotap header
+#define RADIOTAP_LAYOUT_NONE      0xFFFF
+
+// Raw values of the radiotap fields Kismet uses
+struct radiotap_fields {
+    radiotap_fields() {
+        has_flags = has_rate = has_channel = has_signal = has_noise = has_rssi = false;
+        flags = rate = 0;
+        chan_freq = chan_flags = 0;
+        signal_dbm = noise_dbm = 0;
+        rssi = max_rssi = 0;
+    }
+
+    bool has_flags, has_rate, has_channel, has_signal, has_noise, has_rssi;
+
+    uint8_t flags;
+    uint8_t rate;
+    uint16_t chan_freq;
+    uint16_t chan_flags;
+    int8_t signal_dbm;
+    int8_t noise_dbm;
+
+    // OpenBSD RSSI and max RSSI
+    uint8_t rssi;
+    uint8_t max_rssi;
+};
+
+// Offsets of the fields we use, from the start of the radiotap header
+struct radiotap_layout {
+    uint32_t present;
+    unsigned int num_present;
+
+    uint16_t flags_off;
+    uint16_t rate_off;
+    uint16_t channel_off;
+    uint16_t signal_off;
+    uint16_t noise_off;
+    uint16_t rssi_off;
+};
+
+class radiotap_layout_cache {
+public:
+    radiotap_layout_cache();
+
+    // Validate a radiotap header and count the present bitmask words
+    //
+    // Returns:
+    //   0  Valid header, num_present set
+    //  -1  Header or radiotap length larger than the frame
+    //  -2  Present bitmask extends past the radiotap header
+    static int count_present(const uint8_t *in_data, size_t in_len,
+            unsigned int *ret_num_present);
+
+    // Build the layout of a present bitmask by walking it field by field
+    static void compile(uint32_t in_present, unsigned int in_num_present,
+            radiotap_layout *ret_layout);
+
+    // Load the fields of a layout; fields which fall outside the radiotap
+    // header length are skipped
+    static void apply(const radiotap_layout *in_layout, const uint8_t *in_data,
+            radiotap_fields *ret_fields);
+
+    // Decode the fields of a frame validated by count_present, from a cached
+    // layout or by walking the bitmask and caching the result.  Not thread
+    // safe; the radiotap DLT only calls it from the packet thread.
+    void decode(const uint8_t *in_data, unsigned int in_num_present,
+            radiotap_fields *ret_fields);
+
+    // Decode the fields of a frame validated by count_present without using
+    // the cache
+    static void decode_uncached(const uint8_t *in_data, unsigned int in_num_present,
+            radiotap_fields *ret_fields);
+
+protected:
+    // Drivers emit a handful of bitmasks; once the cache is full, new bitmasks
+    // replace the oldest
+    static const unsigned int max_layouts = 16;
+
+    radiotap_layout layouts[max_layouts];
+    unsigned int num_layouts;
+    unsigned int next_replace;
+    unsigned int last_hit;
+};
+
+#endif
+
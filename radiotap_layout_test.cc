@@ -0,0 +1,342 @@
+/* test harness for the Kismet radiotap layout cache
+ *
+ * Decodes the radiotap header of every frame with the original field by field
+ * present bitmask walk and with the layout cache from radiotap_layout.h; any
+ * difference in the decoded fields is printed, followed by the time each
+ * decoder took over the whole corpus.
+ *
+ * With no pcap files, frames are generated with the present bitmasks of
+ * several common drivers (ath9k, iwlwifi, rtl88xxau, mt76, and brcmfmac
+ * nexmon); otherwise every radiotap frame of every pcap file is used, so
+ * captures from several drivers can be benchmarked together.
+ *
+ * # configure and build kismet
+ * ./configure
+ * make
+ *
+ * # build test harness
+ * g++ -std=c++11 -O2 -I. -o radiotap_layout_test radiotap_layout_test.cc \
+ *     radiotap_layout.cc.o -lpcap
+ *
+ * ./radiotap_layout_test [-i iterations] [capture.pcap ...]
+ *
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include <pcap.h>
+
+#include "radiotap_layout.h"
+#include "tcpdump-extract.h"
+
+#ifndef DLT_IEEE802_11_RADIO
+#define DLT_IEEE802_11_RADIO 127
+#endif
+
+// Radiotap bit numbers, so the generated frames and the reference walk don't
+// depend on which radiotap header the platform has
+#define RT_TSFT             0
+#define RT_FLAGS            1
+#define RT_RATE             2
+#define RT_CHANNEL          3
+#define RT_FHSS             4
+#define RT_DBM_ANTSIGNAL    5
+#define RT_DBM_ANTNOISE     6
+#define RT_LOCK_QUALITY     7
+#define RT_TX_ATTENUATION   8
+#define RT_DB_TX_ATTENUATION 9
+#define RT_DBM_TX_POWER     10
+#define RT_ANTENNA          11
+#define RT_RX_FLAGS         14
+#define RT_MCS              19
+#define RT_AMPDU            20
+#define RT_VHT              21
+#define RT_RADIOTAP_NS      29
+#define RT_EXT              31
+
+#define B(x) (1U << (x))
+
+// The original radiotap DLT walk, kept as the reference; fields past the
+// radiotap header are skipped to match the layout cache
+void reference_decode(const uint8_t *data, unsigned int num_present,
+        radiotap_fields *f) {
+    unsigned int it_len = EXTRACT_LE_16BITS(data + 2);
+    unsigned int iter = 4 + (4 * num_present);
+    uint32_t present = EXTRACT_LE_32BITS(data + 4);
+
+    for (unsigned int bit = 0; bit < 32; bit++) {
+        if ((present & B(bit)) == 0)
+            continue;
+
+        unsigned int sz, align;
+
+        switch (bit) {
+            case RT_FLAGS:
+            case RT_RATE:
+            case RT_DBM_ANTSIGNAL:
+            case RT_DBM_ANTNOISE:
+            case RT_ANTENNA:
+            case RT_DBM_TX_POWER:
+                sz = 1;
+                align = 1;
+                break;
+            case RT_CHANNEL:
+                sz = 4;
+                align = 2;
+                break;
+            case RT_FHSS:
+            case RT_LOCK_QUALITY:
+            case RT_TX_ATTENUATION:
+            case RT_DB_TX_ATTENUATION:
+                sz = 2;
+                align = 2;
+                break;
+            case RT_TSFT:
+                sz = 8;
+                align = 8;
+                break;
+            default:
+                return;
+        }
+
+        iter = (iter + (align - 1)) & ~(align - 1);
+
+        if (iter + sz <= it_len) {
+            switch (bit) {
+                case RT_FLAGS:
+                    f->has_flags = true;
+                    f->flags = data[iter];
+                    break;
+                case RT_RATE:
+                    f->has_rate = true;
+                    f->rate = data[iter];
+                    break;
+                case RT_DBM_ANTSIGNAL:
+                    f->has_signal = true;
+                    f->signal_dbm = (int8_t) data[iter];
+                    break;
+                case RT_DBM_ANTNOISE:
+                    f->has_noise = true;
+                    f->noise_dbm = (int8_t) data[iter];
+                    break;
+                case RT_CHANNEL:
+                    f->has_channel = true;
+                    f->chan_freq = EXTRACT_LE_16BITS(data + iter);
+                    f->chan_flags = EXTRACT_LE_16BITS(data + iter + 2);
+                    break;
+                default:
+                    break;
+            }
+        }
+
+        iter += sz;
+    }
+}
+
+bool fields_match(const radiotap_fields& a, const radiotap_fields& b) {
+    if (a.has_flags != b.has_flags || (a.has_flags && a.flags != b.flags))
+        return false;
+    if (a.has_rate != b.has_rate || (a.has_rate && a.rate != b.rate))
+        return false;
+    if (a.has_signal != b.has_signal || (a.has_signal && a.signal_dbm != b.signal_dbm))
+        return false;
+    if (a.has_noise != b.has_noise || (a.has_noise && a.noise_dbm != b.noise_dbm))
+        return false;
+    if (a.has_channel != b.has_channel || (a.has_channel &&
+                (a.chan_freq != b.chan_freq || a.chan_flags != b.chan_flags)))
+        return false;
+
+    return true;
+}
+
+struct driver_profile {
+    const char *name;
+    std::vector<uint32_t> present;
+    // Bytes of fields following the present words
+    unsigned int field_len;
+};
+
+// Generate a frame with random field contents for a driver bitmask chain
+std::string generate_frame(const driver_profile& d) {
+    std::string frame;
+    unsigned int it_len = 4 + (4 * d.present.size()) + d.field_len;
+
+    frame.resize(it_len + 64);
+
+    for (unsigned int i = 0; i < frame.size(); i++)
+        frame[i] = rand() & 0xFF;
+
+    frame[0] = 0;
+    frame[1] = 0;
+    frame[2] = it_len & 0xFF;
+    frame[3] = (it_len >> 8) & 0xFF;
+
+    for (unsigned int i = 0; i < d.present.size(); i++) {
+        uint32_t p = d.present[i];
+        frame[4 + (i * 4) + 0] = p & 0xFF;
+        frame[4 + (i * 4) + 1] = (p >> 8) & 0xFF;
+        frame[4 + (i * 4) + 2] = (p >> 16) & 0xFF;
+        frame[4 + (i * 4) + 3] = (p >> 24) & 0xFF;
+    }
+
+    return frame;
+}
+
+int main(int argc, char *argv[]) {
+    std::vector<std::string> frames;
+    unsigned int iterations = 200;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "i:")) != -1) {
+        if (opt == 'i') {
+            iterations = atoi(optarg);
+        } else {
+            fprintf(stderr, "usage: %s [-i iterations] [capture.pcap ...]\n", argv[0]);
+            exit(1);
+        }
+    }
+
+    if (optind < argc) {
+        for (int a = optind; a < argc; a++) {
+            char errbuf[PCAP_ERRBUF_SIZE];
+            pcap_t *pd = pcap_open_offline(argv[a], errbuf);
+
+            if (pd == NULL) {
+                fprintf(stderr, "Could not open %s: %s\n", argv[a], errbuf);
+                exit(1);
+            }
+
+            if (pcap_datalink(pd) != DLT_IEEE802_11_RADIO) {
+                fprintf(stderr, "Skipping %s, not a radiotap capture\n", argv[a]);
+                pcap_close(pd);
+                continue;
+            }
+
+            struct pcap_pkthdr *pkthdr;
+            const u_char *data;
+            size_t start = frames.size();
+
+            while (pcap_next_ex(pd, &pkthdr, &data) > 0)
+                frames.push_back(std::string((const char *) data, pkthdr->caplen));
+
+            printf("%s: %lu frames\n", argv[a], frames.size() - start);
+
+            pcap_close(pd);
+        }
+    } else {
+        std::vector<driver_profile> drivers = {
+            { "ath9k",
+                { B(RT_TSFT) | B(RT_FLAGS) | B(RT_RATE) | B(RT_CHANNEL) |
+                    B(RT_DBM_ANTSIGNAL) | B(RT_RX_FLAGS) | B(RT_RADIOTAP_NS) | B(RT_EXT),
+                  B(RT_DBM_ANTSIGNAL) | B(RT_ANTENNA) | B(RT_RADIOTAP_NS) | B(RT_EXT),
+                  B(RT_DBM_ANTSIGNAL) | B(RT_ANTENNA) }, 24 },
+            { "iwlwifi",
+                { B(RT_TSFT) | B(RT_FLAGS) | B(RT_CHANNEL) | B(RT_DBM_ANTSIGNAL) |
+                    B(RT_RX_FLAGS) | B(RT_MCS) | B(RT_AMPDU) | B(RT_RADIOTAP_NS) | B(RT_EXT),
+                  B(RT_DBM_ANTSIGNAL) | B(RT_ANTENNA) }, 36 },
+            { "rtl88xxau",
+                { B(RT_FLAGS) | B(RT_RATE) | B(RT_CHANNEL) | B(RT_DBM_ANTSIGNAL) |
+                    B(RT_RX_FLAGS) | B(RT_RADIOTAP_NS) | B(RT_EXT),
+                  B(RT_DBM_ANTSIGNAL) | B(RT_ANTENNA) | B(RT_RADIOTAP_NS) | B(RT_EXT),
+                  B(RT_DBM_ANTSIGNAL) | B(RT_ANTENNA) }, 16 },
+            { "mt76",
+                { B(RT_TSFT) | B(RT_FLAGS) | B(RT_CHANNEL) | B(RT_DBM_ANTSIGNAL) |
+                    B(RT_RX_FLAGS) | B(RT_VHT) | B(RT_RADIOTAP_NS) | B(RT_EXT),
+                  B(RT_DBM_ANTSIGNAL) | B(RT_ANTENNA) }, 36 },
+            { "brcmfmac nexmon",
+                { B(RT_FLAGS) | B(RT_CHANNEL) | B(RT_DBM_ANTSIGNAL) |
+                    B(RT_DBM_ANTNOISE) | B(RT_RX_FLAGS) }, 16 },
+        };
+
+        for (auto d : drivers) {
+            for (unsigned int i = 0; i < 2000; i++)
+                frames.push_back(generate_frame(d));
+            printf("%s: 2000 generated frames\n", d.name);
+        }
+
+        // Interleave sources like a multi-radio capture
+        for (unsigned int i = frames.size() - 1; i > 0; i--)
+            std::swap(frames[i], frames[rand() % (i + 1)]);
+    }
+
+    radiotap_layout_cache cache;
+    std::vector<unsigned int> num_present;
+    unsigned long mismatches = 0, invalid = 0;
+
+    for (auto f : frames) {
+        unsigned int np = 0;
+
+        if (radiotap_layout_cache::count_present((const uint8_t *) f.data(),
+                    f.length(), &np) < 0) {
+            invalid++;
+            np = 0;
+        }
+
+        num_present.push_back(np);
+
+        if (np == 0)
+            continue;
+
+        radiotap_fields ref, cached;
+
+        reference_decode((const uint8_t *) f.data(), np, &ref);
+        cache.decode((const uint8_t *) f.data(), np, &cached);
+
+        if (!fields_match(ref, cached)) {
+            mismatches++;
+            printf("mismatch: present %08x words %u\n",
+                    EXTRACT_LE_32BITS((const uint8_t *) f.data() + 4), np);
+        }
+    }
+
+    printf("%lu frames, %lu invalid, %lu mismatched\n", frames.size(), invalid, mismatches);
+
+    volatile unsigned int bench_sink = 0;
+    struct timespec start, end;
+    double walk_time, cache_time;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (unsigned int i = 0; i < iterations; i++) {
+        for (unsigned int x = 0; x < frames.size(); x++) {
+            if (num_present[x] == 0)
+                continue;
+
+            radiotap_fields rtf;
+            reference_decode((const uint8_t *) frames[x].data(), num_present[x], &rtf);
+            bench_sink += rtf.chan_freq + rtf.signal_dbm;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    walk_time = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (unsigned int i = 0; i < iterations; i++) {
+        for (unsigned int x = 0; x < frames.size(); x++) {
+            if (num_present[x] == 0)
+                continue;
+
+            radiotap_fields rtf;
+            cache.decode((const uint8_t *) frames[x].data(), num_present[x], &rtf);
+            bench_sink += rtf.chan_freq + rtf.signal_dbm;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    cache_time = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+    double nframes = (double) frames.size() * iterations;
+
+    printf("bitmask walk:  %.3fs, %.1f ns/frame\n", walk_time, walk_time * 1e9 / nframes);
+    printf("layout cache:  %.3fs, %.1f ns/frame\n", cache_time, cache_time * 1e9 / nframes);
+
+    return mismatches != 0;
+}
+
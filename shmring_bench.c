@@ -0,0 +1,357 @@
+/* benchmark of the capture helper transports
+ *
+ * Streams frames from a forked producer to the consumer through the IPC pipe
+ * path and through the shared memory ring from kis_shmring.h, and prints the
+ * frames per second and the CPU time per frame (producer and consumer
+ * together) of each.
+ *
+ * The pipe path is modelled on the helper and the server: the producer copies
+ * frames into an output buffer which is written to the pipe once select()
+ * says there's room, and the consumer reads as much as it can and copies each
+ * complete frame out into a frame buffer.  The shared memory path copies the
+ * frame into the ring and out into a frame buffer.
+ *
+ * # configure and build kismet
+ * ./configure
+ * make
+ *
+ * # build benchmark
+ * gcc -O2 -I. -o shmring_bench shmring_bench.c kis_shmring.c.o
+ *
+ * ./shmring_bench [-n frames] [-s frame size] [-r ring KB]
+ *
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/select.h>
+#include <sys/wait.h>
+
+#include "kis_shmring.h"
+
+#define PIPE_OUTBUF_SZ      (1024 * 256)
+#define PIPE_INBUF_SZ       (1024 * 1024)
+
+static unsigned int num_frames = 1000000;
+static unsigned int frame_sz = 512;
+static unsigned int ring_kb = 4096;
+
+static double tv_sec(struct timeval *tv) {
+    return tv->tv_sec + (tv->tv_usec / 1000000.0);
+}
+
+/* Fill a frame with a length header and a sequence number so the consumer
+ * can check nothing went missing */
+static void make_frame(uint8_t *buf, uint32_t seq) {
+    memcpy(buf, &frame_sz, sizeof(uint32_t));
+    memcpy(buf + 4, &seq, sizeof(uint32_t));
+}
+
+static int check_frame(const uint8_t *buf, uint32_t seq) {
+    uint32_t fseq;
+
+    memcpy(&fseq, buf + 4, sizeof(uint32_t));
+
+    return fseq == seq;
+}
+
+static void pipe_producer(int fd) {
+    uint8_t *outbuf = (uint8_t *) malloc(PIPE_OUTBUF_SZ);
+    size_t used = 0, start = 0;
+    uint8_t *frame = (uint8_t *) malloc(frame_sz);
+    unsigned int seq = 0;
+    fd_set wset;
+    ssize_t r;
+
+    memset(frame, 0x55, frame_sz);
+
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+
+    while (seq < num_frames || used != start) {
+        /* Queue as many frames as fit, as the capture thread would */
+        if (start == used) {
+            start = 0;
+            used = 0;
+        }
+
+        while (seq < num_frames && PIPE_OUTBUF_SZ - used >= frame_sz) {
+            make_frame(frame, seq++);
+            memcpy(outbuf + used, frame, frame_sz);
+            used += frame_sz;
+        }
+
+        FD_ZERO(&wset);
+        FD_SET(fd, &wset);
+
+        if (select(fd + 1, NULL, &wset, NULL, NULL) < 0) {
+            if (errno == EINTR)
+                continue;
+            _exit(1);
+        }
+
+        r = write(fd, outbuf + start, used - start);
+
+        if (r < 0) {
+            if (errno == EAGAIN || errno == EINTR)
+                continue;
+            _exit(1);
+        }
+
+        start += r;
+    }
+
+    _exit(0);
+}
+
+static unsigned int pipe_consumer(int fd) {
+    uint8_t *inbuf = (uint8_t *) malloc(PIPE_INBUF_SZ);
+    uint8_t *framebuf = (uint8_t *) malloc(frame_sz);
+    size_t used = 0, offt;
+    unsigned int seq = 0;
+    fd_set rset;
+    ssize_t r;
+    int eof = 0;
+
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+
+    while (seq < num_frames && !eof) {
+        FD_ZERO(&rset);
+        FD_SET(fd, &rset);
+
+        if (select(fd + 1, &rset, NULL, NULL, NULL) < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+
+        while ((r = read(fd, inbuf + used, PIPE_INBUF_SZ - used)) > 0) {
+            used += r;
+
+            if (used == PIPE_INBUF_SZ)
+                break;
+        }
+
+        if (r == 0)
+            eof = 1;
+
+        offt = 0;
+
+        while (used - offt >= frame_sz) {
+            memcpy(framebuf, inbuf + offt, frame_sz);
+
+            if (!check_frame(framebuf, seq)) {
+                fprintf(stderr, "pipe: frame %u out of sequence\n", seq);
+                return seq;
+            }
+
+            seq++;
+            offt += frame_sz;
+        }
+
+        memmove(inbuf, inbuf + offt, used - offt);
+        used -= offt;
+    }
+
+    return seq;
+}
+
+static void shm_producer(kis_shmring_t *ring) {
+    uint8_t *frame = (uint8_t *) malloc(frame_sz);
+    unsigned int seq = 0;
+    uint8_t *buf;
+    int r;
+
+    memset(frame, 0x55, frame_sz);
+
+    while (seq < num_frames) {
+        r = kis_shmring_reserve(ring, frame_sz, &buf);
+
+        if (r < 0) {
+            fprintf(stderr, "frame too large for the ring\n");
+            _exit(1);
+        }
+
+        if (r == 0) {
+            kis_shmring_wait_space(ring, 100);
+            continue;
+        }
+
+        make_frame(frame, seq++);
+        memcpy(buf, frame, frame_sz);
+
+        kis_shmring_commit(ring);
+    }
+
+    kis_shmring_wait_drain(ring, 5000);
+
+    _exit(0);
+}
+
+static unsigned int shm_consumer(kis_shmring_t *ring) {
+    uint8_t *framebuf = (uint8_t *) malloc(frame_sz);
+    unsigned int seq = 0;
+    const uint8_t *data;
+    size_t len;
+    struct pollfd pfd;
+    int r;
+
+    while (seq < num_frames) {
+        r = kis_shmring_peek(ring, &data, &len);
+
+        if (r < 0) {
+            fprintf(stderr, "shm: ring corrupt at frame %u\n", seq);
+            break;
+        }
+
+        if (r == 0) {
+            if (kis_shmring_consumer_sleep(ring) != 0)
+                continue;
+
+            pfd.fd = ring->data_efd;
+            pfd.events = POLLIN;
+
+            if (poll(&pfd, 1, 1000) <= 0) {
+                fprintf(stderr, "shm: timed out waiting for frame %u\n", seq);
+                break;
+            }
+
+            kis_shmring_consumer_wake(ring);
+            continue;
+        }
+
+        memcpy(framebuf, data, len);
+
+        if (len != frame_sz || !check_frame(framebuf, seq)) {
+            fprintf(stderr, "shm: frame %u out of sequence\n", seq);
+            break;
+        }
+
+        kis_shmring_consume(ring);
+
+        seq++;
+    }
+
+    return seq;
+}
+
+static void report(const char *name, unsigned int frames, struct timeval *start,
+        struct timeval *end, struct rusage *ru_start, struct rusage *ru_end,
+        struct rusage *ru_child) {
+    double wall = tv_sec(end) - tv_sec(start);
+    double cpu =
+        (tv_sec(&(ru_end->ru_utime)) - tv_sec(&(ru_start->ru_utime))) +
+        (tv_sec(&(ru_end->ru_stime)) - tv_sec(&(ru_start->ru_stime))) +
+        tv_sec(&(ru_child->ru_utime)) + tv_sec(&(ru_child->ru_stime));
+
+    printf("%-6s %10u frames  %12.0f frames/sec  %8.3f usec cpu/frame  "
+            "(%lu csw)\n",
+            name, frames, frames / wall, (cpu * 1000000.0) / frames,
+            (ru_end->ru_nvcsw - ru_start->ru_nvcsw) + ru_child->ru_nvcsw);
+}
+
+int main(int argc, char *argv[]) {
+    struct timeval start, end;
+    struct rusage ru_start, ru_end, ru_child;
+    unsigned int frames;
+    int pipefd[2];
+    pid_t pid;
+    int status;
+    int c;
+    kis_shmring_t *ring;
+
+    while ((c = getopt(argc, argv, "n:s:r:")) != -1) {
+        if (c == 'n')
+            num_frames = strtoul(optarg, NULL, 10);
+        else if (c == 's')
+            frame_sz = strtoul(optarg, NULL, 10);
+        else if (c == 'r')
+            ring_kb = strtoul(optarg, NULL, 10);
+        else {
+            fprintf(stderr, "usage: %s [-n frames] [-s frame size] [-r ring KB]\n",
+                    argv[0]);
+            exit(1);
+        }
+    }
+
+    if (frame_sz < 8)
+        frame_sz = 8;
+
+    printf("%u frames of %u bytes, %uKB ring\n", num_frames, frame_sz, ring_kb);
+    fflush(stdout);
+
+    /* Pipe */
+    if (pipe(pipefd) < 0) {
+        perror("pipe");
+        exit(1);
+    }
+
+    getrusage(RUSAGE_SELF, &ru_start);
+    gettimeofday(&start, NULL);
+
+    if ((pid = fork()) == 0) {
+        close(pipefd[0]);
+        pipe_producer(pipefd[1]);
+    }
+
+    close(pipefd[1]);
+
+    frames = pipe_consumer(pipefd[0]);
+
+    gettimeofday(&end, NULL);
+    waitpid(pid, &status, 0);
+    getrusage(RUSAGE_SELF, &ru_end);
+    getrusage(RUSAGE_CHILDREN, &ru_child);
+
+    close(pipefd[0]);
+
+    report("pipe", frames, &start, &end, &ru_start, &ru_end, &ru_child);
+    fflush(stdout);
+
+    /* Shared memory ring; children's usage is cumulative, so subtract the
+     * pipe producer */
+    struct rusage ru_pipe_child = ru_child;
+
+    if ((ring = kis_shmring_create(ring_kb * 1024)) == NULL) {
+        perror("kis_shmring_create");
+        exit(1);
+    }
+
+    getrusage(RUSAGE_SELF, &ru_start);
+    gettimeofday(&start, NULL);
+
+    if ((pid = fork()) == 0) {
+        shm_producer(ring);
+    }
+
+    frames = shm_consumer(ring);
+
+    gettimeofday(&end, NULL);
+    waitpid(pid, &status, 0);
+    getrusage(RUSAGE_SELF, &ru_end);
+    getrusage(RUSAGE_CHILDREN, &ru_child);
+
+    ru_child.ru_utime.tv_sec -= ru_pipe_child.ru_utime.tv_sec;
+    ru_child.ru_utime.tv_usec -= ru_pipe_child.ru_utime.tv_usec;
+    ru_child.ru_stime.tv_sec -= ru_pipe_child.ru_stime.tv_sec;
+    ru_child.ru_stime.tv_usec -= ru_pipe_child.ru_stime.tv_usec;
+    ru_child.ru_nvcsw -= ru_pipe_child.ru_nvcsw;
+
+    report("shm", frames, &start, &end, &ru_start, &ru_end, &ru_child);
+
+    kis_shmring_free(ring);
+
+    return 0;
+}
+
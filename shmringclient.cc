@@ -0,0 +1,125 @@
+/*
+    This file is part of Kismet
+
+    Kismet is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kismet is distributed in the hope that it will be useful,
+      but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Kismet; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "config.h"
+
+#include <unistd.h>
+
+#include "shmringclient.h"
+
+// Frames to read before returning to the main loop, so that a helper which
+// never lets the ring go empty doesn't starve everything else
+#define SHMRING_POLL_BUDGET     1024
+
+ShmRingClient::ShmRingClient(GlobalRegistry *in_globalreg, 
+        shared_ptr<BufferHandlerGeneric> in_rbhandler,
+        std::function<void (const uint8_t *, size_t)> in_cb) {
+    globalreg = in_globalreg;
+    handler = in_rbhandler;
+    frame_cb = in_cb;
+
+    ring = NULL;
+}
+
+ShmRingClient::~ShmRingClient() {
+    local_eol_locker lock(&ring_lock);
+
+    CloseRing();
+
+    handler.reset();
+}
+
+void ShmRingClient::OpenRing(kis_shmring_t *in_ring) {
+    local_locker lock(&ring_lock);
+
+    CloseRing();
+
+    ring = in_ring;
+}
+
+void ShmRingClient::CloseRing() {
+    local_locker lock(&ring_lock);
+
+    if (ring != NULL)
+        kis_shmring_free(ring);
+
+    ring = NULL;
+}
+
+int ShmRingClient::MergeSet(int in_max_fd, fd_set *out_rset, fd_set *out_wset) {
+    local_locker lock(&ring_lock);
+
+    if (ring == NULL)
+        return in_max_fd;
+
+    FD_SET(ring->data_efd, out_rset);
+
+    if (ring->data_efd > in_max_fd)
+        return ring->data_efd;
+
+    return in_max_fd;
+}
+
+int ShmRingClient::Poll(fd_set& in_rset, fd_set& in_wset) {
+    local_locker lock(&ring_lock);
+
+    const uint8_t *data;
+    size_t len;
+    int r;
+
+    if (ring == NULL || !FD_ISSET(ring->data_efd, &in_rset))
+        return 0;
+
+    kis_shmring_consumer_wake(ring);
+
+    for (unsigned int n = 0; n < SHMRING_POLL_BUDGET; n++) {
+        r = kis_shmring_peek(ring, &data, &len);
+
+        if (r < 0) {
+            CloseRing();
+            handler->BufferError("Shared memory ring corrupt, closing");
+            return 0;
+        }
+
+        if (r == 0) {
+            // Only sleep once the ring is still empty after flagging it
+            if (kis_shmring_consumer_sleep(ring) == 0)
+                return 0;
+
+            continue;
+        }
+
+        frame_cb(data, len);
+
+        // The callback can shut down the source
+        if (ring == NULL)
+            return 0;
+
+        kis_shmring_consume(ring);
+    }
+
+    // Out of budget with frames still waiting; ring our own doorbell so the
+    // next pass of the main loop comes straight back
+    uint64_t one = 1;
+
+    if (write(ring->data_efd, &one, sizeof(uint64_t)) < 0)
+        return 0;
+
+    return 0;
+}
+
@@ -0,0 +1,67 @@
+/*
+    This file is part of Kismet
+
+    Kismet is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Kismet is distributed in the hope that it will be useful,
+      but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Kismet; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef __SHMRINGCLIENT_H__
+#define __SHMRINGCLIENT_H__
+
+#include "config.h"
+
+#include <functional>
+
+#include "kis_mutex.h"
+#include "globalregistry.h"
+#include "buffer_handler.h"
+#include "pollable.h"
+#include "kis_shmring.h"
+
+// Shared memory ring client for receiving frames from a local capture helper
+//
+// Reads complete frames out of a kis_shmring written by the helper and hands
+// each one, in place, to a callback; the frame is only valid for the duration
+// of the callback.  The pipe to the helper is still handled by a PipeClient;
+// only the frames the helper chooses to send over the ring arrive here.
+//
+// Errors are pushed to the same buffer handler as the pipe, so that a corrupt
+// ring shuts down the helper the same way a protocol error on the pipe does.
+class ShmRingClient : public Pollable {
+public:
+    ShmRingClient(GlobalRegistry *in_globalreg, shared_ptr<BufferHandlerGeneric> in_rbhandler,
+            std::function<void (const uint8_t *, size_t)> in_cb);
+    virtual ~ShmRingClient();
+
+    // Take ownership of a ring
+    void OpenRing(kis_shmring_t *in_ring);
+    void CloseRing();
+
+    // Pollable interface
+    virtual int MergeSet(int in_max_fd, fd_set *out_rset, fd_set *out_wset);
+    virtual int Poll(fd_set& in_rset, fd_set& in_wset);
+
+protected:
+    kis_recursive_timed_mutex ring_lock;
+
+    GlobalRegistry *globalreg;
+    shared_ptr<BufferHandlerGeneric> handler;
+
+    std::function<void (const uint8_t *, size_t)> frame_cb;
+
+    kis_shmring_t *ring;
+};
+
+#endif
+
@@ -22,6 +22,7 @@
 #include <arpa/inet.h>
 
 #include "simple_datasource_proto.h"
+#include "kis_checksum.h"
 
 // Use alternate simpler msgpack library, msgpuck
 #include "msgpuck.h"
@@ -30,34 +31,38 @@
 
 uint32_t adler32_partial_csum(uint8_t *in_buf, size_t in_len,
         uint32_t *s1, uint32_t *s2) {
-	size_t i;
-	uint8_t *buf = in_buf;
-	int CHAR_OFFSET = 0;
+    return kis_adler32_partial(in_buf, in_len, s1, s2);
+}
 
-    if (in_len < 4)
-        return 0;
+uint32_t adler32_csum(uint8_t *in_buf, size_t in_len) {
+    return kis_adler32(in_buf, in_len);
+}
 
-    for (i = 0; i < (in_len - 4); i += 4) {
-        *s2 += 4 * (*s1 + buf[i]) + 3 * buf[i + 1] + 2 * buf[i+2] + buf[i + 3] + 
-            10 * CHAR_OFFSET;
-        *s1 += (buf[i + 0] + buf[i + 1] + buf[i + 2] + buf[i + 3] + 4 * CHAR_OFFSET); 
-	}
+int simple_cap_proto_csum_type(uint32_t in_signature) {
+    if (in_signature == KIS_CAP_SIMPLE_PROTO_SIG)
+        return KIS_CAP_CSUM_ADLER32;
 
-    for (; i < in_len; i++) {
-        *s1 += (buf[i] + CHAR_OFFSET); 
-        *s2 += *s1;
-	}
+    if (in_signature == KIS_CAP_SIMPLE_PROTO_SIG_CRC32C)
+        return KIS_CAP_CSUM_CRC32C;
 
-	return (*s1 & 0xffff) + (*s2 << 16);
+    return -1;
 }
 
-uint32_t adler32_csum(uint8_t *in_buf, size_t in_len) {
-    uint32_t s1, s2;
+uint32_t simple_cap_proto_signature(int in_csum_type) {
+    if (in_csum_type == KIS_CAP_CSUM_CRC32C)
+        return KIS_CAP_SIMPLE_PROTO_SIG_CRC32C;
 
-    s1 = 0;
-    s2 = 0;
+    return KIS_CAP_SIMPLE_PROTO_SIG;
+}
 
-    return adler32_partial_csum(in_buf, in_len, &s1, &s2);
+uint32_t simple_cap_proto_partial_csum(int in_csum_type, uint8_t *in_buf, size_t in_len,
+        uint32_t *s1, uint32_t *s2) {
+    if (in_csum_type == KIS_CAP_CSUM_CRC32C) {
+        *s1 = kis_crc32c_partial(*s1, in_buf, in_len);
+        return *s1;
+    }
+
+    return kis_adler32_partial(in_buf, in_len, s1, s2);
 }
 
 simple_cap_proto_kv_t *encode_simple_cap_proto_kv(const char *in_key, uint8_t *in_obj,
@@ -121,6 +126,13 @@ simple_cap_proto_frame_t *encode_simple_cap_proto(const char *in_type, uint32_t
 simple_cap_proto_t *encode_simple_cap_proto_hdr(size_t *ret_sz, 
         const char *in_type, uint32_t in_seqno,
         simple_cap_proto_kv_t **in_kv_list, unsigned int in_kv_len) {
+    return encode_simple_cap_proto_hdr_csum(ret_sz, KIS_CAP_CSUM_ADLER32,
+            in_type, in_seqno, in_kv_list, in_kv_len);
+}
+
+simple_cap_proto_t *encode_simple_cap_proto_hdr_csum(size_t *ret_sz, 
+        int in_csum_type, const char *in_type, uint32_t in_seqno,
+        simple_cap_proto_kv_t **in_kv_list, unsigned int in_kv_len) {
     simple_cap_proto_t *cp;
     simple_cap_proto_kv_t *kv;
     unsigned int x;
@@ -142,7 +154,7 @@ simple_cap_proto_t *encode_simple_cap_proto_hdr(size_t *ret_sz,
     if (cp == NULL)
         return NULL;
 
-    cp->signature = htonl(KIS_CAP_SIMPLE_PROTO_SIG);
+    cp->signature = htonl(simple_cap_proto_signature(in_csum_type));
     cp->header_checksum = 0;
     cp->data_checksum = 0;
     cp->sequence_number = htonl(in_seqno);
@@ -152,13 +164,13 @@ simple_cap_proto_t *encode_simple_cap_proto_hdr(size_t *ret_sz,
 
     /* calculate the incremental checksum; first we calc the header and save
      * it as the header-only cssum */
-    hcsum = adler32_partial_csum((uint8_t *) cp, 
+    hcsum = simple_cap_proto_partial_csum(in_csum_type, (uint8_t *) cp, 
             sizeof(simple_cap_proto_t), &csum_s1, &csum_s2);
 
     /* Then add the checksum of the KVs */
     for (x = 0; x < in_kv_len; x++) {
         kv = in_kv_list[x];
-        dcsum = adler32_partial_csum((uint8_t *) kv, 
+        dcsum = simple_cap_proto_partial_csum(in_csum_type, (uint8_t *) kv, 
                 sizeof(simple_cap_proto_kv_t) + ntohl(kv->header.obj_sz), 
                 &csum_s1, &csum_s2);
     } 
@@ -176,6 +188,38 @@ simple_cap_proto_t *encode_simple_cap_proto_hdr(size_t *ret_sz,
     return cp;
 }
 
+void encode_simple_cap_proto_hdr_inplace(simple_cap_proto_t *in_hdr, size_t in_sz,
+        int in_csum_type, const char *in_type, uint32_t in_seqno,
+        unsigned int in_kv_len) {
+    uint32_t hcsum, dcsum;
+    uint32_t csum_s1 = 0;
+    uint32_t csum_s2 = 0;
+
+    in_hdr->signature = htonl(simple_cap_proto_signature(in_csum_type));
+    in_hdr->header_checksum = 0;
+    in_hdr->data_checksum = 0;
+    in_hdr->sequence_number = htonl(in_seqno);
+    memset(in_hdr->type, 0, 16);
+    snprintf(in_hdr->type, 16, "%.16s", in_type);
+    in_hdr->packet_sz = htonl((uint32_t) in_sz);
+    in_hdr->num_kv_pairs = htonl(in_kv_len);
+
+    /* Header checksum, then continue it over the KVs which follow */
+    hcsum = simple_cap_proto_partial_csum(in_csum_type, (uint8_t *) in_hdr, 
+            sizeof(simple_cap_proto_t), &csum_s1, &csum_s2);
+
+    if (in_kv_len == 0) {
+        dcsum = hcsum;
+    } else {
+        dcsum = simple_cap_proto_partial_csum(in_csum_type, 
+                (uint8_t *) in_hdr + sizeof(simple_cap_proto_t),
+                in_sz - sizeof(simple_cap_proto_t), &csum_s1, &csum_s2);
+    }
+
+    in_hdr->header_checksum = htonl(hcsum);
+    in_hdr->data_checksum = htonl(dcsum);
+}
+
 simple_cap_proto_kv_t *encode_kv_success(unsigned int success, uint32_t sequence) {
     simple_cap_proto_kv_t *kv;
 
@@ -269,55 +313,189 @@ simple_cap_proto_kv_t *encode_kv_capif(const char *capif) {
     return kv;
 }
 
-simple_cap_proto_kv_t *encode_kv_capdata(struct timeval in_ts, 
+/* Keys of the PACKET KV map */
+static const char *capdata_key_tv_sec = "tv_sec";
+static const char *capdata_key_tv_usec = "tv_usec";
+static const char *capdata_key_pack_sz = "size";
+static const char *capdata_key_packet = "packet";
+
+size_t encode_kv_capdata_size(struct timeval in_ts, uint32_t in_pack_sz) {
+    return sizeof(simple_cap_proto_kv_t) +
+        mp_sizeof_map(4) +
+        mp_sizeof_str(strlen(capdata_key_tv_sec)) + mp_sizeof_uint(in_ts.tv_sec) +
+        mp_sizeof_str(strlen(capdata_key_tv_usec)) + mp_sizeof_uint(in_ts.tv_usec) +
+        mp_sizeof_str(strlen(capdata_key_pack_sz)) + mp_sizeof_uint(in_pack_sz) +
+        mp_sizeof_str(strlen(capdata_key_packet)) + mp_sizeof_bin(in_pack_sz);
+}
+
+size_t encode_kv_capdata_inplace(uint8_t *ret_buf, struct timeval in_ts, 
         uint32_t in_pack_sz, uint8_t *in_pack) {
+    simple_cap_proto_kv_t *kv = (simple_cap_proto_kv_t *) ret_buf;
+    char *start = (char *) kv->object;
+    char *pos = start;
 
-    const char *key_tv_sec = "tv_sec";
-    const char *key_tv_usec = "tv_usec";
-    const char *key_pack_sz = "size";
-    const char *key_packet = "packet";
+    pos = mp_encode_map(pos, 4);
 
-    msgpuck_buffer_t *puckbuffer;
+    pos = mp_encode_str(pos, capdata_key_tv_sec, strlen(capdata_key_tv_sec));
+    pos = mp_encode_uint(pos, in_ts.tv_sec);
+
+    pos = mp_encode_str(pos, capdata_key_tv_usec, strlen(capdata_key_tv_usec));
+    pos = mp_encode_uint(pos, in_ts.tv_usec);
+
+    pos = mp_encode_str(pos, capdata_key_pack_sz, strlen(capdata_key_pack_sz));
+    pos = mp_encode_uint(pos, in_pack_sz);
 
+    pos = mp_encode_str(pos, capdata_key_packet, strlen(capdata_key_packet));
+    pos = mp_encode_bin(pos, (const char *) in_pack, in_pack_sz);
+
+    memset(kv->header.key, 0, 16);
+    snprintf(kv->header.key, 16, "%.16s", "PACKET");
+    kv->header.obj_sz = htonl(pos - start);
+
+    return sizeof(simple_cap_proto_kv_t) + (pos - start);
+}
+
+simple_cap_proto_kv_t *encode_kv_capdata(struct timeval in_ts, 
+        uint32_t in_pack_sz, uint8_t *in_pack) {
     simple_cap_proto_kv_t *kv;
-    size_t content_sz;
 
-    // Allocate a fairly generous headroom in our buffer
-    puckbuffer = mp_b_create_buffer(in_pack_sz + 256);
+    /* Size it exactly and encode it directly, rather than going through a
+     * msgpuck buffer and copying */
+    kv = (simple_cap_proto_kv_t *) malloc(encode_kv_capdata_size(in_ts, in_pack_sz));
 
-    if (puckbuffer == NULL) {
+    if (kv == NULL)
         return NULL;
+
+    encode_kv_capdata_inplace((uint8_t *) kv, in_ts, in_pack_sz, in_pack);
+
+    return kv;
+}
+
+static uint64_t batch_hton64(uint64_t in_val) {
+    uint8_t be[8];
+    uint64_t ret;
+    unsigned int i;
+
+    for (i = 0; i < 8; i++)
+        be[i] = (in_val >> (56 - (i * 8))) & 0xFF;
+
+    memcpy(&ret, be, 8);
+
+    return ret;
+}
+
+uint32_t encode_batch_signal(simple_cap_proto_batch_signal_t *ret_signal,
+        int32_t signal_dbm, uint32_t signal_rssi, int32_t noise_dbm, uint32_t noise_rssi, 
+        double freq_khz, double datarate) {
+    uint32_t flags = 0;
+
+    memset(ret_signal, 0, sizeof(simple_cap_proto_batch_signal_t));
+
+    if (signal_dbm != 0) {
+        ret_signal->signal_dbm = htonl(signal_dbm);
+        flags |= KIS_CAP_BATCH_SIGNAL_DBM;
     }
 
-    mp_b_encode_map(puckbuffer, 4);
+    if (noise_dbm != 0) {
+        ret_signal->noise_dbm = htonl(noise_dbm);
+        flags |= KIS_CAP_BATCH_NOISE_DBM;
+    }
 
-    mp_b_encode_str(puckbuffer, key_tv_sec, strlen(key_tv_sec));
-    mp_b_encode_uint(puckbuffer, in_ts.tv_sec);
+    if (signal_rssi != 0) {
+        ret_signal->signal_rssi = htonl(signal_rssi);
+        flags |= KIS_CAP_BATCH_SIGNAL_RSSI;
+    }
 
-    mp_b_encode_str(puckbuffer, key_tv_usec, strlen(key_tv_usec));
-    mp_b_encode_uint(puckbuffer, in_ts.tv_usec);
+    if (noise_rssi != 0) {
+        ret_signal->noise_rssi = htonl(noise_rssi);
+        flags |= KIS_CAP_BATCH_NOISE_RSSI;
+    }
 
-    mp_b_encode_str(puckbuffer, key_pack_sz, strlen(key_pack_sz));
-    mp_b_encode_uint(puckbuffer, in_pack_sz);
+    if (freq_khz != 0.0f) {
+        ret_signal->freq_khz = htonl((uint32_t) freq_khz);
+        flags |= KIS_CAP_BATCH_FREQ;
+    }
 
-    mp_b_encode_str(puckbuffer, key_packet, strlen(key_packet));
-    mp_b_encode_bin(puckbuffer, (const char *) in_pack, in_pack_sz);
+    if (datarate != 0.0f) {
+        ret_signal->datarate = htonl((uint32_t) (datarate * 1000));
+        flags |= KIS_CAP_BATCH_DATARATE;
+    }
 
-    content_sz = mp_b_used_buffer(puckbuffer);
+    return flags;
+}
 
-    kv = (simple_cap_proto_kv_t *) malloc(sizeof(simple_cap_proto_kv_t) + content_sz);
+void encode_batch_gps(simple_cap_proto_batch_gps_t *ret_gps,
+        double in_lat, double in_lon, double in_alt, double in_speed, double in_heading,
+        double in_precision, int in_fix, time_t in_time) {
+    ret_gps->lat = htonl((int32_t) (in_lat * 10000000));
+    ret_gps->lon = htonl((int32_t) (in_lon * 10000000));
+    ret_gps->alt = htonl((int32_t) (in_alt * 1000));
+    ret_gps->speed = htonl((uint32_t) (in_speed * 1000));
+    ret_gps->heading = htonl((uint32_t) (in_heading * 1000));
+    ret_gps->precision = htonl((uint32_t) (in_precision * 1000));
+    ret_gps->fix = htonl(in_fix);
+    ret_gps->time = batch_hton64((uint64_t) in_time);
+}
 
-    if (kv == NULL)
-        return NULL;
+size_t batch_packet_record_size(int in_signal, int in_gps, uint32_t in_pack_sz) {
+    size_t sz = sizeof(simple_cap_proto_batch_pkt_t) + in_pack_sz;
 
-    snprintf(kv->header.key, 16, "%.16s", "PACKET");
-    kv->header.obj_sz = htonl(content_sz);
+    if (in_signal)
+        sz += sizeof(simple_cap_proto_batch_signal_t);
 
-    memcpy(kv->object, mp_b_get_buffer(puckbuffer), content_sz);
+    if (in_gps)
+        sz += sizeof(simple_cap_proto_batch_gps_t);
 
-    mp_b_free_buffer(puckbuffer);
+    return (sz + 3) & ~((size_t) 3);
+}
 
-    return kv;
+size_t encode_batch_packet(uint8_t *in_buf, size_t in_buf_sz, struct timeval in_ts,
+        uint32_t in_signal_flags, simple_cap_proto_batch_signal_t *in_signal,
+        simple_cap_proto_batch_gps_t *in_gps, uint32_t in_pack_sz, const uint8_t *in_pack) {
+    simple_cap_proto_batch_pkt_t *rec;
+    uint32_t flags = 0;
+    size_t record_sz, offt;
+
+    if (in_signal != NULL && (in_signal_flags & KIS_CAP_BATCH_SIGNAL_MASK) != 0)
+        flags |= (in_signal_flags & KIS_CAP_BATCH_SIGNAL_MASK);
+
+    if (in_gps != NULL)
+        flags |= KIS_CAP_BATCH_GPS;
+
+    record_sz = batch_packet_record_size(flags & KIS_CAP_BATCH_SIGNAL_MASK,
+            flags & KIS_CAP_BATCH_GPS, in_pack_sz);
+
+    if (record_sz > in_buf_sz)
+        return 0;
+
+    rec = (simple_cap_proto_batch_pkt_t *) in_buf;
+
+    rec->record_sz = htonl(record_sz);
+    rec->flags = htonl(flags);
+    rec->tv_sec = batch_hton64((uint64_t) in_ts.tv_sec);
+    rec->tv_usec = htonl(in_ts.tv_usec);
+    rec->caplen = htonl(in_pack_sz);
+
+    offt = sizeof(simple_cap_proto_batch_pkt_t);
+
+    if (flags & KIS_CAP_BATCH_SIGNAL_MASK) {
+        memcpy(in_buf + offt, in_signal, sizeof(simple_cap_proto_batch_signal_t));
+        offt += sizeof(simple_cap_proto_batch_signal_t);
+    }
+
+    if (flags & KIS_CAP_BATCH_GPS) {
+        memcpy(in_buf + offt, in_gps, sizeof(simple_cap_proto_batch_gps_t));
+        offt += sizeof(simple_cap_proto_batch_gps_t);
+    }
+
+    memcpy(in_buf + offt, in_pack, in_pack_sz);
+    offt += in_pack_sz;
+
+    /* Zero the padding so the frame checksum is stable */
+    if (offt < record_sz)
+        memset(in_buf + offt, 0, record_sz - offt);
+
+    return record_sz;
 }
 
 simple_cap_proto_kv_t *encode_kv_gps(double in_lat, double in_lon, double in_alt,
@@ -878,6 +1056,101 @@ simple_cap_proto_kv_t *encode_kv_specset(uint64_t start_mhz, uint64_t end_mhz,
 
 }
 
+simple_cap_proto_kv_t *encode_kv_capstats(uint64_t drops) {
+
+    const char *key_drops = "drops";
+
+    msgpuck_buffer_t *puckbuffer;
+
+    simple_cap_proto_kv_t *kv;
+    size_t content_sz;
+
+    size_t initial_sz = 64;
+
+    puckbuffer = mp_b_create_buffer(initial_sz);
+
+    if (puckbuffer == NULL) {
+        return NULL;
+    }
+
+    mp_b_encode_map(puckbuffer, 1);
+
+    mp_b_encode_str(puckbuffer, key_drops, strlen(key_drops));
+    mp_b_encode_uint(puckbuffer, drops);
+
+    content_sz = mp_b_used_buffer(puckbuffer);
+
+    kv = (simple_cap_proto_kv_t *) malloc(sizeof(simple_cap_proto_kv_t) + content_sz);
+
+    if (kv == NULL) {
+        mp_b_free_buffer(puckbuffer);
+        return NULL;
+    }
+
+    snprintf(kv->header.key, 16, "%.16s", "CAPSTATS");
+    kv->header.obj_sz = htonl(content_sz);
+
+    memcpy(kv->object, mp_b_get_buffer(puckbuffer), content_sz);
+
+    mp_b_free_buffer(puckbuffer);
+
+    return kv;
+}
+
+simple_cap_proto_kv_t *encode_kv_capstats_hop(uint64_t hops, uint64_t tune_usec,
+        uint64_t tune_max_usec, uint64_t late_usec) {
+
+    const char *key_hops = "hops";
+    const char *key_tune = "hop_tune_usec";
+    const char *key_tune_max = "hop_tune_max_usec";
+    const char *key_late = "hop_late_usec";
+
+    msgpuck_buffer_t *puckbuffer;
+
+    simple_cap_proto_kv_t *kv;
+    size_t content_sz;
+
+    size_t initial_sz = 128;
+
+    puckbuffer = mp_b_create_buffer(initial_sz);
+
+    if (puckbuffer == NULL) {
+        return NULL;
+    }
+
+    mp_b_encode_map(puckbuffer, 4);
+
+    mp_b_encode_str(puckbuffer, key_hops, strlen(key_hops));
+    mp_b_encode_uint(puckbuffer, hops);
+
+    mp_b_encode_str(puckbuffer, key_tune, strlen(key_tune));
+    mp_b_encode_uint(puckbuffer, tune_usec);
+
+    mp_b_encode_str(puckbuffer, key_tune_max, strlen(key_tune_max));
+    mp_b_encode_uint(puckbuffer, tune_max_usec);
+
+    mp_b_encode_str(puckbuffer, key_late, strlen(key_late));
+    mp_b_encode_uint(puckbuffer, late_usec);
+
+    content_sz = mp_b_used_buffer(puckbuffer);
+
+    kv = (simple_cap_proto_kv_t *) malloc(sizeof(simple_cap_proto_kv_t) + content_sz);
+
+    if (kv == NULL) {
+        mp_b_free_buffer(puckbuffer);
+        return NULL;
+    }
+
+    snprintf(kv->header.key, 16, "%.16s", "CAPSTATS");
+    kv->header.obj_sz = htonl(content_sz);
+
+    memcpy(kv->object, mp_b_get_buffer(puckbuffer), content_sz);
+
+    mp_b_free_buffer(puckbuffer);
+
+    return kv;
+}
+
 simple_cap_proto_kv_t *encode_kv_message(const char *message, unsigned int flags) {
 
     const char *key_message = "msg";
@@ -926,13 +1199,20 @@ int validate_simple_cap_proto_header(simple_cap_proto_t *in_packet) {
     uint32_t original_hcsum = ntohl(in_packet->header_checksum);
     uint32_t original_dcsum = ntohl(in_packet->data_checksum);
     uint32_t calc_csum;
+    uint32_t csum_s1 = 0, csum_s2 = 0;
+
+    int csum_type = simple_cap_proto_csum_type(ntohl(in_packet->signature));
+
+    if (csum_type < 0)
+        return -1;
 
     /* Zero csum field in packet */
     in_packet->header_checksum = 0;
     in_packet->data_checksum = 0;
 
     /* Checksum the header only */
-    calc_csum = adler32_csum((uint8_t *) in_packet, sizeof(simple_cap_proto_t));
+    calc_csum = simple_cap_proto_partial_csum(csum_type, (uint8_t *) in_packet, 
+            sizeof(simple_cap_proto_t), &csum_s1, &csum_s2);
 
     if (original_hcsum != calc_csum)
         return -1;
@@ -956,19 +1236,30 @@ int validate_simple_cap_proto(simple_cap_proto_t *in_packet) {
     size_t kv_pos;
     simple_cap_proto_kv_t *kv;
 
+    uint32_t csum_s1 = 0, csum_s2 = 0;
+    int csum_type = simple_cap_proto_csum_type(ntohl(in_packet->signature));
+
+    if (csum_type < 0)
+        return -1;
+
     /* Zero csum field in packet */
     in_packet->header_checksum = 0;
     in_packet->data_checksum = 0;
 
     /* Checksum the contents */
-    calc_csum = adler32_csum((uint8_t *) in_packet, sizeof(simple_cap_proto_t));
+    calc_csum = simple_cap_proto_partial_csum(csum_type, (uint8_t *) in_packet, 
+            sizeof(simple_cap_proto_t), &csum_s1, &csum_s2);
 
     if (original_hcsum != calc_csum) {
         fprintf(stderr, "debug - hcsum didn't match\n");
         return -1;
     }
 
-    calc_csum = adler32_csum((uint8_t *) in_packet, ntohl(in_packet->packet_sz));
+    csum_s1 = 0;
+    csum_s2 = 0;
+
+    calc_csum = simple_cap_proto_partial_csum(csum_type, (uint8_t *) in_packet, 
+            ntohl(in_packet->packet_sz), &csum_s1, &csum_s2);
 
     if (original_dcsum != calc_csum) {
         fprintf(stderr, "debug - dcsum didn't match\n");
@@ -45,6 +45,114 @@
 
 #define KIS_CAP_SIMPLE_PROTO_SIG    0xDECAFBAD
 
+/* Frames with this signature use CRC32C instead of adler32 for the header and
+ * data checksums.
+ *
+ * Receivers accept either signature at any time.  A sender only switches to
+ * CRC32C once the other side has shown it understands it, either by offering it
+ * in a CHECKSUM KV or by sending a CRC32C frame, so older peers never see a
+ * CRC32C frame.
+ */
+#define KIS_CAP_SIMPLE_PROTO_SIG_CRC32C     0xDECAFBAE
+
+/* Checksum types, selected by the frame signature */
+#define KIS_CAP_CSUM_ADLER32    0
+#define KIS_CAP_CSUM_CRC32C     1
+
+/* CHECKSUM KV content offering CRC32C */
+#define KIS_CAP_CSUM_CRC32C_NAME    "crc32c"
+
+/* Batched packet data
+ *
+ * A DATABATCH frame carries many captured packets in a single PACKETS KV,
+ * instead of one DATA frame per packet.  The PACKETS KV is not msgpack; it is
+ * a sequence of simple_cap_proto_batch_pkt records, each followed by the
+ * optional blocks its flags announce (signal, then GPS), the packet itself,
+ * and padding to a 4 byte boundary.
+ *
+ * Batches are only sent once the server has offered them with a DATABATCH KV,
+ * so older servers only ever see DATA frames.  Sources which need anything
+ * the compact record can't carry (a channel name, messages) keep using DATA.
+ */
+#define KIS_CAP_BATCH_VERSION       1
+
+/* Record flags */
+#define KIS_CAP_BATCH_SIGNAL_DBM    (1 << 0)
+#define KIS_CAP_BATCH_NOISE_DBM     (1 << 1)
+#define KIS_CAP_BATCH_SIGNAL_RSSI   (1 << 2)
+#define KIS_CAP_BATCH_NOISE_RSSI    (1 << 3)
+#define KIS_CAP_BATCH_FREQ          (1 << 4)
+#define KIS_CAP_BATCH_DATARATE      (1 << 5)
+#define KIS_CAP_BATCH_GPS           (1 << 6)
+
+/* Any of these flags means the record has a signal block */
+#define KIS_CAP_BATCH_SIGNAL_MASK   0x3F
+
+struct simple_cap_proto_batch_pkt {
+    /* Size of the record, including this header, the optional blocks, the 
+     * packet, and the padding */
+    uint32_t record_sz;
+    uint32_t flags;
+    uint64_t tv_sec;
+    uint32_t tv_usec;
+    /* Size of the packet data */
+    uint32_t caplen;
+    uint8_t data[0];
+} __attribute__((packed));
+typedef struct simple_cap_proto_batch_pkt simple_cap_proto_batch_pkt_t;
+
+/* Signal block; fields are only valid when their flag is set */
+struct simple_cap_proto_batch_signal {
+    int32_t signal_dbm;
+    int32_t noise_dbm;
+    int32_t signal_rssi;
+    int32_t noise_rssi;
+    uint32_t freq_khz;
+    /* Data rate * 1000 */
+    uint32_t datarate;
+} __attribute__((packed));
+typedef struct simple_cap_proto_batch_signal simple_cap_proto_batch_signal_t;
+
+/* GPS block, in fixed point */
+struct simple_cap_proto_batch_gps {
+    /* Degrees * 10^7 */
+    int32_t lat;
+    int32_t lon;
+    /* Altitude, speed, heading, and precision * 1000 */
+    int32_t alt;
+    uint32_t speed;
+    uint32_t heading;
+    uint32_t precision;
+    int32_t fix;
+    uint64_t time;
+} __attribute__((packed));
+typedef struct simple_cap_proto_batch_gps simple_cap_proto_batch_gps_t;
+
+/* Compressed packet batches
+ *
+ * Kismet may offer a remote datasource zlib compression of its batches with a
+ * COMPRESS KV.  A datasource which takes the offer sends the content of each
+ * batch deflated, in a ZPACKETS KV instead of a PACKETS KV.
+ *
+ * Every batch on a connection is deflated on the same zlib stream and ended 
+ * with a sync flush, so each batch compresses against the ones before it; 
+ * batches must be inflated in the order they were sent, and the stream starts
+ * over with each connection.
+ */
+#define KIS_CAP_COMPRESS_ZLIB_NAME  "zlib"
+
+struct simple_cap_proto_zbatch {
+    /* Size of the batch records once inflated */
+    uint32_t raw_sz;
+    /* How long the first packet waited in the batch, and how long it took to
+     * deflate the batch, in microseconds */
+    uint32_t batch_usec;
+    uint32_t deflate_usec;
+    /* zlib stream data */
+    uint8_t data[0];
+} __attribute__((packed));
+typedef struct simple_cap_proto_zbatch simple_cap_proto_zbatch_t;
+
 /* Multiple key-value pairs can be nested inside a kismet proto packet. */
 
 /* Object field header */
@@ -112,6 +220,23 @@ uint32_t adler32_csum(uint8_t *in_buffer, size_t in_len);
 uint32_t adler32_partial_csum(uint8_t *in_buf, size_t in_len,
         uint32_t *s1, uint32_t *s2); 
 
+/* Checksum type for a frame signature, in host order
+ *
+ * Returns:
+ * KIS_CAP_CSUM_ADLER32 or KIS_CAP_CSUM_CRC32C
+ * -1 if the signature is not valid
+ */
+int simple_cap_proto_csum_type(uint32_t in_signature);
+
+/* Frame signature, in host order, for a checksum type */
+uint32_t simple_cap_proto_signature(int in_csum_type);
+
+/* Incremental checksum of the given type; the first call must set s1 and s2 to 0.
+ * CRC32C keeps its running state in s1.
+ */
+uint32_t simple_cap_proto_partial_csum(int in_csum_type, uint8_t *in_buf, size_t in_len,
+        uint32_t *s1, uint32_t *s2);
+
 /* Encode a KV list into a packet; DOES NOT free any supplied data, and performs a
  * memcpy of all the data into a single record.
  *
@@ -143,6 +268,25 @@ simple_cap_proto_t *encode_simple_cap_proto_hdr(size_t *ret_sz,
         const char *in_type, uint32_t in_seqno,
         simple_cap_proto_kv_t **in_kv_list, unsigned int in_kv_len);
 
+/* Encode a KV list into a packet header, as above, checksummed with the given
+ * checksum type
+ *
+ * Returns:
+ * Pointer to data
+ * NULL on failure
+ */
+simple_cap_proto_t *encode_simple_cap_proto_hdr_csum(size_t *ret_sz, 
+        int in_csum_type, const char *in_type, uint32_t in_seqno,
+        simple_cap_proto_kv_t **in_kv_list, unsigned int in_kv_len);
+
+/* Fill in the header of a frame of in_sz bytes whose in_kv_len KVs have already
+ * been written directly after the header, checksummed with the given checksum
+ * type.  Used to build a frame in place in an output buffer.
+ */
+void encode_simple_cap_proto_hdr_inplace(simple_cap_proto_t *in_hdr, size_t in_sz,
+        int in_csum_type, const char *in_type, uint32_t in_seqno,
+        unsigned int in_kv_len);
+
 /* Encode raw data into a kv pair.  Copies provided data, and DOES NOT free or
  * modify the original buffers.
  *
@@ -219,6 +363,49 @@ simple_cap_proto_kv_t *encode_kv_capif(const char *capif);
 simple_cap_proto_kv_t *encode_kv_capdata(struct timeval in_ts, 
         uint32_t in_pack_sz, uint8_t *in_pack);
 
+/* Size of the PACKET KV, including the KV header, encode_kv_capdata would 
+ * produce for a packet
+ */
+size_t encode_kv_capdata_size(struct timeval in_ts, uint32_t in_pack_sz);
+
+/* Encode a packet into a PACKET KV in a buffer of at least 
+ * encode_kv_capdata_size() bytes
+ *
+ * Returns:
+ * Size of the KV
+ */
+size_t encode_kv_capdata_inplace(uint8_t *ret_buf, struct timeval in_ts, 
+        uint32_t in_pack_sz, uint8_t *in_pack);
+
+/* Encode the signal block of a batched packet record, using the same arguments
+ * as encode_kv_signal; fields which are 0 are left out.
+ *
+ * Returns:
+ * The record flags for the signal fields which were set
+ */
+uint32_t encode_batch_signal(simple_cap_proto_batch_signal_t *ret_signal,
+        int32_t signal_dbm, uint32_t signal_rssi, int32_t noise_dbm, uint32_t noise_rssi, 
+        double freq_khz, double datarate);
+
+/* Encode the GPS block of a batched packet record */
+void encode_batch_gps(simple_cap_proto_batch_gps_t *ret_gps,
+        double in_lat, double in_lon, double in_alt, double in_speed, double in_heading,
+        double in_precision, int in_fix, time_t in_time);
+
+/* Size of a batched packet record, including padding */
+size_t batch_packet_record_size(int in_signal, int in_gps, uint32_t in_pack_sz);
+
+/* Append a packet to a batch buffer; signal and gps are optional and the
+ * flags of the signal block come from encode_batch_signal.
+ *
+ * Returns:
+ * Number of bytes written
+ * 0 if the record doesn't fit in in_buf_sz
+ */
+size_t encode_batch_packet(uint8_t *in_buf, size_t in_buf_sz, struct timeval in_ts,
+        uint32_t in_signal_flags, simple_cap_proto_batch_signal_t *in_signal,
+        simple_cap_proto_batch_gps_t *in_gps, uint32_t in_pack_sz, const uint8_t *in_pack);
+
 /* Encode a GPS KV
  *
  * This should only be needed when the GPS data is not encoded in the DLT already.
@@ -333,12 +520,32 @@ simple_cap_proto_kv_t *encode_kv_specset(uint64_t start_mhz, uint64_t end_mhz,
         uint64_t samples_per_freq, uint64_t bin_width, uint8_t amp,
         uint64_t if_amp, uint64_t baseband_amp);
 
+/* Encode a CAPSTATS KV pair with the number of packets dropped by the capture
+ * interface (such as a kernel capture ring) before the datasource could read
+ * them, since the previous report
+ *
+ * Returns:
+ * Pointer on success
+ * NULL on failure
+ */
+simple_cap_proto_kv_t *encode_kv_capstats(uint64_t drops);
+
+/* Encode a CAPSTATS KV pair with channel hop timing instead of drops
+ *
+ * Returns:
+ * Pointer on success
+ * NULL on failure
+ */
+simple_cap_proto_kv_t *encode_kv_capstats_hop(uint64_t hops, uint64_t tune_usec,
+        uint64_t tune_max_usec, uint64_t late_usec);
+
 #define MSGFLAG_NONE    0
 #define MSGFLAG_DEBUG   1
 #define MSGFLAG_INFO    2
 #define MSGFLAG_ERROR   4
 #define MSGFLAG_ALERT   8
 #define MSGFLAG_FATAL   16
+
 /* Encode a MESSAGE KV pair
  * Buffer is returned in ret_buffer, length in ret_sz
  *
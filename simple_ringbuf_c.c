@@ -19,33 +19,62 @@
 /* An extremely basic ring buffer implemented as a complete header in pure C; 
  * for use with datasource implementations in C */
 
+#include "config.h"
+
 #include <stdint.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+
+#ifdef SYS_LINUX
+#include <sys/eventfd.h>
+#endif
 
 #include "simple_ringbuf_c.h"
 
+/* No space skipped */
+#define RINGBUF_NO_SKIP     ((size_t) -1)
+
 /* Allocate a ring buffer
  *
  * Returns NULL if allocation failed
  */
 kis_simple_ringbuf_t *kis_simple_ringbuf_create(size_t size) {
     kis_simple_ringbuf_t *rb;
+    size_t rsize = 1;
 
-    rb = (kis_simple_ringbuf_t *) malloc(sizeof(kis_simple_ringbuf_t));
-
-    if (rb == NULL)
+    /* Keep the producer and consumer positions on their own cache lines */
+    if (posix_memalign((void **) &rb, 64, sizeof(kis_simple_ringbuf_t)) != 0)
         return NULL;
 
-    rb->buffer = (uint8_t *) malloc(size);
+    memset(rb, 0, sizeof(kis_simple_ringbuf_t));
 
-    if (rb->buffer == NULL)
+    while (rsize < size)
+        rsize <<= 1;
+
+    rb->buffer = (uint8_t *) malloc(rsize);
+
+    if (rb->buffer == NULL) {
+        free(rb);
         return NULL;
+    }
 
-    rb->buffer_sz = size;
-    rb->start_pos = 0;
-    rb->length = 0;
+    rb->buffer_sz = rsize;
+    rb->mask = rsize - 1;
+    rb->head = 0;
+    rb->tail = 0;
+    rb->skip_pos = RINGBUF_NO_SKIP;
+    rb->reserve_head = 0;
+    rb->reserve_skip = RINGBUF_NO_SKIP;
+    rb->full_tail = 0;
+
+    rb->data_rfd = -1;
+    rb->data_wfd = -1;
+    rb->space_rfd = -1;
+    rb->space_wfd = -1;
 
     return rb;
 }
@@ -53,27 +82,121 @@ kis_simple_ringbuf_t *kis_simple_ringbuf_create(size_t size) {
 /* Destroy a ring buffer
  */
 void kis_simple_ringbuf_free(kis_simple_ringbuf_t *ringbuf) {
+    if (ringbuf->data_rfd >= 0)
+        close(ringbuf->data_rfd);
+    if (ringbuf->data_wfd >= 0 && ringbuf->data_wfd != ringbuf->data_rfd)
+        close(ringbuf->data_wfd);
+    if (ringbuf->space_rfd >= 0)
+        close(ringbuf->space_rfd);
+    if (ringbuf->space_wfd >= 0 && ringbuf->space_wfd != ringbuf->space_rfd)
+        close(ringbuf->space_wfd);
+
     free(ringbuf->buffer);
     free(ringbuf);
 }
 
+static int kis_simple_ringbuf_notify_fds(int *ret_rfd, int *ret_wfd) {
+#ifdef SYS_LINUX
+    int efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+    if (efd < 0)
+        return -1;
+
+    *ret_rfd = efd;
+    *ret_wfd = efd;
+#else
+    int pfd[2];
+    int i;
+
+    if (pipe(pfd) < 0)
+        return -1;
+
+    for (i = 0; i < 2; i++) {
+        fcntl(pfd[i], F_SETFL, fcntl(pfd[i], F_GETFL, 0) | O_NONBLOCK);
+        fcntl(pfd[i], F_SETFD, fcntl(pfd[i], F_GETFD, 0) | FD_CLOEXEC);
+    }
+
+    *ret_rfd = pfd[0];
+    *ret_wfd = pfd[1];
+#endif
+
+    return 0;
+}
+
+/* Create the notification descriptors
+ */
+int kis_simple_ringbuf_enable_notify(kis_simple_ringbuf_t *ringbuf) {
+    if (ringbuf->data_rfd >= 0)
+        return 0;
+
+    if (kis_simple_ringbuf_notify_fds(&(ringbuf->data_rfd), &(ringbuf->data_wfd)) < 0)
+        return -1;
+
+    if (kis_simple_ringbuf_notify_fds(&(ringbuf->space_rfd), &(ringbuf->space_wfd)) < 0) {
+        close(ringbuf->data_rfd);
+        if (ringbuf->data_wfd != ringbuf->data_rfd)
+            close(ringbuf->data_wfd);
+        ringbuf->data_rfd = -1;
+        ringbuf->data_wfd = -1;
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Wake the other side if it flagged that it's sleeping; the fence orders our
+ * position update before the check of the flag, pairing with the fence in 
+ * the sleeper */
+static void kis_simple_ringbuf_doorbell(uint32_t *waiting, int in_fd) {
+    uint64_t one = 1;
+    ssize_t r;
+
+    if (in_fd < 0)
+        return;
+
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    if (__atomic_load_n(waiting, __ATOMIC_RELAXED) == 0)
+        return;
+
+    if (__atomic_exchange_n(waiting, 0, __ATOMIC_ACQ_REL) == 0)
+        return;
+
+    r = write(in_fd, &one, sizeof(uint64_t));
+    (void) r;
+}
+
+static void kis_simple_ringbuf_clear_fd(int in_fd) {
+    uint64_t v[8];
+    ssize_t r;
+
+    /* An eventfd is cleared by one read; drain a pipe */
+    while ((r = read(in_fd, v, sizeof(v))) == sizeof(v))
+        ;
+}
+
 /* Clear ring buffer
  */
 void kis_simple_ringbuf_clear(kis_simple_ringbuf_t *ringbuf) {
-    ringbuf->start_pos = 0;
-    ringbuf->length = 0;
+    __atomic_store_n(&(ringbuf->tail), 
+            __atomic_load_n(&(ringbuf->head), __ATOMIC_ACQUIRE), __ATOMIC_RELEASE);
+
+    kis_simple_ringbuf_doorbell(&(ringbuf->producer_waiting), ringbuf->space_wfd);
 }
 
 /* Get available space
  */
 size_t kis_simple_ringbuf_available(kis_simple_ringbuf_t *ringbuf) {
-    return ringbuf->buffer_sz - ringbuf->length;
+    return ringbuf->buffer_sz - kis_simple_ringbuf_used(ringbuf);
 }
 
 /* Get used space
  */
 size_t kis_simple_ringbuf_used(kis_simple_ringbuf_t *ringbuf) {
-    return ringbuf->length;
+    size_t tail = __atomic_load_n(&(ringbuf->tail), __ATOMIC_ACQUIRE);
+    size_t head = __atomic_load_n(&(ringbuf->head), __ATOMIC_ACQUIRE);
+
+    return head - tail;
 }
 
 /* Append data
@@ -82,35 +205,120 @@ size_t kis_simple_ringbuf_used(kis_simple_ringbuf_t *ringbuf) {
  */
 size_t kis_simple_ringbuf_write(kis_simple_ringbuf_t *ringbuf, 
         void *data, size_t length) {
-    size_t copy_start;
+    size_t head = ringbuf->head;
+    size_t tail = __atomic_load_n(&(ringbuf->tail), __ATOMIC_ACQUIRE);
+    size_t copy_start, chunk_a;
 
-    if (kis_simple_ringbuf_available(ringbuf) < length)
+    if (ringbuf->buffer_sz - (head - tail) < length) {
+        ringbuf->full_tail = tail;
         return 0;
+    }
 
     /* Does the write op fit w/out looping? */
-    copy_start = 
-        (ringbuf->start_pos + ringbuf->length) % ringbuf->buffer_sz;
+    copy_start = head & ringbuf->mask;
 
-    if (copy_start + length < ringbuf->buffer_sz) {
+    if (copy_start + length <= ringbuf->buffer_sz) {
         memcpy(ringbuf->buffer + copy_start, data, length);
-        ringbuf->length += length;
-
-        return length;
     } else {
         /* We have to split up, figure out the length of the two chunks */
-        size_t chunk_a = ringbuf->buffer_sz - copy_start;
-        size_t chunk_b = length - chunk_a;
+        chunk_a = ringbuf->buffer_sz - copy_start;
+
+        memcpy(ringbuf->buffer + copy_start, data, chunk_a);
+        memcpy(ringbuf->buffer, (uint8_t *) data + chunk_a, length - chunk_a);
+    }
 
-        memcpy(ringbuf->buffer + ringbuf->start_pos + ringbuf->length, data, chunk_a);
-        memcpy(ringbuf->buffer, (uint8_t *) data + chunk_a, chunk_b);
+    __atomic_store_n(&(ringbuf->head), head + length, __ATOMIC_RELEASE);
 
-        /* Increase the length of the buffer */
-        ringbuf->length += length;
+    kis_simple_ringbuf_doorbell(&(ringbuf->consumer_waiting), ringbuf->data_wfd);
 
-        return length;
+    return length;
+}
+
+uint8_t *kis_simple_ringbuf_reserve(kis_simple_ringbuf_t *ringbuf, size_t length) {
+    size_t head = ringbuf->head;
+    size_t tail = __atomic_load_n(&(ringbuf->tail), __ATOMIC_ACQUIRE);
+    size_t start = head;
+
+    if (length == 0 || length > ringbuf->buffer_sz)
+        return NULL;
+
+    /* Regions never wrap; skip to the start of the buffer if it doesn't fit
+     * before the end */
+    if ((head & ringbuf->mask) + length > ringbuf->buffer_sz)
+        start = (head | ringbuf->mask) + 1;
+
+    if (start + length - tail > ringbuf->buffer_sz) {
+        ringbuf->full_tail = tail;
+        return NULL;
     }
 
-    return 0;
+    ringbuf->reserve_skip = (start != head) ? head : RINGBUF_NO_SKIP;
+    ringbuf->reserve_head = start + length;
+
+    return ringbuf->buffer + (start & ringbuf->mask);
+}
+
+void kis_simple_ringbuf_commit(kis_simple_ringbuf_t *ringbuf) {
+    if (ringbuf->reserve_head == 0)
+        return;
+
+    /* Published by the release of the head */
+    if (ringbuf->reserve_skip != RINGBUF_NO_SKIP)
+        __atomic_store_n(&(ringbuf->skip_pos), ringbuf->reserve_skip, __ATOMIC_RELAXED);
+
+    __atomic_store_n(&(ringbuf->head), ringbuf->reserve_head, __ATOMIC_RELEASE);
+
+    ringbuf->reserve_head = 0;
+
+    kis_simple_ringbuf_doorbell(&(ringbuf->consumer_waiting), ringbuf->data_wfd);
+}
+
+/* Find the contiguous data at *pos, stepping over skipped space at the end 
+ * of the buffer; the consumer is always past any skip older than the current
+ * one, since the producer can't record another until the consumer frees the 
+ * space after it */
+static size_t kis_simple_ringbuf_contig(kis_simple_ringbuf_t *ringbuf, 
+        size_t *pos, size_t head) {
+    size_t skip = __atomic_load_n(&(ringbuf->skip_pos), __ATOMIC_RELAXED);
+    size_t limit;
+
+    if (*pos == head)
+        return 0;
+
+    if (skip == *pos)
+        *pos = (*pos | ringbuf->mask) + 1;
+
+    limit = (*pos | ringbuf->mask) + 1;
+
+    if (head < limit)
+        limit = head;
+
+    if (skip > *pos && skip < limit)
+        limit = skip;
+
+    return limit - *pos;
+}
+
+static size_t kis_simple_ringbuf_copy(kis_simple_ringbuf_t *ringbuf, void *ptr,
+        size_t size, size_t *pos) {
+    size_t head = __atomic_load_n(&(ringbuf->head), __ATOMIC_ACQUIRE);
+    size_t copied = 0, chunk;
+
+    while (copied < size) {
+        if ((chunk = kis_simple_ringbuf_contig(ringbuf, pos, head)) == 0)
+            break;
+
+        if (chunk > size - copied)
+            chunk = size - copied;
+
+        if (ptr != NULL)
+            memcpy((uint8_t *) ptr + copied, ringbuf->buffer + (*pos & ringbuf->mask), chunk);
+
+        *pos += chunk;
+        copied += chunk;
+    }
+
+    return copied;
 }
 
 /* Copies data into provided buffer.  Advances ringbuf, clearing consumed data.
@@ -121,43 +329,17 @@ size_t kis_simple_ringbuf_write(kis_simple_ringbuf_t *ringbuf,
  */
 size_t kis_simple_ringbuf_read(kis_simple_ringbuf_t *ringbuf, void *ptr, 
         size_t size) {
-    /* Start with how much we have available - no matter what was
-     * requested, we can't read more than this */
-    size_t opsize = kis_simple_ringbuf_used(ringbuf);
-
-    if (opsize == 0)
-        return 0;
-
-    /* Only read the amount we requested, if more is available */
-    if (opsize > size)
-        opsize = size;
-
-    /* Simple contiguous read */
-    if (ringbuf->start_pos + opsize < ringbuf->buffer_sz) {
-        if (ptr != NULL)
-            memcpy(ptr, ringbuf->buffer + ringbuf->start_pos, opsize);
-        ringbuf->start_pos += opsize;
-        ringbuf->length -= opsize;
-        return opsize;
-    } else {
-        /* First chunk, start to end of buffer */
-        size_t chunk_a = ringbuf->buffer_sz - ringbuf->start_pos;
-        /* Second chunk, 0 to remaining data */
-        size_t chunk_b = opsize - chunk_a;
+    size_t pos = ringbuf->tail;
+    size_t copied;
 
-        if (ptr != NULL) {
-            memcpy(ptr, ringbuf->buffer + ringbuf->start_pos, chunk_a);
-            memcpy((uint8_t *) ptr + chunk_a, ringbuf->buffer, chunk_b);
-        }
+    copied = kis_simple_ringbuf_copy(ringbuf, ptr, size, &pos);
 
-        /* Fastforward around the ring to where we finished reading */
-        ringbuf->start_pos = chunk_b;
-        ringbuf->length -= opsize;
-
-        return opsize;
+    if (pos != ringbuf->tail) {
+        __atomic_store_n(&(ringbuf->tail), pos, __ATOMIC_RELEASE);
+        kis_simple_ringbuf_doorbell(&(ringbuf->producer_waiting), ringbuf->space_wfd);
     }
 
-    return 0;
+    return copied;
 }
 
 /* Peeks at data by copying into provided buffer.  Does NOT advance ringbuf
@@ -170,33 +352,79 @@ size_t kis_simple_ringbuf_read(kis_simple_ringbuf_t *ringbuf, void *ptr,
  */
 size_t kis_simple_ringbuf_peek(kis_simple_ringbuf_t *ringbuf, void *ptr, 
         size_t size) {
-    /* Start with how much we have available - no matter what was
-     * requested, we can't read more than this */
-    size_t opsize = kis_simple_ringbuf_used(ringbuf);
+    size_t pos = ringbuf->tail;
+
+    return kis_simple_ringbuf_copy(ringbuf, ptr, size, &pos);
+}
+
+size_t kis_simple_ringbuf_peek_contig(kis_simple_ringbuf_t *ringbuf, uint8_t **ret_ptr) {
+    size_t head = __atomic_load_n(&(ringbuf->head), __ATOMIC_ACQUIRE);
+    size_t pos = ringbuf->tail;
+    size_t chunk;
+
+    chunk = kis_simple_ringbuf_contig(ringbuf, &pos, head);
+
+    *ret_ptr = ringbuf->buffer + (pos & ringbuf->mask);
+
+    return chunk;
+}
+
+int kis_simple_ringbuf_wait_space(kis_simple_ringbuf_t *ringbuf, int timeout_ms) {
+    struct pollfd pfd;
+    int r;
+
+    if (ringbuf->space_rfd < 0) {
+        usleep(1000);
+        return 1;
+    }
 
-    if (opsize == 0)
+    __atomic_store_n(&(ringbuf->producer_waiting), 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    /* The consumer already moved on since we ran out of room */
+    if (__atomic_load_n(&(ringbuf->tail), __ATOMIC_ACQUIRE) != ringbuf->full_tail) {
+        __atomic_store_n(&(ringbuf->producer_waiting), 0, __ATOMIC_RELAXED);
+        return 1;
+    }
+
+    pfd.fd = ringbuf->space_rfd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+
+    r = poll(&pfd, 1, timeout_ms);
+
+    __atomic_store_n(&(ringbuf->producer_waiting), 0, __ATOMIC_RELAXED);
+
+    if (r < 0) {
+        if (errno == EINTR)
+            return 1;
+        return -1;
+    }
+
+    if (r == 0)
         return 0;
 
-    /* Only read the amount we requested, if more is available */
-    if (opsize > size)
-        opsize = size;
+    kis_simple_ringbuf_clear_fd(ringbuf->space_rfd);
 
-    /* Simple contiguous read */
-    if (ringbuf->start_pos + opsize < ringbuf->buffer_sz) {
-        memcpy(ptr, ringbuf->buffer + ringbuf->start_pos, opsize);
-        return opsize;
-    } else {
-        /* First chunk, start to end of buffer */
-        size_t chunk_a = ringbuf->buffer_sz - ringbuf->start_pos;
-        /* Second chunk, 0 to remaining data */
-        size_t chunk_b = opsize - chunk_a;
+    return 1;
+}
 
-        memcpy(ptr, ringbuf->buffer + ringbuf->start_pos, chunk_a);
-        memcpy((uint8_t *) ptr + chunk_a, ringbuf->buffer, chunk_b);
+int kis_simple_ringbuf_consumer_sleep(kis_simple_ringbuf_t *ringbuf) {
+    __atomic_store_n(&(ringbuf->consumer_waiting), 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
 
-        return opsize;
+    if (__atomic_load_n(&(ringbuf->head), __ATOMIC_ACQUIRE) != ringbuf->tail) {
+        __atomic_store_n(&(ringbuf->consumer_waiting), 0, __ATOMIC_RELAXED);
+        return 1;
     }
 
     return 0;
 }
 
+void kis_simple_ringbuf_consumer_wake(kis_simple_ringbuf_t *ringbuf) {
+    __atomic_store_n(&(ringbuf->consumer_waiting), 0, __ATOMIC_RELAXED);
+
+    if (ringbuf->data_rfd >= 0)
+        kis_simple_ringbuf_clear_fd(ringbuf->data_rfd);
+}
+
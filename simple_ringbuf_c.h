@@ -17,7 +17,22 @@
 */
 
 /* An extremely basic ring buffer implemented in pure C; for use with datasource 
- * implementations in C */
+ * implementations in C
+ *
+ * The buffer is a single-producer, single-consumer ring:  one thread may 
+ * write to it while another reads from it, without any locking.  The read
+ * and write positions only ever count up, and the size is rounded up to a 
+ * power of two so they can be masked into the buffer.
+ *
+ * A producer can reserve a contiguous region of the buffer and serialize 
+ * directly into it, then commit it.  A reservation which doesn't fit before 
+ * the end of the buffer skips the remainder, which the consumer steps over.
+ *
+ * A ring may optionally have notification descriptors, so that the consumer 
+ * can sleep in select() until data is committed and the producer can sleep 
+ * until space is freed.  Each side only signals the other when it has flagged
+ * that it is sleeping, so a busy ring makes no system calls.
+ */
 
 #ifndef __RINGBUF_C_H__
 #define __RINGBUF_C_H__
@@ -30,12 +45,35 @@
 struct kis_simple_ringbuf {
     uint8_t *buffer;
     size_t buffer_sz;
-    size_t start_pos; /* Where reading starts from */
-    size_t length; /* Amount of data in the buffer */
+    size_t mask;
+
+    /* Written by the producer:  where writing continues, and the start of the
+     * space skipped by the last reservation which didn't fit before the end 
+     * of the buffer ((size_t) -1 for none) */
+    size_t head __attribute__((aligned(64)));
+    size_t skip_pos;
+    uint32_t producer_waiting;
+
+    /* Written by the consumer:  where reading starts from */
+    size_t tail __attribute__((aligned(64)));
+    uint32_t consumer_waiting;
+
+    /* Producer state of the pending reservation */
+    size_t reserve_head;
+    size_t reserve_skip;
+    /* Consumer position the producer last ran out of space at */
+    size_t full_tail;
+
+    /* Notification descriptors, -1 when notification isn't enabled; on Linux
+     * the read and write descriptor of each are the same eventfd */
+    int data_rfd;
+    int data_wfd;
+    int space_rfd;
+    int space_wfd;
 };
 typedef struct kis_simple_ringbuf kis_simple_ringbuf_t;
 
-/* Allocate a ring buffer
+/* Allocate a ring buffer of at least size bytes
  *
  * Returns NULL if allocation failed
  */
@@ -45,7 +83,14 @@ kis_simple_ringbuf_t *kis_simple_ringbuf_create(size_t size);
  */
 void kis_simple_ringbuf_free(kis_simple_ringbuf_t *ringbuf);
 
-/* Clear ring buffer
+/* Create the notification descriptors
+ *
+ * Returns -1 on failure, 0 on success
+ */
+int kis_simple_ringbuf_enable_notify(kis_simple_ringbuf_t *ringbuf);
+
+/* Clear ring buffer; this discards everything written so far and is a 
+ * consumer operation
  */
 void kis_simple_ringbuf_clear(kis_simple_ringbuf_t *ringbuf);
 
@@ -64,7 +109,19 @@ size_t kis_simple_ringbuf_used(kis_simple_ringbuf_t *ringbuf);
 size_t kis_simple_ringbuf_write(kis_simple_ringbuf_t *ringbuf, 
         void *data, size_t length);
 
+/* Reserve a contiguous region of length bytes to write into.  The region is
+ * not visible to the consumer until it is committed.
+ *
+ * Returns NULL if there isn't room
+ */
+uint8_t *kis_simple_ringbuf_reserve(kis_simple_ringbuf_t *ringbuf, size_t length);
+
+/* Publish the region returned by reserve
+ */
+void kis_simple_ringbuf_commit(kis_simple_ringbuf_t *ringbuf);
+
 /* Copies data into provided buffer.  Advances ringbuf, clearing consumed data.
+ * ptr may be NULL to consume data without copying it.
  *
  * If requested amount is not available, reads amount available and returns.
  *
@@ -82,5 +139,31 @@ size_t kis_simple_ringbuf_read(kis_simple_ringbuf_t *ringbuf, void *ptr, size_t
  */
 size_t kis_simple_ringbuf_peek(kis_simple_ringbuf_t *ringbuf, void *ptr, size_t size);
 
+/* Peeks at data in place.  Sets ret_ptr to the start of the data and returns
+ * the amount which is contiguous, which may be less than the amount used;
+ * consume it with kis_simple_ringbuf_read(ringbuf, NULL, ...)
+ *
+ * Returns 0 if the ring is empty
+ */
+size_t kis_simple_ringbuf_peek_contig(kis_simple_ringbuf_t *ringbuf, uint8_t **ret_ptr);
+
+/* Producer:  wait up to timeout_ms for the consumer to free space after a
+ * write or reservation failed.  Without notification this sleeps briefly.
+ *
+ * Returns 1 if space may be available, 0 on timeout, and -1 on error
+ */
+int kis_simple_ringbuf_wait_space(kis_simple_ringbuf_t *ringbuf, int timeout_ms);
+
+/* Consumer:  flag that we're about to sleep on data_rfd.
+ *
+ * Returns 0 when it's safe to sleep, or 1 if data arrived and should be read 
+ * first
+ */
+int kis_simple_ringbuf_consumer_sleep(kis_simple_ringbuf_t *ringbuf);
+
+/* Consumer:  clear data_rfd after waking
+ */
+void kis_simple_ringbuf_consumer_wake(kis_simple_ringbuf_t *ringbuf);
+
 #endif
 
@@ -41,7 +41,7 @@ BSSTSStateAlert::BSSTSStateAlert(GlobalRegistry *in_globalreg) :
 
 	// Register the packet chain element
 	globalreg->packetchain->RegisterHandler(&bsstsalert_chain_hook, this,
-											CHAINPOS_CLASSIFIER, -50);
+											CHAINPOS_CLASSIFIER, -50, "bss timestamp alert");
 
 	// Activate our alert
 	alert_bss_ts_ref = 
@@ -291,6 +291,35 @@ public:
         set_last_time(in_time);
     }
 
+    // Average of the per-second samples over the last in_secs seconds (at
+    // most a minute) as of in_now.  Seconds with no samples count as the
+    // default value.  Unlike serializing, this doesn't fast-forward the RRD.
+    double get_recent_average(time_t in_now, unsigned int in_secs) {
+        Aggregator agg;
+
+        if (in_secs == 0)
+            return 0;
+
+        if (in_secs > 60)
+            in_secs = 60;
+
+        time_t ltime = get_last_time();
+        int64_t total = 0;
+
+        for (unsigned int s = 0; s < in_secs; s++) {
+            time_t t = in_now - s;
+
+            // Only seconds up to the last update, and within a minute of it,
+            // are still valid in the minute vector
+            if (t <= ltime && ltime - t < 60)
+                total += GetTrackerValue<int64_t>(minute_vec->get_vector_value(t % 60));
+            else
+                total += agg.default_val();
+        }
+
+        return (double) total / in_secs;
+    }
+
     virtual void pre_serialize() {
         tracker_component::pre_serialize();
         Aggregator agg;
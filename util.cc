@@ -64,6 +64,7 @@
 #include <stdexcept>
 
 #include "packet.h"
+#include "kis_checksum.h"
 
 // Munge text down to printable characters only.  Simpler, cleaner munger than
 // before (and more blatant when munging)
@@ -658,27 +659,7 @@ int FetchSysLoadAvg(uint8_t *in_avgmaj, uint8_t *in_avgmin) {
 
 uint32_t Adler32IncrementalChecksum(const char *in_buf, size_t in_len,
         uint32_t *s1, uint32_t *s2) {
-    size_t i;
-    const uint8_t *buf = (const uint8_t *) in_buf;
-    int CHAR_OFFSET = 0;
-
-    if (in_len < 4)
-        return 0;
-
-    for (i = 0; i < (in_len - 4); i += 4) {
-        *s2 += 4 * (*s1 + buf[i]) + 3 * buf[i + 1] + 
-            2 * buf[i+2] + buf[i + 3] + 
-            10 * CHAR_OFFSET;
-        *s1 += (buf[i + 0] + buf[i + 1] + buf[i + 2] + 
-                buf[i + 3] + 4 * CHAR_OFFSET); 
-    }
-
-    for (; i < in_len; i++) {
-        *s1 += (buf[i] + CHAR_OFFSET); 
-        *s2 += *s1;
-    }
-
-    return (*s1 & 0xffff) + (*s2 << 16);
+    return kis_adler32_partial((const uint8_t *) in_buf, in_len, s1, s2);
 }
 
 uint32_t Adler32Checksum(std::string in_buf) {
@@ -694,6 +675,48 @@ uint32_t Adler32Checksum(const char *in_buf, size_t in_len) {
     return Adler32IncrementalChecksum(in_buf, in_len, &s1, &s2);
 }
 
+uint64_t Hash64(const void *in_buf, size_t in_len, uint64_t in_seed) {
+    const uint64_t m = 0xc6a4a7935bd1e995ULL;
+    const int r = 47;
+
+    uint64_t h = in_seed ^ (in_len * m);
+
+    const uint8_t *data = (const uint8_t *) in_buf;
+    const uint8_t *end = data + (in_len & ~((size_t) 7));
+
+    while (data != end) {
+        uint64_t k;
+
+        // Unaligned-safe; the compiler turns this into a single load
+        memcpy(&k, data, sizeof(uint64_t));
+        data += 8;
+
+        k *= m; 
+        k ^= k >> r; 
+        k *= m; 
+
+        h ^= k;
+        h *= m; 
+    }
+
+    switch (in_len & 7) {
+        case 7: h ^= (uint64_t) data[6] << 48;
+        case 6: h ^= (uint64_t) data[5] << 40;
+        case 5: h ^= (uint64_t) data[4] << 32;
+        case 4: h ^= (uint64_t) data[3] << 24;
+        case 3: h ^= (uint64_t) data[2] << 16;
+        case 2: h ^= (uint64_t) data[1] << 8;
+        case 1: h ^= (uint64_t) data[0];
+                h *= m;
+    };
+
+    h ^= h >> r;
+    h *= m;
+    h ^= h >> r;
+
+    return h;
+}
+
 list<_kis_lex_rec> LexString(string in_line, string& errstr) {
 	list<_kis_lex_rec> ret;
 	int curstate = _kis_lex_none;
@@ -1032,6 +1055,34 @@ int GetLengthTagOffsets(unsigned int init_offset,
     return 0;
 }
 
+int GetLengthTagOffsets(unsigned int init_offset,
+        kis_datachunk *in_chunk,
+        length_tag_offsets *tag_offsets) {
+    unsigned int cur_offset = init_offset;
+    uint8_t len;
+
+    tag_offsets->clear();
+
+    // Bail on invalid incoming offsets
+    if (init_offset >= in_chunk->length)
+        return -1;
+
+    // Same walk as the map version, stopping when there isn't room for another 
+    // tag and length
+    while (cur_offset + 2 < in_chunk->length) {
+        len = (in_chunk->data[cur_offset + 1] & 0xFF);
+
+        if (cur_offset + len + 2 > in_chunk->length)
+            return -1;
+
+        tag_offsets->add(in_chunk->data[cur_offset], cur_offset + 1);
+
+        cur_offset += len + 2;
+    }
+
+    return 0;
+}
+
 std::string MultiReplaceAll(std::string in, std::string match, 
         std::string repl) {
     for (size_t pos = 0; (pos = in.find(match, pos)) != std::string::npos;
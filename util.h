@@ -218,6 +218,10 @@ uint32_t Adler32Checksum(std::string buf1);
 uint32_t Adler32IncrementalChecksum(const char *buf1, size_t len, 
         uint32_t *s1, uint32_t *s2);
 
+// 64-bit non-cryptographic hash (MurmurHash64A), for fast lookups such as packet
+// de-duplication where a 32-bit checksum would collide too often
+uint64_t Hash64(const void *in_buf, size_t in_len, uint64_t in_seed = 0);
+
 // 802.11 checksum functions, derived from the BBN USRP 802.11 code
 #define IEEE_802_3_CRC32_POLY	0xEDB88320
 unsigned int update_crc32_80211(unsigned int crc, const unsigned char *data,
@@ -273,6 +277,88 @@ int GetLengthTagOffsets(unsigned int init_offset,
         kis_datachunk *in_chunk,
         std::map<int, std::vector<int> > *tag_cache_map);
 
+// Offsets of the length byte of each tag in a tag/length/value block, indexed
+// directly by the single-byte tag number.  The first few copies of a repeated
+// tag are stored inline and any more go to a shared overflow list.  Tables are
+// meant to be reused between packets; clear() only resets the tags which were
+// set, and once the overflow list has grown parsing doesn't allocate.
+class length_tag_offsets {
+public:
+    const static unsigned int inline_max = 4;
+
+    length_tag_offsets() {
+        memset(counts, 0, sizeof(counts));
+        num_used = 0;
+    }
+
+    void clear() {
+        for (unsigned int i = 0; i < num_used; i++)
+            counts[used[i]] = 0;
+
+        num_used = 0;
+        overflow.clear();
+    }
+
+    void add(uint8_t in_tag, unsigned int in_offset) {
+        unsigned int c = counts[in_tag];
+
+        if (c == 0)
+            used[num_used++] = in_tag;
+
+        if (c < inline_max)
+            offsets[in_tag][c] = in_offset;
+        else
+            overflow.push_back(std::make_pair(in_tag, in_offset));
+
+        counts[in_tag] = c + 1;
+    }
+
+    bool has(uint8_t in_tag) const {
+        return counts[in_tag] != 0;
+    }
+
+    // Number of copies of a tag
+    unsigned int count(uint8_t in_tag) const {
+        return counts[in_tag];
+    }
+
+    // Offset of the in_n'th copy of a tag; in_n must be less than count()
+    unsigned int offset(uint8_t in_tag, unsigned int in_n = 0) const {
+        if (in_n < inline_max)
+            return offsets[in_tag][in_n];
+
+        unsigned int n = inline_max;
+
+        for (auto o : overflow) {
+            if (o.first != in_tag)
+                continue;
+
+            if (n == in_n)
+                return o.second;
+
+            n++;
+        }
+
+        return 0;
+    }
+
+protected:
+    unsigned int counts[256];
+    unsigned int offsets[256][inline_max];
+
+    // Tags set since the last clear
+    uint8_t used[256];
+    unsigned int num_used;
+
+    std::vector<std::pair<uint8_t, unsigned int> > overflow;
+};
+
+// Clears and fills in a tag offset table; returns -1 if a tag runs past the
+// end of the chunk
+int GetLengthTagOffsets(unsigned int init_offset,
+        kis_datachunk *in_chunk,
+        length_tag_offsets *tag_offsets);
+
 // Utility class for doing conditional thread locking; allows one thread to wait
 // indefinitely and another thread to easily unlock it
 template<class t>